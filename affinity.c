@@ -0,0 +1,203 @@
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "affinity.h"
+
+#ifndef MCL_ONFAULT
+#define MCL_ONFAULT	4
+#endif
+
+#define MAX_NAMES	32
+
+/* Whole sysfs path components, so long device names still match. */
+struct names {
+	int n;
+	char name[MAX_NAMES][NAME_MAX + 1];
+};
+
+static void add_name(struct names *nm, const char *s)
+{
+	size_t len = strlen(s);
+
+	if (nm->n < MAX_NAMES && len && len <= NAME_MAX)
+		memcpy(nm->name[nm->n++], s, len + 1);
+}
+
+/* The netdev, then every device from its parent up, each followed by its driver. */
+static int device_names(const char *ifname, struct names *nm)
+{
+	char link[PATH_MAX + 16], path[PATH_MAX], drv[PATH_MAX];
+
+	snprintf(link, sizeof(link), "/sys/class/net/%s/device", ifname);
+	if (realpath(link, path) == NULL)
+		return errno == ENOENT ? -ENODEV : -errno;
+
+	nm->n = 0;
+	add_name(nm, ifname);
+	while (strncmp(path, "/sys/devices/", 13) == 0) {
+		char *slash = strrchr(path, '/');
+		ssize_t len;
+
+		add_name(nm, slash + 1);
+		snprintf(link, sizeof(link), "%s/driver", path);
+		len = readlink(link, drv, sizeof(drv) - 1);
+		if (len > 0) {
+			drv[len] = '\0';
+			add_name(nm, strrchr(drv, '/') ? strrchr(drv, '/') + 1 : drv);
+		}
+		*slash = '\0';
+	}
+	return 0;
+}
+
+/* Exactly, or as the prefix of a per-queue name such as "eth0-rx-0". */
+static int name_matches(const char *tok, const char *name)
+{
+	size_t len = strlen(name);
+
+	return strncmp(tok, name, len) == 0 && (tok[len] == '\0' || tok[len] == '-');
+}
+
+static int read_cpus(int irq, const char *file, cpu_set_t *set)
+{
+	char path[64], buf[256];
+	FILE *f;
+	int ret;
+
+	snprintf(path, sizeof(path), "/proc/irq/%d/%s", irq, file);
+	f = fopen(path, "r");
+	if (f == NULL)
+		return -errno;
+	ret = fgets(buf, sizeof(buf), f) ? aff_parse_cpus(buf, set) : -EIO;
+	fclose(f);
+	if (ret == 0 && CPU_COUNT(set) == 0)
+		ret = -ENOENT;
+	return ret;
+}
+
+int aff_find_irq(const char *ifname, struct aff_irq *irq)
+{
+	struct names nm;
+	char *line = NULL;
+	size_t cap = 0;
+	int best = MAX_NAMES, ret;
+	FILE *f;
+
+	ret = device_names(ifname, &nm);
+	if (ret < 0)
+		return ret;
+
+	f = fopen("/proc/interrupts", "r");
+	if (f == NULL)
+		return -errno;
+	irq->irq = -1;
+	while (getline(&line, &cap, f) != -1) {
+		char *p = line, *tok, *save, *end;
+		long n;
+
+		while (isspace((unsigned char)*p))
+			p++;
+		n = strtol(p, &end, 10);
+		if (end == p || *end != ':')
+			continue;	/* header, NMI, LOC and the like */
+
+		for (tok = strtok_r(end + 1, " \t\n,", &save); tok; tok = strtok_r(NULL, " \t\n,", &save)) {
+			for (int i = 0; i < best; i++) {
+				if (name_matches(tok, nm.name[i])) {
+					best = i;
+					irq->irq = n;
+					snprintf(irq->action, sizeof(irq->action), "%s", tok);
+					break;
+				}
+			}
+		}
+	}
+	free(line);
+	fclose(f);
+	if (irq->irq < 0)
+		return -ENOENT;
+
+	/* Effective affinity is where it lands, smp_affinity only where it may. */
+	CPU_ZERO(&irq->cpus);
+	ret = read_cpus(irq->irq, "effective_affinity_list", &irq->cpus);
+	if (ret < 0)
+		ret = read_cpus(irq->irq, "smp_affinity_list", &irq->cpus);
+	return ret;
+}
+
+int aff_first_cpu(const cpu_set_t *set)
+{
+	for (int i = 0; i < CPU_SETSIZE; i++)
+		if (CPU_ISSET(i, set))
+			return i;
+	return -1;
+}
+
+int aff_parse_cpus(const char *list, cpu_set_t *set)
+{
+	const char *p = list;
+
+	CPU_ZERO(set);
+	while (*p && *p != '\n') {
+		char *end;
+		long lo = strtol(p, &end, 10), hi = lo;
+
+		if (end == p)
+			return -EINVAL;
+		p = end;
+		if (*p == '-') {
+			hi = strtol(p + 1, &end, 10);
+			if (end == p + 1)
+				return -EINVAL;
+			p = end;
+		}
+		if (lo < 0 || hi < lo || hi >= CPU_SETSIZE)
+			return -EINVAL;
+		for (long c = lo; c <= hi; c++)
+			CPU_SET(c, set);
+		if (*p == ',')
+			p++;
+		else if (*p && *p != '\n')
+			return -EINVAL;
+	}
+	return 0;
+}
+
+void aff_format_cpus(const cpu_set_t *set, char *buf, size_t len)
+{
+	size_t off = 0;
+
+	buf[0] = '\0';
+	for (int c = 0; c < CPU_SETSIZE && off < len; c++) {
+		int hi = c;
+
+		if (!CPU_ISSET(c, set))
+			continue;
+		while (hi + 1 < CPU_SETSIZE && CPU_ISSET(hi + 1, set))
+			hi++;
+		if (hi == c)
+			off += snprintf(buf + off, len - off, "%s%d", off ? "," : "", c);
+		else
+			off += snprintf(buf + off, len - off, "%s%d-%d", off ? "," : "", c, hi);
+		c = hi;
+	}
+	if (off == 0)
+		snprintf(buf, len, "none");
+}
+
+int aff_lock_memory(void)
+{
+	/* Without MCL_ONFAULT every thread's whole stack would be populated too. */
+	if (mlockall(MCL_CURRENT | MCL_FUTURE | MCL_ONFAULT) == 0)
+		return 0;
+	if (errno == EINVAL && mlockall(MCL_CURRENT | MCL_FUTURE) == 0)
+		return 0;
+	return -errno;
+}
@@ -0,0 +1,43 @@
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <sched.h>
+#include <stddef.h>
+
+/*
+ * CPU placement of radio I/O threads.
+ *
+ * A netdev's IRQ is found by walking its sysfs device up to the root and
+ * matching each device's name, and the name of the driver bound to it,
+ * against the action names in /proc/interrupts, alone or as the prefix
+ * of a per-queue name such as "eth0-rx-0"; the nearest device wins.
+ * That finds an SPI radio's own IRQ line as well as the SPI controller's
+ * or the USB host controller's behind a CDC-ACM module. The kernel's
+ * effective affinity of that IRQ is where its thread should run.
+ *
+ * Functions return 0 on success and a negative errno value on failure.
+ */
+
+#define AFF_NAME_LEN	32
+
+struct aff_irq {
+	int irq;
+	char action[AFF_NAME_LEN];	/* the /proc/interrupts name matched */
+	cpu_set_t cpus;
+};
+
+/* -ENODEV for a netdev without a device, such as vlora; -ENOENT if no IRQ matches. */
+int aff_find_irq(const char *ifname, struct aff_irq *irq);
+
+/* Lowest CPU in set, or -1 if it is empty. */
+int aff_first_cpu(const cpu_set_t *set);
+
+/* Parses a cpulist such as "0-2,5". */
+int aff_parse_cpus(const char *list, cpu_set_t *set);
+/* Formats set as a cpulist. */
+void aff_format_cpus(const cpu_set_t *set, char *buf, size_t len);
+
+/* Locks current and future memory; pages are locked as they are faulted in. */
+int aff_lock_memory(void);
+
+#endif
@@ -0,0 +1,105 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "crc.h"
+
+/*
+ * No carry-less multiply or CRC instruction path: the ARMv8 CRC
+ * instructions only implement CRC-32/CRC-32C, and PCLMUL folding needs
+ * far longer buffers than a 255-byte radio frame to pay off. Slice-by-8
+ * tables are the fastest option at these sizes.
+ */
+
+void crc8_populate_msb(uint8_t table[CRC8_TABLE_SIZE], uint8_t polynomial)
+{
+	const uint8_t msbit = 0x80;
+	uint8_t t = msbit;
+
+	table[0] = 0;
+
+	for (int i = 1; i < CRC8_TABLE_SIZE; i *= 2) {
+		t = (t << 1) ^ (t & msbit ? polynomial : 0);
+		for (int j = 0; j < i; j++)
+			table[i + j] = table[j] ^ t;
+	}
+}
+
+uint8_t crc8(const uint8_t table[CRC8_TABLE_SIZE], const uint8_t *pdata, size_t nbytes,
+	     uint8_t crc)
+{
+	while (nbytes-- > 0)
+		crc = table[(crc ^ *pdata++) & 0xff];
+
+	return crc;
+}
+
+/* t[k][x] is the CRC of byte x followed by k zero bytes. */
+void crc8_slice_init(struct crc8_slice *s, uint8_t polynomial)
+{
+	crc8_populate_msb(s->t[0], polynomial);
+	for (int k = 1; k < 8; k++)
+		for (int x = 0; x < CRC8_TABLE_SIZE; x++)
+			s->t[k][x] = s->t[0][s->t[k - 1][x]];
+}
+
+uint8_t crc8_slice(const struct crc8_slice *s, const uint8_t *pdata, size_t nbytes, uint8_t crc)
+{
+	while (nbytes >= 8) {
+		crc = s->t[7][crc ^ pdata[0]] ^ s->t[6][pdata[1]] ^
+		      s->t[5][pdata[2]] ^ s->t[4][pdata[3]] ^
+		      s->t[3][pdata[4]] ^ s->t[2][pdata[5]] ^
+		      s->t[1][pdata[6]] ^ s->t[0][pdata[7]];
+		pdata += 8;
+		nbytes -= 8;
+	}
+
+	return crc8(s->t[0], pdata, nbytes, crc);
+}
+
+static struct crc8_slice esp3_table;
+static uint16_t itu_t_table[8][256];
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+static void init_tables(void)
+{
+	crc8_slice_init(&esp3_table, CRC8_POLY_ESP3);
+
+	for (int x = 0; x < 256; x++) {
+		uint16_t c = x << 8;
+
+		for (int b = 0; b < 8; b++)
+			c = c & 0x8000 ? (c << 1) ^ 0x1021 : c << 1;
+		itu_t_table[0][x] = c;
+	}
+	for (int k = 1; k < 8; k++)
+		for (int x = 0; x < 256; x++)
+			itu_t_table[k][x] = (itu_t_table[k - 1][x] << 8) ^
+					    itu_t_table[0][itu_t_table[k - 1][x] >> 8];
+}
+
+uint8_t crc8_esp3(const uint8_t *pdata, size_t nbytes)
+{
+	pthread_once(&tables_once, init_tables);
+	return crc8_slice(&esp3_table, pdata, nbytes, 0);
+}
+
+uint16_t crc_itu_t(uint16_t crc, const uint8_t *buffer, size_t len)
+{
+	const uint16_t (*t)[256] = itu_t_table;
+
+	pthread_once(&tables_once, init_tables);
+
+	while (len >= 8) {
+		crc = t[7][(crc >> 8) ^ buffer[0]] ^ t[6][(crc & 0xff) ^ buffer[1]] ^
+		      t[5][buffer[2]] ^ t[4][buffer[3]] ^
+		      t[3][buffer[4]] ^ t[2][buffer[5]] ^
+		      t[1][buffer[6]] ^ t[0][buffer[7]];
+		buffer += 8;
+		len -= 8;
+	}
+	while (len--)
+		crc = (crc << 8) ^ t[0][(crc >> 8) ^ *buffer++];
+
+	return crc;
+}
@@ -0,0 +1,43 @@
+#ifndef CRC_H
+#define CRC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Userspace CRCs for EnOcean and FSK frames.
+ *
+ * crc8_populate_msb()/crc8() behave like lib/crc8.c in the kernel, so a
+ * telegram checksummed here matches what enocean-esp computes. The
+ * slice-by-8 variants give the same results and consume eight bytes per
+ * step.
+ */
+
+#define CRC8_TABLE_SIZE		256
+#define CRC8_POLY_ESP3		0x07	/* x^8 + x^2 + x + 1, ESP3 and ERP2 */
+#define CRC16_SX127X_SEED	0x1d0f
+
+void crc8_populate_msb(uint8_t table[CRC8_TABLE_SIZE], uint8_t polynomial);
+uint8_t crc8(const uint8_t table[CRC8_TABLE_SIZE], const uint8_t *pdata, size_t nbytes,
+	     uint8_t crc);
+
+struct crc8_slice {
+	uint8_t t[8][CRC8_TABLE_SIZE];
+};
+
+void crc8_slice_init(struct crc8_slice *s, uint8_t polynomial);
+uint8_t crc8_slice(const struct crc8_slice *s, const uint8_t *pdata, size_t nbytes, uint8_t crc);
+
+/* CRC8 with CRC8_POLY_ESP3 and seed 0, as in the ESP3 header and data. */
+uint8_t crc8_esp3(const uint8_t *pdata, size_t nbytes);
+
+/* Same as crc_itu_t() in lib/crc-itu-t.c: CRC-16, poly 0x1021, MSB first. */
+uint16_t crc_itu_t(uint16_t crc, const uint8_t *buffer, size_t len);
+
+/* SX127x FSK/OOK packet engine CRC: CCITT, seed 0x1d0f, inverted. */
+static inline uint16_t crc16_sx127x(const uint8_t *buffer, size_t len)
+{
+	return (uint16_t)~crc_itu_t(CRC16_SX127X_SEED, buffer, len);
+}
+
+#endif
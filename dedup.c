@@ -0,0 +1,227 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dedup.h"
+#include "loracodec.h"
+
+static uint32_t pow2_at_least(uint32_t n)
+{
+	uint32_t v = 1;
+
+	while (v < n && v < 0x80000000u)
+		v <<= 1;
+	return v;
+}
+
+int dd_init(struct dedup *d, uint32_t keys, uint32_t held, uint64_t window_ns,
+	    uint64_t expire_ns, struct fp_cache *cache, dd_release_fn release, void *arg)
+{
+	memset(d, 0, sizeof(*d));
+	if (keys == 0 || held == 0 || keys > (1u << 24) || expire_ns < window_ns)
+		return -EINVAL;
+
+	keys = pow2_at_least(keys);
+	held = pow2_at_least(held);
+	if (held > keys)
+		held = keys;
+
+	d->window_ns = window_ns;
+	d->expire_ns = expire_ns;
+	d->release = release;
+	d->arg = arg;
+	d->cache = cache;
+	d->tab_mask = 2 * keys - 1;
+	d->fifo_mask = keys - 1;
+	d->hold_mask = held - 1;
+	d->tab = calloc(2 * keys, sizeof(*d->tab));
+	d->fifo = calloc(keys, sizeof(*d->fifo));
+	d->frames = calloc(held, sizeof(*d->frames));
+	if (d->tab == NULL || d->fifo == NULL || d->frames == NULL) {
+		dd_free(d);
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+void dd_free(struct dedup *d)
+{
+	if (d->frames)
+		for (uint32_t i = d->next; i != d->tail; i++)
+			fp_put(d->cache, d->frames[i & d->hold_mask]);
+	free(d->tab);
+	free(d->fifo);
+	free(d->frames);
+	memset(d, 0, sizeof(*d));
+}
+
+static int frame_key(const uint8_t *data, unsigned int len, struct dd_key *k)
+{
+	struct lorawan_data ld;
+	struct lorawan_join_req jr;
+
+	memset(k, 0, sizeof(*k));
+	if (lorawan_join_req_parse(data, len, &jr) == 0) {
+		k->id = jr.dev_eui ^ jr.dev_eui >> 32;
+		k->cnt = jr.dev_nonce;
+		k->mic = jr.mic;
+		k->mtype = LORAWAN_JOIN_REQUEST;
+		return 0;
+	}
+	if (lorawan_data_parse(data, len, &ld) < 0 ||
+	    !lorawan_mtype_is_uplink(lorawan_mtype(ld.mhdr)))
+		return -EINVAL;
+	k->id = ld.devaddr;
+	k->cnt = ld.fcnt;
+	k->mic = ld.mic;
+	k->mtype = lorawan_mtype(ld.mhdr);
+	return 0;
+}
+
+static int key_eq(const struct dd_key *a, const struct dd_key *b)
+{
+	return a->id == b->id && a->mic == b->mic && a->cnt == b->cnt && a->mtype == b->mtype;
+}
+
+/* The MIC is already well mixed; fold in the rest and finalize. */
+static uint32_t key_hash(const struct dd_key *k)
+{
+	uint32_t h = k->mic ^ k->id * 0x9e3779b1u ^ (k->cnt | (uint32_t)k->mtype << 16) * 0x85ebca77u;
+
+	h ^= h >> 16;
+	h *= 0x7feb352du;
+	h ^= h >> 15;
+	return h;
+}
+
+/* Probes for k; returns its slot, or the empty slot where it belongs. */
+static uint32_t tab_find(const struct dedup *d, const struct dd_key *k)
+{
+	uint32_t i = key_hash(k) & d->tab_mask;
+
+	while (d->tab[i].used && !key_eq(&d->tab[i].key, k))
+		i = (i + 1) & d->tab_mask;
+	return i;
+}
+
+/* Backward-shift deletion, so probe chains never need tombstones. */
+static void tab_delete(struct dedup *d, uint32_t i)
+{
+	uint32_t j = i;
+
+	for (;;) {
+		j = (j + 1) & d->tab_mask;
+		if (!d->tab[j].used)
+			break;
+		uint32_t home = key_hash(&d->tab[j].key) & d->tab_mask;
+		/* Entry j may move to i only if its home is not in (i, j]. */
+		if (((j - home) & d->tab_mask) >= ((j - i) & d->tab_mask)) {
+			d->tab[i] = d->tab[j];
+			i = j;
+		}
+	}
+	d->tab[i].used = 0;
+}
+
+static void release_next(struct dedup *d, int early)
+{
+	struct dd_fifo *f = &d->fifo[d->next & d->fifo_mask];
+	struct dd_entry *e = &d->tab[tab_find(d, &f->key)];
+	struct fp_frame *frame = d->frames[d->next & d->hold_mask];
+
+	d->next++;
+	e->held = 0;
+	d->st.unique++;
+	if (early)
+		d->st.early++;
+	d->release(frame, &e->best, e->copies, e->radios, d->arg);
+	fp_put(d->cache, frame);
+}
+
+static void forget_head(struct dedup *d, int evict)
+{
+	struct dd_fifo *f = &d->fifo[d->head & d->fifo_mask];
+
+	if (d->head == d->next)
+		release_next(d, 1);
+	tab_delete(d, tab_find(d, &f->key));
+	d->head++;
+	if (evict)
+		d->st.evicted++;
+}
+
+static void expire(struct dedup *d, uint64_t now)
+{
+	while (d->head != d->next && d->fifo[d->head & d->fifo_mask].first_ns + d->expire_ns <= now)
+		forget_head(d, 0);
+}
+
+static int better(const struct dd_meta *a, const struct dd_meta *b)
+{
+	return a->snr_cb > b->snr_cb || (a->snr_cb == b->snr_cb && a->rssi > b->rssi);
+}
+
+int dd_add(struct dedup *d, struct fp_frame *f, const struct dd_meta *meta, uint64_t now)
+{
+	struct dd_key k;
+	struct dd_entry *e;
+
+	if (frame_key(f->data, f->len, &k) < 0)
+		return -EINVAL;
+
+	expire(d, now);
+
+	e = &d->tab[tab_find(d, &k)];
+	if (e->used) {
+		if (!e->held) {
+			d->st.late++;
+			return 0;
+		}
+		d->st.duplicates++;
+		e->copies++;
+		if (meta->radio >= 0 && meta->radio < 32)
+			e->radios |= 1u << meta->radio;
+		if (better(meta, &e->best))
+			e->best = *meta;
+		return 0;
+	}
+
+	if (d->tail - d->head > d->fifo_mask)
+		forget_head(d, 1);
+	if (d->tail - d->next > d->hold_mask)
+		release_next(d, 1);
+
+	/* Either may have moved entries; probe again. */
+	e = &d->tab[tab_find(d, &k)];
+	e->key = k;
+	e->used = 1;
+	e->held = 1;
+	e->copies = 1;
+	e->radios = meta->radio >= 0 && meta->radio < 32 ? 1u << meta->radio : 0;
+	e->best = *meta;
+
+	d->fifo[d->tail & d->fifo_mask].key = k;
+	d->fifo[d->tail & d->fifo_mask].first_ns = now;
+	d->frames[d->tail & d->hold_mask] = fp_get(f);
+	d->tail++;
+	return 1;
+}
+
+int dd_run(struct dedup *d, uint64_t now)
+{
+	int n = 0;
+
+	while (d->next != d->tail && d->fifo[d->next & d->fifo_mask].first_ns + d->window_ns <= now) {
+		release_next(d, 0);
+		n++;
+	}
+	expire(d, now);
+	return n;
+}
+
+uint64_t dd_next(const struct dedup *d)
+{
+	if (d->next == d->tail)
+		return UINT64_MAX;
+	return d->fifo[d->next & d->fifo_mask].first_ns + d->window_ns;
+}
@@ -0,0 +1,117 @@
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include <stdint.h>
+
+#include "framepool.h"
+
+/*
+ * Uplink deduplication across radios listening on overlapping channels.
+ *
+ * LoRaWAN uplinks are keyed on (DevAddr, FCnt, MIC), join requests on
+ * (DevEUI, DevNonce, MIC), in a fixed-size open-addressed table. The
+ * first copy of a frame is held for window_ns. Copies arriving in the
+ * meantime only merge their metadata, the best SNR (then RSSI) winning.
+ * When the window ends, the frame is released once, with the best
+ * metadata. The key stays in the table until expire_ns after the first
+ * copy, so late copies are counted and dropped, not forwarded. Keep
+ * expire_ns below the NbTrans retransmission spacing (about a second),
+ * so a retransmission of the same FCnt is forwarded again.
+ *
+ * Keys live in a FIFO in arrival order, which is also release and expiry
+ * order, so neither needs a scan. When the FIFO or the hold ring is full,
+ * the oldest frame is released or forgotten early; memory never grows.
+ * Frames that are not LoRaWAN uplinks are not keyed and pass straight
+ * through.
+ *
+ * Held frames are framepool.h references, not copies; the last reference
+ * goes back through the cache given to dd_init().
+ */
+
+struct dd_meta {
+	uint64_t time_ns;
+	int radio;
+	int rssi;		/* dBm, 0 if unknown */
+	int snr_cb;		/* centibels, 0 if unknown */
+};
+
+struct dd_stats {
+	uint64_t unique;	/* keyed frames released */
+	uint64_t duplicates;	/* copies merged into a held frame */
+	uint64_t late;		/* copies after release, dropped */
+	uint64_t early;		/* released before their window ended */
+	uint64_t evicted;	/* forgotten before expire_ns */
+};
+
+/*
+ * Called once per unique frame; radios has bit n set if radio n heard it.
+ * The frame is only lent; take a reference to keep it.
+ */
+typedef void (*dd_release_fn)(struct fp_frame *f, const struct dd_meta *best,
+			      unsigned int copies, uint32_t radios, void *arg);
+
+struct dd_key {
+	uint32_t id;		/* DevAddr, or folded DevEUI */
+	uint32_t mic;
+	uint16_t cnt;		/* FCnt, or DevNonce */
+	uint16_t mtype;
+};
+
+struct dd_entry {
+	struct dd_key key;
+	uint8_t used;
+	uint8_t held;
+	uint16_t copies;
+	uint32_t radios;
+	struct dd_meta best;
+};
+
+struct dd_fifo {
+	struct dd_key key;
+	uint64_t first_ns;
+};
+
+struct dedup {
+	uint64_t window_ns;
+	uint64_t expire_ns;
+	dd_release_fn release;
+	void *arg;
+	struct fp_cache *cache;
+
+	struct dd_entry *tab;	/* twice the FIFO size, power of two */
+	uint32_t tab_mask;
+
+	/* Free-running indices: head <= next <= tail. */
+	struct dd_fifo *fifo;
+	uint32_t fifo_mask;
+	uint32_t head;		/* oldest key still in the table */
+	uint32_t next;		/* oldest frame still held */
+	uint32_t tail;
+
+	/* Held frames are fifo[next..tail), stored at index & hold_mask. */
+	struct fp_frame **frames;
+	uint32_t hold_mask;
+
+	struct dd_stats st;
+};
+
+/* keys and held are rounded up to powers of two. */
+int dd_init(struct dedup *d, uint32_t keys, uint32_t held, uint64_t window_ns,
+	    uint64_t expire_ns, struct fp_cache *cache, dd_release_fn release, void *arg);
+/* Drops the held frames unreleased. */
+void dd_free(struct dedup *d);
+
+/*
+ * Returns 1 for the first copy of a frame, now held with a reference of
+ * its own, 0 for a duplicate, or -EINVAL when the frame has no key; the
+ * caller forwards it itself. The caller's reference stays the caller's.
+ */
+int dd_add(struct dedup *d, struct fp_frame *f, const struct dd_meta *meta, uint64_t now);
+
+/* Releases every frame whose window has ended; returns how many. */
+int dd_run(struct dedup *d, uint64_t now);
+
+/* When dd_run() next has a frame to release, or UINT64_MAX. */
+uint64_t dd_next(const struct dedup *d);
+
+#endif
@@ -0,0 +1,300 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dlsched.h"
+
+#define DL_NONE		UINT32_MAX
+
+/* dl_frame.state */
+#define DL_RX2		0x0001	/* moved to its second window */
+#define DL_DEFERRED	0x0002	/* counted in st.deferred */
+
+void lora_phy_default(struct lora_phy *phy, unsigned int sf, unsigned int bw_hz)
+{
+	phy->sf = sf;
+	phy->bw_hz = bw_hz;
+	phy->cr = 1;
+	phy->preamble = 8;
+	phy->crc = 0;		/* LoRaWAN downlinks carry no payload CRC */
+	phy->implicit = 0;
+	phy->ldro = -1;
+}
+
+uint64_t lora_toa_ns(const struct lora_phy *phy, unsigned int len)
+{
+	int sf = phy->sf;
+	int de = phy->ldro;
+	int num, den, nsym;
+
+	/* A symbol lasts 2^SF / BW; LDRO is mandated above 16 ms. */
+	if (de < 0)
+		de = ((uint64_t)1000 << sf) > 16ULL * phy->bw_hz;
+
+	num = 8 * (int)len - 4 * sf + 28 + 16 * !!phy->crc - 20 * !!phy->implicit;
+	den = 4 * (sf - 2 * de);
+	nsym = 8;
+	if (num > 0)
+		nsym += (num + den - 1) / den * (phy->cr + 4);
+
+	/* Preamble is n + 4.25 symbols, so count quarter symbols. */
+	uint64_t quarters = 4ULL * (phy->preamble + nsym) + 17;
+
+	return quarters * (1000000000ULL << sf) / (4ULL * phy->bw_hz);
+}
+
+int dl_init(struct dl_sched *s, int nradios, uint32_t cap, uint64_t lead_ns)
+{
+	memset(s, 0, sizeof(*s));
+	if (nradios < 1 || nradios > DL_MAX_RADIOS || cap == 0)
+		return -EINVAL;
+
+	s->nradios = nradios;
+	s->lead_ns = lead_ns;
+	s->cap = cap;
+	s->frames = calloc(cap, sizeof(*s->frames));
+	s->free_slots = calloc(cap, sizeof(*s->free_slots));
+	if (s->frames == NULL || s->free_slots == NULL)
+		goto err;
+
+	for (int i = 0; i < nradios; i++) {
+		struct dl_radio *r = &s->radios[i];
+
+		r->timed = calloc(cap, sizeof(*r->timed));
+		if (r->timed == NULL)
+			goto err;
+		r->fifo_head = r->fifo_tail = DL_NONE;
+	}
+
+	for (uint32_t i = 0; i < cap; i++)
+		s->free_slots[i] = cap - 1 - i;
+	s->nfree = cap;
+	return 0;
+
+err:
+	dl_free(s);
+	return -ENOMEM;
+}
+
+void dl_free(struct dl_sched *s)
+{
+	for (int i = 0; i < DL_MAX_RADIOS; i++)
+		free(s->radios[i].timed);
+	free(s->frames);
+	free(s->free_slots);
+	memset(s, 0, sizeof(*s));
+}
+
+static void heap_push(struct dl_radio *r, uint64_t key, uint32_t slot)
+{
+	uint32_t i = r->ntimed++;
+
+	while (i > 0) {
+		uint32_t parent = (i - 1) / 2;
+		if (r->timed[parent].key <= key)
+			break;
+		r->timed[i] = r->timed[parent];
+		i = parent;
+	}
+	r->timed[i].key = key;
+	r->timed[i].slot = slot;
+}
+
+static void heap_pop(struct dl_radio *r)
+{
+	struct dl_entry last = r->timed[--r->ntimed];
+	uint32_t i = 0;
+
+	for (;;) {
+		uint32_t child = 2 * i + 1;
+		if (child >= r->ntimed)
+			break;
+		if (child + 1 < r->ntimed && r->timed[child + 1].key < r->timed[child].key)
+			child++;
+		if (last.key <= r->timed[child].key)
+			break;
+		r->timed[i] = r->timed[child];
+		i = child;
+	}
+	if (r->ntimed)
+		r->timed[i] = last;
+}
+
+static uint64_t release_at(const struct dl_sched *s, uint64_t at)
+{
+	return at > s->lead_ns ? at - s->lead_ns : 0;
+}
+
+static void free_slot(struct dl_sched *s, uint32_t slot)
+{
+	s->free_slots[s->nfree++] = slot;
+}
+
+int dl_enqueue(struct dl_sched *s, const struct dl_frame *f, uint64_t now)
+{
+	struct dl_frame *slot;
+	struct dl_radio *r;
+	uint32_t i;
+
+	if (f->port >= s->nradios || f->len > DL_FRAME_MAX ||
+	    (f->rx2_at_ns && f->rx2_port >= s->nradios))
+		return -EINVAL;
+	if (f->at_ns && f->at_ns < now && f->rx2_at_ns < now)
+		return -ETIME;
+	if (s->nfree == 0)
+		return -EAGAIN;
+
+	i = s->free_slots[--s->nfree];
+	slot = &s->frames[i];
+	slot->at_ns = f->at_ns;
+	slot->rx2_at_ns = f->rx2_at_ns;
+	slot->port = f->port;
+	slot->rx2_port = f->rx2_port;
+	slot->len = f->len;
+	slot->state = 0;
+	slot->next = DL_NONE;
+	memcpy(slot->data, f->data, f->len);
+
+	r = &s->radios[f->port];
+	if (f->at_ns) {
+		heap_push(r, release_at(s, f->at_ns), i);
+	} else {
+		if (r->fifo_tail == DL_NONE)
+			r->fifo_head = i;
+		else
+			s->frames[r->fifo_tail].next = i;
+		r->fifo_tail = i;
+		r->nfifo++;
+	}
+	return 0;
+}
+
+static uint64_t frame_toa(const struct dl_radio *r, const struct dl_frame *f)
+{
+	return r->airtime ? lora_toa_ns(&r->phy, f->len) : 0;
+}
+
+static uint64_t radio_ready(const struct dl_radio *r)
+{
+	return r->busy_until > r->free_at ? r->busy_until : r->free_at;
+}
+
+static void account(struct dl_radio *r, uint64_t start, uint64_t toa)
+{
+	r->busy_until = start + toa;
+	/* ETSI off time: T_on / duty - T_on after the frame ends. */
+	if (r->duty_ppm)
+		r->free_at = start + toa * 1000000 / r->duty_ppm;
+	r->st.sent++;
+	r->st.airtime_ns += toa;
+}
+
+/* A timed frame whose window is lost: try RX2, else drop it. */
+static void miss(struct dl_sched *s, struct dl_frame *f, uint32_t slot)
+{
+	if (f->rx2_at_ns && !(f->state & DL_RX2)) {
+		f->state |= DL_RX2;
+		f->at_ns = f->rx2_at_ns;
+		f->port = f->rx2_port;
+		heap_push(&s->radios[f->port], release_at(s, f->at_ns), slot);
+		return;
+	}
+	s->radios[f->port].st.missed++;
+	free_slot(s, slot);
+}
+
+/* Untimed head frame fits on air before the next timed one of r. */
+static int fits_before_timed(const struct dl_sched *s, const struct dl_radio *r,
+			     const struct dl_frame *f, uint64_t now)
+{
+	if (r->ntimed == 0)
+		return 1;
+
+	uint64_t at = s->frames[r->timed[0].slot].at_ns;
+	return now + s->lead_ns + frame_toa(r, f) <= at;
+}
+
+int dl_run(struct dl_sched *s, uint64_t now, dl_send_fn send, void *arg)
+{
+	int sent = 0, ret;
+
+	for (int i = 0; i < s->nradios; i++) {
+		struct dl_radio *r = &s->radios[i];
+
+		while (r->ntimed && r->timed[0].key <= now) {
+			uint32_t slot = r->timed[0].slot;
+			struct dl_frame *f = &s->frames[slot];
+
+			if (f->at_ns < now || f->at_ns < radio_ready(r)) {
+				heap_pop(r);
+				miss(s, f, slot);
+				continue;
+			}
+
+			ret = send(i, f->data, f->len, arg);
+			if (ret == -EAGAIN)
+				return ret;
+			heap_pop(r);
+			if (ret == 0) {
+				account(r, f->at_ns, frame_toa(r, f));
+				if (f->state & DL_RX2)
+					r->st.rx2++;
+				sent++;
+			} else {
+				r->st.missed++;
+			}
+			free_slot(s, slot);
+		}
+
+		while (r->nfifo) {
+			uint32_t slot = r->fifo_head;
+			struct dl_frame *f = &s->frames[slot];
+
+			if (radio_ready(r) > now || !fits_before_timed(s, r, f, now)) {
+				if (!(f->state & DL_DEFERRED)) {
+					f->state |= DL_DEFERRED;
+					r->st.deferred++;
+				}
+				break;
+			}
+
+			ret = send(i, f->data, f->len, arg);
+			if (ret == -EAGAIN)
+				return ret;
+			r->fifo_head = f->next;
+			if (r->fifo_head == DL_NONE)
+				r->fifo_tail = DL_NONE;
+			r->nfifo--;
+			if (ret == 0) {
+				account(r, now + s->lead_ns, frame_toa(r, f));
+				sent++;
+			} else {
+				r->st.missed++;
+			}
+			free_slot(s, slot);
+		}
+	}
+
+	return sent;
+}
+
+uint64_t dl_next(const struct dl_sched *s, uint64_t now)
+{
+	uint64_t next = UINT64_MAX;
+
+	for (int i = 0; i < s->nradios; i++) {
+		const struct dl_radio *r = &s->radios[i];
+
+		if (r->ntimed && r->timed[0].key < next)
+			next = r->timed[0].key;
+		if (r->nfifo) {
+			uint64_t t = radio_ready(r);
+			if (t < now)
+				t = now;
+			/* Behind a timed frame, whose release comes first anyway. */
+			if (t < next && fits_before_timed(s, r, &s->frames[r->fifo_head], t))
+				next = t;
+		}
+	}
+	return next;
+}
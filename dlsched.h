@@ -0,0 +1,115 @@
+#ifndef DLSCHED_H
+#define DLSCHED_H
+
+#include <stdint.h>
+
+/*
+ * Downlink scheduler: per radio, a min-heap of timed frames keyed on the
+ * time they must be handed to the radio and a FIFO of untimed ones, with
+ * time-on-air and duty-cycle accounting.
+ *
+ * A frame either goes out as soon as its radio allows (at_ns 0) without
+ * overlapping a timed frame waiting on it, or at exactly at_ns, e.g. a
+ * class A RX1 window, with an optional second chance at rx2_at_ns on
+ * rx2_port. A timed frame is released lead_ns
+ * early to cover the driver's TX path. When its radio is still on air
+ * from an earlier frame, or the duty-cycle off time has not passed yet,
+ * the frame falls back to RX2, and is dropped as missed if RX2 cannot
+ * be met either. Times are CLOCK_REALTIME nanoseconds, the clock RX
+ * timestamps are in.
+ */
+
+#define DL_MAX_RADIOS	16
+#define DL_FRAME_MAX	256
+
+struct lora_phy {
+	unsigned int sf;	/* 6..12 */
+	unsigned int bw_hz;
+	unsigned int cr;	/* 1..4 for 4/5..4/8 */
+	unsigned int preamble;	/* symbols, 8 for LoRaWAN */
+	int crc;
+	int implicit;		/* no explicit header */
+	int ldro;		/* -1: on when a symbol exceeds 16 ms */
+};
+
+void lora_phy_default(struct lora_phy *phy, unsigned int sf, unsigned int bw_hz);
+
+/* Semtech AN1200.13 time-on-air of a len-byte payload. */
+uint64_t lora_toa_ns(const struct lora_phy *phy, unsigned int len);
+
+struct dl_radio_stats {
+	uint64_t sent;
+	uint64_t rx2;		/* sent in the RX2 window instead */
+	uint64_t missed;	/* no window could be met */
+	uint64_t deferred;	/* untimed frames held back for airtime */
+	uint64_t airtime_ns;
+};
+
+struct dl_entry {
+	uint64_t key;		/* release time */
+	uint32_t slot;
+};
+
+struct dl_radio {
+	int airtime;		/* phy valid: account time-on-air */
+	struct lora_phy phy;
+	uint32_t duty_ppm;	/* 0: no duty-cycle limit */
+	uint64_t busy_until;	/* end of the last frame on air */
+	uint64_t free_at;	/* earliest start the duty cycle allows */
+	struct dl_radio_stats st;
+
+	/* Timed frames in a min-heap, untimed ones in arrival order. */
+	struct dl_entry *timed;
+	uint32_t ntimed;
+	uint32_t fifo_head;
+	uint32_t fifo_tail;
+	uint32_t nfifo;
+};
+
+struct dl_frame {
+	uint64_t at_ns;		/* 0: as soon as the radio allows */
+	uint64_t rx2_at_ns;	/* 0: no second window */
+	uint16_t port;
+	uint16_t rx2_port;
+	uint16_t len;
+	uint16_t state;		/* scheduler use */
+	uint32_t next;		/* scheduler use */
+	unsigned char data[DL_FRAME_MAX];
+};
+
+struct dl_sched {
+	struct dl_radio radios[DL_MAX_RADIOS];
+	int nradios;
+	uint64_t lead_ns;
+	uint32_t cap;
+	struct dl_frame *frames;
+	uint32_t *free_slots;
+	uint32_t nfree;
+};
+
+int dl_init(struct dl_sched *s, int nradios, uint32_t cap, uint64_t lead_ns);
+void dl_free(struct dl_sched *s);
+
+/*
+ * Returns 0, -EAGAIN when the queue is full, -ETIME when every window
+ * has passed already, or -EINVAL for a bad port.
+ */
+int dl_enqueue(struct dl_sched *s, const struct dl_frame *f, uint64_t now);
+
+/* When dl_run() next has work, or UINT64_MAX when nothing is due by then. */
+uint64_t dl_next(const struct dl_sched *s, uint64_t now);
+
+static inline uint32_t dl_queued(const struct dl_sched *s)
+{
+	return s->cap - s->nfree;
+}
+
+/*
+ * Hands every frame due at now to send(), which returns 0 or -EAGAIN
+ * when the radio's queue is full. Returns frames sent, or -EAGAIN if a
+ * send() stopped the run; the frame stays queued for the next one.
+ */
+typedef int (*dl_send_fn)(int port, const void *data, unsigned int len, void *arg);
+int dl_run(struct dl_sched *s, uint64_t now, dl_send_fn send, void *arg);
+
+#endif
@@ -0,0 +1,85 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "evloop.h"
+
+#define EVLOOP_MAX_EVENTS	32
+
+int evloop_init(struct evloop *ev)
+{
+	ev->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (ev->epfd == -1)
+		return -errno;
+	ev->stop = 0;
+	ev->wakeups = 0;
+	ev->flush = NULL;
+	return 0;
+}
+
+void evloop_close(struct evloop *ev)
+{
+	if (ev->epfd != -1)
+		close(ev->epfd);
+	ev->epfd = -1;
+}
+
+int evloop_add(struct evloop *ev, struct ev_source *src, uint32_t events)
+{
+	struct epoll_event e = {
+		.events = events | EPOLLET,
+		.data.ptr = src,
+	};
+
+	if (epoll_ctl(ev->epfd, EPOLL_CTL_ADD, src->fd, &e) == -1)
+		return -errno;
+	return 0;
+}
+
+int evloop_del(struct evloop *ev, struct ev_source *src)
+{
+	if (epoll_ctl(ev->epfd, EPOLL_CTL_DEL, src->fd, NULL) == -1)
+		return -errno;
+	return 0;
+}
+
+int evloop_run(struct evloop *ev, int timeout_ms)
+{
+	struct epoll_event events[EVLOOP_MAX_EVENTS];
+
+	while (!ev->stop) {
+		int n = epoll_wait(ev->epfd, events, EVLOOP_MAX_EVENTS, timeout_ms);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		if (n == 0 && timeout_ms >= 0)
+			return 0;
+
+		ev->wakeups++;
+		for (int i = 0; i < n; i++) {
+			struct ev_source *src = events[i].data.ptr;
+			src->fn(src, events[i].events);
+		}
+		if (ev->flush)
+			ev->flush(ev);
+	}
+
+	return 0;
+}
+
+void evloop_stop(struct evloop *ev)
+{
+	ev->stop = 1;
+}
+
+int set_nonblocking(int fd)
+{
+	int flags = fcntl(fd, F_GETFL);
+
+	if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)
+		return -errno;
+	return 0;
+}
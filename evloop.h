@@ -0,0 +1,49 @@
+#ifndef EVLOOP_H
+#define EVLOOP_H
+
+#include <stdint.h>
+#include <sys/epoll.h>
+
+/*
+ * Minimal epoll event loop shared by the tools.
+ *
+ * Sources are embedded in the caller's own state and registered by
+ * pointer, so adding a socket never allocates. Handlers run on the loop
+ * thread and should drain their fd until EAGAIN, since the loop uses
+ * edge-triggered notification.
+ */
+
+struct ev_source;
+
+typedef void (*ev_handler_t)(struct ev_source *src, uint32_t events);
+
+struct ev_source {
+	int fd;
+	ev_handler_t fn;
+	void *arg;
+};
+
+struct evloop {
+	int epfd;
+	volatile int stop;
+	unsigned long wakeups;
+	/* Optional: runs after each round of handlers, e.g. to send what they queued. */
+	void (*flush)(struct evloop *ev);
+};
+
+int evloop_init(struct evloop *ev);
+void evloop_close(struct evloop *ev);
+
+int evloop_add(struct evloop *ev, struct ev_source *src, uint32_t events);
+int evloop_del(struct evloop *ev, struct ev_source *src);
+
+/*
+ * Dispatches events until evloop_stop(), or until timeout_ms passes
+ * without any event when timeout_ms >= 0. Returns 0 or a negative errno.
+ */
+int evloop_run(struct evloop *ev, int timeout_ms);
+void evloop_stop(struct evloop *ev);
+
+int set_nonblocking(int fd);
+
+#endif
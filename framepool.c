@@ -0,0 +1,156 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+
+#include "framepool.h"
+
+int fp_init(struct framepool *p, size_t max_bytes)
+{
+	size_t per_frame = sizeof(struct fp_frame) + sizeof(uint32_t);
+	size_t frames_len;
+
+	memset(p, 0, sizeof(*p));
+	p->doorbell = -1;
+	if (max_bytes / per_frame < FP_CACHE || max_bytes / per_frame > UINT32_MAX)
+		return -EINVAL;
+	p->nframes = max_bytes / per_frame;
+	frames_len = (size_t)p->nframes * sizeof(struct fp_frame);
+
+	/* Frames and depot in one mapping, faulted in now rather than on the hot path. */
+	p->map_len = frames_len + (size_t)p->nframes * sizeof(uint32_t);
+	p->base = mmap(NULL, p->map_len, PROT_READ | PROT_WRITE,
+		       MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	if (p->base == MAP_FAILED)
+		return -errno;
+	p->depot = (uint32_t *)(p->base + frames_len);
+
+	p->doorbell = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (p->doorbell == -1) {
+		int err = errno;
+		munmap(p->base, p->map_len);
+		return -err;
+	}
+
+	for (uint32_t i = 0; i < p->nframes; i++) {
+		fp_frame_at(p, i)->idx = i;
+		p->depot[i] = p->nframes - 1 - i;
+	}
+	p->ndepot = p->nframes;
+	pthread_mutex_init(&p->lock, NULL);
+	return 0;
+}
+
+void fp_destroy(struct framepool *p)
+{
+	pthread_mutex_destroy(&p->lock);
+	close(p->doorbell);
+	munmap(p->base, p->map_len);
+	memset(p, 0, sizeof(*p));
+	p->doorbell = -1;
+}
+
+void fp_cache_init(struct fp_cache *c, struct framepool *p)
+{
+	c->pool = p;
+	c->n = 0;
+}
+
+static void spill(struct fp_cache *c, uint32_t n)
+{
+	struct framepool *p = c->pool;
+	int ring;
+
+	pthread_mutex_lock(&p->lock);
+	memcpy(&p->depot[p->ndepot], &c->idx[c->n - n], n * sizeof(uint32_t));
+	p->ndepot += n;
+	p->st.spills++;
+	ring = p->starved;
+	p->starved = 0;
+	pthread_mutex_unlock(&p->lock);
+	c->n -= n;
+
+	if (ring) {
+		uint64_t one = 1;
+		ssize_t ret = write(p->doorbell, &one, sizeof(one));
+		(void)ret;
+	}
+}
+
+void fp_cache_flush(struct fp_cache *c)
+{
+	if (c->n)
+		spill(c, c->n);
+}
+
+static int refill(struct fp_cache *c)
+{
+	struct framepool *p = c->pool;
+	uint32_t n;
+
+	pthread_mutex_lock(&p->lock);
+	n = p->ndepot < FP_BATCH ? p->ndepot : FP_BATCH;
+	p->ndepot -= n;
+	memcpy(&c->idx[c->n], &p->depot[p->ndepot], n * sizeof(uint32_t));
+	if (n) {
+		p->st.refills++;
+	} else {
+		p->st.empty++;
+		p->starved = 1;
+	}
+	pthread_mutex_unlock(&p->lock);
+	c->n += n;
+	return n;
+}
+
+struct fp_frame *fp_alloc(struct fp_cache *c)
+{
+	struct fp_frame *f;
+
+	if (c->n == 0 && refill(c) == 0)
+		return NULL;
+	f = fp_frame_at(c->pool, c->idx[--c->n]);
+	atomic_store_explicit(&f->ref, 1, memory_order_relaxed);
+	f->sw_ns = 0;
+	f->hw_ns = 0;
+	f->len = 0;
+	f->flags = 0;
+	f->port = -1;
+	f->rssi = 0;
+	f->snr_cb = 0;
+	return f;
+}
+
+unsigned int fp_alloc_bulk(struct fp_cache *c, struct fp_frame **frames, unsigned int n)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		frames[i] = fp_alloc(c);
+		if (frames[i] == NULL)
+			break;
+	}
+	return i;
+}
+
+void fp_put(struct fp_cache *c, struct fp_frame *f)
+{
+	/* Release, so the next owner sees every write made to the frame. */
+	if (atomic_fetch_sub_explicit(&f->ref, 1, memory_order_acq_rel) != 1)
+		return;
+	if (c->n == FP_CACHE)
+		spill(c, FP_BATCH);
+	c->idx[c->n++] = f->idx;
+}
+
+uint32_t fp_depot_count(struct framepool *p)
+{
+	uint32_t n;
+
+	pthread_mutex_lock(&p->lock);
+	n = p->ndepot;
+	pthread_mutex_unlock(&p->lock);
+	return n;
+}
@@ -0,0 +1,104 @@
+#ifndef FRAMEPOOL_H
+#define FRAMEPOOL_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Fixed-capacity pool of refcounted frame buffers.
+ *
+ * The pool is carved out of one populated mapping of at most max_bytes
+ * when it is created, so running out of frames is backpressure, never an
+ * allocation: fp_alloc() returns NULL and the caller leaves the rest in
+ * its socket until frames come back.
+ *
+ * Every thread takes frames through a cache of its own, which refills
+ * from and spills to the shared depot FP_BATCH frames at a time, so the
+ * lock is taken once per batch, not per frame. A thread may put frames
+ * another thread allocated. A frame starts with one reference; handing
+ * it to the next stage passes that reference on, while a stage that
+ * keeps a frame another one still uses takes its own with fp_get().
+ *
+ * Functions return 0 or a count on success and a negative errno value on
+ * failure.
+ */
+
+#define FP_DATA_MAX	256	/* LoRa payloads are at most 255 bytes */
+#define FP_CACHE	64	/* frames one thread cache holds */
+#define FP_BATCH	32	/* frames moved between a cache and the depot */
+#define FP_ALIGN	64
+
+struct fp_frame {
+	_Atomic uint32_t ref;
+	uint32_t idx;		/* pool use */
+	uint64_t sw_ns;
+	uint64_t hw_ns;
+	uint16_t len;
+	uint16_t flags;
+	int16_t port;		/* radio the frame came from or goes to */
+	int16_t rssi;		/* dBm, 0 if unknown */
+	int16_t snr_cb;		/* centibels, 0 if unknown */
+	_Alignas(FP_ALIGN) unsigned char data[FP_DATA_MAX];
+};
+
+struct fp_stats {
+	uint64_t refills;	/* depot to cache batches */
+	uint64_t spills;	/* cache to depot batches */
+	uint64_t empty;		/* fp_alloc() calls that found no frame */
+};
+
+struct framepool {
+	unsigned char *base;
+	size_t map_len;
+	uint32_t nframes;
+
+	/* Under lock */
+	pthread_mutex_t lock;
+	uint32_t *depot;	/* indices of free frames */
+	uint32_t ndepot;
+	int starved;		/* an allocation failed since the last ring */
+	struct fp_stats st;
+
+	/* eventfd rung when frames return to a starved depot */
+	int doorbell;
+};
+
+struct fp_cache {
+	struct framepool *pool;
+	uint32_t n;
+	uint32_t idx[FP_CACHE];
+};
+
+/* As many frames as fit into max_bytes, index included; at least FP_CACHE. */
+int fp_init(struct framepool *p, size_t max_bytes);
+void fp_destroy(struct framepool *p);
+
+static inline struct fp_frame *fp_frame_at(const struct framepool *p, uint32_t idx)
+{
+	return (struct fp_frame *)(p->base + (size_t)idx * sizeof(struct fp_frame));
+}
+
+void fp_cache_init(struct fp_cache *c, struct framepool *p);
+/* Hands every cached frame back to the depot, e.g. before a thread exits. */
+void fp_cache_flush(struct fp_cache *c);
+
+/* A frame with one reference, len 0 and no metadata, or NULL if none is left. */
+struct fp_frame *fp_alloc(struct fp_cache *c);
+/* Up to n frames, as many as are left; returns the count. */
+unsigned int fp_alloc_bulk(struct fp_cache *c, struct fp_frame **frames, unsigned int n);
+
+static inline struct fp_frame *fp_get(struct fp_frame *f)
+{
+	atomic_fetch_add_explicit(&f->ref, 1, memory_order_relaxed);
+	return f;
+}
+
+/* Drops a reference; the last one returns the frame through c. */
+void fp_put(struct fp_cache *c, struct fp_frame *f);
+
+/* Frames in the depot, not counting those sitting in thread caches. */
+uint32_t fp_depot_count(struct framepool *p);
+
+#endif
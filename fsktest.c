@@ -0,0 +1,398 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+#include "ifcache.h"
+#include "loracodec.h"
+
+/*
+ * FSK throughput tool: ETH_P_FSK datagrams over PF_PACKET, a batch per
+ * sendmmsg()/recvmmsg() call. The nRF24L01+ moves a 32 byte payload in
+ * under 200 us at 2 Mbit/s, so one syscall per frame would cap it well
+ * below the air rate.
+ *
+ * Every payload starts with a little-endian sequence number, so the
+ * receiver can count lost and reordered frames.
+ */
+
+#ifndef PACKET_QDISC_BYPASS
+#define PACKET_QDISC_BYPASS	20
+#endif
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL		46
+#endif
+#ifndef SO_INCOMING_NAPI_ID
+#define SO_INCOMING_NAPI_ID	56
+#endif
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL	69
+#endif
+#ifndef SO_BUSY_POLL_BUDGET
+#define SO_BUSY_POLL_BUDGET	70
+#endif
+
+#define BATCH_MAX	1024
+#define SEQ_LEN		4
+#define NRF24_PAYLOAD	32
+#define POLL_MS		200
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig)
+{
+	stop = 1;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Only the receiver binds to ETH_P_FSK. A sender with protocol 0 gets no
+ * copy of the frames received meanwhile, which it would never read;
+ * it addresses each frame with addr instead.
+ */
+static int open_socket(const struct ifc_entry *ife, int tx, struct sockaddr_ll *addr)
+{
+	struct timeval tv = { .tv_sec = 0, .tv_usec = POLL_MS * 1000 };
+	int skt = socket(PF_PACKET, SOCK_DGRAM | SOCK_CLOEXEC, tx ? 0 : htons(ETH_P_FSK));
+	if (skt == -1) {
+		int err = errno;
+		fprintf(stderr, "socket failed: %s\n", strerror(err));
+		return -1;
+	}
+
+	struct ifreq ifr;
+	int ret;
+	ifr.ifr_ifindex = ife->ifindex;
+	if (ifr.ifr_ifindex == 0) {
+		strcpy(ifr.ifr_name, ife->name);
+		ret = ioctl(skt, SIOCGIFINDEX, &ifr);
+		if (ret == -1) {
+			int err = errno;
+			fprintf(stderr, "ioctl failed: %s\n", strerror(err));
+			close(skt);
+			return -1;
+		}
+	}
+	printf("%s ifindex %d\n", ife->name, ifr.ifr_ifindex);
+
+	memset(addr, 0, sizeof(*addr));
+	addr->sll_family = AF_PACKET;
+	addr->sll_protocol = htons(ETH_P_FSK);
+	addr->sll_ifindex = ifr.ifr_ifindex;
+	if (tx)
+		return skt;
+
+	ret = bind(skt, (struct sockaddr *)addr, sizeof(*addr));
+	if (ret == -1) {
+		int err = errno;
+		fprintf(stderr, "bind failed: %s\n", strerror(err));
+		close(skt);
+		return -1;
+	}
+
+	/* Bounded blocking, so a signal-free loop still notices stop. */
+	setsockopt(skt, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	return skt;
+}
+
+static void print_rate(const char *what, long frames, long bytes, double elapsed)
+{
+	printf("%s %ld bytes %ld elapsed %.6f s\n", what, frames, bytes, elapsed);
+	if (elapsed > 0)
+		printf("%.1f frames/s, %.1f kbit/s payload\n", frames / elapsed,
+		       bytes * 8 / elapsed / 1e3);
+}
+
+static int tx_batches(int skt, struct sockaddr_ll *dst, long count, long batch, int addr,
+		      unsigned int size)
+{
+	static uint8_t frames[BATCH_MAX][FSK_MAX_FRAME];
+	static struct iovec iov[BATCH_MAX];
+	static struct mmsghdr msgs[BATCH_MAX];
+	unsigned int hlen = fsk_hdr_len(addr);
+	long sent = 0, bytes = 0, calls = 0, retries = 0;
+	int len = 0;
+
+	for (long i = 0; i < batch; i++) {
+		uint8_t payload[FSK_MAX_FRAME];
+
+		for (unsigned int j = 0; j < size; j++)
+			payload[j] = 0x42 + j;
+		len = fsk_frame_build(frames[i], sizeof(frames[i]), ETH_P_FSK, addr, payload, size);
+		iov[i].iov_base = frames[i];
+		iov[i].iov_len = len;
+		msgs[i].msg_hdr.msg_name = dst;
+		msgs[i].msg_hdr.msg_namelen = sizeof(*dst);
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	uint64_t start = now_ns();
+	while (sent < count && !stop) {
+		long n = count - sent < batch ? count - sent : batch;
+
+		/* Only the sequence numbers change between batches. */
+		for (long i = 0; i < n; i++)
+			put_le32(frames[i] + hlen, sent + i);
+
+		int ret = sendmmsg(skt, msgs, n, 0);
+		if (ret == -1) {
+			if (errno == ENOBUFS || errno == EAGAIN || errno == EINTR) {
+				struct pollfd pfd = { .fd = skt, .events = POLLOUT };
+				retries++;
+				poll(&pfd, 1, 1);
+				continue;
+			}
+			int err = errno;
+			fprintf(stderr, "sendmmsg failed: %s\n", strerror(err));
+			return 1;
+		}
+		calls++;
+		sent += ret;
+		bytes += (long)ret * len;
+	}
+	double elapsed = (now_ns() - start) / 1e9;
+
+	print_rate("frames_sent", sent, bytes, elapsed);
+	printf("calls %ld, %.2f frames/call, retries %ld\n", calls,
+	       calls ? (double)sent / calls : 0.0, retries);
+	return sent < count && !stop;
+}
+
+struct seq_stats {
+	int started;
+	uint32_t next;
+	long lost;
+	long late;	/* reordered or duplicated */
+	long short_frames;
+};
+
+static void account_seq(struct seq_stats *s, const uint8_t *buf, unsigned int len, int has_addr)
+{
+	const uint8_t *payload;
+	unsigned int plen;
+	int addr;
+
+	if (fsk_frame_parse(buf, len, has_addr, &addr, &payload, &plen) || plen < SEQ_LEN) {
+		s->short_frames++;
+		return;
+	}
+
+	uint32_t seq = get_le32(payload);
+	if (!s->started) {
+		s->started = 1;
+	} else if ((int32_t)(seq - s->next) > 0) {
+		s->lost += seq - s->next;
+	} else if (seq != s->next) {
+		s->late++;
+		return;
+	}
+	s->next = seq + 1;
+}
+
+static int rx_batches(int skt, long count, long batch, int has_addr, int busy_poll_us,
+		      int prefer_busy_poll)
+{
+	static uint8_t frames[BATCH_MAX][FSK_MAX_FRAME];
+	static struct iovec iov[BATCH_MAX];
+	static struct mmsghdr msgs[BATCH_MAX];
+	struct seq_stats seq = { 0 };
+	long received = 0, bytes = 0, calls = 0;
+	uint64_t start = 0;
+	int napi_checked = 0;
+
+	if (busy_poll_us) {
+		if (setsockopt(skt, SOL_SOCKET, SO_BUSY_POLL, &busy_poll_us, sizeof(busy_poll_us)) == -1) {
+			int err = errno;
+			fprintf(stderr, "SO_BUSY_POLL failed: %s\n", strerror(err));
+			return 1;
+		}
+		if (prefer_busy_poll) {
+			int one = 1, budget = batch;
+
+			/* Linux 5.11+; without them busy polling still works. */
+			if (setsockopt(skt, SOL_SOCKET, SO_PREFER_BUSY_POLL, &one, sizeof(one)) == -1 ||
+			    setsockopt(skt, SOL_SOCKET, SO_BUSY_POLL_BUDGET, &budget, sizeof(budget)) == -1) {
+				int err = errno;
+				fprintf(stderr, "SO_PREFER_BUSY_POLL failed: %s\n", strerror(err));
+			}
+		}
+	}
+
+	for (long i = 0; i < batch; i++) {
+		iov[i].iov_base = frames[i];
+		iov[i].iov_len = sizeof(frames[i]);
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	while (!stop && (count == 0 || received < count)) {
+		long n = count && count - received < batch ? count - received : batch;
+
+		int ret = recvmmsg(skt, msgs, n, MSG_WAITFORONE, NULL);
+		if (ret == -1) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+				continue;
+			int err = errno;
+			fprintf(stderr, "recvmmsg failed: %s\n", strerror(err));
+			return 1;
+		}
+		if (start == 0)
+			start = now_ns();
+		calls++;
+
+		for (int i = 0; i < ret; i++) {
+			account_seq(&seq, frames[i], msgs[i].msg_len, has_addr);
+			bytes += msgs[i].msg_len;
+		}
+		received += ret;
+
+		if (busy_poll_us && !napi_checked) {
+			unsigned int napi_id = 0;
+			socklen_t len = sizeof(napi_id);
+
+			napi_checked = 1;
+			getsockopt(skt, SOL_SOCKET, SO_INCOMING_NAPI_ID, &napi_id, &len);
+			if (napi_id == 0)
+				fprintf(stderr, "driver does not use NAPI, SO_BUSY_POLL has no effect\n");
+		}
+	}
+	double elapsed = start ? (now_ns() - start) / 1e9 : 0;
+
+	struct tpacket_stats st;
+	socklen_t len = sizeof(st);
+	memset(&st, 0, sizeof(st));
+	getsockopt(skt, SOL_PACKET, PACKET_STATISTICS, &st, &len);
+
+	print_rate("frames_received", received, bytes, elapsed);
+	printf("calls %ld, %.2f frames/call\n", calls, calls ? (double)received / calls : 0.0);
+	printf("lost %ld late %ld short %ld\n", seq.lost, seq.late, seq.short_frames);
+	printf("kernel packets %u drops %u\n", st.tp_packets, st.tp_drops);
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-i ifname] [-t | -r] [-n count] [-b batch] [-s size] [-a addr] [-q] [-p usecs [-P]]\n", prog);
+	fprintf(stderr, "  -i  interface to bind to (default fsk0)\n");
+	fprintf(stderr, "      may also be an ifindex, a glob such as \"fsk*\" or \"all\", with an optional :count\n");
+	fprintf(stderr, "  -t  transmit (default)\n");
+	fprintf(stderr, "  -r  receive\n");
+	fprintf(stderr, "  -n  frames to send (default 1000) or receive (default 0, unlimited)\n");
+	fprintf(stderr, "  -b  frames per sendmmsg()/recvmmsg() call, 1..%d (default 64)\n", BATCH_MAX);
+	fprintf(stderr, "  -s  payload bytes, %d..%d (default %d, the nRF24L01+ maximum)\n",
+		SEQ_LEN, FSK_MAX_FRAME - 1, NRF24_PAYLOAD);
+	fprintf(stderr, "  -a  lead each frame with this node address byte\n");
+	fprintf(stderr, "  -q  transmit with PACKET_QDISC_BYPASS\n");
+	fprintf(stderr, "  -p  busy poll for this many us per receive (SO_BUSY_POLL)\n");
+	fprintf(stderr, "  -P  with -p, SO_PREFER_BUSY_POLL and a busy poll budget of -b\n");
+}
+
+int main(int argc, char **argv)
+{
+	const char *spec = "fsk0";
+	struct ifc_entry ife;
+	struct ifcache ifc;
+	long count = -1, batch = 64, size = NRF24_PAYLOAD, addr = FSK_NO_ADDR;
+	int mode = 't', bypass = 0, busy_poll_us = 0, prefer = 0, opt, ret;
+
+	while ((opt = getopt(argc, argv, "i:trn:b:s:a:qp:Ph")) != -1) {
+		switch (opt) {
+		case 'i':
+			spec = optarg;
+			break;
+		case 't':
+		case 'r':
+			mode = opt;
+			break;
+		case 'n':
+			count = strtol(optarg, NULL, 0);
+			break;
+		case 'b':
+			batch = strtol(optarg, NULL, 0);
+			break;
+		case 's':
+			size = strtol(optarg, NULL, 0);
+			break;
+		case 'a':
+			addr = strtol(optarg, NULL, 0);
+			break;
+		case 'q':
+			bypass = 1;
+			break;
+		case 'p':
+			busy_poll_us = strtol(optarg, NULL, 0);
+			break;
+		case 'P':
+			prefer = 1;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (count == -1)
+		count = mode == 'r' ? 0 : 1000;
+	if (count < 0 || batch < 1 || batch > BATCH_MAX || busy_poll_us < 0 ||
+	    (addr != FSK_NO_ADDR && (addr < 0 || addr > 0xff)) ||
+	    size < SEQ_LEN || size + fsk_hdr_len(addr) > FSK_MAX_FRAME) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	/* No ARPHRD type is reserved for FSK netdevs, so globs match any. */
+	ifcache_init(&ifc);
+	ret = ifcache_expand(&ifc, spec, IFC_ANY_TYPE, &ife, 1);
+	ifcache_close(&ifc);
+	if (ret <= 0) {
+		fprintf(stderr, "%s: %s\n", spec, strerror(ret ? -ret : ENODEV));
+		return 1;
+	}
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	struct sockaddr_ll sll;
+	int skt = open_socket(&ife, mode == 't', &sll);
+	if (skt == -1)
+		return 1;
+
+	if (bypass) {
+		int one = 1;
+		if (setsockopt(skt, SOL_PACKET, PACKET_QDISC_BYPASS, &one, sizeof(one)) == -1) {
+			int err = errno;
+			fprintf(stderr, "PACKET_QDISC_BYPASS failed: %s\n", strerror(err));
+			close(skt);
+			return 1;
+		}
+	}
+
+	if (mode == 't')
+		ret = tx_batches(skt, &sll, count, batch, addr, size);
+	else
+		ret = rx_batches(skt, count, batch, addr != FSK_NO_ADDR, busy_poll_us, prefer);
+
+	close(skt);
+	return ret;
+}
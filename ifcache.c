@@ -0,0 +1,361 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fnmatch.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <sys/socket.h>
+
+#include "ifcache.h"
+
+#define IFC_BUF_SIZE	16384
+
+void ifcache_init(struct ifcache *c)
+{
+	memset(c, 0, sizeof(*c));
+	c->fd = -1;
+}
+
+static void apply_link(struct ifcache *c, const struct nlmsghdr *nlh)
+{
+	const struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+	const struct rtattr *rta = IFLA_RTA(ifi);
+	int len = IFLA_PAYLOAD(nlh);
+	const char *name = NULL;
+	struct ifc_entry *e = NULL;
+	unsigned int i;
+
+	for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len))
+		if (rta->rta_type == IFLA_IFNAME)
+			name = RTA_DATA(rta);
+
+	for (i = 0; i < c->n; i++) {
+		if (c->e[i].ifindex == ifi->ifi_index) {
+			e = &c->e[i];
+			break;
+		}
+	}
+
+	if (nlh->nlmsg_type == RTM_DELLINK) {
+		if (e)
+			c->e[i] = c->e[--c->n];
+		return;
+	}
+
+	if (e == NULL) {
+		if (c->n == IFC_MAX)
+			return;
+		e = &c->e[c->n++];
+	}
+	e->ifindex = ifi->ifi_index;
+	e->type = ifi->ifi_type;
+	e->flags = ifi->ifi_flags;
+	if (name)
+		snprintf(e->name, sizeof(e->name), "%s", name);
+}
+
+/* Returns 1 at NLMSG_DONE, 0 to keep reading, or a negative errno. */
+static int parse(struct ifcache *c, const char *buf, ssize_t len)
+{
+	const struct nlmsghdr *nlh = (const struct nlmsghdr *)buf;
+
+	for (; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+		switch (nlh->nlmsg_type) {
+		case NLMSG_DONE:
+			return 1;
+		case NLMSG_ERROR: {
+			const struct nlmsgerr *err = NLMSG_DATA(nlh);
+			if (err->error)
+				return err->error;
+			break;
+		}
+		case RTM_NEWLINK:
+		case RTM_DELLINK:
+			apply_link(c, nlh);
+			break;
+		}
+	}
+	return 0;
+}
+
+int ifcache_refresh(struct ifcache *c)
+{
+	static char buf[IFC_BUF_SIZE];
+	struct {
+		struct nlmsghdr nlh;
+		struct ifinfomsg ifi;
+	} req;
+	ssize_t n;
+	int ret;
+
+	memset(&req, 0, sizeof(req));
+	req.nlh.nlmsg_len = sizeof(req);
+	req.nlh.nlmsg_type = RTM_GETLINK;
+	req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req.nlh.nlmsg_seq = ++c->seq;
+	req.ifi.ifi_family = AF_UNSPEC;
+
+	if (send(c->fd, &req, sizeof(req), 0) == -1)
+		return -errno;
+
+	c->n = 0;
+	do {
+		n = recv(c->fd, buf, sizeof(buf), 0);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		ret = parse(c, buf, n);
+	} while (ret == 0);
+
+	return ret < 0 ? ret : 0;
+}
+
+static void apply_stats(const struct nlmsghdr *nlh, const int *ifindex,
+			struct rtnl_link_stats64 *st, int n)
+{
+	const struct if_stats_msg *ism = NLMSG_DATA(nlh);
+	const struct rtattr *rta = (const void *)((const char *)ism + NLMSG_ALIGN(sizeof(*ism)));
+	int len = nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*ism));
+	int i;
+
+	for (i = 0; i < n; i++)
+		if (ifindex[i] == (int)ism->ifindex)
+			break;
+	if (i == n)
+		return;
+
+	for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		if (rta->rta_type != IFLA_STATS_LINK_64)
+			continue;
+		size_t size = RTA_PAYLOAD(rta);
+		memset(&st[i], 0, sizeof(st[i]));
+		memcpy(&st[i], RTA_DATA(rta), size < sizeof(st[i]) ? size : sizeof(st[i]));
+	}
+}
+
+int ifcache_link_stats(struct ifcache *c, const int *ifindex, struct rtnl_link_stats64 *st,
+		       int n)
+{
+	static char buf[IFC_BUF_SIZE];
+	struct {
+		struct nlmsghdr nlh;
+		struct if_stats_msg ism;
+	} req;
+	const struct nlmsghdr *nlh;
+	ssize_t len;
+
+	memset(&req, 0, sizeof(req));
+	req.nlh.nlmsg_len = sizeof(req);
+	req.nlh.nlmsg_type = RTM_GETSTATS;
+	req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req.nlh.nlmsg_seq = ++c->seq;
+	req.ism.family = AF_UNSPEC;
+	req.ism.filter_mask = IFLA_STATS_FILTER_BIT(IFLA_STATS_LINK_64);
+
+	if (send(c->fd, &req, sizeof(req), 0) == -1)
+		return -errno;
+
+	for (;;) {
+		len = recv(c->fd, buf, sizeof(buf), 0);
+		if (len == -1) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		for (nlh = (const void *)buf; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+			switch (nlh->nlmsg_type) {
+			case NLMSG_DONE:
+				return 0;
+			case NLMSG_ERROR: {
+				const struct nlmsgerr *err = NLMSG_DATA(nlh);
+				if (err->error)
+					return err->error;
+				break;
+			}
+			case RTM_NEWSTATS:
+				apply_stats(nlh, ifindex, st, n);
+				break;
+			case RTM_NEWLINK:
+			case RTM_DELLINK:
+				/* A monitoring socket's notification */
+				apply_link(c, nlh);
+				break;
+			}
+		}
+	}
+}
+
+int ifcache_open(struct ifcache *c, int monitor)
+{
+	struct sockaddr_nl addr;
+	int ret;
+
+	c->fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (c->fd == -1)
+		return -errno;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = monitor ? RTMGRP_LINK : 0;
+	if (bind(c->fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+		ret = -errno;
+		ifcache_close(c);
+		return ret;
+	}
+
+	ret = ifcache_refresh(c);
+	if (ret < 0)
+		ifcache_close(c);
+	return ret;
+}
+
+void ifcache_close(struct ifcache *c)
+{
+	if (c->fd >= 0)
+		close(c->fd);
+	c->fd = -1;
+	c->n = 0;
+}
+
+int ifcache_update(struct ifcache *c)
+{
+	static char buf[IFC_BUF_SIZE];
+	int count = 0;
+
+	if (c->fd < 0)
+		return 0;
+
+	for (;;) {
+		ssize_t n = recv(c->fd, buf, sizeof(buf), MSG_DONTWAIT);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				return count;
+			/* ENOBUFS: notifications were lost, start over. */
+			if (errno == ENOBUFS) {
+				int ret = ifcache_refresh(c);
+				if (ret < 0)
+					return ret;
+				count++;
+				continue;
+			}
+			return -errno;
+		}
+		parse(c, buf, n);
+		count++;
+	}
+}
+
+const struct ifc_entry *ifcache_find(const struct ifcache *c, const char *name)
+{
+	for (unsigned int i = 0; i < c->n; i++)
+		if (strcmp(c->e[i].name, name) == 0)
+			return &c->e[i];
+	return NULL;
+}
+
+const struct ifc_entry *ifcache_find_index(const struct ifcache *c, int ifindex)
+{
+	for (unsigned int i = 0; i < c->n; i++)
+		if (c->e[i].ifindex == ifindex)
+			return &c->e[i];
+	return NULL;
+}
+
+static int by_ifindex(const void *a, const void *b)
+{
+	return ((const struct ifc_entry *)a)->ifindex - ((const struct ifc_entry *)b)->ifindex;
+}
+
+int ifcache_expand(struct ifcache *c, const char *spec, unsigned short type,
+		   struct ifc_entry *out, int max)
+{
+	char pattern[IFNAMSIZ * 2];
+	const char *colon;
+	long limit = max;
+	char *end;
+	int n = 0, ret;
+
+	if (max < 1)
+		return -EINVAL;
+
+	long ifindex = strtol(spec, &end, 10);
+	if (*spec && *end == '\0') {
+		if (ifindex <= 0)
+			return -EINVAL;
+		memset(out, 0, sizeof(*out));
+		snprintf(out->name, sizeof(out->name), "%s", spec);
+		out->ifindex = ifindex;
+		out->type = type;
+		return 1;
+	}
+
+	colon = strchr(spec, ':');
+	if (colon) {
+		limit = strtol(colon + 1, &end, 10);
+		if (limit < 1 || *end != '\0')
+			return -EINVAL;
+		if (limit > max)
+			limit = max;
+	}
+	snprintf(pattern, sizeof(pattern), "%.*s",
+		 colon ? (int)(colon - spec) : (int)strlen(spec), spec);
+
+	if (strcmp(pattern, "all") && !strpbrk(pattern, "*?[")) {
+		if (colon || strlen(pattern) >= IFNAMSIZ)
+			return -EINVAL;
+		memset(out, 0, sizeof(*out));
+		strcpy(out->name, pattern);
+		out->type = type;
+		return 1;
+	}
+
+	if (c->fd < 0) {
+		ret = ifcache_open(c, 0);
+		if (ret < 0)
+			return ret;
+	}
+
+	struct ifc_entry match[IFC_MAX];
+
+	for (unsigned int i = 0; i < c->n; i++) {
+		const struct ifc_entry *e = &c->e[i];
+
+		if (type != IFC_ANY_TYPE && e->type != type)
+			continue;
+		if (strcmp(pattern, "all") && fnmatch(pattern, e->name, 0))
+			continue;
+		match[n++] = *e;
+	}
+
+	/* Removals reshuffle the cache, so count from the lowest ifindex. */
+	qsort(match, n, sizeof(*match), by_ifindex);
+	if (n > limit)
+		n = limit;
+	memcpy(out, match, n * sizeof(*out));
+	return n;
+}
+
+int ifcache_expand_list(struct ifcache *c, const char *const *specs, int nspecs,
+			unsigned short type, struct ifc_entry *out, int max)
+{
+	int n = 0;
+
+	for (int i = 0; i < nspecs; i++) {
+		if (n == max)
+			return -E2BIG;
+		int ret = ifcache_expand(c, specs[i], type, out + n, max - n);
+		if (ret < 0)
+			return ret;
+		if (ret == 0)
+			return -ENODEV;
+		n += ret;
+	}
+	return n;
+}
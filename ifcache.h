@@ -0,0 +1,79 @@
+#ifndef IFCACHE_H
+#define IFCACHE_H
+
+#include <stdint.h>
+#include <net/if.h>
+#include <linux/if_link.h>
+
+/*
+ * Netdev name/ifindex/ARPHRD cache filled by one RTM_GETLINK dump on a
+ * raw rtnetlink socket. With monitor set, the socket also joins the link
+ * multicast group, and ifcache_update() applies the RTM_NEWLINK and
+ * RTM_DELLINK notifications queued since.
+ */
+
+#define IFC_MAX		64
+
+#ifndef ARPHRD_LORA
+#define ARPHRD_LORA	827
+#endif
+#ifndef ARPHRD_ENOCEAN
+#define ARPHRD_ENOCEAN	832
+#endif
+
+#define IFC_ANY_TYPE	0xffff
+
+struct ifc_entry {
+	char name[IFNAMSIZ];
+	int ifindex;		/* 0 if not resolved yet */
+	unsigned short type;
+	unsigned int flags;
+};
+
+struct ifcache {
+	int fd;			/* -1 until opened */
+	uint32_t seq;
+	unsigned int n;
+	struct ifc_entry e[IFC_MAX];
+};
+
+void ifcache_init(struct ifcache *c);
+int ifcache_open(struct ifcache *c, int monitor);
+void ifcache_close(struct ifcache *c);
+
+/* Re-dumps every link. */
+int ifcache_refresh(struct ifcache *c);
+/* Applies queued link notifications without blocking; returns how many. */
+int ifcache_update(struct ifcache *c);
+
+/*
+ * Fills st[i] with the netdev counters of ifindex[i], from one
+ * RTM_GETSTATS dump; entries whose link is gone are left as they were.
+ */
+int ifcache_link_stats(struct ifcache *c, const int *ifindex, struct rtnl_link_stats64 *st,
+		       int n);
+
+const struct ifc_entry *ifcache_find(const struct ifcache *c, const char *name);
+const struct ifc_entry *ifcache_find_index(const struct ifcache *c, int ifindex);
+
+/*
+ * Expands one interface argument into up to max entries:
+ *
+ *   lora0     that name; ifindex stays 0 so the caller's own socket can
+ *             resolve it, no netlink round trip is made
+ *   5         ifindex 5, used as is
+ *   lora*     every netdev of the given type matching the glob
+ *   all       every netdev of the given type
+ *
+ * A glob or "all" may end in ":count" to take only the first count
+ * matches. Only globs and "all" open the cache. Returns the number of
+ * entries, or a negative errno.
+ */
+int ifcache_expand(struct ifcache *c, const char *spec, unsigned short type,
+		   struct ifc_entry *out, int max);
+
+/* Expands several arguments; a glob that matches nothing is -ENODEV. */
+int ifcache_expand_list(struct ifcache *c, const char *const *specs, int nspecs,
+			unsigned short type, struct ifc_entry *out, int max);
+
+#endif
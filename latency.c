@@ -0,0 +1,104 @@
+#include <string.h>
+
+#include "latency.h"
+
+#define LAT_SUB_COUNT	(1U << LAT_SUB_BITS)
+
+static unsigned int lat_bucket(uint64_t v)
+{
+	if (v < LAT_SUB_COUNT)
+		return v;
+
+	unsigned int msb = 63 - __builtin_clzll(v);
+	unsigned int shift = msb - LAT_SUB_BITS;
+
+	return ((shift + 1) << LAT_SUB_BITS) + ((v >> shift) & (LAT_SUB_COUNT - 1));
+}
+
+static uint64_t lat_bucket_upper(unsigned int idx)
+{
+	if (idx < LAT_SUB_COUNT)
+		return idx;
+
+	unsigned int shift = (idx >> LAT_SUB_BITS) - 1;
+	uint64_t lower = (uint64_t)(LAT_SUB_COUNT + (idx & (LAT_SUB_COUNT - 1))) << shift;
+
+	return lower + ((1ULL << shift) - 1);
+}
+
+void lat_hist_init(struct lat_hist *h)
+{
+	memset(h, 0, sizeof(*h));
+	h->min = UINT64_MAX;
+}
+
+void lat_hist_add(struct lat_hist *h, uint64_t ns)
+{
+	h->buckets[lat_bucket(ns)]++;
+	h->count++;
+	h->sum += ns;
+	if (ns < h->min)
+		h->min = ns;
+	if (ns > h->max)
+		h->max = ns;
+}
+
+void lat_hist_merge(struct lat_hist *dst, const struct lat_hist *src)
+{
+	for (unsigned int i = 0; i < LAT_BUCKETS; i++)
+		dst->buckets[i] += src->buckets[i];
+	dst->count += src->count;
+	dst->sum += src->sum;
+	if (src->min < dst->min)
+		dst->min = src->min;
+	if (src->max > dst->max)
+		dst->max = src->max;
+}
+
+uint64_t lat_hist_quantile(const struct lat_hist *h, double q)
+{
+	uint64_t target, seen = 0;
+
+	if (h->count == 0)
+		return 0;
+
+	target = (uint64_t)(q * h->count + 0.5);
+	if (target < 1)
+		target = 1;
+
+	for (unsigned int i = 0; i < LAT_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen >= target) {
+			uint64_t v = lat_bucket_upper(i);
+			return v > h->max ? h->max : v;
+		}
+	}
+
+	return h->max;
+}
+
+uint64_t lat_hist_count_le(const struct lat_hist *h, uint64_t ns)
+{
+	uint64_t n = 0;
+
+	for (unsigned int i = 0; i < LAT_BUCKETS && lat_bucket_upper(i) <= ns; i++)
+		n += h->buckets[i];
+	return n;
+}
+
+void lat_hist_print(FILE *f, const char *ifname, const char *stage,
+		    const struct lat_hist *h)
+{
+	if (h->count == 0) {
+		fprintf(f, "%s %s count 0\n", ifname, stage);
+		return;
+	}
+
+	fprintf(f, "%s %s count %llu min %.1f avg %.1f p50 %.1f p99 %.1f p999 %.1f max %.1f us\n",
+		ifname, stage, (unsigned long long)h->count,
+		h->min / 1e3, (double)h->sum / h->count / 1e3,
+		lat_hist_quantile(h, 0.50) / 1e3,
+		lat_hist_quantile(h, 0.99) / 1e3,
+		lat_hist_quantile(h, 0.999) / 1e3,
+		h->max / 1e3);
+}
@@ -0,0 +1,39 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Log-linear latency histogram.
+ *
+ * Values below 2^LAT_SUB_BITS are counted exactly; above that every
+ * power of two is split into 2^LAT_SUB_BITS buckets, giving about 6%
+ * worst-case resolution over the full 64-bit range in a fixed 8 KiB.
+ */
+#define LAT_SUB_BITS	4
+#define LAT_BUCKETS	(64 << LAT_SUB_BITS)
+
+struct lat_hist {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+	uint64_t buckets[LAT_BUCKETS];
+};
+
+void lat_hist_init(struct lat_hist *h);
+void lat_hist_add(struct lat_hist *h, uint64_t ns);
+void lat_hist_merge(struct lat_hist *dst, const struct lat_hist *src);
+
+/* Returns the upper bound of the bucket holding quantile q (0..1). */
+uint64_t lat_hist_quantile(const struct lat_hist *h, double q);
+
+/* Values counted in buckets that end at or below ns, for cumulative exports. */
+uint64_t lat_hist_count_le(const struct lat_hist *h, uint64_t ns);
+
+/* One line per histogram: "<ifname> <stage> count ... p50 ... p99 ... p999 ..." */
+void lat_hist_print(FILE *f, const char *ifname, const char *stage,
+		    const struct lat_hist *h);
+
+#endif
@@ -0,0 +1,335 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "liblorad.h"
+
+static int recv_hello(struct lorad_client *c, struct lorad_hello *h, int fds[3])
+{
+	char control[CMSG_SPACE(3 * sizeof(int))];
+	struct iovec iov = { .iov_base = h, .iov_len = sizeof(*h) };
+	struct msghdr mh = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control,
+		.msg_controllen = sizeof(control),
+	};
+	struct cmsghdr *cmsg;
+	int nfds = 0;
+	ssize_t n;
+
+	n = recvmsg(c->fd, &mh, MSG_CMSG_CLOEXEC);
+	if (n == -1)
+		return -errno;
+
+	for (cmsg = CMSG_FIRSTHDR(&mh); cmsg != NULL; cmsg = CMSG_NXTHDR(&mh, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+			nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			if (nfds > 3)
+				nfds = 3;
+			memcpy(fds, CMSG_DATA(cmsg), nfds * sizeof(int));
+		}
+	}
+
+	if (n != sizeof(*h))
+		return -EPROTO;
+	return nfds;
+}
+
+static int map_ring(struct lorad_client *c, uint32_t nslots, int memfd)
+{
+	struct lorad_shm *shm;
+
+	if (nslots == 0 || (nslots & (nslots - 1)))
+		return -EPROTO;
+
+	shm = mmap(NULL, lorad_shm_size(nslots), PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+	if (shm == MAP_FAILED)
+		return -errno;
+	if (shm->magic != LORAD_MAGIC || shm->version != LORAD_VERSION ||
+	    shm->nslots != nslots || shm->slot_size != sizeof(struct lorad_slot)) {
+		munmap(shm, lorad_shm_size(nslots));
+		return -EPROTO;
+	}
+
+	c->shm = shm;
+	c->mask = nslots - 1;
+	c->head = atomic_load_explicit(&shm->head, memory_order_relaxed);
+	c->tail_cache = atomic_load_explicit(&shm->tail, memory_order_acquire);
+	c->pending = 0;
+	return 0;
+}
+
+int lorad_connect(struct lorad_client *c, const char *path, int flags)
+{
+	struct sockaddr_un addr;
+	struct lorad_req req;
+	struct lorad_hello h;
+	int fds[3] = { -1, -1, -1 };
+	int ret;
+
+	memset(c, 0, sizeof(*c));
+	c->doorbell = -1;
+	c->credit = -1;
+
+	if (path == NULL)
+		path = LORAD_SOCK_PATH;
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return -ENAMETOOLONG;
+
+	c->fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (c->fd == -1)
+		return -errno;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	if (connect(c->fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+		ret = -errno;
+		goto err;
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.op = LORAD_OP_HELLO;
+	req.flags = flags;
+	if (send(c->fd, &req, sizeof(req), 0) == -1) {
+		ret = -errno;
+		goto err;
+	}
+
+	ret = recv_hello(c, &h, fds);
+	if (ret < 0)
+		goto err;
+	if (h.err) {
+		ret = h.err;
+		goto err;
+	}
+	if (h.version != LORAD_VERSION || h.nports > LORAD_MAX_PORTS) {
+		ret = -EPROTO;
+		goto err;
+	}
+
+	c->nports = h.nports;
+	memcpy(c->ports, h.ports, sizeof(c->ports));
+	for (int i = 0; i < c->nports; i++)
+		c->ports[i][IFNAMSIZ - 1] = '\0';
+
+	if (flags & LORAD_HELLO_SHM) {
+		if (ret != 3) {
+			ret = -EPROTO;
+			goto err;
+		}
+		ret = map_ring(c, h.nslots, fds[0]);
+		if (ret < 0)
+			goto err;
+		close(fds[0]);
+		c->doorbell = fds[1];
+		c->credit = fds[2];
+	}
+	return 0;
+
+err:
+	for (int i = 0; i < 3; i++)
+		if (fds[i] != -1)
+			close(fds[i]);
+	close(c->fd);
+	c->fd = -1;
+	return ret;
+}
+
+void lorad_close(struct lorad_client *c)
+{
+	if (c->shm)
+		munmap(c->shm, lorad_shm_size(c->mask + 1));
+	if (c->doorbell != -1)
+		close(c->doorbell);
+	if (c->credit != -1)
+		close(c->credit);
+	if (c->fd != -1)
+		close(c->fd);
+	c->shm = NULL;
+	c->doorbell = c->credit = c->fd = -1;
+}
+
+int lorad_port(const struct lorad_client *c, const char *ifname)
+{
+	for (int i = 0; i < c->nports; i++)
+		if (strcmp(c->ports[i], ifname) == 0)
+			return i;
+	return -ENODEV;
+}
+
+uint32_t lorad_avail(struct lorad_client *c)
+{
+	uint32_t size = c->mask + 1;
+	uint32_t used = c->head + c->pending - c->tail_cache;
+
+	if (c->shm == NULL)
+		return 0;
+	if (used == size) {
+		c->tail_cache = atomic_load_explicit(&c->shm->tail, memory_order_acquire);
+		used = c->head + c->pending - c->tail_cache;
+	}
+	return size - used;
+}
+
+struct lorad_slot *lorad_slot(struct lorad_client *c, uint32_t i)
+{
+	return &c->shm->slots[(c->head + c->pending + i) & c->mask];
+}
+
+int lorad_commit(struct lorad_client *c, uint32_t n)
+{
+	uint64_t one = 1;
+
+	if (c->shm == NULL)
+		return 0;
+
+	n += c->pending;
+	if (n == 0)
+		return 0;
+	c->head += n;
+	c->pending = 0;
+	atomic_store_explicit(&c->shm->head, c->head, memory_order_release);
+
+	if (write(c->doorbell, &one, sizeof(one)) == -1 && errno != EAGAIN)
+		return -errno;
+	return 0;
+}
+
+int lorad_submit_at(struct lorad_client *c, int port, const void *data, unsigned int len,
+		    uint64_t at_ns, int rx2_port, uint64_t rx2_at_ns)
+{
+	if (port < 0 || port >= c->nports || (rx2_at_ns && (rx2_port < 0 || rx2_port >= c->nports)))
+		return -ENODEV;
+	if (len > LORAD_FRAME_MAX)
+		return -EMSGSIZE;
+
+	if (c->shm == NULL) {
+		struct lorad_req req = {
+			.op = LORAD_OP_SEND,
+			.port = port,
+			.len = len,
+			.rx2_port = rx2_at_ns ? rx2_port : 0,
+			.at_ns = at_ns,
+			.rx2_at_ns = rx2_at_ns,
+		};
+		struct iovec iov[2] = {
+			{ .iov_base = &req, .iov_len = sizeof(req) },
+			{ .iov_base = (void *)data, .iov_len = len },
+		};
+		struct msghdr mh = { .msg_iov = iov, .msg_iovlen = 2 };
+
+		if (sendmsg(c->fd, &mh, MSG_DONTWAIT) == -1)
+			return errno == EWOULDBLOCK ? -EAGAIN : -errno;
+		return 0;
+	}
+
+	if (lorad_avail(c) == 0)
+		return -EAGAIN;
+
+	struct lorad_slot *s = lorad_slot(c, 0);
+	s->port = port;
+	s->len = len;
+	s->rx2_port = rx2_at_ns ? rx2_port : 0;
+	s->at_ns = at_ns;
+	s->rx2_at_ns = rx2_at_ns;
+	memcpy(s->data, data, len);
+	c->pending++;
+	return 0;
+}
+
+int lorad_submit(struct lorad_client *c, int port, const void *data, unsigned int len)
+{
+	return lorad_submit_at(c, port, data, len, 0, 0, 0);
+}
+
+int lorad_wait(struct lorad_client *c, int timeout_ms)
+{
+	struct pollfd pfd;
+	uint64_t val;
+	int ret;
+
+	if (c->shm == NULL) {
+		pfd.fd = c->fd;
+		pfd.events = POLLOUT;
+		ret = poll(&pfd, 1, timeout_ms);
+		return ret == -1 ? -errno : 0;
+	}
+
+	/* Slots still pending would never be freed. */
+	ret = lorad_commit(c, 0);
+	if (ret < 0)
+		return ret;
+
+	/*
+	 * Announce the wait before the last look at tail, so that lorad
+	 * either sees need_wakeup or we see its tail update.
+	 */
+	atomic_store(&c->shm->need_wakeup, 1);
+	c->tail_cache = atomic_load(&c->shm->tail);
+	if (c->head - c->tail_cache <= c->mask) {
+		atomic_store(&c->shm->need_wakeup, 0);
+		return 0;
+	}
+
+	pfd.fd = c->credit;
+	pfd.events = POLLIN;
+	ret = poll(&pfd, 1, timeout_ms);
+	if (ret == -1)
+		return -errno;
+	if (ret > 0 && read(c->credit, &val, sizeof(val)) == -1 && errno != EAGAIN)
+		return -errno;
+	return 0;
+}
+
+static uint64_t mono_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int lorad_flush(struct lorad_client *c, int timeout_ms)
+{
+	uint64_t deadline = mono_ms() + timeout_ms;
+	struct pollfd pfd;
+	uint64_t val;
+	int ret;
+
+	if (c->shm == NULL)
+		return 0;
+
+	ret = lorad_commit(c, 0);
+	if (ret < 0)
+		return ret;
+
+	for (;;) {
+		atomic_store(&c->shm->need_wakeup, 1);
+		c->tail_cache = atomic_load(&c->shm->tail);
+		if (c->tail_cache == c->head) {
+			atomic_store(&c->shm->need_wakeup, 0);
+			return 0;
+		}
+
+		uint64_t t = mono_ms();
+		if (t >= deadline)
+			return -ETIMEDOUT;
+
+		pfd.fd = c->credit;
+		pfd.events = POLLIN;
+		ret = poll(&pfd, 1, deadline - t);
+		if (ret == -1 && errno != EINTR)
+			return -errno;
+		if (ret > 0 && read(c->credit, &val, sizeof(val)) == -1 && errno != EAGAIN)
+			return -errno;
+	}
+}
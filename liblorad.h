@@ -0,0 +1,60 @@
+#ifndef LIBLORAD_H
+#define LIBLORAD_H
+
+#include <stdint.h>
+
+#include "lorad.h"
+
+/*
+ * lorad client.
+ *
+ * With LORAD_HELLO_SHM, frames are written straight into slots of the
+ * shared TX ring: lorad_slot() hands out the i-th free slot, the caller
+ * fills port, len and data, and lorad_commit() publishes n slots and
+ * rings the doorbell once. lorad_submit() copies one frame into the
+ * next slot, and the next lorad_commit() publishes it too. Without
+ * shared memory, lorad_submit() sends one LORAD_OP_SEND message per
+ * frame and lorad_commit() does nothing.
+ *
+ * Functions return 0 (or a non-negative value) on success and a negative
+ * errno value on failure. A client is not thread-safe.
+ */
+
+struct lorad_client {
+	int fd;
+	int nports;
+	char ports[LORAD_MAX_PORTS][IFNAMSIZ];
+
+	/* Shared memory only. */
+	struct lorad_shm *shm;
+	int doorbell;
+	int credit;
+	uint32_t mask;
+	uint32_t head;
+	uint32_t tail_cache;
+	uint32_t pending;	/* queued by lorad_submit(), not committed */
+};
+
+int lorad_connect(struct lorad_client *c, const char *path, int flags);
+void lorad_close(struct lorad_client *c);
+
+/* Port number of the daemon interface called ifname, or -ENODEV. */
+int lorad_port(const struct lorad_client *c, const char *ifname);
+
+/* Free TX slots; with shared memory only. */
+uint32_t lorad_avail(struct lorad_client *c);
+struct lorad_slot *lorad_slot(struct lorad_client *c, uint32_t i);
+int lorad_commit(struct lorad_client *c, uint32_t n);
+
+/* -EAGAIN when the ring is full. */
+int lorad_submit(struct lorad_client *c, int port, const void *data, unsigned int len);
+/* Sends at at_ns, else at rx2_at_ns on rx2_port; see lorad.h. */
+int lorad_submit_at(struct lorad_client *c, int port, const void *data, unsigned int len,
+		    uint64_t at_ns, int rx2_port, uint64_t rx2_at_ns);
+
+/* Waits up to timeout_ms for lorad to free TX slots. */
+int lorad_wait(struct lorad_client *c, int timeout_ms);
+/* Waits until lorad has taken every committed slot. */
+int lorad_flush(struct lorad_client *c, int timeout_ms);
+
+#endif
@@ -0,0 +1,808 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/socket.h>
+#include <net/if.h>
+
+#include <netlink/netlink.h>
+#include <netlink/genl/genl.h>
+#include <netlink/genl/ctrl.h>
+
+#include "include/linux/lora.h"
+#include "include/linux/nllora.h"
+#include "ifcache.h"
+#include "libnllora.h"
+
+#define MSG_POOL_SIZE	8
+#define BATCH_BUF_SIZE	8192
+
+/*
+ * The set command and its SF, BW, TX_POWER and SYNC_WORD attributes are
+ * not in the nllora uapi yet. The Makefile defines HAVE_NLLORA_SET once
+ * nllora.h has them. NLLORA_SET_PROPOSED builds against the numbers they
+ * are proposed with, following the existing ones, for kernels carrying
+ * that patch. Without either, the set calls fail with -EOPNOTSUPP.
+ */
+#if defined(NLLORA_SET_PROPOSED) && !defined(HAVE_NLLORA_SET)
+enum {
+	NLLORA_ATTR_SF = NLLORA_ATTR_FREQ + 1,
+	NLLORA_ATTR_BW,
+	NLLORA_ATTR_TX_POWER,
+	NLLORA_ATTR_SYNC_WORD,
+};
+
+enum {
+	NLLORA_CMD_SET_PARAMS = NLLORA_CMD_GET_FREQ + 1,
+};
+
+#define HAVE_NLLORA_SET
+#endif
+
+struct nllora_client {
+	struct nl_sock *sk;
+	struct nl_cb *cb;
+	int family_id;
+
+	struct nl_msg *pool[MSG_POOL_SIZE];
+	unsigned int pool_busy;
+
+	struct ifcache ifc;	/* opened on first use, follows RTM_NEWLINK/DELLINK */
+
+	struct nl_sock *ev_sk;
+	struct nl_cb *ev_cb;
+	nllora_event_cb_t ev_fn;
+	void *ev_arg;
+
+	int dump_unsupported;
+	unsigned char batch_buf[BATCH_BUF_SIZE];
+};
+
+struct freq_reply {
+	int err;
+	int done;
+	uint32_t freq;
+};
+
+struct dump_ctx {
+	struct nllora_ifinfo *info;
+	unsigned int max;
+	unsigned int n;
+	unsigned int expected;	/* pipelined mode: number of requests sent */
+	int by_ifindex;		/* NLM_F_DUMP mode: entries come from the reply */
+	int err;
+	int done;
+};
+
+static struct nla_policy my_policy[NLLORA_ATTR_MAX + 1] = {
+	[NLLORA_ATTR_IFINDEX] = { .type = NLA_U32 },
+	[NLLORA_ATTR_FREQ] = { .type = NLA_U32 },
+};
+
+static int nlerr_to_errno(int nlerr)
+{
+	switch (nlerr < 0 ? -nlerr : nlerr) {
+	case NLE_NOMEM:
+		return -ENOMEM;
+	case NLE_OBJ_NOTFOUND:
+		return -ENOENT;
+	case NLE_AGAIN:
+		return -EAGAIN;
+	case NLE_INTR:
+		return -EINTR;
+	case NLE_OPNOTSUPP:
+		return -EOPNOTSUPP;
+	case NLE_INVAL:
+		return -EINVAL;
+	default:
+		return -EIO;
+	}
+}
+
+static int seq_check(struct nl_msg *msg, void *arg)
+{
+	return NL_OK;
+}
+
+static int error_handler(struct sockaddr_nl *nla, struct nlmsgerr *nlerr, void *arg)
+{
+	struct freq_reply *reply = arg;
+
+	reply->err = nlerr->error;
+	reply->done = 1;
+	return NL_STOP;
+}
+
+static int freq_handler(struct nl_msg *msg, void *arg)
+{
+	struct freq_reply *reply = arg;
+	struct nlattr *attr[NLLORA_ATTR_MAX + 1];
+	int ret;
+
+	ret = genlmsg_parse(nlmsg_hdr(msg), 0, attr, NLLORA_ATTR_MAX, my_policy);
+	if (ret < 0) {
+		reply->err = nlerr_to_errno(ret);
+	} else if (attr[NLLORA_ATTR_FREQ]) {
+		reply->freq = nla_get_u32(attr[NLLORA_ATTR_FREQ]);
+		reply->err = 0;
+	} else {
+		reply->err = -ENODATA;
+	}
+	reply->done = 1;
+
+	return NL_OK;
+}
+
+static int dump_handler(struct nl_msg *msg, void *arg)
+{
+	struct dump_ctx *ctx = arg;
+	struct nlattr *attr[NLLORA_ATTR_MAX + 1];
+	struct nllora_ifinfo *info;
+	int ret;
+
+	ret = genlmsg_parse(nlmsg_hdr(msg), 0, attr, NLLORA_ATTR_MAX, my_policy);
+
+	if (ctx->by_ifindex) {
+		if (ret < 0 || !attr[NLLORA_ATTR_IFINDEX] || ctx->n >= ctx->max)
+			return NL_SKIP;
+		info = &ctx->info[ctx->n++];
+		memset(info, 0, sizeof(*info));
+		info->ifindex = nla_get_u32(attr[NLLORA_ATTR_IFINDEX]);
+		if (if_indextoname(info->ifindex, info->name) == NULL)
+			info->name[0] = '\0';
+	} else {
+		if (ctx->n >= ctx->expected)
+			return NL_SKIP;
+		/* Replies arrive in request order. */
+		info = &ctx->info[ctx->n++];
+		if (ctx->n == ctx->expected)
+			ctx->done = 1;
+	}
+
+	if (ret < 0)
+		info->err = nlerr_to_errno(ret);
+	else if (attr[NLLORA_ATTR_FREQ])
+		info->freq = nla_get_u32(attr[NLLORA_ATTR_FREQ]);
+	else
+		info->err = -ENODATA;
+
+	return NL_OK;
+}
+
+static int dump_error(struct sockaddr_nl *nla, struct nlmsgerr *nlerr, void *arg)
+{
+	struct dump_ctx *ctx = arg;
+
+	if (ctx->by_ifindex) {
+		ctx->err = nlerr->error;
+		ctx->done = 1;
+		return NL_STOP;
+	}
+
+	if (ctx->n < ctx->expected)
+		ctx->info[ctx->n++].err = nlerr->error;
+	if (ctx->n == ctx->expected)
+		ctx->done = 1;
+	return NL_SKIP;
+}
+
+static int dump_finish(struct nl_msg *msg, void *arg)
+{
+	struct dump_ctx *ctx = arg;
+
+	ctx->done = 1;
+	return NL_STOP;
+}
+
+static struct nl_msg *msg_get(struct nllora_client *c)
+{
+	for (unsigned int i = 0; i < MSG_POOL_SIZE; i++) {
+		if (c->pool_busy & (1U << i))
+			continue;
+		c->pool_busy |= 1U << i;
+
+		/* Rewind to an empty message, keeping the allocated buffer. */
+		struct nlmsghdr *nlh = nlmsg_hdr(c->pool[i]);
+		memset(nlh, 0, NLMSG_HDRLEN);
+		nlh->nlmsg_len = NLMSG_HDRLEN;
+		return c->pool[i];
+	}
+
+	return nlmsg_alloc();
+}
+
+static void msg_put(struct nllora_client *c, struct nl_msg *msg)
+{
+	for (unsigned int i = 0; i < MSG_POOL_SIZE; i++) {
+		if (c->pool[i] == msg) {
+			c->pool_busy &= ~(1U << i);
+			return;
+		}
+	}
+
+	nlmsg_free(msg);
+}
+
+struct nllora_client *nllora_client_open(void)
+{
+	struct nllora_client *c;
+	int ret;
+
+	c = calloc(1, sizeof(*c));
+	if (c == NULL)
+		return NULL;
+	ifcache_init(&c->ifc);
+
+	c->sk = nl_socket_alloc();
+	if (c->sk == NULL)
+		goto err_free;
+
+	ret = genl_connect(c->sk);
+	if (ret < 0)
+		goto err_sock;
+
+	/* Exactly one reply (or error) per request, no trailing ACK to drain. */
+	nl_socket_disable_auto_ack(c->sk);
+
+	c->family_id = genl_ctrl_resolve(c->sk, NLLORA_GENL_NAME);
+	if (c->family_id < 0)
+		goto err_sock;
+
+	c->cb = nl_cb_alloc(NL_CB_DEFAULT);
+	if (c->cb == NULL)
+		goto err_sock;
+	nl_cb_set(c->cb, NL_CB_SEQ_CHECK, NL_CB_CUSTOM, seq_check, NULL);
+
+	for (unsigned int i = 0; i < MSG_POOL_SIZE; i++) {
+		c->pool[i] = nlmsg_alloc();
+		if (c->pool[i] == NULL)
+			goto err_pool;
+	}
+
+	return c;
+
+err_pool:
+	for (unsigned int i = 0; i < MSG_POOL_SIZE; i++)
+		if (c->pool[i])
+			nlmsg_free(c->pool[i]);
+	nl_cb_put(c->cb);
+err_sock:
+	nl_socket_free(c->sk);
+err_free:
+	free(c);
+	return NULL;
+}
+
+void nllora_client_close(struct nllora_client *c)
+{
+	if (c == NULL)
+		return;
+
+	for (unsigned int i = 0; i < MSG_POOL_SIZE; i++)
+		nlmsg_free(c->pool[i]);
+	if (c->ev_sk) {
+		nl_cb_put(c->ev_cb);
+		nl_socket_free(c->ev_sk);
+	}
+	nl_cb_put(c->cb);
+	nl_socket_free(c->sk);
+	ifcache_close(&c->ifc);
+	free(c);
+}
+
+int nllora_family_id(struct nllora_client *c)
+{
+	return c->family_id;
+}
+
+static int ifc_sync(struct nllora_client *c)
+{
+	if (c->ifc.fd < 0)
+		return ifcache_open(&c->ifc, 1);
+	return ifcache_update(&c->ifc);
+}
+
+int nllora_ifindex(struct nllora_client *c, const char *ifname)
+{
+	const struct ifc_entry *e;
+	int ret;
+
+	if (strlen(ifname) >= IFNAMSIZ)
+		return -EINVAL;
+
+	ret = ifc_sync(c);
+	if (ret < 0)
+		return ret;
+
+	e = ifcache_find(&c->ifc, ifname);
+	return e ? e->ifindex : -ENODEV;
+}
+
+void nllora_ifindex_flush(struct nllora_client *c)
+{
+	if (c->ifc.fd >= 0)
+		ifcache_refresh(&c->ifc);
+}
+
+struct ifcache *nllora_ifcache(struct nllora_client *c)
+{
+	return ifc_sync(c) < 0 ? NULL : &c->ifc;
+}
+
+int nllora_get_freq(struct nllora_client *c, int ifindex, uint32_t *freq)
+{
+	struct freq_reply reply = { .err = -EIO };
+	struct nl_msg *msg;
+	int ret;
+
+	msg = msg_get(c);
+	if (msg == NULL)
+		return -ENOMEM;
+
+	if (genlmsg_put(msg, NL_AUTO_PID, NL_AUTO_SEQ, c->family_id, 0,
+			NLM_F_REQUEST, NLLORA_CMD_GET_FREQ, 0) == NULL) {
+		ret = -ENOBUFS;
+		goto out;
+	}
+
+	ret = nla_put_u32(msg, NLLORA_ATTR_IFINDEX, ifindex);
+	if (ret < 0) {
+		ret = nlerr_to_errno(ret);
+		goto out;
+	}
+
+	ret = nl_send_auto(c->sk, msg);
+	if (ret < 0) {
+		ret = nlerr_to_errno(ret);
+		goto out;
+	}
+
+	nl_cb_set(c->cb, NL_CB_VALID, NL_CB_CUSTOM, freq_handler, &reply);
+	nl_cb_err(c->cb, NL_CB_CUSTOM, error_handler, &reply);
+
+	while (!reply.done) {
+		ret = nl_recvmsgs(c->sk, c->cb);
+		if (ret < 0 && !reply.done) {
+			reply.err = nlerr_to_errno(ret);
+			break;
+		}
+	}
+
+	ret = reply.err;
+	if (ret == 0)
+		*freq = reply.freq;
+out:
+	msg_put(c, msg);
+	return ret;
+}
+
+/*
+ * Appends a completed request to the batch buffer. Requests queued this
+ * way reach the kernel in a single sendmsg(), which genl processes in
+ * order and answers in the same order.
+ */
+static int batch_add(struct nllora_client *c, size_t *len, struct nl_msg *msg)
+{
+	struct nlmsghdr *nlh;
+	size_t msg_len;
+	int ret;
+
+	nl_complete_msg(c->sk, msg);
+	nlh = nlmsg_hdr(msg);
+	msg_len = NLMSG_ALIGN(nlh->nlmsg_len);
+
+	if (*len + msg_len > BATCH_BUF_SIZE) {
+		ret = nl_sendto(c->sk, c->batch_buf, *len);
+		if (ret < 0)
+			return nlerr_to_errno(ret);
+		*len = 0;
+	}
+
+	memcpy(c->batch_buf + *len, nlh, nlh->nlmsg_len);
+	memset(c->batch_buf + *len + nlh->nlmsg_len, 0, msg_len - nlh->nlmsg_len);
+	*len += msg_len;
+
+	return 0;
+}
+
+static int batch_flush(struct nllora_client *c, size_t len)
+{
+	int ret;
+
+	if (len == 0)
+		return 0;
+
+	ret = nl_sendto(c->sk, c->batch_buf, len);
+	return ret < 0 ? nlerr_to_errno(ret) : 0;
+}
+
+static int dump_recv(struct nllora_client *c, struct dump_ctx *ctx)
+{
+	int ret;
+
+	nl_cb_set(c->cb, NL_CB_VALID, NL_CB_CUSTOM, dump_handler, ctx);
+	nl_cb_set(c->cb, NL_CB_FINISH, NL_CB_CUSTOM, dump_finish, ctx);
+	nl_cb_err(c->cb, NL_CB_CUSTOM, dump_error, ctx);
+
+	while (!ctx->done) {
+		ret = nl_recvmsgs(c->sk, c->cb);
+		if (ret < 0 && !ctx->done) {
+			ctx->err = nlerr_to_errno(ret);
+			break;
+		}
+	}
+
+	nl_cb_set(c->cb, NL_CB_FINISH, NL_CB_DEFAULT, NULL, NULL);
+
+	return ctx->err;
+}
+
+static int dump_multipart(struct nllora_client *c, struct nllora_ifinfo *info, unsigned int max)
+{
+	struct dump_ctx ctx = { .info = info, .max = max, .by_ifindex = 1 };
+	struct nl_msg *msg;
+	int ret;
+
+	msg = msg_get(c);
+	if (msg == NULL)
+		return -ENOMEM;
+
+	if (genlmsg_put(msg, NL_AUTO_PID, NL_AUTO_SEQ, c->family_id, 0,
+			NLM_F_REQUEST | NLM_F_DUMP, NLLORA_CMD_GET_FREQ, 0) == NULL) {
+		msg_put(c, msg);
+		return -ENOBUFS;
+	}
+
+	ret = nl_send_auto(c->sk, msg);
+	msg_put(c, msg);
+	if (ret < 0)
+		return nlerr_to_errno(ret);
+
+	ret = dump_recv(c, &ctx);
+	return ret < 0 ? ret : (int)ctx.n;
+}
+
+static int list_lora_ifaces(struct nllora_client *c, struct nllora_ifinfo *info, unsigned int max)
+{
+	unsigned int n = 0;
+	int ret;
+
+	ret = ifc_sync(c);
+	if (ret < 0)
+		return ret;
+
+	for (unsigned int i = 0; i < c->ifc.n && n < max; i++) {
+		const struct ifc_entry *e = &c->ifc.e[i];
+
+		if (e->type != ARPHRD_LORA)
+			continue;
+		memset(&info[n], 0, sizeof(info[n]));
+		strcpy(info[n].name, e->name);
+		info[n].ifindex = e->ifindex;
+		n++;
+	}
+
+	return n;
+}
+
+static int dump_pipelined(struct nllora_client *c, struct nllora_ifinfo *info, unsigned int max)
+{
+	struct dump_ctx ctx = { .info = info, .max = max };
+	struct nl_msg *msg;
+	size_t len = 0;
+	int n, ret;
+
+	n = list_lora_ifaces(c, info, max);
+	if (n <= 0)
+		return n;
+
+	for (int i = 0; i < n; i++) {
+		msg = msg_get(c);
+		if (msg == NULL)
+			return -ENOMEM;
+
+		if (genlmsg_put(msg, NL_AUTO_PID, NL_AUTO_SEQ, c->family_id, 0,
+				NLM_F_REQUEST, NLLORA_CMD_GET_FREQ, 0) == NULL) {
+			msg_put(c, msg);
+			return -ENOBUFS;
+		}
+		ret = nla_put_u32(msg, NLLORA_ATTR_IFINDEX, info[i].ifindex);
+		if (ret < 0) {
+			msg_put(c, msg);
+			return nlerr_to_errno(ret);
+		}
+
+		ret = batch_add(c, &len, msg);
+		msg_put(c, msg);
+		if (ret < 0)
+			return ret;
+	}
+
+	ret = batch_flush(c, len);
+	if (ret < 0)
+		return ret;
+
+	ctx.expected = n;
+	ret = dump_recv(c, &ctx);
+	return ret < 0 ? ret : n;
+}
+
+int nllora_dump(struct nllora_client *c, struct nllora_ifinfo *info, unsigned int max)
+{
+	int ret;
+
+	if (!c->dump_unsupported) {
+		ret = dump_multipart(c, info, max);
+		if (ret != -EOPNOTSUPP)
+			return ret;
+		/* No dumpit handler in this kernel, don't ask again. */
+		c->dump_unsupported = 1;
+	}
+
+	return dump_pipelined(c, info, max);
+}
+
+#ifdef HAVE_NLLORA_SET
+struct set_ctx {
+	struct nllora_params *p;
+	unsigned int n;
+	uint32_t first_seq;	/* request i has first_seq + i */
+	int done;
+	int err;
+};
+
+static struct nllora_params *set_entry(struct set_ctx *ctx, uint32_t seq)
+{
+	uint32_t i = seq - ctx->first_seq;
+
+	return i < ctx->n ? &ctx->p[i] : NULL;
+}
+
+/* Errors arrive for each failed request, the ACK only for the last. */
+static int set_error(struct sockaddr_nl *nla, struct nlmsgerr *nlerr, void *arg)
+{
+	struct set_ctx *ctx = arg;
+	struct nllora_params *e = set_entry(ctx, nlerr->msg.nlmsg_seq);
+
+	if (e)
+		e->err = nlerr->error;
+	if (e == &ctx->p[ctx->n - 1] || e == NULL)
+		ctx->done = 1;
+	return NL_SKIP;
+}
+
+static int set_ack(struct nl_msg *msg, void *arg)
+{
+	struct set_ctx *ctx = arg;
+
+	ctx->done = 1;
+	return NL_STOP;
+}
+
+static int set_put(struct nllora_client *c, struct nl_msg *msg, const struct nllora_params *p,
+		   unsigned int mask, int ack)
+{
+	int ret = 0;
+
+	if (genlmsg_put(msg, NL_AUTO_PID, NL_AUTO_SEQ, c->family_id, 0,
+			NLM_F_REQUEST | (ack ? NLM_F_ACK : 0), NLLORA_CMD_SET_PARAMS, 0) == NULL)
+		return -ENOBUFS;
+
+	ret = nla_put_u32(msg, NLLORA_ATTR_IFINDEX, p->ifindex);
+	if (ret == 0 && (mask & NLLORA_SET_FREQ))
+		ret = nla_put_u32(msg, NLLORA_ATTR_FREQ, p->freq);
+	if (ret == 0 && (mask & NLLORA_SET_SF))
+		ret = nla_put_u8(msg, NLLORA_ATTR_SF, p->sf);
+	if (ret == 0 && (mask & NLLORA_SET_BW))
+		ret = nla_put_u32(msg, NLLORA_ATTR_BW, p->bw);
+	if (ret == 0 && (mask & NLLORA_SET_TX_POWER))
+		ret = nla_put_u32(msg, NLLORA_ATTR_TX_POWER, (uint32_t)p->tx_power);
+	if (ret == 0 && (mask & NLLORA_SET_SYNC_WORD))
+		ret = nla_put_u8(msg, NLLORA_ATTR_SYNC_WORD, p->sync_word);
+	return ret < 0 ? nlerr_to_errno(ret) : 0;
+}
+
+static int set_recv(struct nllora_client *c, struct set_ctx *ctx)
+{
+	int ret;
+
+	nl_cb_set(c->cb, NL_CB_VALID, NL_CB_CUSTOM, seq_check, NULL);
+	nl_cb_set(c->cb, NL_CB_ACK, NL_CB_CUSTOM, set_ack, ctx);
+	nl_cb_err(c->cb, NL_CB_CUSTOM, set_error, ctx);
+
+	while (!ctx->done) {
+		ret = nl_recvmsgs(c->sk, c->cb);
+		if (ret < 0 && !ctx->done) {
+			ctx->err = nlerr_to_errno(ret);
+			break;
+		}
+	}
+
+	nl_cb_set(c->cb, NL_CB_ACK, NL_CB_DEFAULT, NULL, NULL);
+
+	if (ctx->err)
+		return ctx->err;
+	for (unsigned int i = 0; i < ctx->n; i++)
+		if (ctx->p[i].err)
+			return ctx->p[i].err;
+	return 0;
+}
+
+int nllora_set(struct nllora_client *c, struct nllora_params *p, unsigned int n)
+{
+	struct set_ctx ctx = { .p = p, .n = n };
+	struct nl_msg *msg;
+	size_t len = 0;
+	int ret;
+
+	if (n == 0)
+		return 0;
+
+	for (unsigned int i = 0; i < n; i++) {
+		p[i].err = 0;
+		msg = msg_get(c);
+		if (msg == NULL)
+			return -ENOMEM;
+
+		ret = set_put(c, msg, &p[i], p[i].mask, i == n - 1);
+		if (ret == 0)
+			ret = batch_add(c, &len, msg);
+		if (i == 0)
+			ctx.first_seq = nlmsg_hdr(msg)->nlmsg_seq;
+		msg_put(c, msg);
+		if (ret < 0)
+			return ret;
+	}
+
+	ret = batch_flush(c, len);
+	if (ret < 0)
+		return ret;
+
+	return set_recv(c, &ctx);
+}
+
+int nllora_set_each(struct nllora_client *c, struct nllora_params *p, unsigned int n)
+{
+	int first_err = 0;
+
+	for (unsigned int i = 0; i < n; i++) {
+		p[i].err = 0;
+		for (unsigned int bit = 1; bit <= NLLORA_SET_SYNC_WORD; bit <<= 1) {
+			struct set_ctx ctx = { .p = &p[i], .n = 1 };
+			struct nl_msg *msg;
+			int ret;
+
+			if (!(p[i].mask & bit))
+				continue;
+
+			msg = msg_get(c);
+			if (msg == NULL)
+				return -ENOMEM;
+			ret = set_put(c, msg, &p[i], bit, 1);
+			if (ret == 0) {
+				nl_complete_msg(c->sk, msg);
+				ctx.first_seq = nlmsg_hdr(msg)->nlmsg_seq;
+				ret = nl_send(c->sk, msg);
+				ret = ret < 0 ? nlerr_to_errno(ret) : 0;
+			}
+			msg_put(c, msg);
+			if (ret < 0)
+				return ret;
+
+			ret = set_recv(c, &ctx);
+			if (ret < 0 && first_err == 0)
+				first_err = ret;
+		}
+	}
+
+	return first_err;
+}
+#else
+static int set_unsupported(struct nllora_params *p, unsigned int n)
+{
+	for (unsigned int i = 0; i < n; i++)
+		p[i].err = -EOPNOTSUPP;
+	return n ? -EOPNOTSUPP : 0;
+}
+
+int nllora_set(struct nllora_client *c, struct nllora_params *p, unsigned int n)
+{
+	return set_unsupported(p, n);
+}
+
+int nllora_set_each(struct nllora_client *c, struct nllora_params *p, unsigned int n)
+{
+	return set_unsupported(p, n);
+}
+#endif
+
+static int event_handler(struct nl_msg *msg, void *arg)
+{
+	struct nllora_client *c = arg;
+	struct nlattr *attr[NLLORA_ATTR_MAX + 1];
+	struct nllora_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.cmd = genlmsg_hdr(nlmsg_hdr(msg))->cmd;
+
+	if (genlmsg_parse(nlmsg_hdr(msg), 0, attr, NLLORA_ATTR_MAX, my_policy) == 0) {
+		if (attr[NLLORA_ATTR_IFINDEX])
+			ev.ifindex = nla_get_u32(attr[NLLORA_ATTR_IFINDEX]);
+		if (attr[NLLORA_ATTR_FREQ]) {
+			ev.has_freq = 1;
+			ev.freq = nla_get_u32(attr[NLLORA_ATTR_FREQ]);
+		}
+	}
+
+	if (c->ev_fn)
+		c->ev_fn(&ev, c->ev_arg);
+
+	return NL_OK;
+}
+
+int nllora_subscribe(struct nllora_client *c, const char *group)
+{
+	int grp, ret;
+
+	if (c->ev_sk == NULL) {
+		c->ev_sk = nl_socket_alloc();
+		if (c->ev_sk == NULL)
+			return -ENOMEM;
+
+		ret = genl_connect(c->ev_sk);
+		if (ret < 0)
+			goto err;
+
+		nl_socket_disable_seq_check(c->ev_sk);
+		ret = nl_socket_set_nonblocking(c->ev_sk);
+		if (ret < 0)
+			goto err;
+
+		c->ev_cb = nl_cb_alloc(NL_CB_DEFAULT);
+		if (c->ev_cb == NULL) {
+			ret = -NLE_NOMEM;
+			goto err;
+		}
+		nl_cb_set(c->ev_cb, NL_CB_SEQ_CHECK, NL_CB_CUSTOM, seq_check, NULL);
+		nl_cb_set(c->ev_cb, NL_CB_VALID, NL_CB_CUSTOM, event_handler, c);
+	}
+
+	/* The request socket resolves, the event socket only listens. */
+	grp = genl_ctrl_resolve_grp(c->sk, NLLORA_GENL_NAME, group);
+	if (grp < 0)
+		return nlerr_to_errno(grp);
+
+	ret = nl_socket_add_membership(c->ev_sk, grp);
+	if (ret < 0)
+		return nlerr_to_errno(ret);
+
+	return 0;
+
+err:
+	nl_socket_free(c->ev_sk);
+	c->ev_sk = NULL;
+	return nlerr_to_errno(ret);
+}
+
+int nllora_event_fd(struct nllora_client *c)
+{
+	return c->ev_sk ? nl_socket_get_fd(c->ev_sk) : -EBADF;
+}
+
+int nllora_event_dispatch(struct nllora_client *c, nllora_event_cb_t fn, void *arg)
+{
+	int ret;
+
+	if (c->ev_sk == NULL)
+		return -EBADF;
+
+	c->ev_fn = fn;
+	c->ev_arg = arg;
+
+	for (;;) {
+		ret = nl_recvmsgs(c->ev_sk, c->ev_cb);
+		if (ret == -NLE_AGAIN)
+			return 0;
+		if (ret < 0)
+			return nlerr_to_errno(ret);
+	}
+}
@@ -0,0 +1,106 @@
+#ifndef LIBNLLORA_H
+#define LIBNLLORA_H
+
+#include <stdint.h>
+#include <net/if.h>
+
+/*
+ * Long-lived nllora generic netlink client.
+ *
+ * One client owns one connected nl_sock. The nllora family ID is resolved
+ * once at open time, interface names are resolved once and cached, and
+ * request messages come from a small preallocated pool, so a query is a
+ * single request/response round trip.
+ *
+ * Functions return 0 (or a non-negative value) on success and a negative
+ * errno value on failure. A client is not thread-safe.
+ */
+
+struct nllora_client;
+struct ifcache;
+
+struct nllora_client *nllora_client_open(void);
+void nllora_client_close(struct nllora_client *c);
+
+int nllora_family_id(struct nllora_client *c);
+
+/* Returns the ifindex for ifname, or a negative errno value. */
+int nllora_ifindex(struct nllora_client *c, const char *ifname);
+void nllora_ifindex_flush(struct nllora_client *c);
+
+/* The client's netdev cache, for ifcache_expand(); NULL on error. */
+struct ifcache *nllora_ifcache(struct nllora_client *c);
+
+int nllora_get_freq(struct nllora_client *c, int ifindex, uint32_t *freq);
+
+struct nllora_ifinfo {
+	char name[IFNAMSIZ];
+	int ifindex;
+	int err;		/* 0, or negative errno for this interface */
+	uint32_t freq;
+};
+
+/*
+ * Queries every ARPHRD_LORA netdev in one transaction and fills up to max
+ * entries of info. Returns the number of entries, or a negative errno.
+ */
+int nllora_dump(struct nllora_client *c, struct nllora_ifinfo *info, unsigned int max);
+
+/*
+ * Radio settings, applied with one request per interface. Only the
+ * fields selected in mask are sent; err is filled in per entry.
+ */
+#define NLLORA_SET_FREQ		0x01
+#define NLLORA_SET_SF		0x02
+#define NLLORA_SET_BW		0x04
+#define NLLORA_SET_TX_POWER	0x08
+#define NLLORA_SET_SYNC_WORD	0x10
+
+struct nllora_params {
+	int ifindex;
+	unsigned int mask;
+	uint32_t freq;		/* Hz */
+	uint32_t bw;		/* Hz */
+	int32_t tx_power;	/* dBm */
+	uint8_t sf;
+	uint8_t sync_word;
+	int err;
+};
+
+/*
+ * Applies n entries in a single transaction: their requests leave in one
+ * sendmsg() and only the last one asks for an ACK, so a whole retune costs
+ * one round trip. A failing request gets its own error reply and the
+ * rest still apply. Returns 0, or the first entry's error.
+ */
+int nllora_set(struct nllora_client *c, struct nllora_params *p, unsigned int n);
+
+/* The same, one request and ACK per attribute; the baseline to beat. */
+int nllora_set_each(struct nllora_client *c, struct nllora_params *p, unsigned int n);
+
+/*
+ * Configuration change notifications.
+ *
+ * Events arrive on a second netlink socket of their own, so they never
+ * interleave with request replies. Put nllora_event_fd() into an event
+ * loop and call nllora_event_dispatch() when it turns readable; it drains
+ * every pending notification without blocking.
+ */
+#ifndef NLLORA_MCGRP_CONFIG
+#define NLLORA_MCGRP_CONFIG "config"
+#endif
+
+struct nllora_event {
+	int cmd;
+	int ifindex;		/* 0 if not present */
+	int has_freq;
+	uint32_t freq;
+};
+
+typedef void (*nllora_event_cb_t)(const struct nllora_event *ev, void *arg);
+
+int nllora_subscribe(struct nllora_client *c, const char *group);
+int nllora_event_fd(struct nllora_client *c);
+int nllora_event_dispatch(struct nllora_client *c, nllora_event_cb_t fn, void *arg);
+
+#endif
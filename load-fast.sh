@@ -0,0 +1,139 @@
+#!/bin/sh
+#
+# Boot-time loader: like load.sh, but only loads the chipset drivers whose
+# device tree compatibles or USB IDs are present, loads independent
+# drivers in parallel once the core modules are in, and leaves dynamic
+# debug off unless -d is given.
+#
+# usage: load-fast.sh [-a] [-d] [-r] [-n]
+#   -a  load every chipset driver, as load.sh does
+#   -d  enable dyndbg on the chipset drivers
+#   -r  unload the whole stack first
+#   -n  only print what would be loaded
+#
+
+BDIR=${BDIR:-linux}
+DT=${DT:-/proc/device-tree}
+
+all=0
+dyndbg=
+reload=0
+dryrun=0
+
+while getopts adrn opt; do
+	case $opt in
+	a) all=1 ;;
+	d) dyndbg=dyndbg ;;
+	r) reload=1 ;;
+	n) dryrun=1 ;;
+	*) sed -n '8,12s/^# \{0,1\}//p' "$0" >&2; exit 1 ;;
+	esac
+done
+
+CORE="${BDIR}/net/lora/lora.ko ${BDIR}/net/lora/cfglora.ko ${BDIR}/drivers/net/lora/lora-dev.ko"
+
+modname() {
+	basename "$1" .ko | tr - _
+}
+
+loaded() {
+	[ -d "/sys/module/$(modname "$1")" ]
+}
+
+if [ $reload = 1 ]; then
+	# Twice, so that drivers other drivers depend on go in the second pass.
+	for pass in 1 2; do
+		for m in $(lsmod | awk '/^lora_/ && $1 != "lora_dev" { print $1 }'); do
+			rmmod "$m" 2>/dev/null
+		done
+	done
+	for m in lora_dev nllora cfglora lora; do
+		rmmod "$m" 2>/dev/null
+	done
+fi
+
+# One OF modalias per DT compatible, plus the USB modaliases.
+present=$(
+	if [ -d "$DT" ]; then
+		find "$DT" -name compatible 2>/dev/null | while read -r f; do
+			tr '\0' '\n' < "$f" | sed 's/^/of:NT<NULL>C/'
+		done
+	fi
+	cat /sys/bus/usb/devices/*/modalias 2>/dev/null
+)
+
+# Module aliases are glob patterns, so match them with case.
+wanted() {
+	[ $all = 1 ] && return 0
+	set -f
+	for alias in $(modinfo -F alias "$1" 2>/dev/null); do
+		for dev in $present; do
+			case "$dev" in
+			$alias) set +f; return 0 ;;
+			esac
+		done
+	done
+	set +f
+	return 1
+}
+
+do_insmod() {
+	if [ $dryrun = 1 ]; then
+		echo "insmod $*"
+		return 0
+	fi
+	insmod "$@"
+}
+
+set -e
+for ko in $CORE; do
+	loaded "$ko" || do_insmod "$ko"
+done
+set +e
+
+pending=
+for ko in ${BDIR}/drivers/net/lora/lora-*.ko; do
+	[ "$ko" = "${BDIR}/drivers/net/lora/lora-dev.ko" ] && continue
+	loaded "$ko" && continue
+	wanted "$ko" && pending="$pending $ko"
+done
+
+# Load in waves: a module goes into the current wave once none of its
+# dependencies is still pending, and a wave is inserted in parallel.
+# Dependencies outside this set are left to insmod to report.
+failed=0
+while [ -n "$pending" ]; do
+	names=" $(for ko in $pending; do modname "$ko"; done | tr '\n' ' ')"
+	wave=
+	rest=
+	for ko in $pending; do
+		ready=1
+		for dep in $(modinfo -F depends "$ko" 2>/dev/null | tr ,- ' _'); do
+			case "$names" in
+			*" $dep "*) ready=0 ;;
+			esac
+		done
+		if [ $ready = 1 ]; then
+			wave="$wave $ko"
+		else
+			rest="$rest $ko"
+		fi
+	done
+
+	if [ -z "$wave" ]; then
+		echo "unresolved dependencies:$rest" >&2
+		exit 1
+	fi
+
+	pids=
+	for ko in $wave; do
+		do_insmod "$ko" $dyndbg &
+		pids="$pids $!"
+	done
+	for pid in $pids; do
+		wait "$pid" || failed=1
+	done
+	pending=$rest
+done
+
+exit $failed
@@ -0,0 +1,717 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <linux/if_packet.h>
+#include <linux/socket.h>
+#include <linux/sock_diag.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include "include/linux/lora.h"
+#include "affinity.h"
+#include "ifcache.h"
+#include "latency.h"
+#include "runtime.h"
+
+#ifndef AF_LORA
+#define AF_LORA 28
+#endif
+
+#ifndef PF_LORA
+#define PF_LORA AF_LORA
+#endif
+
+#ifndef PACKET_QDISC_BYPASS
+#define PACKET_QDISC_BYPASS 20
+#endif
+
+#ifndef SO_MEMINFO
+#define SO_MEMINFO 55
+#endif
+
+#define LORA_MAX_PAYLOAD	255
+#define MAX_IFACES		16
+#define MAX_SIZES		32
+#define BATCH			32
+#define RX_IDLE_MS		2000
+
+enum format {
+	FORMAT_CSV,
+	FORMAT_JSON,
+};
+
+/* How frames reach the driver. */
+enum tx_path {
+	PATH_LORA,	/* PF_LORA SOCK_DGRAM */
+	PATH_PACKET,	/* PF_PACKET ETH_P_LORA through the qdisc */
+	PATH_BYPASS,	/* PF_PACKET with PACKET_QDISC_BYPASS */
+	NR_PATHS,
+};
+
+static const char *const path_names[NR_PATHS] = { "lora", "packet", "bypass" };
+
+/* The peer is read by the runtime, with one of its RX engines. */
+struct rx_count {
+	long frames;
+	uint64_t first_ns, last_ns;	/* when the RX engine read them */
+};
+
+struct tx_socket {
+	int fd;
+	struct sockaddr_ll dst;	/* PF_PACKET paths */
+	socklen_t dst_len;	/* 0: bound PF_LORA socket */
+};
+
+struct bench_opts {
+	enum format format;
+	const char *label;
+	const char *peer;
+	long frames;
+	long pings;
+	long timeout_ms;
+	unsigned int sizes[MAX_SIZES];
+	unsigned int nsizes;
+	unsigned int paths;	/* 1 << enum tx_path */
+	unsigned int engines;	/* 1 << enum rt_engine */
+	int pin;		/* run on the CPU of the peer's IRQ */
+	int prio;		/* SCHED_FIFO priority, 0 for none */
+};
+
+struct bench_result {
+	const char *ifname;
+	const char *path;
+	const char *engine;
+	unsigned int size;
+	long tx_frames;
+	double tx_fps;
+	double tx_cpu_ns;
+	long rx_frames;
+	double rx_fps;
+	uint64_t rx_calls;
+	uint32_t rx_drops;	/* peer socket receive queue drops */
+	uint64_t rx_overruns;	/* peer netdev FIFO, overrun and missed errors */
+	struct lat_hist rtt;
+};
+
+static uint64_t clock_ns(clockid_t clk)
+{
+	struct timespec ts;
+
+	clock_gettime(clk, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t now_ns(void)
+{
+	return clock_ns(CLOCK_MONOTONIC);
+}
+
+static int open_lora_socket(const struct ifc_entry *ife)
+{
+	const char *ifname = ife->name;
+	struct sockaddr_lora addr;
+	struct ifreq ifr;
+	int skt;
+
+	skt = socket(PF_LORA, SOCK_DGRAM | SOCK_NONBLOCK, 1);
+	if (skt == -1) {
+		int err = errno;
+		fprintf(stderr, "socket failed: %s\n", strerror(err));
+		return -1;
+	}
+
+	memset(&ifr, 0, sizeof(ifr));
+	ifr.ifr_ifindex = ife->ifindex;
+	if (ifr.ifr_ifindex == 0) {
+		strcpy(ifr.ifr_name, ifname);
+		if (ioctl(skt, SIOCGIFINDEX, &ifr) == -1) {
+			int err = errno;
+			fprintf(stderr, "%s: ioctl failed: %s\n", ifname, strerror(err));
+			close(skt);
+			return -1;
+		}
+	}
+
+	addr.lora_family = AF_LORA;
+	addr.lora_ifindex = ifr.ifr_ifindex;
+	if (bind(skt, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+		int err = errno;
+		fprintf(stderr, "%s: bind failed: %s\n", ifname, strerror(err));
+		close(skt);
+		return -1;
+	}
+
+	return skt;
+}
+
+/*
+ * PF_PACKET TX sockets are opened with protocol 0 and address every frame
+ * instead, so they never queue the interface's received frames.
+ */
+static int open_tx_socket(const struct ifc_entry *ife, enum tx_path path, struct tx_socket *tx)
+{
+	struct ifreq ifr;
+	int skt;
+
+	memset(tx, 0, sizeof(*tx));
+	tx->fd = -1;
+	if (path == PATH_LORA) {
+		tx->fd = open_lora_socket(ife);
+		return tx->fd;
+	}
+
+	skt = socket(PF_PACKET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+	if (skt == -1) {
+		int err = errno;
+		fprintf(stderr, "socket failed: %s\n", strerror(err));
+		return -1;
+	}
+
+	memset(&ifr, 0, sizeof(ifr));
+	ifr.ifr_ifindex = ife->ifindex;
+	if (ifr.ifr_ifindex == 0) {
+		strcpy(ifr.ifr_name, ife->name);
+		if (ioctl(skt, SIOCGIFINDEX, &ifr) == -1) {
+			int err = errno;
+			fprintf(stderr, "%s: ioctl failed: %s\n", ife->name, strerror(err));
+			close(skt);
+			return -1;
+		}
+	}
+
+	if (path == PATH_BYPASS) {
+		int one = 1;
+		if (setsockopt(skt, SOL_PACKET, PACKET_QDISC_BYPASS, &one, sizeof(one)) == -1) {
+			int err = errno;
+			fprintf(stderr, "%s: PACKET_QDISC_BYPASS failed: %s\n", ife->name, strerror(err));
+			close(skt);
+			return -1;
+		}
+	}
+
+	tx->fd = skt;
+	tx->dst.sll_family = AF_PACKET;
+	tx->dst.sll_protocol = htons(ETH_P_LORA);
+	tx->dst.sll_ifindex = ifr.ifr_ifindex;
+	tx->dst_len = sizeof(tx->dst);
+	return skt;
+}
+
+static void count_frame(struct rt_worker *w, struct rt_frame *f, void *arg)
+{
+	struct rx_count *c = arg;
+
+	if (c->frames++ == 0)
+		c->first_ns = f->read_ns;
+	c->last_ns = f->read_ns;
+}
+
+/* Hands the dispatcher whatever the RX engine has queued, without blocking. */
+static long drain(struct rt *rt, struct rx_count *c)
+{
+	long before = c->frames;
+
+	while (rt_dispatch(rt, count_frame, c, 0) > 0)
+		;
+	return c->frames - before;
+}
+
+/* Waits up to timeout_ms for frames to reach the dispatcher; returns how many. */
+static int rx_wait(struct rt *rt, struct rx_count *c, int timeout_ms)
+{
+	uint64_t deadline = now_ns() + timeout_ms * 1000000ULL;
+	int n;
+
+	do {
+		n = rt_dispatch(rt, count_frame, c, timeout_ms);
+	} while (n == 0 && now_ns() < deadline);
+	return n;
+}
+
+static void run_tx_rx(const struct bench_opts *o, const struct tx_socket *tx,
+		      struct rt *rx, unsigned int size, struct bench_result *r)
+{
+	static char payload[LORA_MAX_PAYLOAD];
+	static struct iovec iov[BATCH];
+	static struct mmsghdr msgs[BATCH];
+	struct rx_count c = { 0 };
+
+	for (unsigned int i = 0; i < size; i++)
+		payload[i] = i;
+	for (int i = 0; i < BATCH; i++) {
+		iov[i].iov_base = payload;
+		iov[i].iov_len = size;
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_name = tx->dst_len ? (void *)&tx->dst : NULL;
+		msgs[i].msg_hdr.msg_namelen = tx->dst_len;
+	}
+
+	if (rx) {
+		drain(rx, &c);
+		c.frames = 0;
+	}
+
+	uint64_t deadline = now_ns() + o->timeout_ms * 1000000ULL;
+	uint64_t cpu0 = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+	uint64_t t0 = now_ns();
+	long sent = 0;
+
+	while (sent < o->frames && now_ns() < deadline) {
+		unsigned int n = o->frames - sent < BATCH ? o->frames - sent : BATCH;
+		int ret = sendmmsg(tx->fd, msgs, n, 0);
+		if (ret == -1) {
+			if (errno == EAGAIN || errno == ENOBUFS || errno == EINTR) {
+				struct pollfd pfd = { .fd = tx->fd, .events = POLLOUT };
+				poll(&pfd, 1, 1);
+				continue;
+			}
+			fprintf(stderr, "%s: sendmmsg failed: %s\n", r->ifname, strerror(errno));
+			break;
+		}
+		sent += ret;
+		if (rx)
+			drain(rx, &c);
+	}
+
+	uint64_t t1 = now_ns();
+	uint64_t cpu1 = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+
+	r->tx_frames = sent;
+	r->tx_fps = t1 > t0 ? sent * 1e9 / (t1 - t0) : 0;
+	r->tx_cpu_ns = sent ? (double)(cpu1 - cpu0) / sent : 0;
+
+	if (rx == NULL)
+		return;
+
+	/* Frames still in flight arrive up to one time-on-air later. */
+	while (c.frames < sent && rx_wait(rx, &c, RX_IDLE_MS))
+		;
+	r->rx_frames = c.frames;
+
+	if (c.frames > 1 && c.last_ns > c.first_ns)
+		r->rx_fps = (c.frames - 1) * 1e9 / (c.last_ns - c.first_ns);
+}
+
+/* Measured up to the dispatcher, where runtime users see the frame. */
+static void run_rtt(const struct bench_opts *o, const struct tx_socket *tx,
+		    struct rt *rx, unsigned int size, struct bench_result *r)
+{
+	static char payload[LORA_MAX_PAYLOAD];
+	struct rx_count c = { 0 };
+
+	lat_hist_init(&r->rtt);
+
+	for (long i = 0; i < o->pings; i++) {
+		drain(rx, &c);
+
+		uint64_t t0 = now_ns();
+		if (sendto(tx->fd, payload, size, 0, tx->dst_len ? (struct sockaddr *)&tx->dst : NULL,
+			   tx->dst_len) == -1) {
+			fprintf(stderr, "%s: sendto failed: %s\n", r->ifname, strerror(errno));
+			return;
+		}
+		if (rx_wait(rx, &c, RX_IDLE_MS) > 0)
+			lat_hist_add(&r->rtt, now_ns() - t0);
+	}
+}
+
+/* One RX worker on the peer, read by the given engine. */
+static int start_rx(struct rt *rt, const struct ifc_entry *peer, enum rt_engine engine,
+		    struct rt_worker **w)
+{
+	int ret = rt_init(rt);
+
+	if (ret < 0) {
+		fprintf(stderr, "eventfd: %s\n", strerror(-ret));
+		return -1;
+	}
+	rt->engine = engine;
+	*w = rt_add_worker(rt, RT_RX, peer->name, 0, 0);
+	if (*w == NULL) {
+		fprintf(stderr, "%s: cannot add RX worker\n", peer->name);
+		rt_destroy(rt);
+		return -1;
+	}
+	(*w)->ifindex = peer->ifindex;
+	if (rt_start(rt)) {
+		rt_destroy(rt);
+		return -1;
+	}
+	return 0;
+}
+
+static uint32_t socket_drops(int fd)
+{
+	uint32_t mem[SK_MEMINFO_VARS];
+	socklen_t len = sizeof(mem);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_MEMINFO, mem, &len) == -1 ||
+	    len <= SK_MEMINFO_DROPS * sizeof(mem[0]))
+		return 0;
+	return mem[SK_MEMINFO_DROPS];
+}
+
+/* Frames the radio lost before the stack saw them: FIFO overruns and the like. */
+static uint64_t link_overruns(struct ifcache *c, int ifindex)
+{
+	struct rtnl_link_stats64 st;
+
+	memset(&st, 0, sizeof(st));
+	if (c->fd == -1 || ifcache_link_stats(c, &ifindex, &st, 1) < 0)
+		return 0;
+	return st.rx_fifo_errors + st.rx_over_errors + st.rx_missed_errors;
+}
+
+/* Runs the whole benchmark where the peer's IRQ is delivered, and optionally SCHED_FIFO. */
+static int apply_profile(const struct bench_opts *o, const char *ifname)
+{
+	if (o->pin) {
+		struct aff_irq irq;
+		char cpus[64];
+		int ret = aff_find_irq(ifname, &irq);
+
+		if (ret < 0) {
+			fprintf(stderr, "%s: no IRQ found: %s\n", ifname, strerror(-ret));
+			return -1;
+		}
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(aff_first_cpu(&irq.cpus), &set);
+		if (sched_setaffinity(0, sizeof(set), &set) == -1) {
+			int err = errno;
+			fprintf(stderr, "sched_setaffinity failed: %s\n", strerror(err));
+			return -1;
+		}
+		aff_format_cpus(&irq.cpus, cpus, sizeof(cpus));
+		fprintf(stderr, "%s irq %d %s cpus %s, running on cpu %d\n", ifname, irq.irq,
+			irq.action, cpus, aff_first_cpu(&irq.cpus));
+	}
+	if (o->prio) {
+		struct sched_param sp = { .sched_priority = o->prio };
+		int ret = aff_lock_memory();
+
+		if (ret < 0) {
+			fprintf(stderr, "mlockall failed: %s\n", strerror(-ret));
+			return -1;
+		}
+		if (sched_setscheduler(0, SCHED_FIFO, &sp) == -1) {
+			int err = errno;
+			fprintf(stderr, "SCHED_FIFO failed: %s\n", strerror(err));
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void print_header(const struct bench_opts *o)
+{
+	if (o->format == FORMAT_JSON) {
+		printf("[\n");
+		return;
+	}
+	printf("label,iface,path,rx_engine,size,tx_frames,tx_fps,tx_cpu_ns_per_frame,"
+	       "rx_frames,rx_fps,rx_frames_per_call,rtt_count,rtt_p50_us,rtt_p99_us,rtt_max_us,"
+	       "rx_drops,rx_overruns\n");
+}
+
+static void print_result(const struct bench_opts *o, const struct bench_result *r, int first)
+{
+	const char *label = o->label ? o->label : "";
+	/* A run that received nothing made no calls. */
+	double per_call = (double)r->rx_frames / (r->rx_calls ? r->rx_calls : 1);
+
+	if (o->format == FORMAT_JSON) {
+		printf("%s  {\"label\": \"%s\", \"iface\": \"%s\", \"path\": \"%s\", "
+		       "\"rx_engine\": \"%s\", \"size\": %u, "
+		       "\"tx_frames\": %ld, \"tx_fps\": %.2f, \"tx_cpu_ns_per_frame\": %.1f, "
+		       "\"rx_frames\": %ld, \"rx_fps\": %.2f, \"rx_frames_per_call\": %.2f, "
+		       "\"rtt_count\": %llu, "
+		       "\"rtt_p50_us\": %.1f, \"rtt_p99_us\": %.1f, \"rtt_max_us\": %.1f, "
+		       "\"rx_drops\": %u, \"rx_overruns\": %llu}",
+		       first ? "" : ",\n", label, r->ifname, r->path, r->engine, r->size,
+		       r->tx_frames, r->tx_fps, r->tx_cpu_ns,
+		       r->rx_frames, r->rx_fps, per_call, (unsigned long long)r->rtt.count,
+		       lat_hist_quantile(&r->rtt, 0.50) / 1e3,
+		       lat_hist_quantile(&r->rtt, 0.99) / 1e3,
+		       r->rtt.count ? r->rtt.max / 1e3 : 0.0,
+		       r->rx_drops, (unsigned long long)r->rx_overruns);
+		return;
+	}
+
+	printf("%s,%s,%s,%s,%u,%ld,%.2f,%.1f,%ld,%.2f,%.2f,%llu,%.1f,%.1f,%.1f,%u,%llu\n",
+	       label, r->ifname, r->path, r->engine, r->size, r->tx_frames, r->tx_fps,
+	       r->tx_cpu_ns, r->rx_frames, r->rx_fps, per_call, (unsigned long long)r->rtt.count,
+	       lat_hist_quantile(&r->rtt, 0.50) / 1e3,
+	       lat_hist_quantile(&r->rtt, 0.99) / 1e3,
+	       r->rtt.count ? r->rtt.max / 1e3 : 0.0,
+	       r->rx_drops, (unsigned long long)r->rx_overruns);
+}
+
+static void print_footer(const struct bench_opts *o)
+{
+	if (o->format == FORMAT_JSON)
+		printf("\n]\n");
+	fflush(stdout);
+}
+
+static int parse_sizes(struct bench_opts *o, char *arg)
+{
+	char *tok, *save;
+
+	o->nsizes = 0;
+	for (tok = strtok_r(arg, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		long v = strtol(tok, NULL, 0);
+		if (v < 1 || v > LORA_MAX_PAYLOAD || o->nsizes == MAX_SIZES)
+			return -1;
+		o->sizes[o->nsizes++] = v;
+	}
+	return o->nsizes ? 0 : -1;
+}
+
+static int parse_paths(struct bench_opts *o, char *arg)
+{
+	char *tok, *save;
+
+	o->paths = 0;
+	for (tok = strtok_r(arg, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		int p;
+
+		for (p = 0; p < NR_PATHS; p++) {
+			if (strcmp(tok, path_names[p]) == 0)
+				break;
+		}
+		if (p == NR_PATHS)
+			return -1;
+		o->paths |= 1U << p;
+	}
+	return o->paths ? 0 : -1;
+}
+
+static int parse_engines(struct bench_opts *o, char *arg)
+{
+	char *tok, *save;
+
+	o->engines = 0;
+	for (tok = strtok_r(arg, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		int e = rt_engine_parse(tok);
+
+		if (e < 0)
+			return -1;
+		o->engines |= 1U << e;
+	}
+	return o->engines ? 0 : -1;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-f csv|json] [-l label] [-m paths] [-e engines] [-s sizes] [-n frames] [-t ms] [-p peer] [-r pings] [-C] [-F prio] [ifname...]\n", prog);
+	fprintf(stderr, "  -f  output format (default csv)\n");
+	fprintf(stderr, "  -l  label copied into every row, e.g. the lora-next snapshot\n");
+	fprintf(stderr, "  -m  comma separated TX paths to compare: lora (PF_LORA), packet (PF_PACKET\n");
+	fprintf(stderr, "      ETH_P_LORA) and bypass (PF_PACKET with PACKET_QDISC_BYPASS); default lora\n");
+	fprintf(stderr, "  -e  comma separated runtime RX engines to read the -p peer with: recvmmsg,\n");
+	fprintf(stderr, "      epoll (one recvmsg per frame) and io_uring (multishot recvmsg);\n");
+	fprintf(stderr, "      default recvmmsg\n");
+	fprintf(stderr, "  -s  comma separated payload sizes, 1..%d (default 1,16,32,64,128,255)\n", LORA_MAX_PAYLOAD);
+	fprintf(stderr, "  -n  frames sent per matrix point (default 100)\n");
+	fprintf(stderr, "  -t  TX time limit per matrix point in ms (default 30000)\n");
+	fprintf(stderr, "  -p  interface that receives the TX interfaces' frames, enables RX and RTT\n");
+	fprintf(stderr, "  -r  round trips measured per matrix point with -p (default 10)\n");
+	fprintf(stderr, "  -C  run on the CPU the -p peer's IRQ is delivered on\n");
+	fprintf(stderr, "  -F  run SCHED_FIFO at prio with memory locked\n");
+	fprintf(stderr, "Without interfaces, every ARPHRD_LORA netdev is benchmarked; globs such\n");
+	fprintf(stderr, "as \"lora*\" and ifindex numbers are accepted too.\n");
+}
+
+int main(int argc, char **argv)
+{
+	static const unsigned int default_sizes[] = { 1, 16, 32, 64, 128, 255 };
+	struct bench_opts o = {
+		.format = FORMAT_CSV,
+		.frames = 100,
+		.pings = 10,
+		.timeout_ms = 30000,
+		.paths = 1U << PATH_LORA,
+		.engines = 1U << RT_ENGINE_MMSG,
+	};
+	static const char *const all[] = { "all" };
+	struct ifc_entry ifs[MAX_IFACES];
+	struct ifcache ifc, stats;
+	int nifaces, opt, first = 1;
+
+	o.nsizes = sizeof(default_sizes) / sizeof(default_sizes[0]);
+	memcpy(o.sizes, default_sizes, sizeof(default_sizes));
+
+	while ((opt = getopt(argc, argv, "f:l:m:e:s:n:t:p:r:CF:h")) != -1) {
+		switch (opt) {
+		case 'f':
+			if (strcmp(optarg, "csv") == 0)
+				o.format = FORMAT_CSV;
+			else if (strcmp(optarg, "json") == 0)
+				o.format = FORMAT_JSON;
+			else {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'l':
+			o.label = optarg;
+			break;
+		case 'm':
+			if (parse_paths(&o, optarg)) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'e':
+			if (parse_engines(&o, optarg)) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 's':
+			if (parse_sizes(&o, optarg)) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'n':
+			o.frames = strtol(optarg, NULL, 0);
+			break;
+		case 't':
+			o.timeout_ms = strtol(optarg, NULL, 0);
+			break;
+		case 'p':
+			o.peer = optarg;
+			break;
+		case 'r':
+			o.pings = strtol(optarg, NULL, 0);
+			break;
+		case 'C':
+			o.pin = 1;
+			break;
+		case 'F':
+			o.prio = strtol(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (o.frames < 1 || o.timeout_ms < 1 || o.pings < 0 || (o.pin && !o.peer) ||
+	    o.prio < 0 || o.prio > sched_get_priority_max(SCHED_FIFO)) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	/* One rtnetlink dump resolves every netdev, the peer included. */
+	ifcache_init(&ifc);
+	if (optind < argc)
+		nifaces = ifcache_expand_list(&ifc, (const char *const *)argv + optind,
+					      argc - optind, ARPHRD_LORA, ifs, MAX_IFACES);
+	else
+		nifaces = ifcache_expand_list(&ifc, all, 1, ARPHRD_LORA, ifs, MAX_IFACES);
+	if (nifaces <= 0) {
+		fprintf(stderr, "no LoRa interfaces found\n");
+		return 1;
+	}
+
+	/* Every engine gets a runtime of its own, started per matrix point. */
+	struct ifc_entry peer;
+	if (o.peer && ifcache_expand(&ifc, o.peer, ARPHRD_LORA, &peer, 1) != 1) {
+		fprintf(stderr, "%s: bad peer interface\n", o.peer);
+		return 1;
+	}
+	ifcache_close(&ifc);
+
+	ifcache_init(&stats);
+	if (o.peer) {
+		if (peer.ifindex == 0)
+			peer.ifindex = if_nametoindex(peer.name);
+		int ret = ifcache_open(&stats, 0);
+		if (ret < 0)
+			fprintf(stderr, "rtnetlink: %s, no overrun counts\n", strerror(-ret));
+	}
+	if (apply_profile(&o, o.peer))
+		return 1;
+
+	print_header(&o);
+
+	for (int i = 0; i < nifaces; i++) {
+		if (o.peer && strcmp(ifs[i].name, o.peer) == 0)
+			continue;
+
+		/* Paths alternate per size, so drift hits them alike. */
+		struct tx_socket tx[NR_PATHS];
+		for (int p = 0; p < NR_PATHS; p++) {
+			tx[p].fd = -1;
+			if (o.paths & (1U << p))
+				open_tx_socket(&ifs[i], p, &tx[p]);
+		}
+
+		for (unsigned int s = 0; s < o.nsizes; s++) {
+			for (int p = 0; p < NR_PATHS; p++) {
+				if (tx[p].fd == -1)
+					continue;
+
+				for (int e = 0; e < RT_NR_ENGINES; e++) {
+					static struct rt rx;
+					struct rt_worker *w = NULL;
+					struct bench_result r;
+
+					/* Without a peer, one row per path. */
+					if (o.peer ? !(o.engines & (1U << e)) : e > 0)
+						continue;
+					if (o.peer && start_rx(&rx, &peer, e, &w))
+						continue;
+
+					memset(&r, 0, sizeof(r));
+					r.ifname = ifs[i].name;
+					r.path = path_names[p];
+					r.engine = o.peer ? rt_engine_name(e) : "";
+					r.size = o.sizes[s];
+					lat_hist_init(&r.rtt);
+
+					uint64_t overruns = o.peer ? link_overruns(&stats, peer.ifindex) : 0;
+
+					run_tx_rx(&o, &tx[p], o.peer ? &rx : NULL, r.size, &r);
+					if (o.peer) {
+						run_rtt(&o, &tx[p], &rx, r.size, &r);
+						rt_stop(&rx);
+						rt_join(&rx);
+						r.rx_calls = w->st.calls;
+						r.rx_drops = socket_drops(w->fd);
+						r.rx_overruns = link_overruns(&stats, peer.ifindex) - overruns;
+						rt_destroy(&rx);
+					}
+
+					print_result(&o, &r, first);
+					first = 0;
+					fflush(stdout);
+				}
+			}
+		}
+
+		for (int p = 0; p < NR_PATHS; p++) {
+			if (tx[p].fd != -1)
+				close(tx[p].fd);
+		}
+	}
+
+	print_footer(&o);
+	ifcache_close(&stats);
+
+	return 0;
+}
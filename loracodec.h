@@ -0,0 +1,330 @@
+#ifndef LORACODEC_H
+#define LORACODEC_H
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "include/linux/lora.h"
+
+/*
+ * Header-only frame codecs for the ethertypes in include/linux/lora.h.
+ *
+ * Builders write into a caller-provided buffer and return the frame
+ * length, parsers return pointers into the received buffer. Sizes and
+ * offsets are plain enums and static inline functions, so with constant
+ * arguments they fold at compile time. Errors are negative errno values:
+ * -EMSGSIZE when the frame does not fit, -EINVAL for malformed frames.
+ */
+
+enum {
+	LORA_MAX_FRAME		= 255,	/* SX127x/SX130x/SX128x LoRa payload */
+	FSK_MAX_FRAME		= 255,	/* variable length packet mode */
+	OOK_MAX_FRAME		= 255,
+	FLRC_MAX_FRAME		= 127,	/* SX128x FLRC */
+};
+
+static inline unsigned int lora_codec_max_frame(int ethertype)
+{
+	switch (ethertype) {
+	case ETH_P_LORA:
+	case ETH_P_LORAWAN:
+		return LORA_MAX_FRAME;
+	case ETH_P_FSK:
+		return FSK_MAX_FRAME;
+	case ETH_P_OOK:
+		return OOK_MAX_FRAME;
+	case ETH_P_FLRC:
+		return FLRC_MAX_FRAME;
+	}
+	return 0;
+}
+
+static inline uint16_t get_le16(const uint8_t *p)
+{
+	return p[0] | p[1] << 8;
+}
+
+static inline uint32_t get_le32(const uint8_t *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static inline uint64_t get_le64(const uint8_t *p)
+{
+	return get_le32(p) | (uint64_t)get_le32(p + 4) << 32;
+}
+
+static inline void put_le16(uint8_t *p, uint16_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static inline void put_le32(uint8_t *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static inline void put_le64(uint8_t *p, uint64_t v)
+{
+	put_le32(p, v);
+	put_le32(p + 4, v >> 32);
+}
+
+/*
+ * ETH_P_LORA, ETH_P_FLRC: the datagram is the PHY payload, no header.
+ */
+
+static inline int raw_frame_build(uint8_t *buf, unsigned int cap, int ethertype,
+				  const void *payload, unsigned int len)
+{
+	if (len > cap || len > lora_codec_max_frame(ethertype))
+		return -EMSGSIZE;
+	if (buf != payload)
+		memmove(buf, payload, len);
+	return len;
+}
+
+/*
+ * ETH_P_FSK, ETH_P_OOK: PHY payload, optionally led by the node address
+ * byte the packet engine filters on.
+ */
+
+#define FSK_NO_ADDR	-1
+
+static inline unsigned int fsk_hdr_len(int addr)
+{
+	return addr == FSK_NO_ADDR ? 0 : 1;
+}
+
+static inline int fsk_frame_build(uint8_t *buf, unsigned int cap, int ethertype, int addr,
+				  const void *payload, unsigned int len)
+{
+	unsigned int hlen = fsk_hdr_len(addr);
+
+	if (hlen + len > cap || hlen + len > lora_codec_max_frame(ethertype))
+		return -EMSGSIZE;
+	if (payload)
+		memmove(buf + hlen, payload, len);
+	if (hlen)
+		buf[0] = addr;
+	return hlen + len;
+}
+
+static inline int fsk_frame_parse(const uint8_t *buf, unsigned int len, int has_addr,
+				  int *addr, const uint8_t **payload, unsigned int *plen)
+{
+	unsigned int hlen = has_addr ? 1 : 0;
+
+	if (len < hlen)
+		return -EINVAL;
+	*addr = has_addr ? buf[0] : FSK_NO_ADDR;
+	*payload = buf + hlen;
+	*plen = len - hlen;
+	return 0;
+}
+
+/*
+ * ETH_P_LORAWAN: LoRaWAN 1.0.x MAC frames.
+ *
+ *   MHDR | DevAddr | FCtrl | FCnt | FOpts | [FPort | FRMPayload] | MIC
+ *    1       4        1       2     0..15      1       0..N        4
+ */
+
+enum lorawan_mtype {
+	LORAWAN_JOIN_REQUEST	= 0,
+	LORAWAN_JOIN_ACCEPT	= 1,
+	LORAWAN_UNCONF_UP	= 2,
+	LORAWAN_UNCONF_DOWN	= 3,
+	LORAWAN_CONF_UP		= 4,
+	LORAWAN_CONF_DOWN	= 5,
+	LORAWAN_REJOIN_REQUEST	= 6,
+	LORAWAN_PROPRIETARY	= 7,
+};
+
+enum {
+	LORAWAN_MHDR_LEN	= 1,
+	LORAWAN_FHDR_MIN	= 7,	/* DevAddr, FCtrl, FCnt */
+	LORAWAN_FOPTS_MAX	= 15,
+	LORAWAN_MIC_LEN		= 4,
+	LORAWAN_DATA_MIN	= LORAWAN_MHDR_LEN + LORAWAN_FHDR_MIN + LORAWAN_MIC_LEN,
+	LORAWAN_JOIN_REQ_LEN	= LORAWAN_MHDR_LEN + 8 + 8 + 2 + LORAWAN_MIC_LEN,
+
+	/* Offsets into a data frame */
+	LORAWAN_OFF_DEVADDR	= LORAWAN_MHDR_LEN,
+	LORAWAN_OFF_FCTRL	= LORAWAN_OFF_DEVADDR + 4,
+	LORAWAN_OFF_FCNT	= LORAWAN_OFF_FCTRL + 1,
+	LORAWAN_OFF_FOPTS	= LORAWAN_OFF_FCNT + 2,
+};
+
+_Static_assert(LORAWAN_DATA_MIN == 12, "LoRaWAN data frame header size");
+_Static_assert(LORAWAN_JOIN_REQ_LEN == 23, "LoRaWAN join request size");
+
+#define LORAWAN_MAJOR_R1	0
+
+/* FCtrl */
+#define LORAWAN_FCTRL_ADR	0x80
+#define LORAWAN_FCTRL_ADRACKREQ	0x40	/* uplink */
+#define LORAWAN_FCTRL_ACK	0x20
+#define LORAWAN_FCTRL_CLASSB	0x10	/* uplink */
+#define LORAWAN_FCTRL_FPENDING	0x10	/* downlink */
+#define LORAWAN_FCTRL_FOPTSLEN	0x0f
+
+#define LORAWAN_NO_PORT		-1
+
+static inline uint8_t lorawan_mhdr(enum lorawan_mtype mtype)
+{
+	return mtype << 5 | LORAWAN_MAJOR_R1;
+}
+
+static inline enum lorawan_mtype lorawan_mtype(uint8_t mhdr)
+{
+	return mhdr >> 5;
+}
+
+static inline int lorawan_mtype_is_data(enum lorawan_mtype mtype)
+{
+	return mtype >= LORAWAN_UNCONF_UP && mtype <= LORAWAN_CONF_DOWN;
+}
+
+static inline int lorawan_mtype_is_uplink(enum lorawan_mtype mtype)
+{
+	return mtype == LORAWAN_UNCONF_UP || mtype == LORAWAN_CONF_UP;
+}
+
+/* Offset of FPort, or of the MIC if the frame has no port. */
+static inline unsigned int lorawan_port_off(unsigned int fopts_len)
+{
+	return LORAWAN_OFF_FOPTS + fopts_len;
+}
+
+static inline unsigned int lorawan_payload_off(unsigned int fopts_len, int fport)
+{
+	return lorawan_port_off(fopts_len) + (fport == LORAWAN_NO_PORT ? 0 : 1);
+}
+
+static inline unsigned int lorawan_data_len(unsigned int fopts_len, int fport,
+					    unsigned int payload_len)
+{
+	return lorawan_payload_off(fopts_len, fport) + payload_len + LORAWAN_MIC_LEN;
+}
+
+struct lorawan_data {
+	uint8_t mhdr;
+	uint32_t devaddr;
+	uint8_t fctrl;
+	uint16_t fcnt;		/* low 16 bits as sent on air */
+	const uint8_t *fopts;
+	unsigned int fopts_len;
+	int fport;		/* LORAWAN_NO_PORT if absent */
+	const uint8_t *payload;
+	unsigned int payload_len;
+	uint32_t mic;
+};
+
+/*
+ * Writes MHDR, FHDR and FPort for a frame carrying payload_len bytes of
+ * FRMPayload and zeroes the MIC. Returns the total frame length; the
+ * caller fills FRMPayload at lorawan_payload_off() and then the MIC.
+ * payload may be NULL if the caller writes it in place.
+ */
+static inline int lorawan_data_build(uint8_t *buf, unsigned int cap, enum lorawan_mtype mtype,
+				     uint32_t devaddr, uint8_t fctrl, uint16_t fcnt,
+				     const uint8_t *fopts, unsigned int fopts_len, int fport,
+				     const uint8_t *payload, unsigned int payload_len)
+{
+	unsigned int len = lorawan_data_len(fopts_len, fport, payload_len);
+	unsigned int off;
+
+	if (!lorawan_mtype_is_data(mtype) || fopts_len > LORAWAN_FOPTS_MAX || fport > 255 ||
+	    (fport == LORAWAN_NO_PORT && payload_len))
+		return -EINVAL;
+	if (len > cap || len > LORA_MAX_FRAME)
+		return -EMSGSIZE;
+
+	buf[0] = lorawan_mhdr(mtype);
+	put_le32(buf + LORAWAN_OFF_DEVADDR, devaddr);
+	buf[LORAWAN_OFF_FCTRL] = (fctrl & ~LORAWAN_FCTRL_FOPTSLEN) | fopts_len;
+	put_le16(buf + LORAWAN_OFF_FCNT, fcnt);
+	if (fopts_len)
+		memcpy(buf + LORAWAN_OFF_FOPTS, fopts, fopts_len);
+	off = lorawan_port_off(fopts_len);
+	if (fport != LORAWAN_NO_PORT)
+		buf[off++] = fport;
+	if (payload && payload_len)
+		memmove(buf + off, payload, payload_len);
+	memset(buf + len - LORAWAN_MIC_LEN, 0, LORAWAN_MIC_LEN);
+	return len;
+}
+
+static inline void lorawan_set_mic(uint8_t *buf, unsigned int len, uint32_t mic)
+{
+	put_le32(buf + len - LORAWAN_MIC_LEN, mic);
+}
+
+static inline int lorawan_data_parse(const uint8_t *buf, unsigned int len, struct lorawan_data *d)
+{
+	unsigned int off;
+
+	if (len < LORAWAN_DATA_MIN)
+		return -EINVAL;
+	d->mhdr = buf[0];
+	if (!lorawan_mtype_is_data(lorawan_mtype(d->mhdr)))
+		return -EINVAL;
+	d->devaddr = get_le32(buf + LORAWAN_OFF_DEVADDR);
+	d->fctrl = buf[LORAWAN_OFF_FCTRL];
+	d->fcnt = get_le16(buf + LORAWAN_OFF_FCNT);
+	d->fopts_len = d->fctrl & LORAWAN_FCTRL_FOPTSLEN;
+	d->fopts = buf + LORAWAN_OFF_FOPTS;
+
+	off = lorawan_port_off(d->fopts_len);
+	if (off + LORAWAN_MIC_LEN > len)
+		return -EINVAL;
+	if (off + LORAWAN_MIC_LEN == len) {
+		d->fport = LORAWAN_NO_PORT;
+	} else {
+		d->fport = buf[off++];
+	}
+	d->payload = buf + off;
+	d->payload_len = len - LORAWAN_MIC_LEN - off;
+	d->mic = get_le32(buf + len - LORAWAN_MIC_LEN);
+	return 0;
+}
+
+struct lorawan_join_req {
+	uint64_t join_eui;
+	uint64_t dev_eui;
+	uint16_t dev_nonce;
+	uint32_t mic;
+};
+
+static inline int lorawan_join_req_build(uint8_t *buf, unsigned int cap,
+					 const struct lorawan_join_req *j)
+{
+	if (cap < LORAWAN_JOIN_REQ_LEN)
+		return -EMSGSIZE;
+	buf[0] = lorawan_mhdr(LORAWAN_JOIN_REQUEST);
+	put_le64(buf + 1, j->join_eui);
+	put_le64(buf + 9, j->dev_eui);
+	put_le16(buf + 17, j->dev_nonce);
+	put_le32(buf + 19, j->mic);
+	return LORAWAN_JOIN_REQ_LEN;
+}
+
+static inline int lorawan_join_req_parse(const uint8_t *buf, unsigned int len,
+					 struct lorawan_join_req *j)
+{
+	if (len != LORAWAN_JOIN_REQ_LEN || lorawan_mtype(buf[0]) != LORAWAN_JOIN_REQUEST)
+		return -EINVAL;
+	j->join_eui = get_le64(buf + 1);
+	j->dev_eui = get_le64(buf + 9);
+	j->dev_nonce = get_le16(buf + 17);
+	j->mic = get_le32(buf + 19);
+	return 0;
+}
+
+#endif
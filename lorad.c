@@ -0,0 +1,970 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+
+#include "include/linux/lora.h"
+#include "affinity.h"
+#include "dlsched.h"
+#include "evloop.h"
+#include "ifcache.h"
+#include "lorad.h"
+#include "lorastats.h"
+#include "runtime.h"
+#include "tstamp.h"
+
+#ifndef ETH_P_ERP2
+#define ETH_P_ERP2 0x0100
+#endif
+
+/*
+ * Resident TX daemon: the radio sockets stay bound in runtime.c TX
+ * workers, and clients hand frames over through lorad.h rings or
+ * LORAD_OP_SEND messages instead of opening interfaces themselves.
+ *
+ * Everything client-facing runs on one epoll thread. When a worker's
+ * txq is full, the client's frames stay where they are (in its ring, or
+ * in the socket's receive queue) and the client is retried once a worker
+ * rings the runtime doorbell, so backpressure reaches the client without
+ * lorad buffering anything.
+ *
+ * Timed frames, and every frame for a port with a -P radio profile, go
+ * through dlsched.c first, which releases them from a timerfd.
+ *
+ * Counters go to a lorastats.h segment: the workers publish their own,
+ * and a second timerfd refreshes the netdev and scheduler blocks.
+ */
+
+#define MAX_CLIENTS	64
+#define DRAIN_MS	10000
+#define SCHED_FRAMES	4096
+#define SCHED_LEAD_US	2000
+#define STATS_MS	1000
+
+struct client {
+	int used;
+	int fd;
+	struct ev_source sock_src;
+	struct ev_source bell_src;
+	int blocked;
+
+	/* LORAD_OP_SEND frame that did not fit into its txq. */
+	int has_stash;
+	struct {
+		struct lorad_req req;
+		unsigned char data[LORAD_FRAME_MAX];
+	} stash;
+
+	/* Shared memory; geometry is our own copy, never read back. */
+	struct lorad_shm *shm;
+	uint32_t mask;
+	uint32_t tail;
+	int doorbell;
+	int credit;
+
+	uint64_t frames;
+	uint64_t errors;
+};
+
+static struct rt rt;
+static struct evloop loop;
+static struct client clients[MAX_CLIENTS];
+static struct ev_source listen_src, rt_src, timer_src, stats_src;
+static struct dl_sched sched;
+static int sched_blocked;
+static uint64_t armed_at = UINT64_MAX;
+static char ports[LORAD_MAX_PORTS][IFNAMSIZ];
+static int nports;
+static unsigned int kick_mask;
+static int next_retry;
+
+static uint64_t total_clients, total_frames, total_errors;
+
+static struct ls_segment *stats_seg;
+static struct ifcache stats_ifc;
+static int stats_err;
+
+static void on_signal(int sig)
+{
+	evloop_stop(&loop);
+}
+
+static int sched_send(int port, const void *data, unsigned int len, void *arg)
+{
+	int ret = rt_submit(&rt.workers[port], data, len);
+
+	if (ret != -EAGAIN)
+		kick_mask |= 1U << port;
+	return ret;
+}
+
+static void sched_arm(uint64_t next)
+{
+	struct itimerspec its;
+
+	if (next == armed_at)
+		return;
+	armed_at = next;
+	memset(&its, 0, sizeof(its));
+	if (next != UINT64_MAX) {
+		/* An all-zero it_value would disarm instead. */
+		its.it_value.tv_sec = next / 1000000000ULL;
+		its.it_value.tv_nsec = next % 1000000000ULL ?: 1;
+	}
+	timerfd_settime(timer_src.fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+/* Releases due frames; a full txq defers the rest to the runtime doorbell. */
+static void sched_service(void)
+{
+	uint64_t now = realtime_ns();
+
+	sched_blocked = dl_run(&sched, now, sched_send, NULL) == -EAGAIN;
+	sched_arm(sched_blocked ? UINT64_MAX : dl_next(&sched, realtime_ns()));
+}
+
+static int submit(struct client *cl, unsigned int port, const void *data, unsigned int len,
+		  uint64_t at_ns, unsigned int rx2_port, uint64_t rx2_at_ns)
+{
+	int ret;
+
+	if (port >= (unsigned int)nports || len > LORAD_FRAME_MAX) {
+		cl->errors++;
+		return 0;
+	}
+
+	if (at_ns || sched.radios[port].airtime) {
+		struct dl_frame frame = {
+			.at_ns = at_ns,
+			.rx2_at_ns = rx2_at_ns,
+			.port = port,
+			.rx2_port = rx2_port,
+			.len = len,
+		};
+
+		memcpy(frame.data, data, len);
+		ret = dl_enqueue(&sched, &frame, realtime_ns());
+		if (ret == -EAGAIN)
+			return ret;
+		if (ret < 0) {
+			cl->errors++;
+		} else {
+			cl->frames++;
+			if (!sched_blocked) {
+				uint64_t next = dl_next(&sched, realtime_ns());
+				if (next < armed_at)
+					sched_arm(next);
+			}
+		}
+		return 0;
+	}
+
+	ret = rt_submit(&rt.workers[port], data, len);
+	if (ret == -EAGAIN)
+		return ret;
+	if (ret < 0)
+		cl->errors++;
+	else
+		cl->frames++;
+	kick_mask |= 1U << port;
+	return 0;
+}
+
+static void kick_ports(void)
+{
+	for (int i = 0; i < nports; i++)
+		if (kick_mask & (1U << i))
+			rt_kick(&rt.workers[i]);
+	kick_mask = 0;
+}
+
+static void drop_client(struct client *cl)
+{
+	evloop_del(&loop, &cl->sock_src);
+	close(cl->fd);
+	if (cl->shm) {
+		evloop_del(&loop, &cl->bell_src);
+		munmap(cl->shm, lorad_shm_size(cl->mask + 1));
+		close(cl->doorbell);
+		close(cl->credit);
+	}
+	total_frames += cl->frames;
+	total_errors += cl->errors;
+	memset(cl, 0, sizeof(*cl));
+}
+
+/* Returns -EAGAIN if a txq filled up, or -EPROTO for a corrupt ring. */
+static int drain_ring(struct client *cl)
+{
+	struct lorad_shm *shm = cl->shm;
+	uint32_t head = atomic_load_explicit(&shm->head, memory_order_acquire);
+	uint32_t tail = cl->tail;
+	int ret = 0;
+
+	if (head - tail > cl->mask + 1)
+		return -EPROTO;
+
+	while (tail != head) {
+		struct lorad_slot *s = &shm->slots[tail & cl->mask];
+		unsigned int port = s->port, len = s->len;
+
+		ret = submit(cl, port, s->data, len, s->at_ns, s->rx2_port, s->rx2_at_ns);
+		if (ret < 0)
+			break;
+		tail++;
+	}
+
+	if (tail != cl->tail) {
+		cl->tail = tail;
+		atomic_store(&shm->tail, tail);
+		if (atomic_load(&shm->need_wakeup) && atomic_exchange(&shm->need_wakeup, 0)) {
+			uint64_t one = 1;
+			ssize_t n = write(cl->credit, &one, sizeof(one));
+			(void)n;
+		}
+	}
+	return ret;
+}
+
+static int attach_ring(struct client *cl, struct lorad_hello *h, int fds[3])
+{
+	size_t size = lorad_shm_size(LORAD_RING_SLOTS);
+	struct lorad_shm *shm = MAP_FAILED;
+	int memfd, err;
+
+	memfd = memfd_create("lorad-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (memfd == -1)
+		return -errno;
+	/* Sealed, so a client cannot shrink it under us and cause SIGBUS. */
+	if (ftruncate(memfd, size) == -1 ||
+	    fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) == -1)
+		goto err;
+	shm = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+	if (shm == MAP_FAILED)
+		goto err;
+
+	shm->magic = LORAD_MAGIC;
+	shm->version = LORAD_VERSION;
+	shm->nslots = LORAD_RING_SLOTS;
+	shm->slot_size = sizeof(struct lorad_slot);
+	atomic_init(&shm->head, 0);
+	atomic_init(&shm->tail, 0);
+	atomic_init(&shm->need_wakeup, 0);
+
+	cl->doorbell = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (cl->doorbell == -1)
+		goto err;
+	cl->credit = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (cl->credit == -1) {
+		err = errno;
+		close(cl->doorbell);
+		errno = err;
+		goto err;
+	}
+
+	cl->shm = shm;
+	cl->mask = LORAD_RING_SLOTS - 1;
+	cl->tail = 0;
+	h->nslots = LORAD_RING_SLOTS;
+	fds[0] = memfd;
+	fds[1] = cl->doorbell;
+	fds[2] = cl->credit;
+	return 0;
+
+err:
+	err = errno;
+	if (shm != MAP_FAILED)
+		munmap(shm, size);
+	close(memfd);
+	return -err;
+}
+
+static void doorbell_readable(struct ev_source *src, uint32_t events);
+
+static int send_hello(struct client *cl, const struct lorad_req *req)
+{
+	char control[CMSG_SPACE(3 * sizeof(int))];
+	struct lorad_hello h;
+	struct iovec iov = { .iov_base = &h, .iov_len = sizeof(h) };
+	struct msghdr mh = { .msg_iov = &iov, .msg_iovlen = 1 };
+	int fds[3], ret;
+
+	memset(&h, 0, sizeof(h));
+	h.version = LORAD_VERSION;
+	h.nports = nports;
+	memcpy(h.ports, ports, sizeof(h.ports));
+
+	if (req->flags & LORAD_HELLO_SHM) {
+		h.err = cl->shm ? -EBUSY : attach_ring(cl, &h, fds);
+		if (h.err == 0) {
+			struct cmsghdr *cmsg;
+
+			memset(control, 0, sizeof(control));
+			mh.msg_control = control;
+			mh.msg_controllen = sizeof(control);
+			cmsg = CMSG_FIRSTHDR(&mh);
+			cmsg->cmsg_level = SOL_SOCKET;
+			cmsg->cmsg_type = SCM_RIGHTS;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+			memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+		}
+	}
+
+	ret = sendmsg(cl->fd, &mh, MSG_NOSIGNAL | MSG_DONTWAIT);
+	if (ret == -1)
+		ret = -errno;
+	else
+		ret = 0;
+
+	if (mh.msg_control) {
+		/* The client has its own copy of the memfd now. */
+		close(fds[0]);
+		if (ret == 0) {
+			cl->bell_src.fd = cl->doorbell;
+			cl->bell_src.fn = doorbell_readable;
+			cl->bell_src.arg = cl;
+			ret = evloop_add(&loop, &cl->bell_src, EPOLLIN);
+		}
+	}
+	return ret;
+}
+
+static int submit_stash(struct client *cl)
+{
+	const struct lorad_req *req = &cl->stash.req;
+
+	return submit(cl, req->port, cl->stash.data, req->len, req->at_ns, req->rx2_port,
+		      req->rx2_at_ns);
+}
+
+/* Returns 1 to keep the client, 0 to drop it. */
+static int read_requests(struct client *cl)
+{
+	if (cl->has_stash) {
+		if (submit_stash(cl) < 0)
+			return 1;
+		cl->has_stash = 0;
+	}
+
+	for (;;) {
+		ssize_t n = recv(cl->fd, &cl->stash, sizeof(cl->stash), MSG_DONTWAIT);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return errno == EAGAIN;
+		}
+		if (n == 0)
+			return 0;
+		if (n < (ssize_t)sizeof(struct lorad_req)) {
+			cl->errors++;
+			continue;
+		}
+
+		switch (cl->stash.req.op) {
+		case LORAD_OP_HELLO:
+			if (send_hello(cl, &cl->stash.req) < 0)
+				return 0;
+			break;
+		case LORAD_OP_SEND:
+			if (cl->stash.req.len != n - sizeof(struct lorad_req)) {
+				cl->errors++;
+				break;
+			}
+			if (submit_stash(cl) < 0) {
+				cl->has_stash = 1;
+				return 1;
+			}
+			break;
+		default:
+			cl->errors++;
+			break;
+		}
+	}
+}
+
+static int service(struct client *cl)
+{
+	int keep = read_requests(cl);
+
+	cl->blocked = cl->has_stash;
+	if (keep && cl->shm) {
+		int ret = drain_ring(cl);
+		if (ret == -EPROTO)
+			keep = 0;
+		else if (ret == -EAGAIN)
+			cl->blocked = 1;
+	}
+	return keep;
+}
+
+static void client_readable(struct ev_source *src, uint32_t events)
+{
+	struct client *cl = src->arg;
+
+	if (!service(cl))
+		drop_client(cl);
+	kick_ports();
+}
+
+static void doorbell_readable(struct ev_source *src, uint32_t events)
+{
+	struct client *cl = src->arg;
+	uint64_t val;
+	ssize_t n;
+
+	n = read(cl->doorbell, &val, sizeof(val));
+	(void)n;
+	client_readable(&cl->sock_src, events);
+}
+
+/* Retries the clients blocked on a full queue, round robin. */
+static void retry_blocked(void)
+{
+	for (int i = 0; i < MAX_CLIENTS; i++) {
+		struct client *cl = &clients[(next_retry + i) % MAX_CLIENTS];
+
+		if (cl->used && cl->blocked && !service(cl))
+			drop_client(cl);
+	}
+	next_retry = (next_retry + 1) % MAX_CLIENTS;
+	kick_ports();
+}
+
+static void timer_expired(struct ev_source *src, uint32_t events)
+{
+	uint64_t val;
+	ssize_t n;
+
+	n = read(src->fd, &val, sizeof(val));
+	(void)n;
+	armed_at = UINT64_MAX;
+	sched_service();
+	/* Released frames may have made room for blocked clients. */
+	retry_blocked();
+}
+
+/* Refreshes the link and sched blocks of every port's stats record. */
+static void stats_update(void)
+{
+	static struct rtnl_link_stats64 link[LORAD_MAX_PORTS];
+	int ifindex[LORAD_MAX_PORTS];
+	uint64_t now = realtime_ns();
+	int ret;
+
+	for (int i = 0; i < nports; i++)
+		ifindex[i] = rt.workers[i].ifindex;
+	ret = ifcache_link_stats(&stats_ifc, ifindex, link, nports);
+	if (ret < 0 && ret != stats_err)
+		fprintf(stderr, "RTM_GETSTATS: %s\n", strerror(-ret));
+	stats_err = ret;
+
+	for (int i = 0; i < nports; i++) {
+		struct ls_if *r = &stats_seg->ifs[i];
+		const struct dl_radio *d = &sched.radios[i];
+
+		if (ret == 0) {
+			ls_write_begin(&r->link_seq);
+			r->link.updated_ns = now;
+			r->link.rx_packets = link[i].rx_packets;
+			r->link.tx_packets = link[i].tx_packets;
+			r->link.rx_bytes = link[i].rx_bytes;
+			r->link.tx_bytes = link[i].tx_bytes;
+			r->link.rx_errors = link[i].rx_errors;
+			r->link.tx_errors = link[i].tx_errors;
+			r->link.rx_dropped = link[i].rx_dropped;
+			r->link.tx_dropped = link[i].tx_dropped;
+			r->link.rx_crc_errors = link[i].rx_crc_errors;
+			ls_write_end(&r->link_seq);
+		}
+
+		ls_write_begin(&r->sched_seq);
+		r->sched.updated_ns = now;
+		r->sched.sent = d->st.sent;
+		r->sched.rx2 = d->st.rx2;
+		r->sched.missed = d->st.missed;
+		r->sched.deferred = d->st.deferred;
+		r->sched.airtime_ns = d->st.airtime_ns;
+		r->sched.duty_wait_ns = d->free_at > now ? d->free_at - now : 0;
+		r->sched.duty_ppm = d->duty_ppm;
+		r->sched.airtime = d->airtime;
+		ls_write_end(&r->sched_seq);
+	}
+}
+
+static void stats_expired(struct ev_source *src, uint32_t events)
+{
+	uint64_t val;
+	ssize_t n;
+
+	n = read(src->fd, &val, sizeof(val));
+	(void)n;
+	stats_update();
+}
+
+/* A worker made txq space. */
+static void rt_readable(struct ev_source *src, uint32_t events)
+{
+	uint64_t val;
+	ssize_t n;
+
+	n = read(rt.doorbell, &val, sizeof(val));
+	(void)n;
+
+	if (sched_blocked)
+		sched_service();
+	retry_blocked();
+}
+
+static void accept_clients(struct ev_source *src, uint32_t events)
+{
+	for (;;) {
+		int fd = accept4(src->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd == -1) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			if (errno != EAGAIN) {
+				int err = errno;
+				fprintf(stderr, "accept failed: %s\n", strerror(err));
+			}
+			return;
+		}
+
+		struct client *cl = NULL;
+		for (int i = 0; i < MAX_CLIENTS; i++) {
+			if (!clients[i].used) {
+				cl = &clients[i];
+				break;
+			}
+		}
+		if (cl == NULL) {
+			close(fd);
+			continue;
+		}
+
+		memset(cl, 0, sizeof(*cl));
+		cl->used = 1;
+		cl->fd = fd;
+		cl->sock_src.fd = fd;
+		cl->sock_src.fn = client_readable;
+		cl->sock_src.arg = cl;
+		if (evloop_add(&loop, &cl->sock_src, EPOLLIN) < 0) {
+			close(fd);
+			cl->used = 0;
+			continue;
+		}
+		total_clients++;
+		/* Requests may already be queued. */
+		client_readable(&cl->sock_src, EPOLLIN);
+	}
+}
+
+static int open_listener(const char *path, mode_t mode)
+{
+	struct sockaddr_un addr;
+	int skt;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "%s: path too long\n", path);
+		return -1;
+	}
+
+	skt = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (skt == -1) {
+		int err = errno;
+		fprintf(stderr, "socket failed: %s\n", strerror(err));
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	unlink(path);
+	if (bind(skt, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+		int err = errno;
+		fprintf(stderr, "%s: bind failed: %s\n", path, strerror(err));
+		close(skt);
+		return -1;
+	}
+	if (chmod(path, mode) == -1 || listen(skt, SOMAXCONN) == -1) {
+		int err = errno;
+		fprintf(stderr, "%s: %s\n", path, strerror(err));
+		close(skt);
+		unlink(path);
+		return -1;
+	}
+
+	return skt;
+}
+
+static int add_ports(const char *const *specs, int nspecs, unsigned short type,
+		     int proto, int flags, int batch)
+{
+	struct ifc_entry ifs[LORAD_MAX_PORTS];
+	struct ifcache ifc;
+	int n;
+
+	if (nspecs == 0)
+		return 0;
+
+	ifcache_init(&ifc);
+	n = ifcache_expand_list(&ifc, specs, nspecs, type, ifs, LORAD_MAX_PORTS - nports);
+	ifcache_close(&ifc);
+	if (n < 0) {
+		fprintf(stderr, "interfaces: %s\n", strerror(-n));
+		return -1;
+	}
+
+	for (int i = 0; i < n; i++) {
+		struct rt_worker *w = rt_add_worker(&rt, RT_TX, ifs[i].name, proto, flags);
+		if (w == NULL) {
+			fprintf(stderr, "%s: cannot add worker\n", ifs[i].name);
+			return -1;
+		}
+		w->ifindex = ifs[i].ifindex;
+		w->batch = batch;
+		strcpy(ports[nports++], ifs[i].name);
+	}
+	return 0;
+}
+
+/* Pins every port's worker to the first CPU its radio's IRQ is delivered on. */
+static void pin_ports(struct aff_irq *irqs)
+{
+	for (int i = 0; i < nports; i++) {
+		int ret = aff_find_irq(ports[i], &irqs[i]);
+
+		if (ret < 0) {
+			irqs[i].irq = -1;
+			fprintf(stderr, "%s: no IRQ found, not pinned: %s\n", ports[i], strerror(-ret));
+			continue;
+		}
+		rt.workers[i].cpu = aff_first_cpu(&irqs[i].cpus);
+	}
+}
+
+static void print_affinity(const struct aff_irq *irqs, int prio)
+{
+	char cpus[64];
+
+	for (int i = 0; i < nports; i++) {
+		const struct rt_worker *w = &rt.workers[i];
+
+		printf("port %d %s", i, ports[i]);
+		if (irqs && irqs[i].irq >= 0) {
+			aff_format_cpus(&irqs[i].cpus, cpus, sizeof(cpus));
+			printf(" irq %d %s cpus %s", irqs[i].irq, irqs[i].action, cpus);
+		}
+		if (w->cpu >= 0)
+			printf(" worker cpu %d", w->cpu);
+		else
+			printf(" worker unpinned");
+		if (prio)
+			printf(" fifo %d", prio);
+		printf("\n");
+	}
+}
+
+struct profile {
+	char ifname[IFNAMSIZ];
+	unsigned int sf, bw_khz, cr;
+	double duty_pct;
+};
+
+/* ifname:sf:bw_khz[:cr[:duty%]], cr 5..8 as in 4/5..4/8 */
+static int parse_profile(const char *arg, struct profile *p)
+{
+	int n;
+
+	p->cr = 5;
+	p->duty_pct = 0;
+	n = sscanf(arg, "%15[^:]:%u:%u:%u:%lf", p->ifname, &p->sf, &p->bw_khz, &p->cr,
+		   &p->duty_pct);
+	if (n < 3 || p->sf < 6 || p->sf > 12 || p->bw_khz == 0 || p->cr < 5 || p->cr > 8 ||
+	    p->duty_pct < 0 || p->duty_pct > 100)
+		return -1;
+	return 0;
+}
+
+static int apply_profiles(const struct profile *profiles, int nprofiles)
+{
+	for (int i = 0; i < nprofiles; i++) {
+		const struct profile *p = &profiles[i];
+		int port = -1;
+
+		for (int j = 0; j < nports; j++)
+			if (strcmp(ports[j], p->ifname) == 0)
+				port = j;
+		if (port < 0) {
+			fprintf(stderr, "%s: -P for an interface not served\n", p->ifname);
+			return -1;
+		}
+
+		struct dl_radio *r = &sched.radios[port];
+		lora_phy_default(&r->phy, p->sf, p->bw_khz * 1000);
+		r->phy.cr = p->cr - 4;
+		r->airtime = 1;
+		r->duty_ppm = p->duty_pct * 10000;
+	}
+	return 0;
+}
+
+static void print_sched_stats(FILE *f)
+{
+	for (int i = 0; i < nports; i++) {
+		const struct dl_radio *r = &sched.radios[i];
+		const struct dl_radio_stats *st = &r->st;
+
+		if (!r->airtime && !st->sent && !st->missed)
+			continue;
+		fprintf(f, "%s sched sent %llu rx2 %llu missed %llu deferred %llu airtime %.3f s\n",
+			ports[i], (unsigned long long)st->sent, (unsigned long long)st->rx2,
+			(unsigned long long)st->missed, (unsigned long long)st->deferred,
+			st->airtime_ns / 1e9);
+	}
+	if (dl_queued(&sched))
+		fprintf(f, "sched dropped %u queued frames\n", dl_queued(&sched));
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-i ifname]... [-e ifname]... [-P profile]... [-L lead_us] [-q] [-T] [-S path] [-m mode] [-s name] [-b batch] [-C] [-F prio]\n", prog);
+	fprintf(stderr, "  -i  LoRa interface to serve over PF_LORA (default lora0 without -e)\n");
+	fprintf(stderr, "  -e  EnOcean interface to serve over PF_PACKET\n");
+	fprintf(stderr, "      may also be an ifindex, a glob such as \"lora*\" or \"all\", with an optional :count\n");
+	fprintf(stderr, "  -P  ifname:sf:bw_khz[:cr[:duty%%]] radio profile; frames for this port are\n");
+	fprintf(stderr, "      scheduled by time-on-air and duty cycle, e.g. lora0:12:125:5:1\n");
+	fprintf(stderr, "  -L  hand timed frames to the driver this early (default %d us)\n", SCHED_LEAD_US);
+	fprintf(stderr, "  -q  skip the qdisc: -i ports send through PF_PACKET ETH_P_LORA, and\n");
+	fprintf(stderr, "      every port with PACKET_QDISC_BYPASS\n");
+	fprintf(stderr, "  -T  timestamp TX for the latency histograms in the stats segment\n");
+	fprintf(stderr, "  -S  Unix socket to listen on (default %s)\n", LORAD_SOCK_PATH);
+	fprintf(stderr, "  -m  socket file mode (default 0660)\n");
+	fprintf(stderr, "  -s  shared memory stats segment (default %s)\n", LORAD_STATS_NAME);
+	fprintf(stderr, "  -b  frames per sendmmsg() call, 1..%d (default %d)\n", RT_QUEUE_LEN, RT_BATCH);
+	fprintf(stderr, "  -C  run each port's worker on the CPU its radio's IRQ is delivered on\n");
+	fprintf(stderr, "  -F  run the workers and the event loop SCHED_FIFO at prio, memory locked\n");
+}
+
+int main(int argc, char **argv)
+{
+	const char *lora_specs[LORAD_MAX_PORTS], *enocean_specs[LORAD_MAX_PORTS];
+	int nlora = 0, nenocean = 0;
+	struct profile profiles[LORAD_MAX_PORTS];
+	int nprofiles = 0;
+	const char *path = LORAD_SOCK_PATH, *stats_name = LORAD_STATS_NAME;
+	long mode = 0660, batch = RT_BATCH, lead_us = SCHED_LEAD_US;
+	int bypass = 0, tstamp = 0, pin = 0, opt, ret;
+	long prio = 0;
+
+	while ((opt = getopt(argc, argv, "i:e:P:L:qTS:m:s:b:CF:h")) != -1) {
+		switch (opt) {
+		case 'i':
+		case 'e':
+			if (nlora + nenocean == LORAD_MAX_PORTS) {
+				fprintf(stderr, "at most %d interfaces\n", LORAD_MAX_PORTS);
+				return 1;
+			}
+			if (opt == 'i')
+				lora_specs[nlora++] = optarg;
+			else
+				enocean_specs[nenocean++] = optarg;
+			break;
+		case 'P':
+			if (nprofiles == LORAD_MAX_PORTS || parse_profile(optarg, &profiles[nprofiles])) {
+				usage(argv[0]);
+				return 1;
+			}
+			nprofiles++;
+			break;
+		case 'L':
+			lead_us = strtol(optarg, NULL, 0);
+			break;
+		case 'q':
+			bypass = 1;
+			break;
+		case 'T':
+			tstamp = 1;
+			break;
+		case 'S':
+			path = optarg;
+			break;
+		case 'm':
+			mode = strtol(optarg, NULL, 8);
+			break;
+		case 's':
+			stats_name = optarg;
+			break;
+		case 'b':
+			batch = strtol(optarg, NULL, 0);
+			break;
+		case 'C':
+			pin = 1;
+			break;
+		case 'F':
+			prio = strtol(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (optind < argc || batch < 1 || batch > RT_QUEUE_LEN || mode < 0 || mode > 07777 ||
+	    lead_us < 0 || prio < 0 || prio > sched_get_priority_max(SCHED_FIFO)) {
+		usage(argv[0]);
+		return 1;
+	}
+	if (nlora + nenocean == 0)
+		lora_specs[nlora++] = "lora0";
+
+	ret = rt_init(&rt);
+	if (ret < 0) {
+		fprintf(stderr, "rt_init failed: %s\n", strerror(-ret));
+		return 1;
+	}
+	int flags = (bypass ? RT_QDISC_BYPASS : 0) | (tstamp ? RT_TSTAMP : 0);
+	if (add_ports(lora_specs, nlora, ARPHRD_LORA, bypass ? ETH_P_LORA : 0, flags, batch) ||
+	    add_ports(enocean_specs, nenocean, ARPHRD_ENOCEAN, ETH_P_ERP2, flags, batch))
+		return 1;
+	ret = dl_init(&sched, nports, SCHED_FRAMES, lead_us * 1000ULL);
+	if (ret < 0) {
+		fprintf(stderr, "dl_init failed: %s\n", strerror(-ret));
+		return 1;
+	}
+	if (apply_profiles(profiles, nprofiles))
+		return 1;
+
+	ret = ls_create(stats_name, nports, &stats_seg);
+	if (ret < 0) {
+		fprintf(stderr, "%s: %s\n", stats_name, strerror(-ret));
+		return 1;
+	}
+	for (int i = 0; i < nports; i++)
+		rt.workers[i].stats = &stats_seg->ifs[i];
+	ifcache_init(&stats_ifc);
+	ret = ifcache_open(&stats_ifc, 0);
+	if (ret < 0) {
+		fprintf(stderr, "rtnetlink: %s\n", strerror(-ret));
+		return 1;
+	}
+
+	static struct aff_irq irqs[LORAD_MAX_PORTS];
+	if (pin)
+		pin_ports(irqs);
+	if (prio) {
+		/* Before any thread starts, so their stacks are locked too. */
+		ret = aff_lock_memory();
+		if (ret < 0) {
+			fprintf(stderr, "mlockall failed: %s\n", strerror(-ret));
+			return 1;
+		}
+		rt.prio = prio;
+	}
+
+	if (rt_start(&rt))
+		return 1;
+	if (prio) {
+		struct sched_param sp = { .sched_priority = prio };
+
+		ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp);
+		if (ret) {
+			fprintf(stderr, "SCHED_FIFO failed: %s\n", strerror(ret));
+			return 1;
+		}
+	}
+	stats_update();
+	ls_publish(stats_seg);
+
+	ret = evloop_init(&loop);
+	if (ret < 0) {
+		fprintf(stderr, "epoll: %s\n", strerror(-ret));
+		return 1;
+	}
+
+	listen_src.fd = open_listener(path, mode);
+	if (listen_src.fd < 0)
+		return 1;
+	listen_src.fn = accept_clients;
+	rt_src.fd = rt.doorbell;
+	rt_src.fn = rt_readable;
+	timer_src.fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+	timer_src.fn = timer_expired;
+	stats_src.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	stats_src.fn = stats_expired;
+	if (timer_src.fd == -1 || stats_src.fd == -1) {
+		int err = errno;
+		fprintf(stderr, "timerfd_create failed: %s\n", strerror(err));
+		return 1;
+	}
+	struct itimerspec its = {
+		.it_interval = { STATS_MS / 1000, (STATS_MS % 1000) * 1000000L },
+		.it_value = { STATS_MS / 1000, (STATS_MS % 1000) * 1000000L },
+	};
+	timerfd_settime(stats_src.fd, 0, &its, NULL);
+	if ((ret = evloop_add(&loop, &listen_src, EPOLLIN)) < 0 ||
+	    (ret = evloop_add(&loop, &rt_src, EPOLLIN)) < 0 ||
+	    (ret = evloop_add(&loop, &timer_src, EPOLLIN)) < 0 ||
+	    (ret = evloop_add(&loop, &stats_src, EPOLLIN)) < 0) {
+		fprintf(stderr, "epoll_ctl: %s\n", strerror(-ret));
+		return 1;
+	}
+
+	for (int i = 0; i < nports; i++)
+		printf("port %d %s socket %d\n", i, ports[i], rt.workers[i].fd);
+	if (pin || prio)
+		print_affinity(pin ? irqs : NULL, prio);
+	fflush(stdout);
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	uint64_t start = realtime_ns();
+	ret = evloop_run(&loop, -1);
+	if (ret < 0)
+		fprintf(stderr, "epoll_wait: %s\n", strerror(-ret));
+
+	close(listen_src.fd);
+	unlink(path);
+	for (int i = 0; i < MAX_CLIENTS; i++)
+		if (clients[i].used)
+			drop_client(&clients[i]);
+
+	if (rt_drain(&rt, DRAIN_MS) < 0)
+		fprintf(stderr, "TX queues not drained after %d ms\n", DRAIN_MS);
+	double elapsed = (realtime_ns() - start) / 1e9;
+	rt_stop(&rt);
+	rt_join(&rt);
+	stats_update();
+
+	for (int i = 0; i < rt.nworkers; i++)
+		rt_print_stats(stdout, &rt.workers[i], elapsed);
+	print_sched_stats(stdout);
+	printf("clients %llu frames %llu rejected %llu\n", (unsigned long long)total_clients,
+	       (unsigned long long)total_frames, (unsigned long long)total_errors);
+
+	close(timer_src.fd);
+	close(stats_src.fd);
+	ifcache_close(&stats_ifc);
+	ls_destroy(stats_name, stats_seg);
+	dl_free(&sched);
+	evloop_close(&loop);
+	rt_destroy(&rt);
+	return 0;
+}
@@ -0,0 +1,93 @@
+#ifndef LORAD_H
+#define LORAD_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <net/if.h>
+
+/*
+ * lorad wire protocol, shared by the daemon and liblorad.
+ *
+ * A client connects to the daemon's SOCK_SEQPACKET Unix socket and sends
+ * LORAD_OP_HELLO. The reply lists the daemon's ports, one per bound
+ * interface. If the hello asked for LORAD_HELLO_SHM, the reply also
+ * carries three descriptors via SCM_RIGHTS:
+ *
+ *   memfd     a struct lorad_shm TX ring, mapped read/write by both sides
+ *   doorbell  eventfd the client writes after committing slots
+ *   credit    eventfd lorad writes after freeing slots, if need_wakeup
+ *
+ * The ring is single-producer (the client) and single-consumer (lorad).
+ * lorad keeps its own copy of the geometry and bounds-checks every slot,
+ * so a client can only ever hurt its own frames.
+ *
+ * Without shared memory, every LORAD_OP_SEND message is one frame.
+ *
+ * A frame with at_ns set goes out at exactly that CLOCK_REALTIME time,
+ * e.g. a class A RX1 window, or at rx2_at_ns on rx2_port if that window
+ * cannot be met; see dlsched.h.
+ */
+
+#define LORAD_SOCK_PATH		"/run/lorad.sock"
+#define LORAD_MAGIC		0x4c524144	/* "LRAD" */
+#define LORAD_VERSION		2
+
+#define LORAD_MAX_PORTS		16
+#define LORAD_FRAME_MAX		256
+#define LORAD_RING_SLOTS	256
+#define LORAD_CACHE_LINE	64
+
+enum lorad_op {
+	LORAD_OP_HELLO = 1,
+	LORAD_OP_SEND,
+};
+
+#define LORAD_HELLO_SHM		0x0001
+
+struct lorad_req {
+	uint16_t op;
+	uint16_t port;		/* LORAD_OP_SEND */
+	uint16_t flags;		/* LORAD_OP_HELLO */
+	uint16_t len;
+	uint16_t rx2_port;
+	uint16_t reserved[3];
+	uint64_t at_ns;		/* 0: send now */
+	uint64_t rx2_at_ns;	/* 0: no second window */
+	/* LORAD_OP_SEND: len bytes of frame follow */
+};
+
+struct lorad_hello {
+	int32_t err;		/* 0, or a negative errno */
+	uint32_t version;
+	uint32_t nports;
+	uint32_t nslots;	/* 0 without shared memory */
+	char ports[LORAD_MAX_PORTS][IFNAMSIZ];
+};
+
+struct lorad_slot {
+	uint16_t port;
+	uint16_t len;
+	uint16_t rx2_port;
+	uint16_t reserved;
+	uint64_t at_ns;
+	uint64_t rx2_at_ns;
+	unsigned char data[LORAD_FRAME_MAX];
+} __attribute__((aligned(LORAD_CACHE_LINE)));
+
+struct lorad_shm {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t nslots;
+	uint32_t slot_size;
+	_Alignas(LORAD_CACHE_LINE) _Atomic uint32_t head;	/* written by the client */
+	_Atomic uint32_t need_wakeup;				/* set by the client */
+	_Alignas(LORAD_CACHE_LINE) _Atomic uint32_t tail;	/* written by lorad */
+	_Alignas(LORAD_CACHE_LINE) struct lorad_slot slots[];
+};
+
+static inline size_t lorad_shm_size(uint32_t nslots)
+{
+	return sizeof(struct lorad_shm) + (size_t)nslots * sizeof(struct lorad_slot);
+}
+
+#endif
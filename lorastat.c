@@ -0,0 +1,288 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "latency.h"
+#include "lorastats.h"
+
+/*
+ * Reads the lorad stats segment and prints it as text or in the
+ * Prometheus exposition format, e.g. for the node_exporter textfile
+ * collector. Once mapped, every round is a plain copy out of shared
+ * memory.
+ */
+
+enum block {
+	BLK_WORKER,
+	BLK_LINK,
+	BLK_SCHED,
+};
+
+struct metric {
+	const char *name;
+	const char *help;
+	enum block block;
+	size_t off;
+	int gauge;
+	double scale;		/* 0: integer counter */
+};
+
+#define W(f)	BLK_WORKER, offsetof(struct ls_worker, f)
+#define L(f)	BLK_LINK, offsetof(struct ls_link, f)
+#define S(f)	BLK_SCHED, offsetof(struct ls_sched, f)
+
+static const struct metric metrics[] = {
+	{ "lora_worker_frames_total", "Frames through the runtime worker", W(frames), 0, 0 },
+	{ "lora_worker_bytes_total", "Bytes through the runtime worker", W(bytes), 0, 0 },
+	{ "lora_worker_calls_total", "recvmmsg()/sendmmsg() calls", W(calls), 0, 0 },
+	{ "lora_worker_errors_total", "Frames the worker failed on", W(errors), 0, 0 },
+	{ "lora_worker_retries_total", "Sends retried after ENOBUFS or EAGAIN", W(retries), 0, 0 },
+	{ "lora_worker_drops_total", "Socket receive queue drops", W(drops), 0, 0 },
+	{ "lora_link_rx_packets_total", "Netdev RX packets", L(rx_packets), 0, 0 },
+	{ "lora_link_tx_packets_total", "Netdev TX packets", L(tx_packets), 0, 0 },
+	{ "lora_link_rx_bytes_total", "Netdev RX bytes", L(rx_bytes), 0, 0 },
+	{ "lora_link_tx_bytes_total", "Netdev TX bytes", L(tx_bytes), 0, 0 },
+	{ "lora_link_rx_errors_total", "Netdev RX errors", L(rx_errors), 0, 0 },
+	{ "lora_link_tx_errors_total", "Netdev TX errors", L(tx_errors), 0, 0 },
+	{ "lora_link_rx_dropped_total", "Netdev RX drops", L(rx_dropped), 0, 0 },
+	{ "lora_link_tx_dropped_total", "Netdev TX drops", L(tx_dropped), 0, 0 },
+	{ "lora_link_rx_crc_errors_total", "Frames received with a bad CRC", L(rx_crc_errors), 0, 0 },
+	{ "lora_sched_sent_total", "Scheduled frames sent", S(sent), 0, 0 },
+	{ "lora_sched_rx2_total", "Scheduled frames sent in RX2", S(rx2), 0, 0 },
+	{ "lora_sched_missed_total", "Scheduled frames that missed every window", S(missed), 0, 0 },
+	{ "lora_sched_deferred_total", "Untimed frames held back for airtime", S(deferred), 0, 0 },
+	{ "lora_sched_airtime_seconds_total", "Time on air", S(airtime_ns), 0, 1e-9 },
+	{ "lora_sched_duty_wait_seconds", "Time until the duty cycle allows a frame",
+	  S(duty_wait_ns), 1, 1e-9 },
+};
+
+/* Bucket bounds of lora_latency_seconds, in ns */
+static const uint64_t bounds[] = {
+	10000, 100000, 500000, 1000000, 2000000, 5000000, 10000000, 50000000,
+	100000000, 1000000000,
+};
+
+static struct ls_if snap[LS_MAX_IFS];
+static int valid[LS_MAX_IFS];
+
+static const char *dir_name(const struct ls_if *r)
+{
+	return r->flags & LS_TX ? "tx" : "rx";
+}
+
+static int snapshot(const struct ls_segment *seg)
+{
+	int n = seg->nifs;
+
+	for (int i = 0; i < n; i++) {
+		const struct ls_if *r = &seg->ifs[i];
+		struct ls_if *s = &snap[i];
+
+		memcpy(s->ifname, r->ifname, sizeof(s->ifname));
+		s->ifname[IFNAMSIZ - 1] = '\0';
+		s->ifindex = r->ifindex;
+		s->flags = r->flags;
+		valid[i] = ls_read(&r->worker_seq, &s->worker, &r->worker, sizeof(s->worker)) == 0 &&
+			   ls_read(&r->link_seq, &s->link, &r->link, sizeof(s->link)) == 0 &&
+			   ls_read(&r->sched_seq, &s->sched, &r->sched, sizeof(s->sched)) == 0;
+		if (!valid[i])
+			fprintf(stderr, "%s: record busy, skipped\n", s->ifname);
+	}
+	return n;
+}
+
+static const void *block_of(const struct ls_if *s, enum block b)
+{
+	switch (b) {
+	case BLK_WORKER:
+		return &s->worker;
+	case BLK_LINK:
+		return &s->link;
+	default:
+		return &s->sched;
+	}
+}
+
+static void print_hist(const struct ls_if *s, const char *stage, const struct lat_hist *h)
+{
+	const char *labels = "ifname=\"%s\",dir=\"%s\",stage=\"%s\"";
+
+	for (size_t i = 0; i < sizeof(bounds) / sizeof(bounds[0]); i++) {
+		printf("lora_latency_seconds_bucket{");
+		printf(labels, s->ifname, dir_name(s), stage);
+		printf(",le=\"%g\"} %llu\n", bounds[i] / 1e9,
+		       (unsigned long long)lat_hist_count_le(h, bounds[i]));
+	}
+	printf("lora_latency_seconds_bucket{");
+	printf(labels, s->ifname, dir_name(s), stage);
+	printf(",le=\"+Inf\"} %llu\n", (unsigned long long)h->count);
+	printf("lora_latency_seconds_sum{");
+	printf(labels, s->ifname, dir_name(s), stage);
+	printf("} %.9f\n", h->sum / 1e9);
+	printf("lora_latency_seconds_count{");
+	printf(labels, s->ifname, dir_name(s), stage);
+	printf("} %llu\n", (unsigned long long)h->count);
+}
+
+static void print_prometheus(int n)
+{
+	for (size_t m = 0; m < sizeof(metrics) / sizeof(metrics[0]); m++) {
+		const struct metric *mt = &metrics[m];
+
+		printf("# HELP %s %s\n", mt->name, mt->help);
+		printf("# TYPE %s %s\n", mt->name, mt->gauge ? "gauge" : "counter");
+		for (int i = 0; i < n; i++) {
+			const struct ls_if *s = &snap[i];
+			uint64_t v;
+
+			if (!valid[i] || (mt->block == BLK_SCHED && !(s->flags & LS_TX)))
+				continue;
+			memcpy(&v, (const char *)block_of(s, mt->block) + mt->off, sizeof(v));
+			printf("%s{ifname=\"%s\",dir=\"%s\"} ", mt->name, s->ifname, dir_name(s));
+			if (mt->scale)
+				printf("%.9f\n", v * mt->scale);
+			else
+				printf("%llu\n", (unsigned long long)v);
+		}
+	}
+
+	printf("# HELP lora_sched_duty_cycle_ratio Duty-cycle limit of the radio profile\n");
+	printf("# TYPE lora_sched_duty_cycle_ratio gauge\n");
+	for (int i = 0; i < n; i++)
+		if (valid[i] && snap[i].sched.airtime && snap[i].sched.duty_ppm)
+			printf("lora_sched_duty_cycle_ratio{ifname=\"%s\",dir=\"%s\"} %.6f\n",
+			       snap[i].ifname, dir_name(&snap[i]), snap[i].sched.duty_ppm / 1e6);
+
+	printf("# HELP lora_latency_seconds Runtime worker latency by timestamp stage\n");
+	printf("# TYPE lora_latency_seconds histogram\n");
+	for (int i = 0; i < n; i++) {
+		const struct ls_if *s = &snap[i];
+
+		if (!valid[i] || !(s->flags & LS_TSTAMP))
+			continue;
+		print_hist(s, s->flags & LS_TX ? "tx_sched" : "rx_sw", &s->worker.hist_sched);
+		if (s->flags & LS_TX)
+			print_hist(s, "tx_snd", &s->worker.hist_snd);
+		if (s->flags & LS_HWTSTAMP)
+			print_hist(s, s->flags & LS_TX ? "tx_hw" : "rx_hw", &s->worker.hist_hw);
+	}
+}
+
+static void print_text(int n)
+{
+	for (int i = 0; i < n; i++) {
+		const struct ls_if *s = &snap[i];
+		const struct ls_worker *w = &s->worker;
+		const struct ls_link *l = &s->link;
+		const struct ls_sched *d = &s->sched;
+
+		if (!valid[i])
+			continue;
+		printf("%s %s frames %llu bytes %llu calls %llu errors %llu retries %llu drops %llu\n",
+		       s->ifname, dir_name(s), (unsigned long long)w->frames,
+		       (unsigned long long)w->bytes, (unsigned long long)w->calls,
+		       (unsigned long long)w->errors, (unsigned long long)w->retries,
+		       (unsigned long long)w->drops);
+		printf("%s link rx %llu/%llu tx %llu/%llu errors %llu/%llu dropped %llu/%llu crc %llu\n",
+		       s->ifname, (unsigned long long)l->rx_packets, (unsigned long long)l->rx_bytes,
+		       (unsigned long long)l->tx_packets, (unsigned long long)l->tx_bytes,
+		       (unsigned long long)l->rx_errors, (unsigned long long)l->tx_errors,
+		       (unsigned long long)l->rx_dropped, (unsigned long long)l->tx_dropped,
+		       (unsigned long long)l->rx_crc_errors);
+		if (d->airtime || d->sent || d->missed)
+			printf("%s sched sent %llu rx2 %llu missed %llu deferred %llu airtime %.3f s duty %.4f%% wait %.3f s\n",
+			       s->ifname, (unsigned long long)d->sent, (unsigned long long)d->rx2,
+			       (unsigned long long)d->missed, (unsigned long long)d->deferred,
+			       d->airtime_ns / 1e9, d->duty_ppm / 1e4, d->duty_wait_ns / 1e9);
+		if (s->flags & LS_TSTAMP) {
+			lat_hist_print(stdout, s->ifname, s->flags & LS_TX ? "tx_sched" : "rx_sw",
+				       &w->hist_sched);
+			if (s->flags & LS_TX)
+				lat_hist_print(stdout, s->ifname, "tx_snd", &w->hist_snd);
+			if (s->flags & LS_HWTSTAMP)
+				lat_hist_print(stdout, s->ifname, s->flags & LS_TX ? "tx_hw" : "rx_hw",
+					       &w->hist_hw);
+		}
+	}
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-s name] [-p] [-i interval_s]\n", prog);
+	fprintf(stderr, "  -s  stats segment (default %s)\n", LORAD_STATS_NAME);
+	fprintf(stderr, "  -p  Prometheus exposition format\n");
+	fprintf(stderr, "  -i  print again every interval_s seconds\n");
+}
+
+int main(int argc, char **argv)
+{
+	const char *name = LORAD_STATS_NAME;
+	const struct ls_segment *seg = NULL;
+	double interval = 0;
+	int prometheus = 0, opt, ret;
+
+	while ((opt = getopt(argc, argv, "s:pi:h")) != -1) {
+		switch (opt) {
+		case 's':
+			name = optarg;
+			break;
+		case 'p':
+			prometheus = 1;
+			break;
+		case 'i':
+			interval = strtod(optarg, NULL);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (optind < argc || interval < 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	for (;;) {
+		/* lorad restarted or exited: map the current segment. */
+		if (seg && !ls_valid(seg)) {
+			ls_unmap(seg);
+			seg = NULL;
+		}
+		if (seg == NULL) {
+			ret = ls_open(name, &seg);
+			if (ret < 0) {
+				fprintf(stderr, "%s: %s\n", name, strerror(-ret));
+				if (interval == 0)
+					return 1;
+				seg = NULL;
+			}
+		}
+
+		if (seg) {
+			int n = snapshot(seg);
+
+			if (prometheus)
+				print_prometheus(n);
+			else
+				print_text(n);
+			fflush(stdout);
+		}
+		if (interval == 0)
+			break;
+
+		struct timespec ts = {
+			.tv_sec = (time_t)interval,
+			.tv_nsec = (long)((interval - (time_t)interval) * 1e9),
+		};
+		nanosleep(&ts, NULL);
+	}
+
+	ls_unmap(seg);
+	return 0;
+}
@@ -0,0 +1,138 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "lorastats.h"
+
+#define LS_READ_TRIES	1000
+
+int ls_read(const uint32_t *seq, void *dst, const void *src, size_t len)
+{
+	for (int i = 0; i < LS_READ_TRIES; i++) {
+		uint32_t s = __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+
+		if (s & 1) {
+			sched_yield();
+			continue;
+		}
+		memcpy(dst, src, len);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(seq, __ATOMIC_RELAXED) == s)
+			return 0;
+	}
+	return -EBUSY;
+}
+
+/*
+ * Clears the magic of a segment left behind, so its readers reopen, and
+ * unlinks it. It is never truncated: that would SIGBUS readers still
+ * mapping it, while the unlinked copy stays theirs until they let go.
+ */
+static void ls_retire(const char *name)
+{
+	struct ls_segment *seg;
+	struct stat st;
+	int fd;
+
+	fd = shm_open(name, O_RDWR | O_CLOEXEC, 0);
+	if (fd == -1)
+		return;
+	if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(seg->magic)) {
+		seg = mmap(NULL, sizeof(seg->magic), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (seg != MAP_FAILED) {
+			__atomic_store_n(&seg->magic, 0, __ATOMIC_RELEASE);
+			munmap(seg, sizeof(seg->magic));
+		}
+	}
+	close(fd);
+	shm_unlink(name);
+}
+
+int ls_create(const char *name, unsigned int nifs, struct ls_segment **segp)
+{
+	struct ls_segment *seg;
+	struct timespec ts;
+	int fd, err;
+
+	if (nifs > LS_MAX_IFS)
+		return -EINVAL;
+	ls_retire(name);
+	fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	if (fd == -1)
+		return -errno;
+	if (ftruncate(fd, sizeof(*seg)) == -1) {
+		err = errno;
+		close(fd);
+		return -err;
+	}
+	seg = mmap(NULL, sizeof(*seg), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	err = errno;
+	close(fd);
+	if (seg == MAP_FAILED)
+		return -err;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	seg->version = LS_VERSION;
+	seg->size = sizeof(*seg);
+	seg->nifs = nifs;
+	seg->start_ns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	seg->pid = getpid();
+	*segp = seg;
+	return 0;
+}
+
+void ls_publish(struct ls_segment *seg)
+{
+	__atomic_store_n(&seg->magic, LS_MAGIC, __ATOMIC_RELEASE);
+}
+
+void ls_destroy(const char *name, struct ls_segment *seg)
+{
+	__atomic_store_n(&seg->magic, 0, __ATOMIC_RELEASE);
+	ls_unmap(seg);
+	shm_unlink(name);
+}
+
+int ls_open(const char *name, const struct ls_segment **segp)
+{
+	const struct ls_segment *seg;
+	struct stat st;
+	int fd, err;
+
+	fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+	if (fd == -1)
+		return -errno;
+	if (fstat(fd, &st) == -1) {
+		err = errno;
+		close(fd);
+		return -err;
+	}
+	if (st.st_size < (off_t)sizeof(*seg)) {
+		close(fd);
+		return -EPROTO;
+	}
+	seg = mmap(NULL, sizeof(*seg), PROT_READ, MAP_SHARED, fd, 0);
+	err = errno;
+	close(fd);
+	if (seg == MAP_FAILED)
+		return -err;
+
+	if (!ls_valid(seg) || seg->version != LS_VERSION || seg->size != sizeof(*seg) ||
+	    seg->nifs > LS_MAX_IFS) {
+		ls_unmap(seg);
+		return -EPROTO;
+	}
+	*segp = seg;
+	return 0;
+}
+
+void ls_unmap(const struct ls_segment *seg)
+{
+	munmap((void *)seg, sizeof(*seg));
+}
@@ -0,0 +1,138 @@
+#ifndef LORASTATS_H
+#define LORASTATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <net/if.h>
+
+#include "latency.h"
+
+/*
+ * Statistics segment: a POSIX shared memory object holding one record per
+ * daemon port, for exporters to map read-only and copy out without
+ * system calls or locks.
+ *
+ * Every block of a record has a single writer and a sequence counter of
+ * its own, in a cache line of its own: the runtime worker owning the
+ * socket writes the worker block, the daemon's event loop the link and
+ * sched blocks. The counter is odd while its block is being written; a
+ * reader copies the block with ls_read(), which retries until it saw the
+ * same even count before and after the copy. Writers never wait for
+ * readers, so a stuck exporter cannot stall the TX or RX path.
+ *
+ * Times are CLOCK_REALTIME nanoseconds. Functions return 0 or a negative
+ * errno value.
+ */
+
+#define LORAD_STATS_NAME	"/lorad-stats"
+
+#define LS_MAGIC		0x4c535431	/* "LST1" */
+#define LS_VERSION		1
+#define LS_MAX_IFS		16
+#define LS_CACHE_LINE		64
+
+/* Runtime worker counters, see struct rt_stats. */
+struct ls_worker {
+	uint64_t updated_ns;
+	uint64_t frames;
+	uint64_t bytes;
+	uint64_t calls;
+	uint64_t errors;
+	uint64_t retries;
+	uint64_t drops;
+	/* Only with LS_TSTAMP; stages as in rt_print_stats(). */
+	struct lat_hist hist_sched;
+	struct lat_hist hist_snd;
+	struct lat_hist hist_hw;
+};
+
+/* Netdev counters, as in /sys/class/net/<ifname>/statistics. */
+struct ls_link {
+	uint64_t updated_ns;
+	uint64_t rx_packets;
+	uint64_t tx_packets;
+	uint64_t rx_bytes;
+	uint64_t tx_bytes;
+	uint64_t rx_errors;
+	uint64_t tx_errors;
+	uint64_t rx_dropped;
+	uint64_t tx_dropped;
+	uint64_t rx_crc_errors;
+};
+
+/* Downlink scheduler state, see struct dl_radio. */
+struct ls_sched {
+	uint64_t updated_ns;
+	uint64_t sent;
+	uint64_t rx2;
+	uint64_t missed;
+	uint64_t deferred;
+	uint64_t airtime_ns;
+	uint64_t duty_wait_ns;	/* until the duty cycle allows a frame, 0: now */
+	uint32_t duty_ppm;	/* 0: no duty-cycle limit */
+	uint32_t airtime;	/* has a radio profile */
+};
+
+/* Record flags */
+#define LS_TX		0x0001
+#define LS_TSTAMP	0x0002	/* hist_* are filled in */
+#define LS_HWTSTAMP	0x0004
+
+struct ls_if {
+	char ifname[IFNAMSIZ];
+	int32_t ifindex;
+	uint32_t flags;
+
+	_Alignas(LS_CACHE_LINE) uint32_t worker_seq;
+	struct ls_worker worker;
+	_Alignas(LS_CACHE_LINE) uint32_t link_seq;
+	struct ls_link link;
+	_Alignas(LS_CACHE_LINE) uint32_t sched_seq;
+	struct ls_sched sched;
+};
+
+struct ls_segment {
+	uint32_t magic;		/* set last, once the records are named */
+	uint32_t version;
+	uint32_t size;		/* sizeof(struct ls_segment) */
+	uint32_t nifs;
+	uint64_t start_ns;
+	int32_t pid;
+	_Alignas(LS_CACHE_LINE) struct ls_if ifs[LS_MAX_IFS];
+};
+
+static inline void ls_write_begin(uint32_t *seq)
+{
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void ls_write_end(uint32_t *seq)
+{
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Copies a block written between ls_write_begin() and ls_write_end().
+ * -EBUSY if the writer stayed inside the block, e.g. since it died there.
+ */
+int ls_read(const uint32_t *seq, void *dst, const void *src, size_t len);
+
+/* Creates name afresh, zeroed, with nifs records; an older one is retired. */
+int ls_create(const char *name, unsigned int nifs, struct ls_segment **segp);
+/* The writer's last step: readers ignore the segment until this. */
+void ls_publish(struct ls_segment *seg);
+/* Clears the magic, unmaps and unlinks the segment. */
+void ls_destroy(const char *name, struct ls_segment *seg);
+
+/* Maps name read-only; -EPROTO for a segment of another layout. */
+int ls_open(const char *name, const struct ls_segment **segp);
+void ls_unmap(const struct ls_segment *seg);
+
+/* False once the writer exited or restarted; map the name again. */
+static inline int ls_valid(const struct ls_segment *seg)
+{
+	return __atomic_load_n(&seg->magic, __ATOMIC_ACQUIRE) == LS_MAGIC;
+}
+
+#endif
@@ -0,0 +1,392 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_AESNI 1
+#endif
+
+#if defined(__aarch64__) && (defined(__ARM_FEATURE_AES) || defined(__ARM_FEATURE_CRYPTO))
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#ifndef HWCAP_AES
+#define HWCAP_AES (1 << 3)
+#endif
+#define HAVE_ARMV8_CE 1
+#endif
+
+#include "lwcrypto.h"
+
+/* Blocks in flight per engine call; enough to hide the AES latency. */
+#define LANES 8
+
+typedef void (*encrypt_fn)(const struct lw_key *const *keys, const uint8_t (*in)[16],
+			   uint8_t (*out)[16], int n);
+
+static const uint8_t sbox[256] = {
+	0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+	0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+	0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+	0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+	0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+	0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+	0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+	0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+	0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+	0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+	0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+	0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+	0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+	0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+	0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+	0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16,
+};
+
+static inline uint8_t xtime(uint8_t x)
+{
+	return x << 1 ^ (x & 0x80 ? 0x1b : 0);
+}
+
+static void encrypt_block_c(const struct lw_key *k, const uint8_t in[16], uint8_t out[16])
+{
+	uint8_t s[16], t[16];
+
+	for (int i = 0; i < 16; i++)
+		s[i] = in[i] ^ k->rk[0][i];
+
+	for (int r = 1; r <= 10; r++) {
+		/* SubBytes and ShiftRows, state is column-major */
+		for (int c = 0; c < 4; c++)
+			for (int row = 0; row < 4; row++)
+				t[4 * c + row] = sbox[s[4 * ((c + row) & 3) + row]];
+
+		if (r == 10) {
+			for (int i = 0; i < 16; i++)
+				s[i] = t[i] ^ k->rk[r][i];
+			break;
+		}
+
+		for (int c = 0; c < 4; c++) {
+			uint8_t *col = t + 4 * c;
+			uint8_t all = col[0] ^ col[1] ^ col[2] ^ col[3];
+
+			s[4 * c + 0] = col[0] ^ all ^ xtime(col[0] ^ col[1]) ^ k->rk[r][4 * c + 0];
+			s[4 * c + 1] = col[1] ^ all ^ xtime(col[1] ^ col[2]) ^ k->rk[r][4 * c + 1];
+			s[4 * c + 2] = col[2] ^ all ^ xtime(col[2] ^ col[3]) ^ k->rk[r][4 * c + 2];
+			s[4 * c + 3] = col[3] ^ all ^ xtime(col[3] ^ col[0]) ^ k->rk[r][4 * c + 3];
+		}
+	}
+
+	memcpy(out, s, 16);
+}
+
+static void encrypt_c(const struct lw_key *const *keys, const uint8_t (*in)[16],
+		      uint8_t (*out)[16], int n)
+{
+	for (int i = 0; i < n; i++)
+		encrypt_block_c(keys[i], in[i], out[i]);
+}
+
+#ifdef HAVE_AESNI
+/* Rounds outside, lanes inside: independent aesenc chains overlap. */
+__attribute__((target("aes,sse2")))
+static void encrypt_aesni(const struct lw_key *const *keys, const uint8_t (*in)[16],
+			  uint8_t (*out)[16], int n)
+{
+	__m128i s[LANES];
+
+	for (int i = 0; i < n; i++)
+		s[i] = _mm_xor_si128(_mm_loadu_si128((const __m128i *)in[i]),
+				     _mm_load_si128((const __m128i *)keys[i]->rk[0]));
+	for (int r = 1; r < 10; r++)
+		for (int i = 0; i < n; i++)
+			s[i] = _mm_aesenc_si128(s[i], _mm_load_si128((const __m128i *)keys[i]->rk[r]));
+	for (int i = 0; i < n; i++) {
+		s[i] = _mm_aesenclast_si128(s[i], _mm_load_si128((const __m128i *)keys[i]->rk[10]));
+		_mm_storeu_si128((__m128i *)out[i], s[i]);
+	}
+}
+#endif
+
+#ifdef HAVE_ARMV8_CE
+static void encrypt_armv8(const struct lw_key *const *keys, const uint8_t (*in)[16],
+			  uint8_t (*out)[16], int n)
+{
+	uint8x16_t s[LANES];
+
+	for (int i = 0; i < n; i++)
+		s[i] = vld1q_u8(in[i]);
+	for (int r = 0; r < 9; r++)
+		for (int i = 0; i < n; i++)
+			s[i] = vaesmcq_u8(vaeseq_u8(s[i], vld1q_u8(keys[i]->rk[r])));
+	for (int i = 0; i < n; i++) {
+		s[i] = veorq_u8(vaeseq_u8(s[i], vld1q_u8(keys[i]->rk[9])), vld1q_u8(keys[i]->rk[10]));
+		vst1q_u8(out[i], s[i]);
+	}
+}
+#endif
+
+static encrypt_fn engine = encrypt_c;
+static const char *engine_name = "c";
+static pthread_once_t engine_once = PTHREAD_ONCE_INIT;
+
+static void select_engine(void)
+{
+#ifdef HAVE_AESNI
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("aes")) {
+		engine = encrypt_aesni;
+		engine_name = "aesni";
+	}
+#endif
+#ifdef HAVE_ARMV8_CE
+	if (getauxval(AT_HWCAP) & HWCAP_AES) {
+		engine = encrypt_armv8;
+		engine_name = "armv8-ce";
+	}
+#endif
+}
+
+static encrypt_fn get_engine(void)
+{
+	pthread_once(&engine_once, select_engine);
+	return engine;
+}
+
+const char *lw_crypto_engine(void)
+{
+	get_engine();
+	return engine_name;
+}
+
+static void shift_subkey(uint8_t out[16], const uint8_t in[16])
+{
+	uint8_t msb = in[0] & 0x80;
+
+	for (int i = 0; i < 15; i++)
+		out[i] = in[i] << 1 | in[i + 1] >> 7;
+	out[15] = in[15] << 1;
+	if (msb)
+		out[15] ^= 0x87;
+}
+
+void lw_key_init(struct lw_key *k, const uint8_t key[LW_KEY_LEN])
+{
+	static const uint8_t rcon[10] = { 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36 };
+	uint8_t *w = &k->rk[0][0];
+	uint8_t zero[16] = { 0 }, l[16];
+
+	memcpy(w, key, 16);
+	for (int i = 16; i < 176; i += 4) {
+		uint8_t t[4] = { w[i - 4], w[i - 3], w[i - 2], w[i - 1] };
+
+		if (i % 16 == 0) {
+			uint8_t t0 = t[0];
+
+			t[0] = sbox[t[1]] ^ rcon[i / 16 - 1];
+			t[1] = sbox[t[2]];
+			t[2] = sbox[t[3]];
+			t[3] = sbox[t0];
+		}
+		for (int j = 0; j < 4; j++)
+			w[i + j] = w[i - 16 + j] ^ t[j];
+	}
+
+	encrypt_block_c(k, zero, l);
+	shift_subkey(k->k1, l);
+	shift_subkey(k->k2, k->k1);
+}
+
+/*
+ * CMAC over prefix (B0, or nothing for join requests) followed by the
+ * frame without its MIC. The prefix is exactly one block, so every other
+ * block is a plain pointer into the frame except for the last one.
+ */
+struct cmac_lane {
+	const struct lw_key *key;
+	const uint8_t *msg;
+	unsigned int plen;
+	unsigned int nblocks;
+	uint8_t prefix[16];
+	uint8_t last[16];
+};
+
+static void cmac_lane_init(struct cmac_lane *l, const struct lw_mic_job *j, unsigned int mlen)
+{
+	unsigned int total, off, tail;
+
+	l->key = j->key;
+	l->msg = j->frame;
+	l->plen = 0;
+	if (!j->join) {
+		memset(l->prefix, 0, sizeof(l->prefix));
+		l->prefix[0] = 0x49;
+		l->prefix[5] = j->dir;
+		l->prefix[6] = j->devaddr;
+		l->prefix[7] = j->devaddr >> 8;
+		l->prefix[8] = j->devaddr >> 16;
+		l->prefix[9] = j->devaddr >> 24;
+		l->prefix[10] = j->fcnt;
+		l->prefix[11] = j->fcnt >> 8;
+		l->prefix[12] = j->fcnt >> 16;
+		l->prefix[13] = j->fcnt >> 24;
+		l->prefix[15] = mlen;
+		l->plen = 16;
+	}
+
+	total = l->plen + mlen;
+	l->nblocks = total ? (total + 15) / 16 : 1;
+	off = (l->nblocks - 1) * 16;
+	tail = total - off;
+
+	/* off is block aligned and the prefix is a single block. */
+	if (off < l->plen)
+		memcpy(l->last, l->prefix, 16);
+	else
+		memcpy(l->last, l->msg + off - l->plen, tail);
+
+	if (total && tail == 16) {
+		for (int i = 0; i < 16; i++)
+			l->last[i] ^= l->key->k1[i];
+	} else {
+		l->last[tail] = 0x80;
+		memset(l->last + tail + 1, 0, 15 - tail);
+		for (int i = 0; i < 16; i++)
+			l->last[i] ^= l->key->k2[i];
+	}
+}
+
+static const uint8_t *cmac_block(const struct cmac_lane *l, unsigned int b)
+{
+	if (b == l->nblocks - 1)
+		return l->last;
+	if (b * 16 < l->plen)
+		return l->prefix;
+	return l->msg + b * 16 - l->plen;
+}
+
+static void cmac_lanes(encrypt_fn enc, struct cmac_lane *lanes, int n, uint8_t (*mac)[16])
+{
+	const struct lw_key *keys[LANES];
+	uint8_t in[LANES][16];
+	int idx[LANES];
+	unsigned int maxb = 0;
+
+	memset(mac, 0, (size_t)n * 16);
+	for (int i = 0; i < n; i++)
+		if (lanes[i].nblocks > maxb)
+			maxb = lanes[i].nblocks;
+
+	for (unsigned int b = 0; b < maxb; b++) {
+		int m = 0;
+
+		for (int i = 0; i < n; i++) {
+			const uint8_t *blk;
+
+			if (b >= lanes[i].nblocks)
+				continue;
+			blk = cmac_block(&lanes[i], b);
+			for (int k = 0; k < 16; k++)
+				in[m][k] = mac[i][k] ^ blk[k];
+			keys[m] = lanes[i].key;
+			idx[m++] = i;
+		}
+		enc(keys, (const uint8_t (*)[16])in, in, m);
+		for (int k = 0; k < m; k++)
+			memcpy(mac[idx[k]], in[k], 16);
+	}
+}
+
+void lw_mic_verify_batch(struct lw_mic_job *jobs, int n)
+{
+	encrypt_fn enc = get_engine();
+	struct cmac_lane lanes[LANES];
+	struct lw_mic_job *lj[LANES];
+	uint8_t mac[LANES][16];
+	int m = 0;
+
+	for (int i = 0; i < n; i++) {
+		struct lw_mic_job *j = &jobs[i];
+
+		j->ok = 0;
+		if (j->len < 5 || (!j->join && j->len - 4 > 255))
+			continue;
+		cmac_lane_init(&lanes[m], j, j->len - 4);
+		lj[m++] = j;
+
+		if (m == LANES) {
+			cmac_lanes(enc, lanes, m, mac);
+			for (int k = 0; k < m; k++)
+				lj[k]->ok = !memcmp(mac[k], lj[k]->frame + lj[k]->len - 4, 4);
+			m = 0;
+		}
+	}
+	if (m) {
+		cmac_lanes(enc, lanes, m, mac);
+		for (int k = 0; k < m; k++)
+			lj[k]->ok = !memcmp(mac[k], lj[k]->frame + lj[k]->len - 4, 4);
+	}
+}
+
+uint32_t lw_mic(const struct lw_key *k, const uint8_t *frame, unsigned int len,
+		uint8_t dir, uint32_t devaddr, uint32_t fcnt)
+{
+	struct lw_mic_job j = {
+		.key = k, .frame = frame, .dir = dir, .devaddr = devaddr, .fcnt = fcnt,
+	};
+	struct cmac_lane l;
+	uint8_t mac[1][16];
+
+	cmac_lane_init(&l, &j, len);
+	cmac_lanes(get_engine(), &l, 1, mac);
+	return mac[0][0] | mac[0][1] << 8 | mac[0][2] << 16 | (uint32_t)mac[0][3] << 24;
+}
+
+/* Keystream blocks A_i for all jobs are encrypted LANES at a time. */
+void lw_crypt_batch(struct lw_ctr_job *jobs, int n)
+{
+	encrypt_fn enc = get_engine();
+	const struct lw_key *keys[LANES];
+	uint8_t a[LANES][16];
+	uint8_t *dst[LANES];
+	unsigned int dlen[LANES];
+	int m = 0;
+
+	for (int i = 0; i < n; i++) {
+		struct lw_ctr_job *j = &jobs[i];
+
+		for (unsigned int off = 0, blk = 1; off < j->len; off += 16, blk++) {
+			memset(a[m], 0, 16);
+			a[m][0] = 0x01;
+			a[m][5] = j->dir;
+			a[m][6] = j->devaddr;
+			a[m][7] = j->devaddr >> 8;
+			a[m][8] = j->devaddr >> 16;
+			a[m][9] = j->devaddr >> 24;
+			a[m][10] = j->fcnt;
+			a[m][11] = j->fcnt >> 8;
+			a[m][12] = j->fcnt >> 16;
+			a[m][13] = j->fcnt >> 24;
+			a[m][15] = blk;
+			keys[m] = j->key;
+			dst[m] = j->payload + off;
+			dlen[m] = j->len - off < 16 ? j->len - off : 16;
+
+			if (++m == LANES) {
+				enc(keys, (const uint8_t (*)[16])a, a, m);
+				for (int k = 0; k < m; k++)
+					for (unsigned int b = 0; b < dlen[k]; b++)
+						dst[k][b] ^= a[k][b];
+				m = 0;
+			}
+		}
+	}
+	if (m) {
+		enc(keys, (const uint8_t (*)[16])a, a, m);
+		for (int k = 0; k < m; k++)
+			for (unsigned int b = 0; b < dlen[k]; b++)
+				dst[k][b] ^= a[k][b];
+	}
+}
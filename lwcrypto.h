@@ -0,0 +1,63 @@
+#ifndef LWCRYPTO_H
+#define LWCRYPTO_H
+
+#include <stdint.h>
+
+/*
+ * LoRaWAN 1.0.x frame crypto: AES-128 CMAC for the MIC and AES-128 CTR
+ * for FRMPayload. Keys are expanded once into an lw_key and reused for
+ * every frame of a session; jobs are processed a batch at a time so the
+ * AES units can work on several frames in parallel.
+ *
+ * The engine (AES-NI, ARMv8 Crypto Extensions or portable C) is picked
+ * once, on first use.
+ */
+
+#define LW_KEY_LEN	16
+#define LW_DIR_UP	0
+#define LW_DIR_DOWN	1
+
+struct lw_key {
+	_Alignas(16) uint8_t rk[11][16];	/* AES-128 round keys */
+	uint8_t k1[16];				/* CMAC subkeys */
+	uint8_t k2[16];
+};
+
+void lw_key_init(struct lw_key *k, const uint8_t key[LW_KEY_LEN]);
+
+/*
+ * MIC check of one received frame, MIC included in len. For data frames
+ * the B0 block is built from dir, devaddr and the full 32-bit fcnt; join
+ * requests set join and leave those alone. ok is the result.
+ */
+struct lw_mic_job {
+	const struct lw_key *key;
+	const uint8_t *frame;
+	unsigned int len;
+	uint8_t dir;
+	uint8_t join;
+	uint32_t devaddr;
+	uint32_t fcnt;
+	int ok;
+};
+
+/* FRMPayload en/decryption in place; both directions are the same. */
+struct lw_ctr_job {
+	const struct lw_key *key;
+	uint8_t *payload;
+	unsigned int len;
+	uint8_t dir;
+	uint32_t devaddr;
+	uint32_t fcnt;
+};
+
+void lw_mic_verify_batch(struct lw_mic_job *jobs, int n);
+void lw_crypt_batch(struct lw_ctr_job *jobs, int n);
+
+/* MIC of frame[0..len), as it goes in the last four bytes on air. */
+uint32_t lw_mic(const struct lw_key *k, const uint8_t *frame, unsigned int len,
+		uint8_t dir, uint32_t devaddr, uint32_t fcnt);
+
+const char *lw_crypto_engine(void);
+
+#endif
@@ -0,0 +1,500 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/netlink.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+/*
+ * Loads a module stack and records when each module's init returned,
+ * when its devices were bound (probe done) and when its netdevs appeared
+ * and answered SIOCGIFINDEX. Bind and netdev uevents are picked up by a
+ * listener thread while finit_module() runs, so asynchronous probes are
+ * timed too. The result is a Chrome trace (chrome://tracing, Perfetto).
+ */
+
+#define MAX_STEPS	64
+#define MAX_EVENTS	256
+#define UEVENT_BUF	8192
+#define SETTLE_MS	2000
+
+enum step_kind {
+	STEP_INSMOD,
+	STEP_EXEC,	/* modprobe and anything else, run through sh */
+};
+
+struct step {
+	enum step_kind kind;
+	char path[PATH_MAX];
+	char params[256];
+	char module[64];
+	uint64_t start_ns;
+	uint64_t end_ns;
+	int err;
+};
+
+enum event_kind {
+	EV_BIND,
+	EV_NETDEV,
+};
+
+struct event {
+	enum event_kind kind;
+	uint64_t ns;
+	uint64_t ready_ns;	/* EV_NETDEV: SIOCGIFINDEX answered */
+	int step;		/* step that was running, or the last one */
+	char module[64];
+	char name[64];		/* device or interface */
+};
+
+static struct step steps[MAX_STEPS];
+static int nsteps;
+static _Atomic int current_step = -1;
+
+static struct event events[MAX_EVENTS];
+static int nevents;
+static pthread_mutex_t events_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t t0;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void module_name(char *dst, size_t len, const char *path)
+{
+	char tmp[PATH_MAX];
+	char *base, *dot;
+
+	snprintf(tmp, sizeof(tmp), "%s", path);
+	base = basename(tmp);
+	dot = strstr(base, ".ko");
+	if (dot)
+		*dot = '\0';
+	snprintf(dst, len, "%s", base);
+	for (char *p = dst; *p; p++)
+		if (*p == '-')
+			*p = '_';
+}
+
+/* Module owning a sysfs driver link, or "" for built-in drivers. */
+static void link_module(char *dst, size_t len, const char *path)
+{
+	char target[PATH_MAX];
+	ssize_t n;
+
+	n = readlink(path, target, sizeof(target) - 1);
+	if (n < 0) {
+		dst[0] = '\0';
+		return;
+	}
+	target[n] = '\0';
+	snprintf(dst, len, "%s", basename(target));
+}
+
+static const char *uevent_get(const char *buf, size_t len, const char *key)
+{
+	size_t klen = strlen(key);
+
+	for (size_t off = strlen(buf) + 1; off < len; off += strlen(buf + off) + 1)
+		if (!strncmp(buf + off, key, klen) && buf[off + klen] == '=')
+			return buf + off + klen + 1;
+	return NULL;
+}
+
+static uint64_t wait_ifindex(int ctl, const char *ifname)
+{
+	struct ifreq ifr;
+
+	memset(&ifr, 0, sizeof(ifr));
+	snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", ifname);
+	for (int i = 0; i < 1000; i++) {
+		if (ioctl(ctl, SIOCGIFINDEX, &ifr) == 0)
+			return now_ns();
+		usleep(1000);
+	}
+	return 0;
+}
+
+static void handle_uevent(int ctl, const char *buf, size_t len, uint64_t ns)
+{
+	const char *action_end = strchr(buf, '@');
+	const char *subsys = uevent_get(buf, len, "SUBSYSTEM");
+	char path[PATH_MAX];
+	struct event ev;
+
+	if (action_end == NULL || subsys == NULL)
+		return;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.ns = ns;
+	ev.step = current_step;
+
+	if (!strncmp(buf, "bind@", 5)) {
+		const char *driver = uevent_get(buf, len, "DRIVER");
+		const char *dev = strrchr(buf, '/');
+
+		if (driver == NULL || dev == NULL)
+			return;
+		ev.kind = EV_BIND;
+		snprintf(ev.name, sizeof(ev.name), "%s", dev + 1);
+		snprintf(path, sizeof(path), "/sys/bus/%s/drivers/%s/module", subsys, driver);
+		link_module(ev.module, sizeof(ev.module), path);
+	} else if (!strncmp(buf, "add@", 4) && !strcmp(subsys, "net")) {
+		const char *ifname = uevent_get(buf, len, "INTERFACE");
+
+		if (ifname == NULL)
+			return;
+		ev.kind = EV_NETDEV;
+		snprintf(ev.name, sizeof(ev.name), "%s", ifname);
+		snprintf(path, sizeof(path), "/sys/class/net/%s/device/driver/module", ifname);
+		link_module(ev.module, sizeof(ev.module), path);
+		ev.ready_ns = wait_ifindex(ctl, ifname);
+	} else {
+		return;
+	}
+
+	/* Virtual devices have no driver link; blame the module being loaded. */
+	if (ev.module[0] == '\0' && ev.step >= 0)
+		snprintf(ev.module, sizeof(ev.module), "%s", steps[ev.step].module);
+
+	pthread_mutex_lock(&events_lock);
+	if (nevents < MAX_EVENTS)
+		events[nevents++] = ev;
+	pthread_mutex_unlock(&events_lock);
+}
+
+static void *uevent_thread(void *arg)
+{
+	int nl = *(int *)arg;
+	static char buf[UEVENT_BUF];
+	int ctl = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+
+	for (;;) {
+		ssize_t n = recv(nl, buf, sizeof(buf) - 1, 0);
+		uint64_t ns = now_ns();
+
+		if (n < 0) {
+			if (errno == EINTR || errno == ENOBUFS)
+				continue;
+			break;
+		}
+		buf[n] = '\0';
+		handle_uevent(ctl, buf, n, ns);
+	}
+
+	close(ctl);
+	return NULL;
+}
+
+static int open_uevent_socket(void)
+{
+	struct sockaddr_nl addr;
+	int size = 1 << 20;
+
+	int nl = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+	if (nl == -1) {
+		int err = errno;
+		fprintf(stderr, "uevent socket failed: %s\n", strerror(err));
+		return -1;
+	}
+	if (setsockopt(nl, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) == -1)
+		setsockopt(nl, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = 1;
+	if (bind(nl, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+		int err = errno;
+		fprintf(stderr, "uevent bind failed: %s\n", strerror(err));
+		close(nl);
+		return -1;
+	}
+	return nl;
+}
+
+static int add_step(enum step_kind kind, const char *path, const char *params)
+{
+	struct step *s;
+
+	if (nsteps == MAX_STEPS) {
+		fprintf(stderr, "more than %d steps\n", MAX_STEPS);
+		return -1;
+	}
+	s = &steps[nsteps++];
+	memset(s, 0, sizeof(*s));
+	s->kind = kind;
+	snprintf(s->path, sizeof(s->path), "%s", path);
+	snprintf(s->params, sizeof(s->params), "%s", params ? params : "");
+	if (kind == STEP_INSMOD) {
+		module_name(s->module, sizeof(s->module), path);
+	} else {
+		char tmp[sizeof(s->module)];
+
+		/* "modprobe crc8" -> crc8 */
+		if (sscanf(path, "%*s %63s", tmp) == 1)
+			snprintf(s->module, sizeof(s->module), "%s", tmp);
+		else
+			snprintf(s->module, sizeof(s->module), "%s", path);
+	}
+	return 0;
+}
+
+/*
+ * Takes the insmod and modprobe lines of load.sh and friends, with ${BDIR}
+ * replaced; rmmod lines are skipped, so unload the stack beforehand.
+ */
+static int parse_script(const char *path, const char *bdir)
+{
+	char line[1024];
+
+	FILE *f = fopen(path, "r");
+	if (f == NULL) {
+		int err = errno;
+		fprintf(stderr, "%s: %s\n", path, strerror(err));
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		char expanded[PATH_MAX + 256], *p, *ko, *params;
+		size_t o = 0;
+
+		line[strcspn(line, "\n")] = '\0';
+		for (p = line; *p && o < sizeof(expanded) - 1; ) {
+			if (!strncmp(p, "${BDIR}", 7)) {
+				o += snprintf(expanded + o, sizeof(expanded) - o, "%s", bdir);
+				p += 7;
+			} else {
+				expanded[o++] = *p++;
+			}
+		}
+		expanded[o < sizeof(expanded) ? o : sizeof(expanded) - 1] = '\0';
+
+		p = expanded + strspn(expanded, " \t");
+		if (!strncmp(p, "insmod ", 7)) {
+			ko = strtok(p + 7, " \t");
+			params = strtok(NULL, "");
+			if (ko == NULL || add_step(STEP_INSMOD, ko, params)) {
+				fclose(f);
+				return -1;
+			}
+		} else if (!strncmp(p, "modprobe ", 9)) {
+			if (add_step(STEP_EXEC, p, NULL)) {
+				fclose(f);
+				return -1;
+			}
+		}
+	}
+
+	fclose(f);
+	return 0;
+}
+
+static int run_insmod(struct step *s)
+{
+	int fd = open(s->path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return -errno;
+
+	int ret = syscall(SYS_finit_module, fd, s->params, 0);
+	int err = ret ? -errno : 0;
+
+	close(fd);
+	return err;
+}
+
+/* Returns the exit status, or a negative errno if it could not run. */
+static int run_exec(struct step *s)
+{
+	int status;
+	pid_t pid = fork();
+
+	if (pid == -1)
+		return -errno;
+	if (pid == 0) {
+		execl("/bin/sh", "sh", "-c", s->path, (char *)NULL);
+		_exit(127);
+	}
+	if (waitpid(pid, &status, 0) == -1)
+		return -errno;
+	return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+static double rel_us(uint64_t ns)
+{
+	return ns > t0 ? (ns - t0) / 1e3 : 0.0;
+}
+
+static void write_trace(FILE *f)
+{
+	fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"init\"}},\n");
+	fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"probe\"}},\n");
+	fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":3,\"args\":{\"name\":\"netdev\"}}");
+
+	for (int i = 0; i < nsteps; i++) {
+		struct step *s = &steps[i];
+
+		fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,"
+			"\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"path\":\"%s\",\"params\":\"%s\",\"err\":%d}}",
+			s->module, s->kind == STEP_INSMOD ? "insmod" : "exec", rel_us(s->start_ns),
+			(s->end_ns - s->start_ns) / 1e3, s->path, s->params, s->err);
+	}
+
+	for (int i = 0; i < nevents; i++) {
+		struct event *e = &events[i];
+		uint64_t start = e->step >= 0 ? steps[e->step].start_ns : t0;
+		uint64_t end = e->kind == EV_NETDEV && e->ready_ns ? e->ready_ns : e->ns;
+
+		fprintf(f, ",\n{\"name\":\"%s %s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+			"\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"module\":\"%s\",\"uevent_us\":%.3f}}",
+			e->module, e->name, e->kind == EV_BIND ? "probe" : "netdev",
+			e->kind == EV_BIND ? 2 : 3, rel_us(start), (end - start) / 1e3,
+			e->module, rel_us(e->ns));
+	}
+
+	fprintf(f, "\n]}\n");
+}
+
+static void print_summary(void)
+{
+	printf("%-24s %10s %10s %-10s %10s\n", "module", "init_ms", "probe_ms", "netdev", "ready_ms");
+	for (int i = 0; i < nsteps; i++) {
+		struct step *s = &steps[i];
+		int shown = 0;
+
+		for (int j = 0; j < nevents; j++) {
+			struct event *e = &events[j];
+
+			if (strcmp(e->module, s->module))
+				continue;
+			printf("%-24s %10.3f %10.3f %-10s %10.3f\n", s->module,
+			       (s->end_ns - s->start_ns) / 1e6, (e->ns - s->start_ns) / 1e6,
+			       e->kind == EV_NETDEV ? e->name : "-",
+			       e->kind == EV_NETDEV && e->ready_ns ?
+			       (e->ready_ns - s->start_ns) / 1e6 : 0.0);
+			shown = 1;
+		}
+		if (!shown)
+			printf("%-24s %10.3f %10s %-10s %10s%s\n", s->module,
+			       (s->end_ns - s->start_ns) / 1e6, "-", "-", "-",
+			       s->err ? (s->err == -EEXIST ? " (already loaded)" : " (failed)") : "");
+	}
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-o trace.json] [-t settle_ms] [-B bdir] script.sh|module.ko...\n", prog);
+	fprintf(stderr, "  -o  Chrome trace output (default modtrace.json)\n");
+	fprintf(stderr, "  -t  wait this long after the last module for async probes (default %d)\n",
+		SETTLE_MS);
+	fprintf(stderr, "  -B  value of ${BDIR} in scripts (default linux)\n");
+	fprintf(stderr, "Scripts contribute their insmod and modprobe lines; unload the stack first.\n");
+}
+
+int main(int argc, char **argv)
+{
+	const char *out = "modtrace.json", *bdir = "linux";
+	long settle_ms = SETTLE_MS;
+	int opt, failed = 0;
+
+	while ((opt = getopt(argc, argv, "o:t:B:h")) != -1) {
+		switch (opt) {
+		case 'o':
+			out = optarg;
+			break;
+		case 't':
+			settle_ms = strtol(optarg, NULL, 0);
+			break;
+		case 'B':
+			bdir = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (optind == argc || settle_ms < 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	for (int i = optind; i < argc; i++) {
+		size_t len = strlen(argv[i]);
+		int ret;
+
+		if (len > 3 && !strcmp(argv[i] + len - 3, ".ko"))
+			ret = add_step(STEP_INSMOD, argv[i], NULL);
+		else
+			ret = parse_script(argv[i], bdir);
+		if (ret)
+			return 1;
+	}
+
+	if (nsteps == 0) {
+		fprintf(stderr, "no insmod or modprobe steps found\n");
+		return 1;
+	}
+
+	int nl = open_uevent_socket();
+	if (nl == -1)
+		return 1;
+
+	pthread_t thread;
+	int ret = pthread_create(&thread, NULL, uevent_thread, &nl);
+	if (ret) {
+		fprintf(stderr, "pthread_create failed: %s\n", strerror(ret));
+		return 1;
+	}
+
+	t0 = now_ns();
+	for (int i = 0; i < nsteps; i++) {
+		struct step *s = &steps[i];
+
+		current_step = i;
+		s->start_ns = now_ns();
+		s->err = s->kind == STEP_INSMOD ? run_insmod(s) : run_exec(s);
+		s->end_ns = now_ns();
+		if (s->err > 0) {
+			fprintf(stderr, "%s: exit status %d\n", s->path, s->err);
+			failed = 1;
+		} else if (s->err && s->err != -EEXIST) {
+			fprintf(stderr, "%s: %s\n", s->path, strerror(-s->err));
+			failed = 1;
+		}
+	}
+
+	usleep(settle_ms * 1000);
+	pthread_mutex_lock(&events_lock);
+
+	FILE *f = fopen(out, "w");
+	if (f == NULL) {
+		int err = errno;
+		fprintf(stderr, "%s: %s\n", out, strerror(err));
+		return 1;
+	}
+	write_trace(f);
+	fclose(f);
+
+	print_summary();
+	printf("total %.3f ms, trace written to %s\n", (steps[nsteps - 1].end_ns - t0) / 1e6, out);
+
+	return failed;
+}
@@ -1,140 +1,492 @@
 #include <errno.h>
+#include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <linux/socket.h>
-#include <sys/ioctl.h>
-#include <net/if.h>
-
-#include <netlink/netlink.h>
-#include <netlink/genl/genl.h>
-#include <netlink/genl/ctrl.h>
+#include <sys/socket.h>
 
 #include "include/linux/lora.h"
-#include "include/linux/nllora.h"
+#include "evloop.h"
+#include "ifcache.h"
+#include "libnllora.h"
+
+#ifndef AF_LORA
+#define AF_LORA 28
+#endif
+
+#ifndef PF_LORA
+#define PF_LORA AF_LORA
+#endif
+
+#define MONITOR_MAX_IFACES	16
 
-static struct nla_policy my_policy[NLLORA_ATTR_MAX + 1] = {
-	[NLLORA_ATTR_IFINDEX] = { .type = NLA_U32 },
-	[NLLORA_ATTR_FREQ] = { .type = NLA_U32 },
+struct command {
+	const char *name;
+	const char *args;
+	int (*fn)(struct nllora_client *c, int argc, char **argv);
 };
 
-static int seq_check(struct nl_msg *msg, void *arg)
+static uint64_t now_ns(void)
 {
-	return NL_OK;
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Expands ifname, ifindex, glob and "all[:count]" arguments against the
+ * client's rtnetlink cache and resolves each entry to an ifindex.
+ */
+static int expand_ifaces(struct nllora_client *c, char **specs, int nspecs,
+			 struct ifc_entry *out, int max)
+{
+	struct ifcache *ifc = nllora_ifcache(c);
+	int n;
+
+	if (ifc == NULL) {
+		fprintf(stderr, "rtnetlink link dump failed\n");
+		return -1;
+	}
+
+	n = ifcache_expand_list(ifc, (const char *const *)specs, nspecs,
+				ARPHRD_LORA, out, max);
+	if (n < 0) {
+		fprintf(stderr, "interfaces: %s\n", strerror(-n));
+		return -1;
+	}
+
+	for (int i = 0; i < n; i++) {
+		if (out[i].ifindex)
+			continue;
+		int ifindex = nllora_ifindex(c, out[i].name);
+		if (ifindex < 0) {
+			fprintf(stderr, "%s: %s\n", out[i].name, strerror(-ifindex));
+			return -1;
+		}
+		out[i].ifindex = ifindex;
+	}
+	return n;
 }
 
-static int print_msg(struct nl_msg *msg, void *arg)
+/*
+ * Commands return 0 on success, 1 on failure and -1 on a usage error.
+ *
+ * get [-n iterations] [ifname...]
+ */
+static int cmd_get(struct nllora_client *c, int argc, char **argv)
 {
-	struct nlattr *attr[NLLORA_ATTR_MAX + 1];
+	char *def_ifname[] = { "lora0" };
+	char **specs = def_ifname;
+	int nspecs = 1;
+	struct ifc_entry ifs[IFC_MAX];
+	int nifs;
+	long iterations = 1;
+	int opt;
 
-	genlmsg_parse(nlmsg_hdr(msg), 0, attr, NLLORA_ATTR_MAX, my_policy);
+	optind = 1;
+	while ((opt = getopt(argc, argv, "n:")) != -1) {
+		switch (opt) {
+		case 'n':
+			iterations = strtol(optarg, NULL, 0);
+			break;
+		default:
+			return -1;
+		}
+	}
+	if (iterations < 1)
+		return -1;
+	if (optind < argc) {
+		specs = argv + optind;
+		nspecs = argc - optind;
+	}
 
-	printf("received!\n");
+	nifs = expand_ifaces(c, specs, nspecs, ifs, IFC_MAX);
+	if (nifs < 0)
+		return 1;
 
-	nl_msg_dump(msg, stdout);
+	for (int i = 0; i < nifs; i++) {
+		const char *ifname = ifs[i].name;
+		int ifindex = ifs[i].ifindex;
 
-	if (attr[NLLORA_ATTR_FREQ])
-		printf("frequency: %u\n", nla_get_u32(attr[NLLORA_ATTR_FREQ]));
+		printf("%s ifindex %d\n", ifname, ifindex);
+
+		uint64_t lat_min = UINT64_MAX, lat_max = 0, lat_sum = 0;
+		uint32_t freq = 0;
+		for (long n = 0; n < iterations; n++) {
+			uint64_t t0 = now_ns();
+			int ret = nllora_get_freq(c, ifindex, &freq);
+			uint64_t lat = now_ns() - t0;
+			if (ret < 0) {
+				fprintf(stderr, "%s: get_freq: %s\n", ifname, strerror(-ret));
+				return 1;
+			}
+			lat_sum += lat;
+			if (lat < lat_min)
+				lat_min = lat;
+			if (lat > lat_max)
+				lat_max = lat;
+		}
+
+		printf("frequency: %u\n", freq);
+		if (iterations > 1)
+			printf("%ld queries, latency min/avg/max %.1f/%.1f/%.1f us\n",
+			       iterations, lat_min / 1e3, lat_sum / 1e3 / iterations,
+			       lat_max / 1e3);
+	}
 
-	return NL_OK;
+	return 0;
 }
 
-int main(void)
+/* dump: one batched query covering every LoRa netdev */
+static int cmd_dump(struct nllora_client *c, int argc, char **argv)
 {
-	struct ifreq ifr;
-	int skt;
-	struct nl_sock *sk;
-	struct nl_msg *msg;
-	struct nl_cb *cb;
-	void *ptr;
-	int family_id, ret;
+	struct nllora_ifinfo info[64];
+	int n;
 
-	skt = socket(PF_LORA, SOCK_DGRAM, 1);
-	if (skt == -1) {
-		int err = errno;
-		fprintf(stderr, "socket failed: %s\n", strerror(err));
+	if (argc > 1)
+		return -1;
+
+	uint64_t t0 = now_ns();
+	n = nllora_dump(c, info, sizeof(info) / sizeof(info[0]));
+	uint64_t lat = now_ns() - t0;
+	if (n < 0) {
+		fprintf(stderr, "dump: %s\n", strerror(-n));
 		return 1;
 	}
 
-	strcpy(ifr.ifr_name, "lora0");
-	ret = ioctl(skt, SIOCGIFINDEX, &ifr);
-	if (ret == -1) {
-		int err = errno;
-		fprintf(stderr, "ioctl failed: %s\n", strerror(err));
-		return 1;
+	for (int i = 0; i < n; i++) {
+		if (info[i].err)
+			printf("%s ifindex %d error: %s\n", info[i].name,
+			       info[i].ifindex, strerror(-info[i].err));
+		else
+			printf("%s ifindex %d frequency: %u\n", info[i].name,
+			       info[i].ifindex, info[i].freq);
 	}
-	printf("ifindex %d\n", ifr.ifr_ifindex);
+	printf("%d interfaces in %.1f us\n", n, lat / 1e3);
 
-	sk = nl_socket_alloc();
-	if (sk == NULL) {
-		fprintf(stderr, "nl_socket_alloc\n");
-		return 1;
+	return 0;
+}
+
+static int parse_setting(struct nllora_params *p, const char *arg)
+{
+	const char *eq = strchr(arg, '=');
+	char *end;
+	long v;
+
+	if (eq == NULL)
+		return -1;
+	v = strtol(eq + 1, &end, 0);
+	if (*end != '\0' || end == eq + 1)
+		return -1;
+
+	if (strncmp(arg, "freq=", 5) == 0 && v > 0) {
+		p->freq = v;
+		p->mask |= NLLORA_SET_FREQ;
+	} else if (strncmp(arg, "sf=", 3) == 0 && v >= 5 && v <= 12) {
+		p->sf = v;
+		p->mask |= NLLORA_SET_SF;
+	} else if (strncmp(arg, "bw=", 3) == 0 && v > 0) {
+		p->bw = v;
+		p->mask |= NLLORA_SET_BW;
+	} else if (strncmp(arg, "power=", 6) == 0 && v >= -30 && v <= 30) {
+		p->tx_power = v;
+		p->mask |= NLLORA_SET_TX_POWER;
+	} else if (strncmp(arg, "sync=", 5) == 0 && v >= 0 && v <= 0xff) {
+		p->sync_word = v;
+		p->mask |= NLLORA_SET_SYNC_WORD;
+	} else {
+		return -1;
 	}
+	return 0;
+}
 
-	ret = genl_connect(sk);
-	if (ret < 0) {
-		fprintf(stderr, "nl_socket_alloc\n");
-		nl_socket_free(sk);
-		return 1;
+/*
+ * set [-n iterations] [-c] ifname setting... [ifname setting...]...
+ *
+ * Settings are freq=Hz, sf=5..12, bw=Hz, power=dBm and sync=byte. All
+ * interfaces are retuned in one transaction; -c also times one request
+ * per attribute for comparison.
+ */
+static int cmd_set(struct nllora_client *c, int argc, char **argv)
+{
+	struct nllora_params p[IFC_MAX];
+	const char *names[IFC_MAX];
+	unsigned int n = 0;
+	long iterations = 1;
+	int compare = 0, opt;
+
+	optind = 1;
+	while ((opt = getopt(argc, argv, "n:c")) != -1) {
+		switch (opt) {
+		case 'n':
+			iterations = strtol(optarg, NULL, 0);
+			break;
+		case 'c':
+			compare = 1;
+			break;
+		default:
+			return -1;
+		}
 	}
+	if (iterations < 1 || optind == argc)
+		return -1;
 
-	family_id = genl_ctrl_resolve(sk, NLLORA_GENL_NAME);
-	if (family_id < 0) {
-		fprintf(stderr, "genl_ctrl_resolve\n");
-		nl_socket_free(sk);
-		return 1;
+	memset(p, 0, sizeof(p));
+	for (int i = optind; i < argc; i++) {
+		if (strchr(argv[i], '=')) {
+			if (n == 0 || parse_setting(&p[n - 1], argv[i]))
+				return -1;
+			continue;
+		}
+		if (n == IFC_MAX) {
+			fprintf(stderr, "at most %d interfaces\n", IFC_MAX);
+			return 1;
+		}
+		int ifindex = nllora_ifindex(c, argv[i]);
+		if (ifindex < 0) {
+			fprintf(stderr, "%s: %s\n", argv[i], strerror(-ifindex));
+			return 1;
+		}
+		names[n] = argv[i];
+		p[n++].ifindex = ifindex;
 	}
+	for (unsigned int i = 0; i < n; i++)
+		if (p[i].mask == 0)
+			return -1;
 
-	msg = nlmsg_alloc();
-	if (msg == NULL) {
-		fprintf(stderr, "nlmsg_alloc\n");
-		nl_socket_free(sk);
-		return 1;
+	for (int pass = 0; pass <= compare; pass++) {
+		uint64_t lat_min = UINT64_MAX, lat_max = 0, lat_sum = 0;
+		int ret = 0;
+
+		for (long it = 0; it < iterations; it++) {
+			uint64_t t0 = now_ns();
+			ret = pass ? nllora_set_each(c, p, n) : nllora_set(c, p, n);
+			uint64_t lat = now_ns() - t0;
+			if (ret < 0)
+				break;
+			lat_sum += lat;
+			if (lat < lat_min)
+				lat_min = lat;
+			if (lat > lat_max)
+				lat_max = lat;
+		}
+		if (ret < 0) {
+			int reported = 0;
+
+			for (unsigned int i = 0; i < n; i++) {
+				if (p[i].err) {
+					fprintf(stderr, "%s: set: %s\n", names[i], strerror(-p[i].err));
+					reported = 1;
+				}
+			}
+			if (!reported)
+				fprintf(stderr, "set: %s\n", strerror(-ret));
+			return 1;
+		}
+		printf("%s: %u interfaces, latency min/avg/max %.1f/%.1f/%.1f us\n",
+		       pass ? "per attribute" : "batched", n, lat_min / 1e3,
+		       lat_sum / 1e3 / iterations, lat_max / 1e3);
 	}
 
-	ptr = genlmsg_put(msg, NL_AUTO_PID, NL_AUTO_SEQ, family_id, 0, NLM_F_REQUEST, NLLORA_CMD_GET_FREQ, 0);
-	if (ptr == NULL) {
-		fprintf(stderr, "genlmsg_put\n");
-		nlmsg_free(msg);
-		nl_socket_free(sk);
-		return 1;
+	return 0;
+}
+
+struct monitor_iface {
+	struct ev_source src;
+	const char *name;
+	unsigned long frames;
+};
+
+static struct evloop loop;
+
+static void on_signal(int sig)
+{
+	evloop_stop(&loop);
+}
+
+static void print_event(const struct nllora_event *ev, void *arg)
+{
+	printf("event cmd %d ifindex %d", ev->cmd, ev->ifindex);
+	if (ev->has_freq)
+		printf(" frequency: %u", ev->freq);
+	printf("\n");
+}
+
+static void nl_readable(struct ev_source *src, uint32_t events)
+{
+	struct nllora_client *c = src->arg;
+	int ret = nllora_event_dispatch(c, print_event, NULL);
+	if (ret < 0)
+		fprintf(stderr, "event dispatch: %s\n", strerror(-ret));
+}
+
+static void data_readable(struct ev_source *src, uint32_t events)
+{
+	struct monitor_iface *mi = src->arg;
+	char buf[256];
+
+	for (;;) {
+		ssize_t len = recv(src->fd, buf, sizeof(buf), 0);
+		if (len == -1) {
+			if (errno != EAGAIN && errno != EINTR)
+				fprintf(stderr, "%s: recv: %s\n", mi->name, strerror(errno));
+			if (errno != EINTR)
+				break;
+			continue;
+		}
+		mi->frames++;
+		printf("%s: rx %zd bytes\n", mi->name, len);
 	}
+}
+
+static int open_data_socket(int ifindex)
+{
+	struct sockaddr_lora addr;
+	int skt;
+
+	skt = socket(PF_LORA, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 1);
+	if (skt == -1) {
+		int err = errno;
+		fprintf(stderr, "socket failed: %s\n", strerror(err));
+		return -1;
+	}
+
+	addr.lora_family = AF_LORA;
+	addr.lora_ifindex = ifindex;
+	if (bind(skt, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+		int err = errno;
+		fprintf(stderr, "bind failed: %s\n", strerror(err));
+		close(skt);
+		return -1;
+	}
+
+	return skt;
+}
+
+/*
+ * monitor [ifname...]: waits on nllora notifications and on PF_LORA data
+ * sockets for the given interfaces, without polling.
+ */
+static int cmd_monitor(struct nllora_client *c, int argc, char **argv)
+{
+	struct monitor_iface ifaces[MONITOR_MAX_IFACES];
+	struct ifc_entry ifs[MONITOR_MAX_IFACES];
+	struct ev_source nl_src;
+	int nifaces, ret;
 
-	ret = nla_put_u32(msg, NLLORA_ATTR_IFINDEX, ifr.ifr_ifindex);
+	nifaces = expand_ifaces(c, argv + 1, argc - 1, ifs, MONITOR_MAX_IFACES);
+	if (nifaces < 0)
+		return 1;
+
+	ret = evloop_init(&loop);
 	if (ret < 0) {
-		fprintf(stderr, "nla_put_u32\n");
-		nlmsg_free(msg);
-		nl_socket_free(sk);
+		fprintf(stderr, "epoll: %s\n", strerror(-ret));
 		return 1;
 	}
 
-	ret = nl_send_auto(sk, msg);
+	ret = nllora_subscribe(c, NLLORA_MCGRP_CONFIG);
 	if (ret < 0) {
-		fprintf(stderr, "nl_send_auto\n");
-		nlmsg_free(msg);
-		nl_socket_free(sk);
-		return 1;
+		fprintf(stderr, "subscribe %s: %s, no config events\n",
+			NLLORA_MCGRP_CONFIG, strerror(-ret));
+	} else {
+		nl_src.fd = nllora_event_fd(c);
+		nl_src.fn = nl_readable;
+		nl_src.arg = c;
+		evloop_add(&loop, &nl_src, EPOLLIN);
 	}
 
-	nl_msg_dump(msg, stdout);
+	for (int i = 0; i < nifaces; i++) {
+		struct monitor_iface *mi = &ifaces[i];
 
-	nlmsg_free(msg);
+		mi->name = ifs[i].name;
+		mi->frames = 0;
+		mi->src.fd = open_data_socket(ifs[i].ifindex);
+		if (mi->src.fd < 0)
+			return 1;
+		mi->src.fn = data_readable;
+		mi->src.arg = mi;
+		ret = evloop_add(&loop, &mi->src, EPOLLIN);
+		if (ret < 0) {
+			fprintf(stderr, "epoll_ctl: %s\n", strerror(-ret));
+			return 1;
+		}
+	}
 
-	cb = nl_cb_alloc(NL_CB_DEFAULT);
-	if (cb == NULL) {
-		fprintf(stderr, "nl_cb_alloc\n");
-		nl_socket_free(sk);
-		return 1;
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	ret = evloop_run(&loop, -1);
+	if (ret < 0)
+		fprintf(stderr, "epoll_wait: %s\n", strerror(-ret));
+
+	for (int i = 0; i < nifaces; i++) {
+		printf("%s frames %lu\n", ifaces[i].name, ifaces[i].frames);
+		close(ifaces[i].src.fd);
 	}
+	printf("wakeups %lu\n", loop.wakeups);
+	evloop_close(&loop);
 
-	nl_cb_set(cb, NL_CB_SEQ_CHECK, NL_CB_CUSTOM, seq_check, NULL);
-	nl_cb_set(cb, NL_CB_VALID, NL_CB_CUSTOM, print_msg, NULL);
+	return ret < 0;
+}
 
-	ret = nl_recvmsgs(sk, cb);
+static const struct command commands[] = {
+	{ "get", "[-n iterations] [ifname...]", cmd_get },
+	{ "dump", "", cmd_dump },
+	{ "set", "[-n iterations] [-c] ifname freq=|sf=|bw=|power=|sync=... [ifname ...]", cmd_set },
+	{ "monitor", "[ifname...]", cmd_monitor },
+};
 
-	nl_cb_put(cb);
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [command] [args]\n", prog);
+	for (size_t i = 0; i < sizeof(commands) / sizeof(commands[0]); i++)
+		fprintf(stderr, "  %s %s\n", commands[i].name, commands[i].args);
+	fprintf(stderr, "Without a command, queries the frequency of lora0.\n");
+}
 
-	nl_socket_free(sk);
+int main(int argc, char **argv)
+{
+	const struct command *cmd = &commands[0];
+	const char *prog = argv[0];
+	struct nllora_client *c;
+	int ret;
 
-	return 0;
+	if (argc > 1) {
+		cmd = NULL;
+		for (size_t i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
+			if (strcmp(argv[1], commands[i].name) == 0)
+				cmd = &commands[i];
+		}
+		if (cmd == NULL) {
+			usage(prog);
+			return 1;
+		}
+		argc--;
+		argv++;
+	}
+
+	c = nllora_client_open();
+	if (c == NULL) {
+		fprintf(stderr, "nllora_client_open failed\n");
+		return 1;
+	}
+	printf("family_id %d\n", nllora_family_id(c));
+
+	ret = cmd->fn(c, argc, argv);
+	if (ret < 0) {
+		usage(prog);
+		ret = 1;
+	}
+
+	nllora_client_close(c);
+
+	return ret;
 }
@@ -0,0 +1,348 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pcapng.h"
+
+#define BT_SHB		0x0a0d0d0a
+#define BT_IDB		0x00000001
+#define BT_EPB		0x00000006
+#define BYTE_ORDER_MAGIC 0x1a2b3c4d
+
+#define OPT_ENDOFOPT	0
+#define OPT_IF_NAME	2
+#define OPT_IF_TSRESOL	9
+
+#define SHB_LEN		28
+#define EPB_FIXED	32	/* without data and options */
+
+static inline size_t pad4(size_t n)
+{
+	return (n + 3) & ~(size_t)3;
+}
+
+/* Blocks are written in host byte order, as the magic tells readers. */
+static unsigned char *put16(unsigned char *p, uint16_t v)
+{
+	memcpy(p, &v, sizeof(v));
+	return p + sizeof(v);
+}
+
+static unsigned char *put32(unsigned char *p, uint32_t v)
+{
+	memcpy(p, &v, sizeof(v));
+	return p + sizeof(v);
+}
+
+static unsigned char *put_opt(unsigned char *p, uint16_t code, const void *val, uint16_t len)
+{
+	p = put16(p, code);
+	p = put16(p, len);
+	memcpy(p, val, len);
+	memset(p + len, 0, pad4(len) - len);
+	return p + pad4(len);
+}
+
+static size_t idb_len(const struct pcapng_if *ifp)
+{
+	/* Header, if_name, if_tsresol, opt_endofopt, trailer */
+	return 16 + 4 + pad4(strlen(ifp->name)) + 8 + 4 + 4;
+}
+
+static size_t headers_len(const struct pcapng_writer *w)
+{
+	size_t n = SHB_LEN;
+
+	for (int i = 0; i < w->nifs; i++)
+		n += idb_len(&w->ifs[i]);
+	return n;
+}
+
+static void put_headers(struct pcapng_writer *w)
+{
+	unsigned char *p = w->cur->data + w->cur->len;
+	uint8_t tsresol = 9;	/* nanoseconds */
+
+	p = put32(p, BT_SHB);
+	p = put32(p, SHB_LEN);
+	p = put32(p, BYTE_ORDER_MAGIC);
+	p = put16(p, 1);
+	p = put16(p, 0);
+	p = put32(p, 0xffffffff);	/* section length unknown */
+	p = put32(p, 0xffffffff);
+	p = put32(p, SHB_LEN);
+
+	for (int i = 0; i < w->nifs; i++) {
+		const struct pcapng_if *ifp = &w->ifs[i];
+		uint32_t len = idb_len(ifp);
+
+		p = put32(p, BT_IDB);
+		p = put32(p, len);
+		p = put16(p, ifp->linktype);
+		p = put16(p, 0);
+		p = put32(p, ifp->snaplen);
+		p = put_opt(p, OPT_IF_NAME, ifp->name, strlen(ifp->name));
+		p = put_opt(p, OPT_IF_TSRESOL, &tsresol, 1);
+		p = put_opt(p, OPT_ENDOFOPT, NULL, 0);
+		p = put32(p, len);
+	}
+
+	w->cur->len = p - w->cur->data;
+	w->file_bytes = headers_len(w);
+}
+
+static int open_file(struct pcapng_writer *w, unsigned int seq)
+{
+	char name[sizeof(w->path) + 16];
+
+	if (seq)
+		snprintf(name, sizeof(name), "%s%u", w->path, seq);
+	else
+		snprintf(name, sizeof(name), "%s", w->path);
+	w->fd = open(name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (w->fd == -1) {
+		int err = errno;
+		fprintf(stderr, "%s: %s\n", name, strerror(err));
+		return -err;
+	}
+	w->seq = seq;
+	w->st.files++;
+	return 0;
+}
+
+static int write_all(int fd, const unsigned char *p, size_t len)
+{
+	while (len) {
+		ssize_t n = write(fd, p, len);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static void *writer_thread(void *arg)
+{
+	struct pcapng_writer *w = arg;
+	int err = 0;
+
+	pthread_mutex_lock(&w->lock);
+	for (;;) {
+		while (w->head == w->tail && !w->stop)
+			pthread_cond_wait(&w->cond, &w->lock);
+		if (w->head == w->tail)
+			break;
+		struct pcapng_buf *b = &w->bufs[w->head % PCAPNG_NBUF];
+		pthread_mutex_unlock(&w->lock);
+
+		/* After an error, keep recycling buffers so the capture goes on. */
+		if (!err && b->newfile) {
+			close(w->fd);
+			err = open_file(w, w->seq + 1);
+		}
+		if (!err)
+			err = write_all(w->fd, b->data, b->len);
+
+		pthread_mutex_lock(&w->lock);
+		if (err && !w->err)
+			w->err = err;
+		w->head++;
+		pthread_cond_signal(&w->cond);
+	}
+	pthread_mutex_unlock(&w->lock);
+	return NULL;
+}
+
+/* Queues the current buffer and waits for a free one. */
+static int submit(struct pcapng_writer *w, int newfile)
+{
+	int err;
+
+	pthread_mutex_lock(&w->lock);
+	w->tail++;
+	pthread_cond_signal(&w->cond);
+	if (w->tail - w->head == PCAPNG_NBUF) {
+		w->st.stalls++;
+		while (w->tail - w->head == PCAPNG_NBUF)
+			pthread_cond_wait(&w->cond, &w->lock);
+	}
+	err = w->err;
+	pthread_mutex_unlock(&w->lock);
+
+	w->cur = &w->bufs[w->tail % PCAPNG_NBUF];
+	w->cur->len = 0;
+	w->cur->newfile = newfile;
+	if (newfile)
+		put_headers(w);
+	return err;
+}
+
+int pcapng_open(struct pcapng_writer *w, const char *path, const struct pcapng_if *ifs,
+		int nifs, uint64_t rotate_bytes, size_t buf_size)
+{
+	int ret;
+
+	memset(w, 0, sizeof(*w));
+	w->fd = -1;
+	if (nifs < 1 || nifs > PCAPNG_MAX_IF || strlen(path) >= sizeof(w->path))
+		return -EINVAL;
+	if (buf_size == 0)
+		buf_size = PCAPNG_BUF_SIZE;
+	memcpy(w->ifs, ifs, nifs * sizeof(*ifs));
+	w->nifs = nifs;
+	if (buf_size < headers_len(w) + EPB_FIXED + 2 * 65536)
+		return -EINVAL;
+	strcpy(w->path, path);
+	w->rotate_bytes = rotate_bytes;
+	w->buf_size = buf_size;
+
+	for (int i = 0; i < PCAPNG_NBUF; i++) {
+		w->bufs[i].data = malloc(buf_size);
+		if (w->bufs[i].data == NULL) {
+			ret = -ENOMEM;
+			goto err;
+		}
+	}
+
+	ret = open_file(w, 0);
+	if (ret < 0)
+		goto err;
+
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_cond_init(&w->cond, NULL);
+	ret = pthread_create(&w->thread, NULL, writer_thread, w);
+	if (ret) {
+		ret = -ret;
+		pthread_cond_destroy(&w->cond);
+		pthread_mutex_destroy(&w->lock);
+		close(w->fd);
+		goto err;
+	}
+
+	w->cur = &w->bufs[0];
+	put_headers(w);
+	return 0;
+
+err:
+	for (int i = 0; i < PCAPNG_NBUF; i++)
+		free(w->bufs[i].data);
+	return ret;
+}
+
+int pcapng_write(struct pcapng_writer *w, int ifid, uint64_t time_ns,
+		 const struct iovec *iov, int iovcnt, uint32_t orig_len)
+{
+	size_t caplen = 0, len;
+	unsigned char *p;
+	int ret;
+
+	if (ifid < 0 || ifid >= w->nifs)
+		return -EINVAL;
+	for (int i = 0; i < iovcnt; i++)
+		caplen += iov[i].iov_len;
+	if (caplen > 65535)
+		return -EMSGSIZE;
+	len = EPB_FIXED + pad4(caplen);
+
+	if (w->rotate_bytes && w->file_bytes + len > w->rotate_bytes &&
+	    w->file_bytes > headers_len(w)) {
+		ret = submit(w, 1);
+		if (ret < 0)
+			return ret;
+	} else if (w->cur->len + len > w->buf_size) {
+		ret = submit(w, 0);
+		if (ret < 0)
+			return ret;
+	}
+
+	p = w->cur->data + w->cur->len;
+	p = put32(p, BT_EPB);
+	p = put32(p, len);
+	p = put32(p, ifid);
+	p = put32(p, time_ns >> 32);
+	p = put32(p, time_ns);
+	p = put32(p, caplen);
+	p = put32(p, orig_len < caplen ? caplen : orig_len);
+	for (int i = 0; i < iovcnt; i++) {
+		memcpy(p, iov[i].iov_base, iov[i].iov_len);
+		p += iov[i].iov_len;
+	}
+	memset(p, 0, pad4(caplen) - caplen);
+	p += pad4(caplen) - caplen;
+	put32(p, len);
+
+	w->cur->len += len;
+	w->file_bytes += len;
+	w->st.records++;
+	w->st.bytes += len;
+	return 0;
+}
+
+int pcapng_flush(struct pcapng_writer *w)
+{
+	if (w->cur->len == 0)
+		return 0;
+	return submit(w, 0);
+}
+
+int pcapng_close(struct pcapng_writer *w)
+{
+	int ret;
+
+	if (w->cur->len) {
+		pthread_mutex_lock(&w->lock);
+		w->tail++;
+		pthread_mutex_unlock(&w->lock);
+	}
+	pthread_mutex_lock(&w->lock);
+	w->stop = 1;
+	pthread_cond_signal(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+	pthread_join(w->thread, NULL);
+
+	ret = w->err;
+	if (w->fd != -1 && close(w->fd) && !ret)
+		ret = -errno;
+	pthread_cond_destroy(&w->cond);
+	pthread_mutex_destroy(&w->lock);
+	for (int i = 0; i < PCAPNG_NBUF; i++)
+		free(w->bufs[i].data);
+	w->cur = NULL;
+	return ret;
+}
+
+void loratap_hdr(uint8_t *hdr, uint32_t freq_hz, unsigned int bw_khz, unsigned int sf,
+		 int rssi_dbm, int snr_cb, uint8_t sync_word)
+{
+	uint8_t rssi = 0;
+
+	/* LoRaTap RSSI is dBm + 139, SNR is dB in quarter steps. */
+	if (rssi_dbm) {
+		int v = rssi_dbm + 139;
+		rssi = v < 0 ? 0 : v > 255 ? 255 : v;
+	}
+	hdr[0] = 0;
+	hdr[1] = 0;
+	hdr[2] = 0;
+	hdr[3] = LORATAP_HDR_LEN;
+	hdr[4] = freq_hz >> 24;
+	hdr[5] = freq_hz >> 16;
+	hdr[6] = freq_hz >> 8;
+	hdr[7] = freq_hz;
+	hdr[8] = bw_khz / 125;
+	hdr[9] = sf;
+	hdr[10] = rssi;
+	hdr[11] = rssi;
+	hdr[12] = 0;
+	hdr[13] = (int8_t)(snr_cb * 4 / 10);
+	hdr[14] = sync_word;
+}
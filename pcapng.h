@@ -0,0 +1,105 @@
+#ifndef PCAPNG_H
+#define PCAPNG_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include <net/if.h>
+
+/*
+ * Streaming pcapng capture writer.
+ *
+ * Records are appended to large in-memory buffers by the capturing thread,
+ * and a writer thread of its own hands full buffers to write(). A slow SD
+ * card therefore stalls only the writer; the capturing thread waits only
+ * when every buffer is full, and each such wait is counted.
+ *
+ * With rotation, a new file is started before a record would push the
+ * current one past rotate_bytes. Files are named like tcpdump -C names
+ * them: path, path1, path2, ... Each one starts with its own section and
+ * interface blocks, so it can be read on its own.
+ *
+ * Functions return 0 on success and a negative errno value on failure. A
+ * write error in the writer thread is returned by the next call.
+ */
+
+#define LINKTYPE_LORATAP	270
+#define LORATAP_HDR_LEN		15
+#define LORATAP_SYNC_PUBLIC	0x34
+
+#define PCAPNG_MAX_IF		16
+#define PCAPNG_NBUF		8
+#define PCAPNG_BUF_SIZE		(1 << 20)
+
+struct pcapng_if {
+	char name[IFNAMSIZ];
+	uint16_t linktype;
+	uint32_t snaplen;
+};
+
+struct pcapng_buf {
+	unsigned char *data;
+	size_t len;
+	int newfile;		/* open the next file before writing this */
+};
+
+struct pcapng_stats {
+	uint64_t records;
+	uint64_t bytes;
+	uint64_t files;
+	uint64_t stalls;	/* waits for a free buffer */
+};
+
+struct pcapng_writer {
+	char path[4096];
+	uint64_t rotate_bytes;	/* 0: never rotate */
+	size_t buf_size;
+	struct pcapng_if ifs[PCAPNG_MAX_IF];
+	int nifs;
+
+	/* Capturing thread only */
+	struct pcapng_buf *cur;
+	uint64_t file_bytes;
+
+	/* Under lock: bufs[head..tail) are full, the rest are free. */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct pcapng_buf bufs[PCAPNG_NBUF];
+	unsigned int head;
+	unsigned int tail;
+	int stop;
+	int err;
+
+	/* Writer thread only */
+	pthread_t thread;
+	int fd;
+	unsigned int seq;
+
+	struct pcapng_stats st;
+};
+
+/*
+ * Writes path with one interface block per ifs entry; record ifid n is
+ * ifs[n]. buf_size 0 picks PCAPNG_BUF_SIZE.
+ */
+int pcapng_open(struct pcapng_writer *w, const char *path, const struct pcapng_if *ifs,
+		int nifs, uint64_t rotate_bytes, size_t buf_size);
+
+/* Appends one Enhanced Packet Block; time_ns is CLOCK_REALTIME. */
+int pcapng_write(struct pcapng_writer *w, int ifid, uint64_t time_ns,
+		 const struct iovec *iov, int iovcnt, uint32_t orig_len);
+
+/* Hands the partly filled buffer to the writer thread. */
+int pcapng_flush(struct pcapng_writer *w);
+
+/* Flushes, waits for the writer thread and closes the file. */
+int pcapng_close(struct pcapng_writer *w);
+
+/*
+ * LoRaTap version 0 pseudo-header. rssi_dbm and snr_cb 0 mean unknown and
+ * are written as 0.
+ */
+void loratap_hdr(uint8_t *hdr, uint32_t freq_hz, unsigned int bw_khz, unsigned int sf,
+		 int rssi_dbm, int snr_cb, uint8_t sync_word);
+
+#endif
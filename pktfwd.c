@@ -0,0 +1,1110 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <netdb.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/socket.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+
+#include "include/linux/lora.h"
+#include "dedup.h"
+#include "evloop.h"
+#include "framepool.h"
+#include "ifcache.h"
+#include "liblorad.h"
+#include "semtech.h"
+#include "tstamp.h"
+#include "uplink.h"
+
+/*
+ * Semtech UDP packet forwarder on the kernel stack: uplinks come from
+ * PF_LORA sockets, downlinks go out through lorad, so the concentrator
+ * stays owned by its driver.
+ *
+ * Every radio socket and both server sockets sit on one epoll loop.
+ * Handlers only queue: uplinks become rxpk objects in PUSH_DATA
+ * datagrams, PULL_RESPs become lorad slots and TX_ACKs. After each round
+ * of handlers everything queued goes out with one sendmmsg() per server
+ * socket and one lorad doorbell, so a burst from several radios costs a
+ * few syscalls rather than a few per frame.
+ *
+ * With several radios, uplinks pass through dedup.c first, so a frame
+ * heard on overlapping channels is forwarded once.
+ *
+ * Uplinks are received straight into framepool.h frames, and dedup.c
+ * holds them by reference. When -M runs out, a radio is left unread, its
+ * socket buffering the rest, until released frames come back.
+ *
+ * With -B, uplinks go out as uplink.h binary batches instead, one
+ * datagram every few milliseconds or frames. A batch is built in place
+ * and sent from there, or with -Z compressed from there into the
+ * datagram.
+ *
+ * The kernel RX timestamp stands in for the concentrator counter: tmst
+ * is CLOCK_REALTIME in microseconds, modulo 2^32, which lets a txpk tmst
+ * be turned back into a lorad send time.
+ */
+
+#define MAX_RADIOS	LORAD_MAX_PORTS
+#define RX_BATCH	32
+#define PUSH_BATCH	16	/* PUSH_DATA datagrams per sendmmsg() */
+#define PUSH_MAX	2048
+#define DOWN_BATCH	16
+#define DOWN_MAX	1024
+#define ACK_MAX		64
+#define KEEPALIVE_S	10
+#define STAT_S		30
+#define TX_AHEAD_S	30	/* latest tmst still taken as the future */
+#define DEDUP_KEYS	1024
+#define DEDUP_HELD	128
+#define DEDUP_WINDOW_MS	20
+#define DEDUP_EXPIRE_MS	500
+#define POOL_KB		1024
+#define POOL_MIN	(DEDUP_HELD + RX_BATCH + FP_CACHE)
+#define BATCH_MAX	1400	/* fits a 1500 byte MTU with IPv6 and UDP */
+#define BATCH_FRAMES	32
+#define DICT_MAX	65536
+
+struct radio {
+	struct ev_source src;
+	char ifname[IFNAMSIZ];
+	uint32_t freq_hz;
+	unsigned int sf, bw_khz, cr;
+	int powe;		/* dBm it transmits at, -1 if not given */
+	int ipol;		/* transmits with inverted IQ, as LoRaWAN downlinks */
+	int port;		/* lorad port, -1 if lorad does not serve it */
+	uint64_t frames;
+	uint64_t truncated;
+	int starved;		/* left unread for want of frames */
+	uint64_t stalls;
+};
+
+/* Per stat interval, as the reference forwarder reports them. */
+struct interval {
+	uint32_t rxnb, rxok, rxfw, dwnb, txnb;
+	uint32_t pushes, acks;
+};
+
+static struct evloop loop;
+static struct radio radios[MAX_RADIOS];
+static int nradios;
+static struct lorad_client lc;
+static int have_lorad;
+static int lorad_pending;
+static uint64_t gw_eui;
+static uint16_t next_token;
+static struct ev_source up_src, down_src, keepalive_src, stat_src, dedup_src, batch_src;
+static struct dedup dedup;
+static struct framepool pool;
+static struct fp_cache cache;
+static int use_dedup;
+static uint64_t dedup_armed = UINT64_MAX;
+
+/* PUSH_DATA datagrams of this round; the last one may still be open. */
+static uint8_t push_buf[PUSH_BATCH][PUSH_MAX];
+static unsigned int push_len[PUSH_BATCH];
+static unsigned int push_frames[PUSH_BATCH];
+static struct semtech_push push;
+static int npush;
+static int push_open;
+
+/* With -B, the batch being built, and where it is compressed to. */
+static long batch_ms = -1;
+static long batch_frames = BATCH_FRAMES;
+static uint8_t batch_buf[BATCH_MAX];
+static uint8_t zip_buf[BATCH_MAX];
+static struct ul_batch batch;
+static int batch_open;
+static uint64_t batch_due;
+static struct ul_codec codec;
+static uint8_t dict_buf[DICT_MAX];
+
+static uint8_t ack_buf[DOWN_BATCH][ACK_MAX];
+static unsigned int ack_len[DOWN_BATCH];
+static int nack;
+
+static struct interval iv;
+static uint64_t total_up, total_pushes, total_acks, total_drops;
+static uint64_t total_down, total_tx, total_rejected, total_pull_acks;
+static uint64_t total_batch_raw, total_batch_sent;
+
+static void on_signal(int sig)
+{
+	evloop_stop(&loop);
+}
+
+/* Sends n datagrams of a table; UDP drops what the socket cannot take. */
+static int send_all(int fd, uint8_t *base, size_t stride, const unsigned int *lens, int n)
+{
+	struct iovec iov[PUSH_BATCH];
+	struct mmsghdr msgs[PUSH_BATCH];
+	int sent = 0;
+
+	memset(msgs, 0, n * sizeof(msgs[0]));
+	for (int i = 0; i < n; i++) {
+		iov[i].iov_base = base + i * stride;
+		iov[i].iov_len = lens[i];
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	while (sent < n) {
+		int ret = sendmmsg(fd, msgs + sent, n - sent, MSG_DONTWAIT);
+		if (ret == -1) {
+			if (errno == EINTR)
+				continue;
+			/* ECONNREFUSED just means the server is not up yet. */
+			if (errno != EAGAIN && errno != ENOBUFS && errno != ECONNREFUSED) {
+				int err = errno;
+				fprintf(stderr, "sendmmsg failed: %s\n", strerror(err));
+			}
+			break;
+		}
+		sent += ret;
+	}
+	return sent;
+}
+
+static void flush_push(void)
+{
+	if (push_open) {
+		push_frames[npush] = push.nrxpk;
+		push_len[npush++] = semtech_push_end(&push);
+		push_open = 0;
+	}
+	if (npush == 0)
+		return;
+
+	int sent = send_all(up_src.fd, push_buf[0], PUSH_MAX, push_len, npush);
+	for (int i = 0; i < npush; i++) {
+		if (i < sent)
+			iv.rxfw += push_frames[i];
+		else
+			total_drops += push_frames[i];
+	}
+	total_pushes += sent;
+	iv.pushes += sent;
+	npush = 0;
+}
+
+static void arm_at(int fd, uint64_t ns)
+{
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof(its));
+	if (ns != UINT64_MAX) {
+		/* An all-zero it_value would disarm instead. */
+		its.it_value.tv_sec = ns / 1000000000ULL;
+		its.it_value.tv_nsec = ns % 1000000000ULL ?: 1;
+	}
+	timerfd_settime(fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+static void close_batch(void)
+{
+	unsigned int len = ul_end(&batch), wire = len;
+	const uint8_t *buf = batch_buf;
+
+	/* Sent as built when the codec cannot make it shorter. */
+	int n = ul_compress(&codec, zip_buf, sizeof(zip_buf), batch_buf, len);
+	if (n > 0) {
+		buf = zip_buf;
+		wire = n;
+	}
+	batch_open = 0;
+
+	if (send_all(up_src.fd, (uint8_t *)buf, 0, &wire, 1) == 1) {
+		iv.rxfw += batch.count;
+		iv.pushes++;
+		total_pushes++;
+		total_batch_raw += len;
+		total_batch_sent += wire;
+	} else {
+		total_drops += batch.count;
+	}
+}
+
+static void queue_batch(const struct semtech_rxpk *rx)
+{
+	for (int tries = 0; tries < 2; tries++) {
+		if (!batch_open) {
+			ul_begin(&batch, batch_buf, sizeof(batch_buf), next_token++, gw_eui);
+			batch_open = 1;
+			batch_due = realtime_ns() + batch_ms * 1000000ULL;
+			if (batch_ms)
+				arm_at(batch_src.fd, batch_due);
+		}
+		if (ul_add(&batch, rx) == 0) {
+			if (batch.count == batch_frames)
+				close_batch();
+			return;
+		}
+		if (batch.count == 0) {
+			batch_open = 0;
+			break;
+		}
+		/* Full: send it, the frame starts the next one. */
+		close_batch();
+	}
+	total_drops++;
+}
+
+static void queue_rxpk(const struct semtech_rxpk *rx)
+{
+	if (batch_ms >= 0) {
+		queue_batch(rx);
+		return;
+	}
+	for (int tries = 0; tries < 2; tries++) {
+		if (!push_open) {
+			if (npush == PUSH_BATCH)
+				flush_push();
+			semtech_push_begin(&push, push_buf[npush], PUSH_MAX, next_token++, gw_eui);
+			push_open = 1;
+		}
+		if (semtech_push_add(&push, rx) == 0)
+			return;
+		if (push.nrxpk == 0)
+			break;
+		/* Full: close it, the frame starts the next one. */
+		push_frames[npush] = push.nrxpk;
+		push_len[npush++] = semtech_push_end(&push);
+		push_open = 0;
+	}
+	total_drops++;
+}
+
+static void fill_rxpk(struct semtech_rxpk *rx, int radio, uint64_t time_ns,
+		      const uint8_t *data, unsigned int len)
+{
+	const struct radio *r = &radios[radio];
+
+	memset(rx, 0, sizeof(*rx));
+	rx->time_ns = time_ns;
+	rx->tmst = time_ns / 1000;
+	rx->chan = radio;
+	rx->rfch = radio;
+	rx->freq_hz = r->freq_hz;
+	rx->sf = r->sf;
+	rx->bw_khz = r->bw_khz;
+	rx->cr = r->cr;
+	rx->data = data;
+	rx->len = len;
+}
+
+/* The copy with the best metadata goes out, as heard by its radio. */
+static void dedup_release(struct fp_frame *f, const struct dd_meta *best, unsigned int copies,
+			  uint32_t mask, void *arg)
+{
+	struct semtech_rxpk rx;
+
+	fill_rxpk(&rx, best->radio, best->time_ns, f->data, f->len);
+	rx.rssi = best->rssi;
+	rx.lsnr_cb = best->snr_cb;
+	queue_rxpk(&rx);
+}
+
+static void dedup_arm(uint64_t next)
+{
+	if (next == dedup_armed)
+		return;
+	dedup_armed = next;
+	arm_at(dedup_src.fd, next);
+}
+
+/* Releases happen in round_flush(), this only ends the epoll wait. */
+static void dedup_expired(struct ev_source *src, uint32_t events)
+{
+	uint64_t val;
+	ssize_t n;
+
+	n = read(src->fd, &val, sizeof(val));
+	(void)n;
+	dedup_armed = UINT64_MAX;
+}
+
+/* Likewise; a batch sent early may leave it to fire for nothing. */
+static void batch_expired(struct ev_source *src, uint32_t events)
+{
+	uint64_t val;
+	ssize_t n;
+
+	n = read(src->fd, &val, sizeof(val));
+	(void)n;
+}
+
+static void radio_readable(struct ev_source *src, uint32_t events);
+
+static void round_flush(struct evloop *ev)
+{
+	if (use_dedup)
+		dd_run(&dedup, realtime_ns());
+	/* Released frames are back in the pool; read what was left waiting. */
+	for (int i = 0; i < nradios; i++) {
+		if (radios[i].starved) {
+			radios[i].starved = 0;
+			radio_readable(&radios[i].src, EPOLLIN);
+		}
+	}
+	if (use_dedup)
+		dedup_arm(dd_next(&dedup));
+	if (batch_open && realtime_ns() >= batch_due)
+		close_batch();
+	flush_push();
+	if (nack) {
+		send_all(down_src.fd, ack_buf[0], ACK_MAX, ack_len, nack);
+		nack = 0;
+	}
+	if (lorad_pending) {
+		lorad_commit(&lc, 0);
+		lorad_pending = 0;
+	}
+}
+
+static void radio_readable(struct ev_source *src, uint32_t events)
+{
+	static struct fp_frame *frames[RX_BATCH];
+	static char control[RX_BATCH][TSTAMP_CMSG_SPACE];
+	static struct iovec iov[RX_BATCH];
+	static struct mmsghdr msgs[RX_BATCH];
+	struct radio *r = src->arg;
+
+	for (;;) {
+		unsigned int m = fp_alloc_bulk(&cache, frames, RX_BATCH);
+		if (m == 0) {
+			r->starved = 1;
+			r->stalls++;
+			return;
+		}
+		for (unsigned int i = 0; i < m; i++) {
+			iov[i].iov_base = frames[i]->data;
+			iov[i].iov_len = FP_DATA_MAX;
+			memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			msgs[i].msg_hdr.msg_control = control[i];
+			msgs[i].msg_hdr.msg_controllen = sizeof(control[i]);
+		}
+
+		int n = recvmmsg(src->fd, msgs, m, MSG_DONTWAIT, NULL);
+		if (n == -1) {
+			int err = errno;
+
+			for (unsigned int i = 0; i < m; i++)
+				fp_put(&cache, frames[i]);
+			if (err == EINTR)
+				continue;
+			if (err != EAGAIN)
+				fprintf(stderr, "%s: recvmmsg failed: %s\n", r->ifname, strerror(err));
+			return;
+		}
+
+		for (int i = 0; i < n; i++) {
+			struct msghdr *mh = &msgs[i].msg_hdr;
+			struct fp_frame *f = frames[i];
+
+			iv.rxnb++;
+			if (mh->msg_flags & MSG_TRUNC) {
+				r->truncated++;
+				continue;
+			}
+			iv.rxok++;
+			tstamp_from_cmsg(mh, &f->sw_ns, &f->hw_ns);
+			f->len = msgs[i].msg_len;
+			f->port = r - radios;
+			r->frames++;
+			total_up++;
+
+			uint64_t now = realtime_ns();
+			struct dd_meta meta = {
+				.time_ns = f->hw_ns ? f->hw_ns : f->sw_ns ? f->sw_ns : now,
+				.radio = f->port,
+			};
+			if (use_dedup && dd_add(&dedup, f, &meta, now) >= 0)
+				continue;
+
+			struct semtech_rxpk rx;
+			fill_rxpk(&rx, meta.radio, meta.time_ns, f->data, f->len);
+			queue_rxpk(&rx);
+		}
+		/* dedup.c took its own reference to what it holds. */
+		for (unsigned int i = 0; i < m; i++)
+			fp_put(&cache, frames[i]);
+		if (n < (int)m)
+			return;
+	}
+}
+
+static void queue_ack(uint16_t token, const char *error)
+{
+	int len;
+
+	if (nack == DOWN_BATCH) {
+		send_all(down_src.fd, ack_buf[0], ACK_MAX, ack_len, nack);
+		nack = 0;
+	}
+	len = semtech_tx_ack(ack_buf[nack], ACK_MAX, token, gw_eui, error);
+	if (len > 0)
+		ack_len[nack++] = len;
+}
+
+/*
+ * Radios cannot be retuned per frame, so a downlink goes to one already
+ * on its frequency, data rate and IQ polarity; network servers leave
+ * rfch at 0 anyway. The coding rate is in the LoRa header, any will do.
+ * powe is the most the server allows, so a louder radio cannot send it.
+ * Returns the TX_ACK error, or NULL with *out set.
+ */
+static const char *pick_radio(const struct semtech_txpk *tx, struct radio **out)
+{
+	const char *error = "TX_FREQ";
+
+	for (int i = 0; i < nradios; i++) {
+		struct radio *r = &radios[i];
+
+		if (r->port < 0 || r->freq_hz != tx->freq_hz || r->sf != tx->sf ||
+		    r->bw_khz != tx->bw_khz || r->ipol != !!tx->ipol)
+			continue;
+		if (tx->powe >= 0 && r->powe > tx->powe) {
+			error = "TX_POWER";
+			continue;
+		}
+		*out = r;
+		return NULL;
+	}
+	return error;
+}
+
+static uint64_t tmst_to_ns(uint32_t tmst, uint64_t now_ns)
+{
+	int64_t now_us = now_ns / 1000;
+	int32_t delta = tmst - (uint32_t)now_us;
+
+	return delta < 0 ? 0 : (uint64_t)(now_us + delta) * 1000;
+}
+
+/* Returns the TX_ACK error, or NULL to not answer a malformed request. */
+static const char *downlink(const char *json)
+{
+	struct semtech_txpk tx;
+	struct radio *r;
+	uint64_t at_ns = 0;
+	int ret;
+
+	iv.dwnb++;
+	total_down++;
+	ret = semtech_parse_txpk(json, &tx);
+	if (ret == -EINVAL || ret == -EMSGSIZE) {
+		total_rejected++;
+		return NULL;
+	}
+	/* FSK, the one -ENOTSUP, has no radio either. */
+	const char *error = ret == 0 ? pick_radio(&tx, &r) : "TX_FREQ";
+	if (error) {
+		total_rejected++;
+		return error;
+	}
+
+	if (!tx.imme) {
+		uint64_t now = realtime_ns();
+
+		if (!tx.has_tmst) {
+			/* Class B beacon time needs a GPS this gateway lacks. */
+			total_rejected++;
+			return tx.has_tmms ? "GPS_UNLOCKED" : "TOO_LATE";
+		}
+		at_ns = tmst_to_ns(tx.tmst, now);
+		if (at_ns == 0) {
+			total_rejected++;
+			return "TOO_LATE";
+		}
+		if (at_ns - now > TX_AHEAD_S * 1000000000ULL) {
+			total_rejected++;
+			return "TOO_EARLY";
+		}
+	}
+
+	ret = lorad_submit_at(&lc, r->port, tx.data, tx.len, at_ns, 0, 0);
+	if (ret < 0) {
+		total_rejected++;
+		return ret == -EAGAIN ? "COLLISION_PACKET" : "TX_FREQ";
+	}
+	lorad_pending = 1;
+	iv.txnb++;
+	total_tx++;
+	return "NONE";
+}
+
+static void up_readable(struct ev_source *src, uint32_t events)
+{
+	static uint8_t buf[DOWN_BATCH][ACK_MAX];
+	static struct iovec iov[DOWN_BATCH];
+	static struct mmsghdr msgs[DOWN_BATCH];
+
+	for (;;) {
+		for (int i = 0; i < DOWN_BATCH; i++) {
+			iov[i].iov_base = buf[i];
+			iov[i].iov_len = sizeof(buf[i]);
+			memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		int n = recvmmsg(src->fd, msgs, DOWN_BATCH, MSG_DONTWAIT, NULL);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return;
+		}
+		for (int i = 0; i < n; i++) {
+			if (msgs[i].msg_len >= SEMTECH_ACK_LEN && buf[i][0] == SEMTECH_VERSION &&
+			    buf[i][3] == SEMTECH_PUSH_ACK) {
+				iv.acks++;
+				total_acks++;
+			}
+		}
+		if (n < DOWN_BATCH)
+			return;
+	}
+}
+
+static void down_readable(struct ev_source *src, uint32_t events)
+{
+	/* One spare byte per datagram for the JSON's NUL terminator. */
+	static uint8_t buf[DOWN_BATCH][DOWN_MAX + 1];
+	static struct iovec iov[DOWN_BATCH];
+	static struct mmsghdr msgs[DOWN_BATCH];
+
+	for (;;) {
+		for (int i = 0; i < DOWN_BATCH; i++) {
+			iov[i].iov_base = buf[i];
+			iov[i].iov_len = DOWN_MAX;
+			memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		int n = recvmmsg(src->fd, msgs, DOWN_BATCH, MSG_DONTWAIT, NULL);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return;
+		}
+		for (int i = 0; i < n; i++) {
+			unsigned int len = msgs[i].msg_len;
+			uint8_t *p = buf[i];
+
+			if (len < SEMTECH_ACK_LEN || p[0] != SEMTECH_VERSION)
+				continue;
+			if (p[3] == SEMTECH_PULL_ACK) {
+				total_pull_acks++;
+			} else if (p[3] == SEMTECH_PULL_RESP && !(msgs[i].msg_hdr.msg_flags & MSG_TRUNC)) {
+				p[len] = '\0';
+				const char *error = downlink((const char *)p + SEMTECH_ACK_LEN);
+				if (error)
+					queue_ack(p[1] << 8 | p[2], error);
+			}
+		}
+		if (n < DOWN_BATCH)
+			return;
+	}
+}
+
+static void send_pull_data(void)
+{
+	uint8_t buf[SEMTECH_HDR_LEN];
+
+	semtech_hdr(buf, next_token++, SEMTECH_PULL_DATA, gw_eui);
+	if (send(down_src.fd, buf, sizeof(buf), MSG_DONTWAIT) == -1 && errno != ECONNREFUSED) {
+		int err = errno;
+		fprintf(stderr, "PULL_DATA failed: %s\n", strerror(err));
+	}
+}
+
+static void keepalive_expired(struct ev_source *src, uint32_t events)
+{
+	uint64_t val;
+	ssize_t n;
+
+	n = read(src->fd, &val, sizeof(val));
+	(void)n;
+	send_pull_data();
+}
+
+static void stat_expired(struct ev_source *src, uint32_t events)
+{
+	uint8_t buf[512];
+	uint64_t val;
+	ssize_t n;
+
+	n = read(src->fd, &val, sizeof(val));
+	(void)n;
+
+	/* Frames reach us with a good CRC only; truncated ones are not ok. */
+	struct semtech_stat st = {
+		.time_ns = realtime_ns(),
+		.rxnb = iv.rxnb,
+		.rxok = iv.rxok,
+		.rxfw = iv.rxfw,
+		.ackr_pm = iv.pushes ? (uint64_t)iv.acks * 1000 / iv.pushes : 0,
+		.dwnb = iv.dwnb,
+		.txnb = iv.txnb,
+	};
+	if (st.ackr_pm > 1000)
+		st.ackr_pm = 1000;
+	memset(&iv, 0, sizeof(iv));
+
+	int len = semtech_stat(buf, sizeof(buf), next_token++, gw_eui, &st);
+	if (len > 0 && send(up_src.fd, buf, len, MSG_DONTWAIT) != -1)
+		iv.pushes++;
+}
+
+static int open_timer(struct ev_source *src, ev_handler_t fn, long period_s)
+{
+	struct itimerspec its = {
+		.it_interval = { .tv_sec = period_s },
+		.it_value = { .tv_sec = period_s },
+	};
+
+	src->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	src->fn = fn;
+	if (src->fd == -1 || timerfd_settime(src->fd, 0, &its, NULL) == -1) {
+		int err = errno;
+		fprintf(stderr, "timerfd failed: %s\n", strerror(err));
+		return -1;
+	}
+	return 0;
+}
+
+static int open_server(const char *host, const char *port)
+{
+	struct addrinfo hints, *res, *ai;
+	int skt = -1, ret;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	ret = getaddrinfo(host, port, &hints, &res);
+	if (ret) {
+		fprintf(stderr, "%s:%s: %s\n", host, port, gai_strerror(ret));
+		return -1;
+	}
+
+	for (ai = res; ai; ai = ai->ai_next) {
+		skt = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+			     ai->ai_protocol);
+		if (skt == -1)
+			continue;
+		if (connect(skt, ai->ai_addr, ai->ai_addrlen) == 0)
+			break;
+		close(skt);
+		skt = -1;
+	}
+	if (skt == -1) {
+		int err = errno;
+		fprintf(stderr, "%s:%s: %s\n", host, port, strerror(err));
+	}
+	freeaddrinfo(res);
+	return skt;
+}
+
+static int open_radio(struct radio *r, int ifindex)
+{
+	struct sockaddr_lora addr;
+	struct ifreq ifr;
+	int skt, ret;
+
+	skt = socket(PF_LORA, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 1);
+	if (skt == -1) {
+		int err = errno;
+		fprintf(stderr, "%s: socket failed: %s\n", r->ifname, strerror(err));
+		return -1;
+	}
+
+	if (ifindex == 0) {
+		memset(&ifr, 0, sizeof(ifr));
+		strcpy(ifr.ifr_name, r->ifname);
+		if (ioctl(skt, SIOCGIFINDEX, &ifr) == -1) {
+			int err = errno;
+			fprintf(stderr, "%s: ioctl failed: %s\n", r->ifname, strerror(err));
+			close(skt);
+			return -1;
+		}
+		ifindex = ifr.ifr_ifindex;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.lora_family = AF_LORA;
+	addr.lora_ifindex = ifindex;
+	if (bind(skt, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+		int err = errno;
+		fprintf(stderr, "%s: bind failed: %s\n", r->ifname, strerror(err));
+		close(skt);
+		return -1;
+	}
+
+	/* Hardware stamps come from the concentrator counter, when mapped. */
+	ret = tstamp_enable_rx(skt, 1);
+	if (ret < 0)
+		fprintf(stderr, "%s: SO_TIMESTAMPING failed: %s\n", r->ifname, strerror(-ret));
+
+	r->src.fd = skt;
+	r->src.fn = radio_readable;
+	r->src.arg = r;
+	return 0;
+}
+
+/* lz4|zstd[:dictfile] */
+static int parse_codec(const char *arg)
+{
+	const char *colon = strchr(arg, ':');
+	size_t len = colon ? (size_t)(colon - arg) : strlen(arg);
+	enum ul_codec_id id;
+	ssize_t n = 0;
+	int ret;
+
+	if (len == 3 && strncmp(arg, "lz4", 3) == 0) {
+		id = UL_LZ4;
+	} else if (len == 4 && strncmp(arg, "zstd", 4) == 0) {
+		id = UL_ZSTD;
+	} else {
+		fprintf(stderr, "%.*s: unknown codec\n", (int)len, arg);
+		return -1;
+	}
+
+	if (colon) {
+		FILE *f = fopen(colon + 1, "r");
+		if (f == NULL) {
+			int err = errno;
+			fprintf(stderr, "%s: %s\n", colon + 1, strerror(err));
+			return -1;
+		}
+		n = fread(dict_buf, 1, sizeof(dict_buf), f);
+		ret = ferror(f) ? -EIO : fgetc(f) != EOF ? -EFBIG : 0;
+		fclose(f);
+		if (ret < 0) {
+			fprintf(stderr, "%s: %s\n", colon + 1, strerror(-ret));
+			return -1;
+		}
+	}
+
+	ret = ul_codec_init(&codec, id, dict_buf, n);
+	if (ret < 0) {
+		fprintf(stderr, "%.*s: %s\n", (int)len, arg,
+			ret == -ENOTSUP ? "not built in" : strerror(-ret));
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * ifname:freq_mhz:sf:bw_khz[:cr[:powe[:iq]]], cr 5..8 as in 4/5..4/8,
+ * powe the TX power in dBm, iq i for inverted TX (default) or n for normal
+ */
+static int parse_radio(const char *arg, struct radio *r, char *spec, size_t size)
+{
+	const char *colon = strchr(arg, ':');
+	char iq = 'i';
+	double mhz;
+	int n;
+
+	memset(r, 0, sizeof(*r));
+	r->cr = 5;
+	r->powe = -1;
+	r->port = -1;
+	if (colon == NULL || (size_t)(colon - arg) >= size)
+		return -1;
+	memcpy(spec, arg, colon - arg);
+	spec[colon - arg] = '\0';
+
+	n = sscanf(colon + 1, "%lf:%u:%u:%u:%d:%c", &mhz, &r->sf, &r->bw_khz, &r->cr, &r->powe,
+		   &iq);
+	if (n < 3 || mhz <= 0 || mhz > 4000 || r->sf < 5 || r->sf > 12 ||
+	    r->bw_khz == 0 || r->cr < 5 || r->cr > 8 || (n >= 5 && (r->powe < 0 || r->powe > 40)) ||
+	    (iq != 'i' && iq != 'n'))
+		return -1;
+	r->freq_hz = mhz * 1e6 + 0.5;
+	r->ipol = iq == 'i';
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s -g eui -s host [-u port] [-d port] [-i radio]... [-D path | -N] [-W ms] [-E ms] [-M kb] [-B ms[:frames] [-Z codec[:dict]]] [-k secs] [-t secs]\n", prog);
+	fprintf(stderr, "  -g  gateway EUI, 16 hex digits\n");
+	fprintf(stderr, "  -s  network server host\n");
+	fprintf(stderr, "  -u  server port for PUSH_DATA (default 1700)\n");
+	fprintf(stderr, "  -d  server port for PULL_DATA (default 1700)\n");
+	fprintf(stderr, "  -i  ifname:freq_mhz:sf:bw_khz[:cr[:powe[:iq]]] radio serving uplinks, cr 5..8,\n");
+	fprintf(stderr, "      powe its TX power in dBm, iq i (default) if it transmits with inverted IQ\n");
+	fprintf(stderr, "      or n if not (default lora0:868.1:7:125); ifname may also be an ifindex\n");
+	fprintf(stderr, "  -D  send downlinks through the lorad at this socket (default %s)\n", LORAD_SOCK_PATH);
+	fprintf(stderr, "  -N  uplinks only, answer every PULL_RESP with TX_FREQ\n");
+	fprintf(stderr, "  -W  with several radios, hold an uplink this long for copies from the\n");
+	fprintf(stderr, "      others and forward it once (default %d ms, 0: forward the first copy)\n", DEDUP_WINDOW_MS);
+	fprintf(stderr, "  -E  drop copies arriving up to this long after the first (default %d ms)\n", DEDUP_EXPIRE_MS);
+	fprintf(stderr, "  -M  memory for uplink frames in flight (default %d KiB)\n", POOL_KB);
+	fprintf(stderr, "  -B  send uplinks as binary batches, each after this long or this many\n");
+	fprintf(stderr, "      frames (default %d), whichever comes first; 0 ms: what each loop round received\n", BATCH_FRAMES);
+	fprintf(stderr, "  -Z  with -B, compress batches with lz4 or zstd[:dictfile], if built in\n");
+	fprintf(stderr, "  -k  PULL_DATA keepalive interval (default %d s)\n", KEEPALIVE_S);
+	fprintf(stderr, "  -t  stat interval (default %d s)\n", STAT_S);
+}
+
+int main(int argc, char **argv)
+{
+	const char *radio_args[MAX_RADIOS];
+	char specs[MAX_RADIOS][IFNAMSIZ + 8];
+	const char *host = NULL, *up_port = "1700", *down_port = "1700";
+	const char *lorad_path = LORAD_SOCK_PATH, *codec_arg = NULL;
+	long keepalive = KEEPALIVE_S, stat_s = STAT_S;
+	long window_ms = DEDUP_WINDOW_MS, expire_ms = DEDUP_EXPIRE_MS, pool_kb = POOL_KB;
+	int nargs = 0, no_lorad = 0, have_eui = 0, opt, ret;
+
+	while ((opt = getopt(argc, argv, "g:s:u:d:i:D:NW:E:M:B:Z:k:t:h")) != -1) {
+		switch (opt) {
+		case 'g':
+			gw_eui = strtoull(optarg, NULL, 16);
+			have_eui = strlen(optarg) == 16;
+			break;
+		case 's':
+			host = optarg;
+			break;
+		case 'u':
+			up_port = optarg;
+			break;
+		case 'd':
+			down_port = optarg;
+			break;
+		case 'i':
+			if (nargs == MAX_RADIOS) {
+				fprintf(stderr, "at most %d radios\n", MAX_RADIOS);
+				return 1;
+			}
+			radio_args[nargs++] = optarg;
+			break;
+		case 'D':
+			lorad_path = optarg;
+			break;
+		case 'N':
+			no_lorad = 1;
+			break;
+		case 'W':
+			window_ms = strtol(optarg, NULL, 0);
+			break;
+		case 'E':
+			expire_ms = strtol(optarg, NULL, 0);
+			break;
+		case 'M':
+			pool_kb = strtol(optarg, NULL, 0);
+			break;
+		case 'B':
+			if (sscanf(optarg, "%ld:%ld", &batch_ms, &batch_frames) < 1) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'Z':
+			codec_arg = optarg;
+			break;
+		case 'k':
+			keepalive = strtol(optarg, NULL, 0);
+			break;
+		case 't':
+			stat_s = strtol(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (optind < argc || host == NULL || !have_eui || keepalive < 1 || stat_s < 1 ||
+	    window_ms < 0 || expire_ms < window_ms || pool_kb < 1 || batch_ms < -1 ||
+	    batch_ms > 60000 || batch_frames < 1 || batch_frames > UL_MAX_COUNT ||
+	    (codec_arg && batch_ms < 0)) {
+		usage(argv[0]);
+		return 1;
+	}
+	if (codec_arg && parse_codec(codec_arg))
+		return 1;
+	if (nargs == 0)
+		radio_args[nargs++] = "lora0:868.1:7:125";
+
+	struct ifc_entry ifs[MAX_RADIOS];
+	struct ifcache ifc;
+
+	ifcache_init(&ifc);
+	for (int i = 0; i < nargs; i++) {
+		if (parse_radio(radio_args[i], &radios[i], specs[i], sizeof(specs[i]))) {
+			usage(argv[0]);
+			return 1;
+		}
+		ret = ifcache_expand(&ifc, specs[i], ARPHRD_LORA, &ifs[i], 1);
+		if (ret != 1) {
+			fprintf(stderr, "%s: %s\n", specs[i], strerror(ret < 0 ? -ret : ENODEV));
+			return 1;
+		}
+		strcpy(radios[i].ifname, ifs[i].name);
+	}
+	ifcache_close(&ifc);
+	nradios = nargs;
+
+	ret = fp_init(&pool, pool_kb * 1024);
+	if (ret == 0 && pool.nframes < POOL_MIN) {
+		fp_destroy(&pool);
+		ret = -EINVAL;
+	}
+	if (ret < 0) {
+		fprintf(stderr, "frame pool of %ld KiB: %s\n", pool_kb, strerror(-ret));
+		return 1;
+	}
+	fp_cache_init(&cache, &pool);
+
+	/* One radio never hears a frame twice. */
+	use_dedup = nradios > 1;
+	if (use_dedup) {
+		ret = dd_init(&dedup, DEDUP_KEYS, DEDUP_HELD, window_ms * 1000000ULL,
+			      expire_ms * 1000000ULL, &cache, dedup_release, NULL);
+		if (ret < 0) {
+			fprintf(stderr, "dd_init failed: %s\n", strerror(-ret));
+			return 1;
+		}
+	}
+
+	if (!no_lorad) {
+		ret = lorad_connect(&lc, lorad_path, LORAD_HELLO_SHM);
+		if (ret < 0) {
+			fprintf(stderr, "%s: %s\n", lorad_path, strerror(-ret));
+			return 1;
+		}
+		have_lorad = 1;
+		for (int i = 0; i < nradios; i++) {
+			radios[i].port = lorad_port(&lc, radios[i].ifname);
+			if (radios[i].port < 0)
+				fprintf(stderr, "%s: not served by lorad, no downlinks\n", radios[i].ifname);
+		}
+	}
+
+	ret = evloop_init(&loop);
+	if (ret < 0) {
+		fprintf(stderr, "epoll: %s\n", strerror(-ret));
+		return 1;
+	}
+	loop.flush = round_flush;
+
+	up_src.fd = open_server(host, up_port);
+	down_src.fd = open_server(host, down_port);
+	if (up_src.fd == -1 || down_src.fd == -1)
+		return 1;
+	up_src.fn = up_readable;
+	down_src.fn = down_readable;
+	if (open_timer(&keepalive_src, keepalive_expired, keepalive) ||
+	    open_timer(&stat_src, stat_expired, stat_s))
+		return 1;
+	dedup_src.fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+	dedup_src.fn = dedup_expired;
+	batch_src.fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+	batch_src.fn = batch_expired;
+	if (dedup_src.fd == -1 || batch_src.fd == -1) {
+		int err = errno;
+		fprintf(stderr, "timerfd_create failed: %s\n", strerror(err));
+		return 1;
+	}
+	if ((ret = evloop_add(&loop, &up_src, EPOLLIN)) < 0 ||
+	    (ret = evloop_add(&loop, &down_src, EPOLLIN)) < 0 ||
+	    (ret = evloop_add(&loop, &keepalive_src, EPOLLIN)) < 0 ||
+	    (ret = evloop_add(&loop, &stat_src, EPOLLIN)) < 0 ||
+	    (ret = evloop_add(&loop, &dedup_src, EPOLLIN)) < 0 ||
+	    (ret = evloop_add(&loop, &batch_src, EPOLLIN)) < 0) {
+		fprintf(stderr, "epoll_ctl: %s\n", strerror(-ret));
+		return 1;
+	}
+
+	for (int i = 0; i < nradios; i++) {
+		struct radio *r = &radios[i];
+
+		if (open_radio(r, ifs[i].ifindex))
+			return 1;
+		ret = evloop_add(&loop, &r->src, EPOLLIN);
+		if (ret < 0) {
+			fprintf(stderr, "epoll_ctl: %s\n", strerror(-ret));
+			return 1;
+		}
+
+		char powe[16] = "";
+
+		if (r->powe >= 0)
+			snprintf(powe, sizeof(powe), " %d dBm", r->powe);
+		printf("radio %d %s %u.%06u MHz SF%uBW%u 4/%u%s %s IQ lorad port %d\n", i,
+		       r->ifname, r->freq_hz / 1000000, r->freq_hz % 1000000, r->sf, r->bw_khz, r->cr,
+		       powe, r->ipol ? "inverted" : "normal", r->port);
+	}
+	fflush(stdout);
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	/* Let the server learn the downlink address right away. */
+	send_pull_data();
+
+	ret = evloop_run(&loop, -1);
+	if (ret < 0)
+		fprintf(stderr, "epoll_wait: %s\n", strerror(-ret));
+	if (use_dedup)
+		dd_run(&dedup, UINT64_MAX);
+	batch_due = 0;
+	round_flush(&loop);
+
+	for (int i = 0; i < nradios; i++) {
+		printf("%s uplinks %llu truncated %llu stalls %llu\n", radios[i].ifname,
+		       (unsigned long long)radios[i].frames, (unsigned long long)radios[i].truncated,
+		       (unsigned long long)radios[i].stalls);
+		close(radios[i].src.fd);
+	}
+	printf("up %llu push_data %llu push_ack %llu dropped %llu\n",
+	       (unsigned long long)total_up, (unsigned long long)total_pushes,
+	       (unsigned long long)total_acks, (unsigned long long)total_drops);
+	if (batch_ms >= 0)
+		printf("batches raw %llu bytes sent %llu bytes\n",
+		       (unsigned long long)total_batch_raw, (unsigned long long)total_batch_sent);
+	if (use_dedup)
+		printf("dedup unique %llu duplicates %llu late %llu early %llu evicted %llu\n",
+		       (unsigned long long)dedup.st.unique, (unsigned long long)dedup.st.duplicates,
+		       (unsigned long long)dedup.st.late, (unsigned long long)dedup.st.early,
+		       (unsigned long long)dedup.st.evicted);
+	printf("pool frames %u refills %llu spills %llu empty %llu\n", pool.nframes,
+	       (unsigned long long)pool.st.refills, (unsigned long long)pool.st.spills,
+	       (unsigned long long)pool.st.empty);
+	printf("pull_resp %llu sent %llu rejected %llu pull_ack %llu wakeups %lu\n",
+	       (unsigned long long)total_down, (unsigned long long)total_tx,
+	       (unsigned long long)total_rejected, (unsigned long long)total_pull_acks,
+	       loop.wakeups);
+
+	if (have_lorad) {
+		lorad_flush(&lc, 1000);
+		lorad_close(&lc);
+	}
+	close(up_src.fd);
+	close(down_src.fd);
+	close(keepalive_src.fd);
+	close(stat_src.fd);
+	close(dedup_src.fd);
+	close(batch_src.fd);
+	ul_codec_free(&codec);
+	dd_free(&dedup);
+	fp_cache_flush(&cache);
+	fp_destroy(&pool);
+	evloop_close(&loop);
+	return 0;
+}
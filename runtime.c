@@ -0,0 +1,1203 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <linux/if_packet.h>
+#include <linux/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+#include "include/linux/lora.h"
+#include "lorastats.h"
+#include "runtime.h"
+#include "tstamp.h"
+#include "uring.h"
+
+#ifndef PACKET_QDISC_BYPASS
+#define PACKET_QDISC_BYPASS 20
+#endif
+
+#ifndef AF_LORA
+#define AF_LORA 28
+#endif
+
+#ifndef PF_LORA
+#define PF_LORA AF_LORA
+#endif
+
+#ifndef SO_RXQ_OVFL
+#define SO_RXQ_OVFL 40
+#endif
+
+#define TS_WINDOW	65536
+#define TS_DRAIN_MS	2000
+
+/* Shared by every RX socket; a stalled dispatcher runs them out first. */
+#define URING_NBUFS	RT_QUEUE_LEN
+#define URING_BUF_SIZE	((sizeof(struct io_uring_recvmsg_out) + TSTAMP_CMSG_SPACE + \
+			  RT_FRAME_MAX + 63) & ~63)
+
+static const char *const engine_names[RT_NR_ENGINES] = {
+	[RT_ENGINE_MMSG] = "recvmmsg",
+	[RT_ENGINE_EPOLL] = "epoll",
+	[RT_ENGINE_URING] = "io_uring",
+};
+
+/* epoll data and io_uring user_data: a worker's id, or one of these plus it */
+#define RX_DOORBELL	RT_MAX_WORKERS
+#define URING_CANCEL	(2 * RT_MAX_WORKERS)
+
+/* A datagram the io_uring engine received for a parked worker. */
+struct rx_held {
+	uint64_t t_read;
+	int32_t res;
+	uint32_t bid;
+};
+
+/* State of the single RX thread of the epoll and io_uring engines. */
+struct rt_rx_engine {
+	pthread_t thread;
+	int epfd;
+	struct uring ring;
+	struct uring_pbuf pbuf;
+	struct msghdr msg;	/* multishot recvmsg template */
+	uint32_t pending[RT_MAX_WORKERS];	/* filled, uncommitted slots */
+	_Atomic uint32_t parked;	/* workers out of service for a full rxq */
+	uint32_t armed;		/* io_uring: multishot recvmsg in flight */
+	uint32_t waking;	/* io_uring: doorbell read in flight */
+	uint64_t wake_val[RT_MAX_WORKERS];
+	uint32_t held_head[RT_MAX_WORKERS], held_tail[RT_MAX_WORKERS];
+	struct rx_held held[RT_MAX_WORKERS][URING_NBUFS];
+};
+
+static uint64_t mono_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void doorbell_ring(int fd)
+{
+	uint64_t one = 1;
+	ssize_t ret;
+
+	ret = write(fd, &one, sizeof(one));
+	(void)ret;
+}
+
+static void doorbell_clear(int fd)
+{
+	uint64_t val;
+	ssize_t ret;
+
+	ret = read(fd, &val, sizeof(val));
+	(void)ret;
+}
+
+static void doorbell_wait(int fd, int timeout_ms)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+	if (poll(&pfd, 1, timeout_ms) > 0)
+		doorbell_clear(fd);
+}
+
+static int open_socket(struct rt_worker *w)
+{
+	struct timeval tv = { .tv_sec = 0, .tv_usec = RT_POLL_MS * 1000 };
+	struct ifreq ifr;
+	int skt, ret;
+
+	/*
+	 * A PF_PACKET socket with a protocol gets a copy of every frame the
+	 * interface receives, so senders use 0 and address each frame.
+	 */
+	if (w->proto)
+		skt = socket(PF_PACKET, SOCK_DGRAM | SOCK_CLOEXEC,
+			     w->dir == RT_RX ? htons(w->proto) : 0);
+	else
+		skt = socket(PF_LORA, SOCK_DGRAM | SOCK_CLOEXEC, 1);
+	if (skt == -1) {
+		int err = errno;
+		fprintf(stderr, "%s: socket failed: %s\n", w->ifname, strerror(err));
+		return -1;
+	}
+
+	if (w->ifindex == 0) {
+		memset(&ifr, 0, sizeof(ifr));
+		strcpy(ifr.ifr_name, w->ifname);
+		ret = ioctl(skt, SIOCGIFINDEX, &ifr);
+		if (ret == -1) {
+			int err = errno;
+			fprintf(stderr, "%s: ioctl failed: %s\n", w->ifname, strerror(err));
+			goto err;
+		}
+		w->ifindex = ifr.ifr_ifindex;
+	}
+
+	if (w->proto) {
+		struct sockaddr_ll addr;
+
+		memset(&addr, 0, sizeof(addr));
+		addr.sll_family = AF_PACKET;
+		addr.sll_protocol = htons(w->proto);
+		addr.sll_ifindex = w->ifindex;
+		if (w->dir == RT_RX) {
+			ret = bind(skt, (struct sockaddr *)&addr, sizeof(addr));
+		} else {
+			memcpy(&w->dst, &addr, sizeof(addr));
+			w->dst_len = sizeof(addr);
+			ret = 0;
+		}
+	} else {
+		struct sockaddr_lora addr;
+
+		memset(&addr, 0, sizeof(addr));
+		addr.lora_family = AF_LORA;
+		addr.lora_ifindex = w->ifindex;
+		ret = bind(skt, (struct sockaddr *)&addr, sizeof(addr));
+	}
+	if (ret == -1) {
+		int err = errno;
+		fprintf(stderr, "%s: bind failed: %s\n", w->ifname, strerror(err));
+		goto err;
+	}
+
+	/* Bounded blocking, so workers notice rt_stop() without signals. */
+	setsockopt(skt, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(skt, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	if (w->dir == RT_RX) {
+		int one = 1;
+		setsockopt(skt, SOL_SOCKET, SO_RXQ_OVFL, &one, sizeof(one));
+	}
+
+	/*
+	 * The radio serializes TX itself, so the qdisc only adds latency.
+	 * Without it a full driver queue shows up as ENOBUFS, which the TX
+	 * worker already retries.
+	 */
+	if (w->flags & RT_QDISC_BYPASS) {
+		int one = 1;
+		ret = w->proto ? setsockopt(skt, SOL_PACKET, PACKET_QDISC_BYPASS, &one, sizeof(one)) : -1;
+		if (ret == -1) {
+			int err = w->proto ? errno : EPROTONOSUPPORT;
+			fprintf(stderr, "%s: PACKET_QDISC_BYPASS failed: %s\n", w->ifname, strerror(err));
+			goto err;
+		}
+	}
+
+	if (w->flags & RT_TSTAMP) {
+		int hw = !!(w->flags & RT_HWTSTAMP);
+		ret = w->dir == RT_RX ? tstamp_enable_rx(skt, hw) : tstamp_enable_tx(skt, hw);
+		if (ret < 0) {
+			fprintf(stderr, "%s: SO_TIMESTAMPING failed: %s\n", w->ifname, strerror(-ret));
+			goto err;
+		}
+	}
+
+	w->fd = skt;
+	return 0;
+
+err:
+	close(skt);
+	return -1;
+}
+
+static void account_call(struct rt_stats *st, uint64_t ns)
+{
+	st->calls++;
+	st->call_ns_sum += ns;
+	if (ns < st->call_ns_min)
+		st->call_ns_min = ns;
+	if (ns > st->call_ns_max)
+		st->call_ns_max = ns;
+}
+
+static void get_rxq_ovfl(struct msghdr *mh, uint32_t *drops)
+{
+	struct cmsghdr *cmsg;
+
+	for (cmsg = CMSG_FIRSTHDR(mh); cmsg != NULL; cmsg = CMSG_NXTHDR(mh, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL)
+			memcpy(drops, CMSG_DATA(cmsg), sizeof(*drops));
+	}
+}
+
+/* Copies the counters to the worker's stats record, if RT_STATS_MS passed. */
+static void stats_publish(struct rt_worker *w, int force)
+{
+	struct ls_if *r = w->stats;
+	uint64_t now;
+
+	if (r == NULL)
+		return;
+	now = mono_ns();
+	if (!force && now - w->stats_at < RT_STATS_MS * 1000000ULL)
+		return;
+	w->stats_at = now;
+
+	ls_write_begin(&r->worker_seq);
+	r->worker.updated_ns = realtime_ns();
+	r->worker.frames = w->st.frames;
+	r->worker.bytes = w->st.bytes;
+	r->worker.calls = w->st.calls;
+	r->worker.errors = w->st.errors;
+	r->worker.retries = w->st.retries;
+	r->worker.drops = w->st.drops;
+	if (w->flags & RT_TSTAMP) {
+		r->worker.hist_sched = *w->hist_sched;
+		r->worker.hist_snd = *w->hist_snd;
+		r->worker.hist_hw = *w->hist_hw;
+	}
+	ls_write_end(&r->worker_seq);
+}
+
+/* Fills in everything but the payload, which is already in f->data. */
+static void rx_fill(struct rt_worker *w, struct rt_frame *f, struct msghdr *mh,
+		    unsigned int len, int trunc, uint64_t t_read)
+{
+	f->len = len < RT_FRAME_MAX ? len : RT_FRAME_MAX;
+	f->flags = trunc ? RT_FRAME_TRUNC : 0;
+	f->read_ns = t_read;
+	f->sw_ns = 0;
+	f->hw_ns = 0;
+	get_rxq_ovfl(mh, &w->st.drops);
+	if (w->flags & RT_TSTAMP) {
+		tstamp_from_cmsg(mh, &f->sw_ns, &f->hw_ns);
+		if (f->sw_ns && f->sw_ns <= t_read)
+			lat_hist_add(w->hist_sched, t_read - f->sw_ns);
+		if (f->hw_ns && f->hw_ns <= t_read)
+			lat_hist_add(w->hist_hw, t_read - f->hw_ns);
+	}
+	w->st.bytes += f->len;
+}
+
+static void rx_loop(struct rt_worker *w, struct iovec *iov, struct mmsghdr *msgs)
+{
+	char (*control)[TSTAMP_CMSG_SPACE];
+
+	control = calloc(w->batch, sizeof(*control));
+	if (control == NULL) {
+		w->st.errors++;
+		return;
+	}
+
+	while (!rt_stopping(w->rt)) {
+		stats_publish(w, 0);
+
+		uint32_t n = spsc_prod_avail(&w->q);
+		if (n == 0) {
+			/* Dispatcher is behind; let the socket buffer absorb it. */
+			doorbell_ring(w->rt->doorbell);
+			usleep(1000);
+			continue;
+		}
+		if (n > w->batch)
+			n = w->batch;
+
+		for (uint32_t i = 0; i < n; i++) {
+			struct rt_frame *f = spsc_prod_slot(&w->q, i);
+
+			iov[i].iov_base = f->data;
+			iov[i].iov_len = RT_FRAME_MAX;
+			memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			msgs[i].msg_hdr.msg_control = control[i];
+			msgs[i].msg_hdr.msg_controllen = sizeof(control[i]);
+		}
+
+		uint64_t t0 = mono_ns();
+		int ret = recvmmsg(w->fd, msgs, n, MSG_WAITFORONE, NULL);
+		if (ret == -1) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+				continue;
+			w->st.errors++;
+			usleep(RT_POLL_MS * 1000);
+			continue;
+		}
+		uint64_t t_read = realtime_ns();
+		account_call(&w->st, mono_ns() - t0);
+
+		for (int i = 0; i < ret; i++) {
+			struct msghdr *mh = &msgs[i].msg_hdr;
+
+			rx_fill(w, spsc_prod_slot(&w->q, i), mh, msgs[i].msg_len,
+				mh->msg_flags & MSG_TRUNC, t_read);
+		}
+		w->st.frames += ret;
+
+		spsc_prod_commit(&w->q, ret);
+		doorbell_ring(w->rt->doorbell);
+	}
+
+	stats_publish(w, 1);
+	free(control);
+}
+
+static void tx_drain_tstamps(struct rt_worker *w)
+{
+	struct tx_tstamp ts;
+	int ret;
+
+	while ((ret = tstamp_read_tx(w->fd, &ts)) != 0) {
+		if (ret == -EPROTO)
+			continue;
+		if (ret < 0)
+			break;
+
+		uint64_t t0 = w->tx_submit[ts.id % TS_WINDOW];
+		switch (ts.kind) {
+		case TSTAMP_SCHED:
+			if (ts.sw_ns >= t0)
+				lat_hist_add(w->hist_sched, ts.sw_ns - t0);
+			break;
+		case TSTAMP_SND:
+			w->tx_snd_seen++;
+			if (ts.sw_ns && ts.sw_ns >= t0)
+				lat_hist_add(w->hist_snd, ts.sw_ns - t0);
+			if (ts.hw_ns && ts.hw_ns >= t0)
+				lat_hist_add(w->hist_hw, ts.hw_ns - t0);
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+/* TX completion can trail the last send by a full time-on-air. */
+static void tx_wait_tstamps(struct rt_worker *w)
+{
+	struct pollfd pfd = { .fd = w->fd, .events = 0 };
+	uint64_t deadline = mono_ns() + TS_DRAIN_MS * 1000000ULL;
+
+	while (w->tx_snd_seen < (long)w->st.frames) {
+		uint64_t t = mono_ns();
+		if (t >= deadline)
+			break;
+		if (poll(&pfd, 1, (deadline - t) / 1000000 + 1) <= 0)
+			break;
+		tx_drain_tstamps(w);
+	}
+}
+
+static void tx_loop(struct rt_worker *w, struct iovec *iov, struct mmsghdr *msgs)
+{
+	for (;;) {
+		stats_publish(w, 0);
+
+		uint32_t n = spsc_cons_avail(&w->q);
+		if (n == 0) {
+			if (rt_stopping(w->rt))
+				break;
+			doorbell_wait(w->doorbell, RT_POLL_MS);
+			continue;
+		}
+		if (rt_stopping(w->rt)) {
+			/* Not drained in time, discard what is left. */
+			w->st.errors += n;
+			spsc_cons_release(&w->q, n);
+			continue;
+		}
+		if (n > w->batch)
+			n = w->batch;
+
+		for (uint32_t i = 0; i < n; i++) {
+			struct rt_frame *f = spsc_cons_slot(&w->q, i);
+
+			iov[i].iov_base = f->data;
+			iov[i].iov_len = f->len;
+			memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+			if (w->dst_len) {
+				msgs[i].msg_hdr.msg_name = &w->dst;
+				msgs[i].msg_hdr.msg_namelen = w->dst_len;
+			}
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			if (w->tx_submit)
+				w->tx_submit[(w->tx_key + i) % TS_WINDOW] = f->sw_ns;
+		}
+
+		uint64_t t0 = mono_ns();
+		int ret = sendmmsg(w->fd, msgs, n, 0);
+		uint64_t lat = mono_ns() - t0;
+		if (ret == -1) {
+			if (errno == ENOBUFS || errno == EAGAIN || errno == EWOULDBLOCK ||
+			    errno == EINTR) {
+				struct pollfd pfd = { .fd = w->fd, .events = POLLOUT };
+				w->st.retries++;
+				poll(&pfd, 1, 1);
+				continue;
+			}
+			/* The first frame was rejected; drop it and go on. */
+			w->st.errors++;
+			spsc_cons_release(&w->q, 1);
+			w->tx_key++;
+			continue;
+		}
+		account_call(&w->st, lat);
+
+		for (int i = 0; i < ret; i++)
+			w->st.bytes += ((struct rt_frame *)spsc_cons_slot(&w->q, i))->len;
+		w->st.frames += ret;
+		w->tx_key += ret;
+		spsc_cons_release(&w->q, ret);
+		doorbell_ring(w->rt->doorbell);
+
+		if (w->flags & RT_TSTAMP)
+			tx_drain_tstamps(w);
+	}
+
+	if (w->flags & RT_TSTAMP)
+		tx_wait_tstamps(w);
+	stats_publish(w, 1);
+}
+
+static int rx_shared(const struct rt_worker *w)
+{
+	return w->dir == RT_RX && w->rt->engine != RT_ENGINE_MMSG;
+}
+
+static void rx_shared_publish(struct rt *rt, int force)
+{
+	for (int i = 0; i < rt->nworkers; i++)
+		if (rx_shared(&rt->workers[i]))
+			stats_publish(&rt->workers[i], force);
+}
+
+/*
+ * A worker whose rxq is full is taken out of the shared thread's service,
+ * so it cannot hold up the other sockets; its socket buffer absorbs the
+ * backlog until the dispatcher frees a batch of slots and, seeing it
+ * parked, rings its doorbell.
+ */
+static void rx_park(struct rt *rt, struct rt_worker *w)
+{
+	atomic_fetch_or(&rt->rx->parked, 1u << w->id);
+	/* Pairs with rx_wake(): either it sees the bit or rx_unpark() its slots. */
+	atomic_thread_fence(memory_order_seq_cst);
+}
+
+static int rx_is_parked(struct rt *rt, const struct rt_worker *w)
+{
+	return atomic_load_explicit(&rt->rx->parked, memory_order_relaxed) & 1u << w->id;
+}
+
+/* Free rxq slots; rereads the dispatcher's index only when out of them. */
+static uint32_t rx_room(struct rt *rt, struct rt_worker *w)
+{
+	uint32_t pending = rt->rx->pending[w->id];
+	uint32_t room = spsc_prod_avail(&w->q) - pending;
+
+	return room ? room : spsc_prod_space(&w->q) - pending;
+}
+
+/* Returns 1 if the worker had room for a batch and is back in service. */
+static int rx_unpark(struct rt *rt, struct rt_worker *w)
+{
+	if (spsc_prod_space(&w->q) - rt->rx->pending[w->id] < w->batch)
+		return 0;
+	atomic_fetch_and(&rt->rx->parked, ~(1u << w->id));
+	return 1;
+}
+
+/* Dispatcher side, after freeing slots of w. */
+static void rx_wake(struct rt *rt, struct rt_worker *w)
+{
+	atomic_thread_fence(memory_order_seq_cst);
+	if (rx_is_parked(rt, w))
+		doorbell_ring(w->doorbell);
+}
+
+static void rx_epoll_serve(struct rt *rt, struct rt_worker *w, uint32_t events)
+{
+	struct epoll_event ev = { .events = events, .data.u64 = w->id };
+
+	if (epoll_ctl(rt->rx->epfd, EPOLL_CTL_MOD, w->fd, &ev) == -1)
+		w->st.errors++;
+}
+
+/* Level-triggered, so a socket left unread for a full rxq comes back. */
+static void rx_epoll_loop(struct rt *rt)
+{
+	struct epoll_event evs[2 * RT_MAX_WORKERS];
+	char control[TSTAMP_CMSG_SPACE];
+
+	while (!rt_stopping(rt)) {
+		int n = epoll_wait(rt->rx->epfd, evs, 2 * RT_MAX_WORKERS, RT_POLL_MS);
+		int kick = 0;
+
+		for (int i = 0; i < n; i++) {
+			uint64_t id = evs[i].data.u64;
+
+			if (id >= RX_DOORBELL) {
+				doorbell_clear(rt->workers[id - RX_DOORBELL].doorbell);
+				continue;
+			}
+
+			struct rt_worker *w = &rt->workers[id];
+			uint32_t avail = spsc_prod_avail(&w->q), got = 0;
+
+			if (avail > w->batch)
+				avail = w->batch;
+			while (got < avail) {
+				struct rt_frame *f = spsc_prod_slot(&w->q, got);
+				struct iovec iov = { .iov_base = f->data, .iov_len = RT_FRAME_MAX };
+				struct msghdr mh = {
+					.msg_iov = &iov,
+					.msg_iovlen = 1,
+					.msg_control = control,
+					.msg_controllen = sizeof(control),
+				};
+
+				uint64_t t0 = mono_ns();
+				ssize_t ret = recvmsg(w->fd, &mh, 0);
+				if (ret == -1) {
+					if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+						w->st.errors++;
+					break;
+				}
+				account_call(&w->st, mono_ns() - t0);
+				rx_fill(w, f, &mh, ret, mh.msg_flags & MSG_TRUNC, realtime_ns());
+				got++;
+			}
+			if (got) {
+				w->st.frames += got;
+				spsc_prod_commit(&w->q, got);
+				kick = 1;
+			}
+			if (spsc_prod_avail(&w->q) == 0) {
+				rx_epoll_serve(rt, w, 0);
+				rx_park(rt, w);
+			}
+		}
+		if (kick)
+			doorbell_ring(rt->doorbell);
+
+		for (int i = 0; i < rt->nworkers; i++) {
+			struct rt_worker *w = &rt->workers[i];
+
+			if (rx_shared(w) && rx_is_parked(rt, w) && rx_unpark(rt, w))
+				rx_epoll_serve(rt, w, EPOLLIN);
+		}
+		rx_shared_publish(rt, 0);
+	}
+	rx_shared_publish(rt, 1);
+}
+
+static int uring_arm(struct rt_rx_engine *rx, struct rt_worker *w)
+{
+	struct io_uring_sqe *sqe = uring_get_sqe(&rx->ring);
+
+	if (sqe == NULL)
+		return -EBUSY;
+	uring_prep_recvmsg_multishot(sqe, w->fd, &rx->msg, rx->pbuf.bgid, w->id);
+	rx->armed |= 1u << w->id;
+	return 0;
+}
+
+/* Stops a parked worker's multishot recvmsg taking shared buffers. */
+static void uring_cancel(struct rt_rx_engine *rx, struct rt_worker *w)
+{
+	struct io_uring_sqe *sqe = uring_get_sqe(&rx->ring);
+
+	if (sqe)
+		uring_prep_cancel(sqe, w->id, URING_CANCEL);
+}
+
+static void uring_wait_doorbell(struct rt_rx_engine *rx, struct rt_worker *w)
+{
+	struct io_uring_sqe *sqe = uring_get_sqe(&rx->ring);
+
+	if (sqe == NULL)
+		return;
+	uring_prep_read(sqe, w->doorbell, &rx->wake_val[w->id], sizeof(rx->wake_val[w->id]),
+			RX_DOORBELL + w->id);
+	rx->waking |= 1u << w->id;
+}
+
+static void uring_commit(struct rt *rt)
+{
+	struct rt_rx_engine *rx = rt->rx;
+	int kick = 0;
+
+	for (int i = 0; i < rt->nworkers; i++) {
+		if (rx->pending[i] == 0)
+			continue;
+		rt->workers[i].st.frames += rx->pending[i];
+		spsc_prod_commit(&rt->workers[i].q, rx->pending[i]);
+		rx->pending[i] = 0;
+		kick = 1;
+	}
+	if (kick)
+		doorbell_ring(rt->doorbell);
+}
+
+/* Copies one datagram into the next free slot and recycles its buffer. */
+static void uring_deliver(struct rt *rt, struct rt_worker *w, unsigned int bid, int res,
+			  uint64_t t_read)
+{
+	struct rt_rx_engine *rx = rt->rx;
+	struct io_uring_recvmsg_out *out = (void *)uring_pbuf_addr(&rx->pbuf, bid);
+	unsigned char *control = (unsigned char *)(out + 1) + rx->msg.msg_namelen;
+	unsigned char *payload = control + rx->msg.msg_controllen;
+	unsigned int room = (unsigned int)res - (payload - (unsigned char *)out);
+	struct msghdr mh = {
+		.msg_control = control,
+		.msg_controllen = out->controllen,
+	};
+	struct rt_frame *f = spsc_prod_slot(&w->q, rx->pending[w->id]++);
+	unsigned int len = out->payloadlen < room ? out->payloadlen : room;
+
+	memcpy(f->data, payload, len < RT_FRAME_MAX ? len : RT_FRAME_MAX);
+	rx_fill(w, f, &mh, len, (out->flags & MSG_TRUNC) || out->payloadlen > room, t_read);
+	uring_pbuf_recycle(&rx->pbuf, bid);
+}
+
+/*
+ * One CQE per datagram; its buffer goes back to the ring right away,
+ * unless the worker's rxq is full. Then the worker is parked: the buffer
+ * is held for it and its recvmsg cancelled until the dispatcher catches up.
+ */
+static void uring_complete(struct rt *rt, struct io_uring_cqe *cqe, uint64_t t_read)
+{
+	struct rt_rx_engine *rx = rt->rx;
+
+	if (cqe->user_data == URING_CANCEL)
+		return;
+	if (cqe->user_data >= RX_DOORBELL) {
+		rx->waking &= ~(1u << (cqe->user_data - RX_DOORBELL));
+		return;
+	}
+
+	struct rt_worker *w = &rt->workers[cqe->user_data];
+	int more = cqe->flags & IORING_CQE_F_MORE;
+
+	if (!more)
+		rx->armed &= ~(1u << w->id);
+	if (cqe->res < 0) {
+		/* -ENOBUFS: all buffers in use, the socket holds the rest. */
+		if (cqe->res != -ENOBUFS && cqe->res != -ECANCELED) {
+			w->st.errors++;
+			if (cqe->res == -EINVAL) {
+				fprintf(stderr, "%s: multishot recvmsg: %s\n", w->ifname,
+					strerror(-cqe->res));
+				return;
+			}
+		}
+		if (!more && !rx_is_parked(rt, w))
+			uring_arm(rx, w);
+		return;
+	}
+
+	unsigned int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+
+	if (rx->held_head[w->id] != rx->held_tail[w->id] || rx_room(rt, w) == 0) {
+		struct rx_held *h = &rx->held[w->id][rx->held_tail[w->id]++ & (URING_NBUFS - 1)];
+
+		h->t_read = t_read;
+		h->res = cqe->res;
+		h->bid = bid;
+		if (!rx_is_parked(rt, w)) {
+			rx_park(rt, w);
+			if (more)
+				uring_cancel(rx, w);
+		}
+		return;
+	}
+	uring_deliver(rt, w, bid, cqe->res, t_read);
+
+	if (!more && !rx_is_parked(rt, w))
+		uring_arm(rx, w);
+}
+
+/* Hands parked workers their held buffers and re-arms those with room again. */
+static void uring_unpark(struct rt *rt)
+{
+	struct rt_rx_engine *rx = rt->rx;
+
+	for (int i = 0; i < rt->nworkers; i++) {
+		struct rt_worker *w = &rt->workers[i];
+
+		if (!rx_shared(w) || !rx_is_parked(rt, w))
+			continue;
+		while (rx->held_head[i] != rx->held_tail[i] && rx_room(rt, w)) {
+			struct rx_held *h = &rx->held[i][rx->held_head[i]++ & (URING_NBUFS - 1)];
+
+			uring_deliver(rt, w, h->bid, h->res, h->t_read);
+		}
+		if (rx->held_head[i] == rx->held_tail[i] && rx_unpark(rt, w)) {
+			if (!(rx->armed & 1u << i))
+				uring_arm(rx, w);
+		} else if (!(rx->waking & 1u << i)) {
+			uring_wait_doorbell(rx, w);
+		}
+	}
+}
+
+static void rx_uring_loop(struct rt *rt)
+{
+	struct rt_rx_engine *rx = rt->rx;
+
+	while (!rt_stopping(rt)) {
+		uint64_t t0 = mono_ns();
+		int ret = uring_enter(&rx->ring, 1, RT_POLL_MS);
+		if (ret < 0) {
+			fprintf(stderr, "io_uring_enter: %s\n", strerror(-ret));
+			break;
+		}
+		uint64_t t_read = realtime_ns(), lat = mono_ns() - t0;
+
+		struct io_uring_cqe *cqe;
+		while ((cqe = uring_peek_cqe(&rx->ring)) != NULL) {
+			uring_complete(rt, cqe, t_read);
+			uring_cqe_seen(&rx->ring);
+		}
+		uring_unpark(rt);
+		uring_pbuf_publish(&rx->pbuf);
+
+		for (int i = 0; i < rt->nworkers; i++)
+			if (rx->pending[i])
+				account_call(&rt->workers[i].st, lat);
+		uring_commit(rt);
+		rx_shared_publish(rt, 0);
+	}
+	rx_shared_publish(rt, 1);
+}
+
+static void pin_thread(const cpu_set_t *set)
+{
+	if (CPU_COUNT(set))
+		pthread_setaffinity_np(pthread_self(), sizeof(*set), set);
+}
+
+static void *rx_shared_main(void *arg)
+{
+	struct rt *rt = arg;
+	cpu_set_t set;
+
+	/* One thread serves them all, so it may run where any of their IRQs do. */
+	CPU_ZERO(&set);
+	for (int i = 0; i < rt->nworkers; i++)
+		if (rx_shared(&rt->workers[i]) && rt->workers[i].cpu >= 0)
+			CPU_SET(rt->workers[i].cpu, &set);
+	pin_thread(&set);
+
+	if (rt->engine == RT_ENGINE_URING)
+		rx_uring_loop(rt);
+	else
+		rx_epoll_loop(rt);
+	doorbell_ring(rt->doorbell);
+	return NULL;
+}
+
+static void rx_engine_free(struct rt *rt)
+{
+	struct rt_rx_engine *rx = rt->rx;
+
+	if (rx == NULL)
+		return;
+	if (rt->engine == RT_ENGINE_URING) {
+		uring_pbuf_free(&rx->ring, &rx->pbuf);
+		uring_exit(&rx->ring);
+	} else {
+		close(rx->epfd);
+	}
+	free(rx);
+	rt->rx = NULL;
+}
+
+/* Sets up the shared RX thread's state once the sockets are open. */
+static int rx_engine_init(struct rt *rt)
+{
+	struct rt_rx_engine *rx;
+	int ret;
+
+	rx = calloc(1, sizeof(*rx));
+	if (rx == NULL)
+		return -ENOMEM;
+
+	if (rt->engine == RT_ENGINE_EPOLL) {
+		rx->epfd = epoll_create1(EPOLL_CLOEXEC);
+		if (rx->epfd == -1) {
+			ret = -errno;
+			free(rx);
+			return ret;
+		}
+		for (int i = 0; i < rt->nworkers; i++) {
+			struct rt_worker *w = &rt->workers[i];
+			struct epoll_event ev = { .events = EPOLLIN, .data.u64 = i };
+			struct epoll_event bell = { .events = EPOLLIN, .data.u64 = RX_DOORBELL + i };
+
+			if (!rx_shared(w))
+				continue;
+			fcntl(w->fd, F_SETFL, fcntl(w->fd, F_GETFL) | O_NONBLOCK);
+			if (epoll_ctl(rx->epfd, EPOLL_CTL_ADD, w->fd, &ev) == -1 ||
+			    epoll_ctl(rx->epfd, EPOLL_CTL_ADD, w->doorbell, &bell) == -1) {
+				ret = -errno;
+				close(rx->epfd);
+				free(rx);
+				return ret;
+			}
+		}
+		rt->rx = rx;
+		return 0;
+	}
+
+	ret = uring_init(&rx->ring, RT_QUEUE_LEN);
+	if (ret < 0) {
+		free(rx);
+		return ret;
+	}
+	ret = uring_pbuf_init(&rx->ring, &rx->pbuf, 0, URING_NBUFS, URING_BUF_SIZE);
+	if (ret < 0) {
+		uring_exit(&rx->ring);
+		free(rx);
+		return ret;
+	}
+	rx->msg.msg_controllen = TSTAMP_CMSG_SPACE;
+	for (int i = 0; i < rt->nworkers; i++)
+		if (rx_shared(&rt->workers[i]))
+			uring_arm(rx, &rt->workers[i]);
+	rt->rx = rx;
+	return 0;
+}
+
+static void *worker_main(void *arg)
+{
+	struct rt_worker *w = arg;
+
+	if (w->cpu >= 0) {
+		cpu_set_t set;
+
+		CPU_ZERO(&set);
+		CPU_SET(w->cpu, &set);
+		pin_thread(&set);
+	}
+
+	struct iovec *iov = calloc(w->batch, sizeof(*iov));
+	struct mmsghdr *msgs = calloc(w->batch, sizeof(*msgs));
+
+	if (iov && msgs) {
+		if (w->dir == RT_RX)
+			rx_loop(w, iov, msgs);
+		else
+			tx_loop(w, iov, msgs);
+	} else {
+		w->st.errors++;
+	}
+
+	free(iov);
+	free(msgs);
+	doorbell_ring(w->rt->doorbell);
+	return NULL;
+}
+
+int rt_init(struct rt *rt)
+{
+	memset(rt, 0, sizeof(*rt));
+	atomic_init(&rt->stop, 0);
+	rt->doorbell = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (rt->doorbell == -1)
+		return -errno;
+	return 0;
+}
+
+void rt_destroy(struct rt *rt)
+{
+	rx_engine_free(rt);
+	for (int i = 0; i < rt->nworkers; i++) {
+		struct rt_worker *w = &rt->workers[i];
+
+		if (w->fd != -1)
+			close(w->fd);
+		close(w->doorbell);
+		spsc_free(&w->q);
+		free(w->hist_sched);
+		free(w->hist_snd);
+		free(w->hist_hw);
+		free(w->tx_submit);
+	}
+	close(rt->doorbell);
+	rt->nworkers = 0;
+}
+
+int rt_engine_parse(const char *name)
+{
+	for (int i = 0; i < RT_NR_ENGINES; i++)
+		if (strcmp(name, engine_names[i]) == 0)
+			return i;
+	return -EINVAL;
+}
+
+const char *rt_engine_name(enum rt_engine engine)
+{
+	return engine < RT_NR_ENGINES ? engine_names[engine] : "unknown";
+}
+
+struct rt_worker *rt_add_worker(struct rt *rt, enum rt_dir dir, const char *ifname,
+				int proto, int flags)
+{
+	struct rt_worker *w;
+
+	if (rt->nworkers == RT_MAX_WORKERS || strlen(ifname) >= IFNAMSIZ)
+		return NULL;
+
+	w = &rt->workers[rt->nworkers];
+	memset(w, 0, sizeof(*w));
+	w->rt = rt;
+	w->id = rt->nworkers;
+	w->dir = dir;
+	strcpy(w->ifname, ifname);
+	w->proto = proto;
+	w->flags = flags;
+	w->cpu = -1;
+	w->batch = RT_BATCH;
+	w->fd = -1;
+	w->st.call_ns_min = UINT64_MAX;
+
+	w->doorbell = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (w->doorbell == -1)
+		return NULL;
+
+	if (spsc_init(&w->q, RT_QUEUE_LEN, sizeof(struct rt_frame))) {
+		close(w->doorbell);
+		return NULL;
+	}
+
+	if (flags & RT_TSTAMP) {
+		w->hist_sched = malloc(sizeof(*w->hist_sched));
+		w->hist_snd = malloc(sizeof(*w->hist_snd));
+		w->hist_hw = malloc(sizeof(*w->hist_hw));
+		if (dir == RT_TX)
+			w->tx_submit = calloc(TS_WINDOW, sizeof(*w->tx_submit));
+		if (!w->hist_sched || !w->hist_snd || !w->hist_hw ||
+		    (dir == RT_TX && !w->tx_submit)) {
+			free(w->hist_sched);
+			free(w->hist_snd);
+			free(w->hist_hw);
+			free(w->tx_submit);
+			spsc_free(&w->q);
+			close(w->doorbell);
+			return NULL;
+		}
+		lat_hist_init(w->hist_sched);
+		lat_hist_init(w->hist_snd);
+		lat_hist_init(w->hist_hw);
+	}
+
+	rt->nworkers++;
+	return w;
+}
+
+static int start_thread(struct rt *rt, pthread_t *thread, void *(*fn)(void *), void *arg)
+{
+	pthread_attr_t attr;
+	int ret;
+
+	pthread_attr_init(&attr);
+	if (rt->prio) {
+		struct sched_param sp = { .sched_priority = rt->prio };
+
+		pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+		pthread_attr_setschedparam(&attr, &sp);
+	}
+	ret = pthread_create(thread, &attr, fn, arg);
+	pthread_attr_destroy(&attr);
+	if (ret)
+		fprintf(stderr, "pthread_create: %s%s\n", strerror(ret),
+			ret == EPERM && rt->prio ? " (SCHED_FIFO needs CAP_SYS_NICE)" : "");
+	return ret;
+}
+
+int rt_start(struct rt *rt)
+{
+	int started, shared = 0, ret;
+
+	for (int i = 0; i < rt->nworkers; i++) {
+		struct rt_worker *w = &rt->workers[i];
+
+		if (w->batch < 1 || w->batch > RT_QUEUE_LEN)
+			w->batch = RT_BATCH;
+		if (open_socket(w))
+			return -1;
+		shared |= rx_shared(w);
+
+		if (w->stats) {
+			strcpy(w->stats->ifname, w->ifname);
+			w->stats->ifindex = w->ifindex;
+			w->stats->flags = (w->dir == RT_TX ? LS_TX : 0) |
+					  (w->flags & RT_TSTAMP ? LS_TSTAMP : 0) |
+					  (w->flags & RT_HWTSTAMP ? LS_HWTSTAMP : 0);
+		}
+	}
+
+	if (shared) {
+		ret = rx_engine_init(rt);
+		if (ret < 0) {
+			fprintf(stderr, "%s engine: %s\n", rt_engine_name(rt->engine), strerror(-ret));
+			return -1;
+		}
+		ret = start_thread(rt, &rt->rx->thread, rx_shared_main, rt);
+		if (ret) {
+			rx_engine_free(rt);
+			return -1;
+		}
+	}
+
+	for (started = 0; started < rt->nworkers; started++) {
+		if (rx_shared(&rt->workers[started]))
+			continue;
+		ret = start_thread(rt, &rt->workers[started].thread, worker_main,
+				   &rt->workers[started]);
+		if (ret)
+			break;
+	}
+
+	if (started < rt->nworkers) {
+		rt_stop(rt);
+		for (int i = 0; i < started; i++)
+			if (!rx_shared(&rt->workers[i]))
+				pthread_join(rt->workers[i].thread, NULL);
+		if (rt->rx)
+			pthread_join(rt->rx->thread, NULL);
+		return -1;
+	}
+
+	return 0;
+}
+
+void rt_stop(struct rt *rt)
+{
+	atomic_store(&rt->stop, 1);
+	for (int i = 0; i < rt->nworkers; i++)
+		doorbell_ring(rt->workers[i].doorbell);
+}
+
+void rt_join(struct rt *rt)
+{
+	for (int i = 0; i < rt->nworkers; i++)
+		if (!rx_shared(&rt->workers[i]))
+			pthread_join(rt->workers[i].thread, NULL);
+	if (rt->rx)
+		pthread_join(rt->rx->thread, NULL);
+}
+
+int rt_dispatch(struct rt *rt, rt_dispatch_fn fn, void *arg, int timeout_ms)
+{
+	int total = 0;
+
+	for (int pass = 0; pass < 2 && total == 0; pass++) {
+		if (pass)
+			doorbell_wait(rt->doorbell, timeout_ms);
+
+		for (int i = 0; i < rt->nworkers; i++) {
+			struct rt_worker *w = &rt->workers[i];
+
+			if (w->dir != RT_RX)
+				continue;
+
+			uint32_t n = spsc_cons_avail(&w->q);
+			for (uint32_t j = 0; j < n; j++)
+				fn(w, spsc_cons_slot(&w->q, j), arg);
+			spsc_cons_release(&w->q, n);
+			if (n && rt->rx)
+				rx_wake(rt, w);
+			total += n;
+		}
+	}
+
+	return total;
+}
+
+int rt_submit(struct rt_worker *w, const void *data, unsigned int len)
+{
+	struct rt_frame *f;
+
+	if (len > RT_FRAME_MAX)
+		return -EMSGSIZE;
+	if (spsc_prod_avail(&w->q) == 0)
+		return -EAGAIN;
+
+	f = spsc_prod_slot(&w->q, 0);
+	memcpy(f->data, data, len);
+	f->len = len;
+	f->flags = 0;
+	f->sw_ns = w->flags & RT_TSTAMP ? realtime_ns() : 0;
+	spsc_prod_commit(&w->q, 1);
+
+	return 0;
+}
+
+void rt_kick(struct rt_worker *w)
+{
+	doorbell_ring(w->doorbell);
+}
+
+void rt_wait(struct rt *rt, int timeout_ms)
+{
+	doorbell_wait(rt->doorbell, timeout_ms);
+}
+
+int rt_drain(struct rt *rt, int timeout_ms)
+{
+	uint64_t deadline = mono_ns() + (uint64_t)timeout_ms * 1000000ULL;
+
+	for (;;) {
+		int pending = 0;
+
+		for (int i = 0; i < rt->nworkers; i++) {
+			if (rt->workers[i].dir == RT_TX && spsc_count(&rt->workers[i].q))
+				pending = 1;
+		}
+		if (!pending)
+			return 0;
+		if (mono_ns() >= deadline)
+			return -ETIMEDOUT;
+		rt_wait(rt, 10);
+	}
+}
+
+void rt_print_stats(FILE *f, const struct rt_worker *w, double elapsed)
+{
+	const struct rt_stats *st = &w->st;
+
+	fprintf(f, "%s %s frames %llu bytes %llu %.1f frames/s\n",
+		w->ifname, w->dir == RT_RX ? "rx" : "tx",
+		(unsigned long long)st->frames, (unsigned long long)st->bytes,
+		elapsed > 0 ? st->frames / elapsed : 0.0);
+	if (st->calls)
+		fprintf(f, "%s calls %llu, %.2f frames/call, latency min/avg/max %.1f/%.1f/%.1f us\n",
+			w->ifname, (unsigned long long)st->calls,
+			(double)st->frames / st->calls, st->call_ns_min / 1e3,
+			st->call_ns_sum / 1e3 / st->calls, st->call_ns_max / 1e3);
+	fprintf(f, "%s errors %llu retries %llu drops %u\n", w->ifname,
+		(unsigned long long)st->errors, (unsigned long long)st->retries, st->drops);
+
+	if (w->flags & RT_TSTAMP) {
+		if (w->dir == RT_TX) {
+			lat_hist_print(f, w->ifname, "tx_sched", w->hist_sched);
+			lat_hist_print(f, w->ifname, "tx_snd", w->hist_snd);
+			if (w->flags & RT_HWTSTAMP)
+				lat_hist_print(f, w->ifname, "tx_hw", w->hist_hw);
+		} else {
+			lat_hist_print(f, w->ifname, "rx_sw", w->hist_sched);
+			if (w->flags & RT_HWTSTAMP)
+				lat_hist_print(f, w->ifname, "rx_hw", w->hist_hw);
+		}
+	}
+}
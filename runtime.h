@@ -0,0 +1,172 @@
+#ifndef RUNTIME_H
+#define RUNTIME_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <net/if.h>
+
+#include "latency.h"
+#include "spsc.h"
+
+/*
+ * Per-interface worker runtime.
+ *
+ * Every radio interface gets one worker thread that owns its socket.
+ * RX workers receive straight into the slots of their rxq and publish
+ * them to the dispatcher (the thread calling rt_dispatch()). TX workers
+ * drain their txq, which the dispatcher fills through rt_submit(). The
+ * queues are lock-free SPSC rings, so a worker stuck behind a slow UART
+ * module only ever backs up its own queue.
+ *
+ * Wakeups use eventfd doorbells: one per worker for the dispatcher to
+ * kick it, and one shared doorbell for workers to kick the dispatcher.
+ *
+ * rt->engine picks how RX workers read their sockets. With recvmmsg,
+ * each worker has a thread of its own. With epoll and io_uring, a single
+ * RX thread serves every RX socket and fills each worker's rxq in its
+ * place. The io_uring engine arms one multishot recvmsg per socket,
+ * taking buffers from a shared provided buffer ring, so a busy gateway
+ * receives without one system call per batch and socket. A worker whose
+ * rxq fills up is taken out of the shared thread's service until
+ * rt_dispatch() frees room, so the other sockets keep being read. TX
+ * workers always use sendmmsg().
+ *
+ * A worker given a lorastats.h record copies its counters and latency
+ * histograms there every RT_STATS_MS, from its own thread, so readers of
+ * the segment never touch the live rt_stats.
+ */
+
+#define RT_MAX_WORKERS	16
+#define RT_QUEUE_LEN	1024
+#define RT_BATCH	64	/* default frames per recvmmsg()/sendmmsg() */
+#define RT_FRAME_MAX	256
+#define RT_POLL_MS	200
+#define RT_STATS_MS	250
+
+#define RT_FRAME_TRUNC	0x0001
+
+struct rt_frame {
+	uint64_t sw_ns;		/* kernel RX timestamp, or submit time for TX */
+	uint64_t hw_ns;
+	uint64_t read_ns;	/* CLOCK_REALTIME when userspace got the frame */
+	uint16_t len;
+	uint16_t flags;
+	unsigned char data[RT_FRAME_MAX];
+};
+
+enum rt_dir {
+	RT_RX,
+	RT_TX,
+};
+
+enum rt_engine {
+	RT_ENGINE_MMSG,		/* a thread per RX worker, blocking recvmmsg() */
+	RT_ENGINE_EPOLL,	/* one RX thread, epoll and recvmsg() */
+	RT_ENGINE_URING,	/* one RX thread, io_uring multishot recvmsg */
+	RT_NR_ENGINES,
+};
+
+/* Worker flags */
+#define RT_TSTAMP	0x0001	/* software SO_TIMESTAMPING */
+#define RT_HWTSTAMP	0x0002	/* plus hardware timestamps */
+#define RT_QDISC_BYPASS	0x0004	/* PF_PACKET TX straight to the driver */
+
+struct rt_stats {
+	uint64_t frames;
+	uint64_t bytes;
+	uint64_t calls;
+	uint64_t errors;
+	uint64_t retries;	/* ENOBUFS/EAGAIN on send */
+	uint32_t drops;		/* socket drops from SO_RXQ_OVFL */
+	uint64_t call_ns_min;
+	uint64_t call_ns_max;
+	uint64_t call_ns_sum;
+};
+
+struct rt;
+struct ls_if;
+
+struct rt_worker {
+	struct rt *rt;
+	int id;
+	enum rt_dir dir;
+	char ifname[IFNAMSIZ];
+	int ifindex;		/* 0: resolve ifname with SIOCGIFINDEX */
+	int proto;		/* 0: PF_LORA, else PF_PACKET with this ethertype */
+	int flags;
+	int cpu;		/* -1: not pinned */
+	unsigned int batch;	/* 1..RT_QUEUE_LEN */
+	int fd;
+	struct sockaddr_storage dst;	/* PF_PACKET TX: where each frame goes */
+	socklen_t dst_len;
+	int doorbell;
+	pthread_t thread;
+	struct spsc_ring q;	/* rxq for RT_RX, txq for RT_TX */
+	struct ls_if *stats;	/* NULL: not exported; set before rt_start() */
+	uint64_t stats_at;
+
+	/* Written by the worker only; read them after rt_join(). */
+	struct rt_stats st;
+	struct lat_hist *hist_sched;	/* TX: submit to qdisc, or RX software */
+	struct lat_hist *hist_snd;	/* TX: submit to driver */
+	struct lat_hist *hist_hw;	/* hardware timestamps */
+	uint64_t *tx_submit;
+	uint32_t tx_key;
+	long tx_snd_seen;
+};
+
+struct rt_rx_engine;
+
+struct rt {
+	struct rt_worker workers[RT_MAX_WORKERS];
+	int nworkers;
+	int doorbell;
+	atomic_int stop;
+	enum rt_engine engine;	/* set before rt_start() */
+	int prio;		/* 0: inherit, else SCHED_FIFO priority of the I/O threads */
+	struct rt_rx_engine *rx;	/* shared RX thread, if any */
+};
+
+int rt_init(struct rt *rt);
+void rt_destroy(struct rt *rt);
+
+/* "recvmmsg", "epoll" or "io_uring"; -EINVAL for anything else. */
+int rt_engine_parse(const char *name);
+const char *rt_engine_name(enum rt_engine engine);
+
+/* Returns the new worker, or NULL if the table is full. */
+struct rt_worker *rt_add_worker(struct rt *rt, enum rt_dir dir, const char *ifname,
+				int proto, int flags);
+
+/* Opens every worker's socket, then starts the threads. */
+int rt_start(struct rt *rt);
+void rt_stop(struct rt *rt);
+void rt_join(struct rt *rt);
+
+static inline int rt_stopping(struct rt *rt)
+{
+	return atomic_load_explicit(&rt->stop, memory_order_relaxed);
+}
+
+typedef void (*rt_dispatch_fn)(struct rt_worker *w, struct rt_frame *f, void *arg);
+
+/*
+ * Hands every queued RX frame to fn; if none is queued, waits up to
+ * timeout_ms for a worker's doorbell first. Returns frames handled.
+ */
+int rt_dispatch(struct rt *rt, rt_dispatch_fn fn, void *arg, int timeout_ms);
+
+/* TX: queue one frame without blocking; -EAGAIN when the txq is full. */
+int rt_submit(struct rt_worker *w, const void *data, unsigned int len);
+/* TX: wake the worker after a series of rt_submit() calls. */
+void rt_kick(struct rt_worker *w);
+/* Waits up to timeout_ms for a worker to make TX queue space. */
+void rt_wait(struct rt *rt, int timeout_ms);
+/* Waits until every txq is empty, or timeout_ms passes. */
+int rt_drain(struct rt *rt, int timeout_ms);
+
+void rt_print_stats(FILE *f, const struct rt_worker *w, double elapsed);
+
+#endif
@@ -0,0 +1,577 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <net/if.h>
+
+#include "loracodec.h"
+#include "lwcrypto.h"
+#include "ifcache.h"
+#include "pcapng.h"
+#include "runtime.h"
+
+/*
+ * Every interface gets an RX worker that recvmmsg()s straight into the
+ * preallocated, cache-line-aligned slots of its queue; this thread only
+ * walks the published slots, so there is no per-frame allocation or copy.
+ */
+
+/*
+ * With -k, LoRaWAN frames from known sessions are queued and MIC-checked
+ * and decrypted a batch at a time, once per dispatch round, instead of
+ * setting up crypto per frame.
+ */
+#define SESSION_SLOTS	4096	/* power of two */
+#define LW_BATCH	64
+
+/*
+ * With -c, every frame is also captured to pcapng as LINKTYPE_LORATAP,
+ * with the radio settings given by -m in the LoRaTap header. The
+ * dispatcher only copies into pcapng.c buffers; disk writes happen on the
+ * writer thread.
+ */
+
+struct session {
+	int used;
+	uint32_t devaddr;
+	uint32_t fcnt_up;
+	uint32_t fcnt_down;
+	struct lw_key nwkskey;
+	struct lw_key appskey;
+};
+
+struct lw_pending {
+	struct session *sess;
+	const char *ifname;
+	struct lorawan_data d;
+	uint32_t fcnt;
+	unsigned int len;
+	uint8_t frame[RT_FRAME_MAX];
+};
+
+struct rx_state {
+	int verbose;
+	int lorawan;
+	long count;
+	uint64_t frames;
+	uint64_t truncated;
+	uint64_t malformed;
+
+	struct session *sessions;
+	struct lw_pending pending[LW_BATCH];
+	int npending;
+	uint64_t mic_ok;
+	uint64_t mic_fail;
+	uint64_t unknown;
+
+	struct pcapng_writer *cap;
+	struct radio_meta *meta;	/* per worker, for LoRaTap */
+	uint64_t cap_errors;
+};
+
+struct radio_meta {
+	uint32_t freq_hz;
+	unsigned int sf;
+	unsigned int bw_khz;
+};
+
+static struct rt rt;
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig)
+{
+	stop = 1;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void dump_frame(const char *ifname, const unsigned char *buf, size_t len)
+{
+	printf("%s ", ifname);
+	for (size_t i = 0; i < len; i++)
+		printf("%02x", buf[i]);
+	printf("\n");
+}
+
+static struct session *session_slot(struct session *tab, uint32_t devaddr)
+{
+	uint32_t h = devaddr * 2654435761u;
+
+	for (unsigned int i = 0; i < SESSION_SLOTS; i++) {
+		struct session *e = &tab[(h + i) & (SESSION_SLOTS - 1)];
+
+		if (!e->used || e->devaddr == devaddr)
+			return e;
+	}
+	return NULL;
+}
+
+static int parse_key(const char *hex, uint8_t key[LW_KEY_LEN])
+{
+	if (strlen(hex) != 2 * LW_KEY_LEN)
+		return -1;
+	for (int i = 0; i < LW_KEY_LEN; i++)
+		if (sscanf(hex + 2 * i, "%2hhx", &key[i]) != 1)
+			return -1;
+	return 0;
+}
+
+/* One "devaddr nwkskey appskey" line per ABP session, all hex. */
+static int load_sessions(struct rx_state *s, const char *path)
+{
+	char line[256], nwk[64], app[64];
+	unsigned int devaddr;
+	int lineno = 0, n = 0;
+
+	FILE *f = fopen(path, "r");
+	if (f == NULL) {
+		int err = errno;
+		fprintf(stderr, "%s: %s\n", path, strerror(err));
+		return -1;
+	}
+
+	s->sessions = calloc(SESSION_SLOTS, sizeof(*s->sessions));
+	if (s->sessions == NULL) {
+		fclose(f);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		uint8_t nk[LW_KEY_LEN], ak[LW_KEY_LEN];
+		struct session *e;
+
+		lineno++;
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		if (sscanf(line, "%x %63s %63s", &devaddr, nwk, app) != 3 ||
+		    parse_key(nwk, nk) || parse_key(app, ak)) {
+			fprintf(stderr, "%s:%d: expected devaddr nwkskey appskey\n", path, lineno);
+			fclose(f);
+			return -1;
+		}
+		e = session_slot(s->sessions, devaddr);
+		if (e == NULL) {
+			fprintf(stderr, "%s: more than %d sessions\n", path, SESSION_SLOTS);
+			fclose(f);
+			return -1;
+		}
+		e->used = 1;
+		e->devaddr = devaddr;
+		lw_key_init(&e->nwkskey, nk);
+		lw_key_init(&e->appskey, ak);
+		n++;
+	}
+
+	fclose(f);
+	printf("%d LoRaWAN sessions, %s crypto\n", n, lw_crypto_engine());
+	return 0;
+}
+
+/* Extends the 16-bit FCnt on air with the session's upper bits. */
+static uint32_t fcnt_extend(uint32_t last, uint16_t fcnt)
+{
+	uint32_t v = (last & 0xffff0000u) | fcnt;
+
+	if (v < last)
+		v += 0x10000;
+	return v;
+}
+
+static void lw_flush(struct rx_state *s)
+{
+	struct lw_mic_job mic[LW_BATCH];
+	struct lw_ctr_job ctr[LW_BATCH];
+	int nctr = 0;
+
+	for (int i = 0; i < s->npending; i++) {
+		struct lw_pending *p = &s->pending[i];
+		int up = lorawan_mtype_is_uplink(lorawan_mtype(p->d.mhdr));
+
+		p->fcnt = fcnt_extend(up ? p->sess->fcnt_up : p->sess->fcnt_down, p->d.fcnt);
+		mic[i] = (struct lw_mic_job){
+			.key = &p->sess->nwkskey,
+			.frame = p->frame,
+			.len = p->len,
+			.dir = up ? LW_DIR_UP : LW_DIR_DOWN,
+			.devaddr = p->d.devaddr,
+			.fcnt = p->fcnt,
+		};
+	}
+	lw_mic_verify_batch(mic, s->npending);
+
+	for (int i = 0; i < s->npending; i++) {
+		struct lw_pending *p = &s->pending[i];
+
+		if (!mic[i].ok) {
+			s->mic_fail++;
+			continue;
+		}
+		s->mic_ok++;
+		if (mic[i].dir == LW_DIR_UP)
+			p->sess->fcnt_up = p->fcnt;
+		else
+			p->sess->fcnt_down = p->fcnt;
+		if (p->d.payload_len == 0)
+			continue;
+		ctr[nctr++] = (struct lw_ctr_job){
+			.key = p->d.fport == 0 ? &p->sess->nwkskey : &p->sess->appskey,
+			.payload = p->frame + (p->d.payload - p->frame),
+			.len = p->d.payload_len,
+			.dir = mic[i].dir,
+			.devaddr = p->d.devaddr,
+			.fcnt = p->fcnt,
+		};
+	}
+	lw_crypt_batch(ctr, nctr);
+
+	if (s->verbose) {
+		for (int i = 0; i < s->npending; i++) {
+			struct lw_pending *p = &s->pending[i];
+
+			printf("%s devaddr %08x fcnt %u fport %d mic %s ", p->ifname, p->d.devaddr,
+			       p->fcnt, p->d.fport, mic[i].ok ? "ok" : "bad");
+			for (unsigned int b = 0; b < p->d.payload_len; b++)
+				printf("%02x", p->d.payload[b]);
+			printf("\n");
+		}
+	}
+
+	s->npending = 0;
+}
+
+static void handle_lorawan(struct rx_state *s, const char *ifname, const struct rt_frame *f)
+{
+	struct lorawan_data d;
+
+	if (lorawan_data_parse(f->data, f->len, &d) < 0) {
+		s->malformed++;
+		if (s->verbose)
+			dump_frame(ifname, f->data, f->len);
+		return;
+	}
+	if (s->sessions) {
+		struct session *e = session_slot(s->sessions, d.devaddr);
+		struct lw_pending *p;
+
+		if (e == NULL || !e->used) {
+			s->unknown++;
+			return;
+		}
+		p = &s->pending[s->npending++];
+		memcpy(p->frame, f->data, f->len);
+		p->len = f->len;
+		p->sess = e;
+		p->ifname = ifname;
+		lorawan_data_parse(p->frame, p->len, &p->d);
+		if (s->npending == LW_BATCH)
+			lw_flush(s);
+		return;
+	}
+	if (s->verbose)
+		printf("%s mtype %d devaddr %08x fcnt %u fport %d len %u mic %08x\n", ifname,
+		       lorawan_mtype(d.mhdr), d.devaddr, d.fcnt, d.fport, d.payload_len, d.mic);
+}
+
+static void capture_frame(struct rx_state *s, struct rt_worker *w, const struct rt_frame *f)
+{
+	const struct radio_meta *m = &s->meta[w->id];
+	uint8_t hdr[LORATAP_HDR_LEN];
+	struct iovec iov[2];
+
+	/* PF_LORA carries no RSSI or SNR. */
+	loratap_hdr(hdr, m->freq_hz, m->bw_khz, m->sf, 0, 0, LORATAP_SYNC_PUBLIC);
+	iov[0].iov_base = hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iov[1].iov_base = (void *)f->data;
+	iov[1].iov_len = f->len;
+	if (pcapng_write(s->cap, w->id, f->hw_ns ? f->hw_ns : f->sw_ns ? f->sw_ns : f->read_ns,
+			 iov, 2, sizeof(hdr) + f->len) < 0)
+		s->cap_errors++;
+}
+
+static void handle_frame(struct rt_worker *w, struct rt_frame *f, void *arg)
+{
+	struct rx_state *s = arg;
+
+	if (s->count && s->frames >= (uint64_t)s->count)
+		return;
+
+	s->frames++;
+	if (f->flags & RT_FRAME_TRUNC)
+		s->truncated++;
+	if (s->cap)
+		capture_frame(s, w, f);
+	if (s->lorawan)
+		handle_lorawan(s, w->ifname, f);
+	else if (s->verbose)
+		dump_frame(w->ifname, f->data, f->len);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-i ifname]... [-e engine] [-b batch] [-n count] [-v] [-w] [-k keyfile] [-T | -H]\n", prog);
+	fprintf(stderr, "       [-c file [-C mb] [-m ifname:freq_mhz:sf:bw_khz]...]\n");
+	fprintf(stderr, "  -i  interface to receive on, repeat for one worker per interface (default lora0)\n");
+	fprintf(stderr, "      may also be an ifindex, a glob such as \"lora*\" or \"all\", with an optional :count\n");
+	fprintf(stderr, "  -e  recvmmsg: a thread per interface (default), epoll or io_uring: one\n");
+	fprintf(stderr, "      thread for all of them, io_uring with multishot recvmsg\n");
+	fprintf(stderr, "  -b  frames per recvmmsg() call, 1..%d (default 64)\n", RT_QUEUE_LEN);
+	fprintf(stderr, "  -n  stop after this many frames, 0 for unlimited (default 0)\n");
+	fprintf(stderr, "  -v  hex dump every received frame\n");
+	fprintf(stderr, "  -w  parse frames as LoRaWAN MAC frames, -v prints their headers\n");
+	fprintf(stderr, "  -k  check MICs and decrypt with ABP session keys, implies -w\n");
+	fprintf(stderr, "  -T  report SO_TIMESTAMPING software RX queueing latency\n");
+	fprintf(stderr, "  -H  like -T, plus hardware RX timestamps\n");
+	fprintf(stderr, "  -c  capture every frame to this pcapng file (LoRaTap link type)\n");
+	fprintf(stderr, "  -C  start file1, file2, ... before a file exceeds this many MB\n");
+	fprintf(stderr, "  -m  radio settings to record for an interface's frames\n");
+}
+
+static int parse_meta(const char *arg, char *name, size_t size, struct radio_meta *m)
+{
+	const char *colon = strchr(arg, ':');
+	double mhz;
+
+	if (colon == NULL || (size_t)(colon - arg) >= size)
+		return -1;
+	memcpy(name, arg, colon - arg);
+	name[colon - arg] = '\0';
+	if (sscanf(colon + 1, "%lf:%u:%u", &mhz, &m->sf, &m->bw_khz) != 3 ||
+	    mhz <= 0 || mhz > 4000 || m->sf < 5 || m->sf > 12 || m->bw_khz == 0)
+		return -1;
+	m->freq_hz = mhz * 1e6 + 0.5;
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	const char *specs[RT_MAX_WORKERS];
+	struct ifc_entry ifs[RT_MAX_WORKERS];
+	struct ifcache ifc;
+	struct rx_state s;
+	int nspecs = 0, nifaces, ret;
+	long batch = RT_BATCH;
+	int engine = RT_ENGINE_MMSG;
+	const char *keyfile = NULL;
+	int tstamps = 0, opt;
+	const char *cap_path = NULL;
+	const char *meta_args[RT_MAX_WORKERS];
+	int nmeta = 0;
+	long rotate_mb = 0;
+	struct radio_meta meta[RT_MAX_WORKERS];
+	struct pcapng_writer cap;
+
+	memset(&s, 0, sizeof(s));
+
+	while ((opt = getopt(argc, argv, "i:e:b:n:vwk:THc:C:m:h")) != -1) {
+		switch (opt) {
+		case 'i':
+			if (nspecs == RT_MAX_WORKERS) {
+				fprintf(stderr, "at most %d interfaces\n", RT_MAX_WORKERS);
+				return 1;
+			}
+			specs[nspecs++] = optarg;
+			break;
+		case 'e':
+			engine = rt_engine_parse(optarg);
+			if (engine < 0) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'b':
+			batch = strtol(optarg, NULL, 0);
+			break;
+		case 'n':
+			s.count = strtol(optarg, NULL, 0);
+			break;
+		case 'v':
+			s.verbose = 1;
+			break;
+		case 'w':
+			s.lorawan = 1;
+			break;
+		case 'k':
+			keyfile = optarg;
+			s.lorawan = 1;
+			break;
+		case 'T':
+		case 'H':
+			tstamps = opt;
+			break;
+		case 'c':
+			cap_path = optarg;
+			break;
+		case 'C':
+			rotate_mb = strtol(optarg, NULL, 0);
+			break;
+		case 'm':
+			if (nmeta == RT_MAX_WORKERS) {
+				fprintf(stderr, "at most %d -m settings\n", RT_MAX_WORKERS);
+				return 1;
+			}
+			meta_args[nmeta++] = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (nspecs == 0)
+		specs[nspecs++] = "lora0";
+
+	ifcache_init(&ifc);
+	nifaces = ifcache_expand_list(&ifc, specs, nspecs, ARPHRD_LORA, ifs, RT_MAX_WORKERS);
+	ifcache_close(&ifc);
+	if (nifaces < 0) {
+		fprintf(stderr, "interfaces: %s\n", strerror(-nifaces));
+		return 1;
+	}
+	if (batch < 1 || batch > RT_QUEUE_LEN || s.count < 0 || rotate_mb < 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	memset(meta, 0, sizeof(meta));
+	for (int i = 0; i < nmeta; i++) {
+		char name[IFNAMSIZ];
+		struct radio_meta m;
+		int j;
+
+		if (parse_meta(meta_args[i], name, sizeof(name), &m)) {
+			usage(argv[0]);
+			return 1;
+		}
+		for (j = 0; j < nifaces; j++)
+			if (strcmp(ifs[j].name, name) == 0)
+				break;
+		if (j == nifaces) {
+			fprintf(stderr, "-m %s: not a receiving interface\n", name);
+			return 1;
+		}
+		meta[j] = m;
+	}
+
+	if (keyfile && load_sessions(&s, keyfile))
+		return 1;
+
+	if (cap_path) {
+		struct pcapng_if cifs[RT_MAX_WORKERS];
+
+		memset(cifs, 0, sizeof(cifs));
+		for (int i = 0; i < nifaces; i++) {
+			strcpy(cifs[i].name, ifs[i].name);
+			cifs[i].linktype = LINKTYPE_LORATAP;
+			cifs[i].snaplen = LORATAP_HDR_LEN + RT_FRAME_MAX;
+		}
+		ret = pcapng_open(&cap, cap_path, cifs, nifaces, rotate_mb * 1000000ULL, 0);
+		if (ret < 0) {
+			fprintf(stderr, "pcapng_open failed: %s\n", strerror(-ret));
+			return 1;
+		}
+		s.cap = &cap;
+		s.meta = meta;
+	}
+
+	ret = rt_init(&rt);
+	if (ret < 0) {
+		fprintf(stderr, "rt_init failed: %s\n", strerror(-ret));
+		return 1;
+	}
+	rt.engine = engine;
+
+	int flags = 0;
+	if (tstamps)
+		flags |= RT_TSTAMP;
+	if (tstamps == 'H')
+		flags |= RT_HWTSTAMP;
+
+	for (int i = 0; i < nifaces; i++) {
+		struct rt_worker *w = rt_add_worker(&rt, RT_RX, ifs[i].name, 0, flags);
+		if (w == NULL) {
+			fprintf(stderr, "%s: cannot add worker\n", ifs[i].name);
+			return 1;
+		}
+		w->ifindex = ifs[i].ifindex;
+		w->batch = batch;
+	}
+
+	if (rt_start(&rt))
+		return 1;
+	for (int i = 0; i < nifaces; i++)
+		printf("%s socket %d %s\n", rt.workers[i].ifname, rt.workers[i].fd,
+		       rt_engine_name(rt.engine));
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	uint64_t last_frames = 0;
+	uint64_t start = now_ns(), last = start;
+
+	while (!stop && (s.count == 0 || s.frames < (uint64_t)s.count)) {
+		rt_dispatch(&rt, handle_frame, &s, RT_POLL_MS);
+		if (s.npending)
+			lw_flush(&s);
+
+		uint64_t t = now_ns();
+		if (t - last >= 1000000000ULL) {
+			/* Bounds what a crash loses on a quiet channel. */
+			if (s.cap && pcapng_flush(s.cap) < 0)
+				s.cap_errors++;
+			uint32_t drops = 0;
+			for (int i = 0; i < nifaces; i++)
+				drops += rt.workers[i].st.drops;
+			printf("rx %.1f frames/s, total %llu, drops %u\n",
+			       (s.frames - last_frames) * 1e9 / (t - last),
+			       (unsigned long long)s.frames, drops);
+			last = t;
+			last_frames = s.frames;
+		}
+	}
+
+	double elapsed = (now_ns() - start) / 1e9;
+
+	rt_stop(&rt);
+	rt_join(&rt);
+
+	for (int i = 0; i < nifaces; i++)
+		rt_print_stats(stdout, &rt.workers[i], elapsed);
+	if (s.cap) {
+		ret = pcapng_close(s.cap);
+		if (ret < 0)
+			fprintf(stderr, "capture: %s\n", strerror(-ret));
+		printf("capture records %llu bytes %llu files %llu stalls %llu errors %llu\n",
+		       (unsigned long long)cap.st.records, (unsigned long long)cap.st.bytes,
+		       (unsigned long long)cap.st.files, (unsigned long long)cap.st.stalls,
+		       (unsigned long long)s.cap_errors);
+	}
+	printf("frames_received %llu truncated %llu\n",
+	       (unsigned long long)s.frames, (unsigned long long)s.truncated);
+	if (s.lorawan)
+		printf("lorawan malformed %llu\n", (unsigned long long)s.malformed);
+	if (s.sessions)
+		printf("lorawan mic_ok %llu mic_fail %llu unknown_devaddr %llu\n",
+		       (unsigned long long)s.mic_ok, (unsigned long long)s.mic_fail,
+		       (unsigned long long)s.unknown);
+	printf("elapsed %.6f s, %.1f frames/s\n", elapsed,
+	       elapsed > 0 ? s.frames / elapsed : 0.0);
+
+	rt_destroy(&rt);
+	free(s.sessions);
+
+	return 0;
+}
@@ -0,0 +1,395 @@
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "semtech.h"
+
+struct jbuf {
+	char *p;
+	unsigned int len;
+	unsigned int cap;
+	int overflow;
+};
+
+static void jprintf(struct jbuf *b, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	if (b->overflow)
+		return;
+	va_start(ap, fmt);
+	n = vsnprintf(b->p + b->len, b->cap - b->len, fmt, ap);
+	va_end(ap);
+	if (n < 0 || (unsigned int)n >= b->cap - b->len)
+		b->overflow = 1;
+	else
+		b->len += n;
+}
+
+static const char b64_chars[] =
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static void jbase64(struct jbuf *b, const uint8_t *data, unsigned int len)
+{
+	unsigned int out = (len + 2) / 3 * 4;
+
+	if (b->overflow || b->cap - b->len <= out) {
+		b->overflow = 1;
+		return;
+	}
+
+	char *p = b->p + b->len;
+	for (unsigned int i = 0; i < len; i += 3) {
+		uint32_t v = data[i] << 16;
+
+		if (i + 1 < len)
+			v |= data[i + 1] << 8;
+		if (i + 2 < len)
+			v |= data[i + 2];
+		*p++ = b64_chars[v >> 18];
+		*p++ = b64_chars[(v >> 12) & 0x3f];
+		*p++ = i + 1 < len ? b64_chars[(v >> 6) & 0x3f] : '=';
+		*p++ = i + 2 < len ? b64_chars[v & 0x3f] : '=';
+	}
+	b->len += out;
+	b->p[b->len] = '\0';
+}
+
+static int b64_value(char c)
+{
+	if (c >= 'A' && c <= 'Z')
+		return c - 'A';
+	if (c >= 'a' && c <= 'z')
+		return c - 'a' + 26;
+	if (c >= '0' && c <= '9')
+		return c - '0' + 52;
+	if (c == '+')
+		return 62;
+	if (c == '/')
+		return 63;
+	return -1;
+}
+
+static int base64_decode(const char *s, unsigned int slen, uint8_t *out, unsigned int cap)
+{
+	unsigned int n = 0, bits = 0;
+	uint32_t acc = 0;
+
+	for (unsigned int i = 0; i < slen && s[i] != '='; i++) {
+		int v = b64_value(s[i]);
+		if (v < 0)
+			return -EINVAL;
+		acc = acc << 6 | v;
+		bits += 6;
+		if (bits >= 8) {
+			bits -= 8;
+			if (n == cap)
+				return -EMSGSIZE;
+			out[n++] = acc >> bits;
+		}
+	}
+	return n;
+}
+
+void semtech_hdr(uint8_t *buf, uint16_t token, enum semtech_id id, uint64_t eui)
+{
+	buf[0] = SEMTECH_VERSION;
+	buf[1] = token >> 8;
+	buf[2] = token;
+	buf[3] = id;
+	for (int i = 0; i < 8; i++)
+		buf[4 + i] = eui >> (56 - 8 * i);
+}
+
+void semtech_push_begin(struct semtech_push *p, uint8_t *buf, unsigned int cap,
+			uint16_t token, uint64_t eui)
+{
+	p->buf = buf;
+	p->cap = cap;
+	p->nrxpk = 0;
+	semtech_hdr(buf, token, SEMTECH_PUSH_DATA, eui);
+	memcpy(buf + SEMTECH_HDR_LEN, "{\"rxpk\":[", 9);
+	p->len = SEMTECH_HDR_LEN + 9;
+}
+
+/* ISO 8601 with microseconds, as the reference forwarder writes it. */
+static void jtime(struct jbuf *b, uint64_t ns)
+{
+	time_t sec = ns / 1000000000ULL;
+	struct tm tm;
+
+	gmtime_r(&sec, &tm);
+	jprintf(b, "\"time\":\"%04d-%02d-%02dT%02d:%02d:%02d.%06uZ\",",
+		tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min,
+		tm.tm_sec, (unsigned int)(ns % 1000000000ULL / 1000));
+}
+
+int semtech_push_add(struct semtech_push *p, const struct semtech_rxpk *rx)
+{
+	/* Two bytes stay free for the closing "]}". */
+	struct jbuf b = {
+		.p = (char *)p->buf,
+		.len = p->len,
+		.cap = p->cap - 2,
+	};
+	int lsnr = rx->lsnr_cb;
+
+	if (p->len + 2 > p->cap)
+		return -EMSGSIZE;
+	jprintf(&b, "%s{", p->nrxpk ? "," : "");
+	if (rx->time_ns)
+		jtime(&b, rx->time_ns);
+	jprintf(&b, "\"tmst\":%u,\"chan\":%u,\"rfch\":%u,\"freq\":%u.%06u,\"stat\":1,"
+		"\"modu\":\"LORA\",\"datr\":\"SF%uBW%u\",\"codr\":\"4/%u\","
+		"\"rssi\":%d,\"lsnr\":%s%d.%d,\"size\":%u,\"data\":\"",
+		rx->tmst, rx->chan, rx->rfch, rx->freq_hz / 1000000, rx->freq_hz % 1000000,
+		rx->sf, rx->bw_khz, rx->cr, rx->rssi, lsnr < 0 ? "-" : "",
+		abs(lsnr) / 10, abs(lsnr) % 10, rx->len);
+	jbase64(&b, rx->data, rx->len);
+	jprintf(&b, "\"}");
+	if (b.overflow)
+		return -EMSGSIZE;
+
+	p->len = b.len;
+	p->nrxpk++;
+	return 0;
+}
+
+unsigned int semtech_push_end(struct semtech_push *p)
+{
+	p->buf[p->len++] = ']';
+	p->buf[p->len++] = '}';
+	return p->len;
+}
+
+int semtech_stat(uint8_t *buf, unsigned int cap, uint16_t token, uint64_t eui,
+		 const struct semtech_stat *st)
+{
+	struct jbuf b = { .p = (char *)buf, .len = SEMTECH_HDR_LEN, .cap = cap };
+	time_t sec = st->time_ns / 1000000000ULL;
+	struct tm tm;
+
+	if (cap < SEMTECH_HDR_LEN)
+		return -EMSGSIZE;
+	semtech_hdr(buf, token, SEMTECH_PUSH_DATA, eui);
+	gmtime_r(&sec, &tm);
+	jprintf(&b, "{\"stat\":{\"time\":\"%04d-%02d-%02d %02d:%02d:%02d GMT\","
+		"\"rxnb\":%u,\"rxok\":%u,\"rxfw\":%u,\"ackr\":%u.%u,\"dwnb\":%u,\"txnb\":%u}}",
+		tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec,
+		st->rxnb, st->rxok, st->rxfw, st->ackr_pm / 10, st->ackr_pm % 10,
+		st->dwnb, st->txnb);
+	return b.overflow ? -EMSGSIZE : (int)b.len;
+}
+
+int semtech_tx_ack(uint8_t *buf, unsigned int cap, uint16_t token, uint64_t eui,
+		   const char *error)
+{
+	struct jbuf b = { .p = (char *)buf, .len = SEMTECH_HDR_LEN, .cap = cap };
+
+	if (cap < SEMTECH_HDR_LEN)
+		return -EMSGSIZE;
+	semtech_hdr(buf, token, SEMTECH_TX_ACK, eui);
+	jprintf(&b, "{\"txpk_ack\":{\"error\":\"%s\"}}", error ? error : "NONE");
+	return b.overflow ? -EMSGSIZE : (int)b.len;
+}
+
+/*
+ * Just enough of a JSON reader for txpk: values are scanned in place,
+ * strings are returned raw (txpk has no escapes), numbers end at the
+ * first non-number character, which the NUL terminator guarantees.
+ */
+static const char *skip_ws(const char *p)
+{
+	while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')
+		p++;
+	return p;
+}
+
+static const char *scan_string(const char *p, const char **s, unsigned int *len)
+{
+	const char *start;
+
+	if (*p != '"')
+		return NULL;
+	start = ++p;
+	while (*p != '"') {
+		if (*p == '\0')
+			return NULL;
+		if (*p == '\\' && p[1] != '\0')
+			p++;
+		p++;
+	}
+	*s = start;
+	*len = p - start;
+	return p + 1;
+}
+
+static const char *skip_value(const char *p, int depth)
+{
+	const char *s;
+	unsigned int len;
+
+	p = skip_ws(p);
+	if (*p == '"')
+		return scan_string(p, &s, &len);
+	if (*p == '{' || *p == '[') {
+		char close = *p == '{' ? '}' : ']';
+
+		if (depth > 8)
+			return NULL;
+		p = skip_ws(p + 1);
+		if (*p == close)
+			return p + 1;
+		for (;;) {
+			if (close == '}') {
+				p = scan_string(skip_ws(p), &s, &len);
+				if (p == NULL || *(p = skip_ws(p)) != ':')
+					return NULL;
+				p++;
+			}
+			p = skip_value(p, depth + 1);
+			if (p == NULL)
+				return NULL;
+			p = skip_ws(p);
+			if (*p == close)
+				return p + 1;
+			if (*p != ',')
+				return NULL;
+			p++;
+		}
+	}
+	if (*p == '\0')
+		return NULL;
+	/* Number, true, false or null. */
+	while (*p != '\0' && *p != ',' && *p != '}' && *p != ']' &&
+	       *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r')
+		p++;
+	return p;
+}
+
+static int key_is(const char *key, unsigned int len, const char *name)
+{
+	return strlen(name) == len && memcmp(key, name, len) == 0;
+}
+
+/*
+ * Members come in any order, so datr and codr, whose form depends on
+ * modu, are only read once the whole object is scanned.
+ */
+struct txpk_scan {
+	struct semtech_txpk *tx;
+	const char *datr;
+	const char *codr;
+};
+
+static int txpk_member(void *arg, const char *key, unsigned int klen, const char *v)
+{
+	struct txpk_scan *scan = arg;
+	struct semtech_txpk *tx = scan->tx;
+	const char *s;
+	unsigned int len;
+	char *end;
+
+	if (key_is(key, klen, "imme")) {
+		tx->imme = strncmp(v, "true", 4) == 0;
+	} else if (key_is(key, klen, "ipol")) {
+		tx->ipol = strncmp(v, "true", 4) == 0;
+	} else if (key_is(key, klen, "ncrc")) {
+		tx->ncrc = strncmp(v, "true", 4) == 0;
+	} else if (key_is(key, klen, "tmst")) {
+		tx->tmst = strtoul(v, &end, 10);
+		tx->has_tmst = end != v;
+	} else if (key_is(key, klen, "tmms")) {
+		tx->has_tmms = 1;
+	} else if (key_is(key, klen, "freq")) {
+		/* MHz with up to six decimals; stay clear of binary rounding. */
+		tx->freq_hz = strtod(v, &end) * 1e6 + 0.5;
+	} else if (key_is(key, klen, "rfch")) {
+		tx->rfch = strtoul(v, NULL, 10);
+	} else if (key_is(key, klen, "powe")) {
+		tx->powe = strtol(v, NULL, 10);
+	} else if (key_is(key, klen, "modu")) {
+		if (scan_string(v, &s, &len) == NULL)
+			return -EINVAL;
+		if (!key_is(s, len, "LORA"))
+			return -ENOTSUP;
+	} else if (key_is(key, klen, "datr")) {
+		scan->datr = v;
+	} else if (key_is(key, klen, "codr")) {
+		scan->codr = v;
+	} else if (key_is(key, klen, "data")) {
+		if (scan_string(v, &s, &len) == NULL)
+			return -EINVAL;
+		int n = base64_decode(s, len, tx->data, sizeof(tx->data));
+		if (n < 0)
+			return n;
+		tx->len = n;
+	}
+	return 0;
+}
+
+typedef int (*member_fn)(void *arg, const char *key, unsigned int klen, const char *v);
+
+/* Hands every member of the object at p to fn; returns 0 or fn's error. */
+static int scan_object(const char *p, member_fn fn, void *arg)
+{
+	const char *key;
+	unsigned int klen;
+	int ret;
+
+	p = skip_ws(p);
+	if (*p++ != '{')
+		return -EINVAL;
+	if (*(p = skip_ws(p)) == '}')
+		return 0;
+	for (;;) {
+		p = scan_string(p, &key, &klen);
+		if (p == NULL || *(p = skip_ws(p)) != ':')
+			return -EINVAL;
+		p = skip_ws(p + 1);
+		ret = fn(arg, key, klen, p);
+		if (ret < 0)
+			return ret;
+		p = skip_value(p, 1);
+		if (p == NULL)
+			return -EINVAL;
+		p = skip_ws(p);
+		if (*p == '}')
+			return 0;
+		if (*p++ != ',')
+			return -EINVAL;
+		p = skip_ws(p);
+	}
+}
+
+static int top_member(void *arg, const char *key, unsigned int klen, const char *v)
+{
+	if (!key_is(key, klen, "txpk"))
+		return 0;
+	return scan_object(v, txpk_member, arg);
+}
+
+int semtech_parse_txpk(const char *json, struct semtech_txpk *tx)
+{
+	struct txpk_scan scan = { .tx = tx };
+	int ret;
+
+	memset(tx, 0, sizeof(*tx));
+	tx->powe = -1;
+
+	/* {"txpk":{...}}; other top-level members are skipped. */
+	ret = scan_object(json, top_member, &scan);
+	if (ret < 0)
+		return ret;
+	/* A LoRa txpk; a modu other than LORA has already failed with -ENOTSUP. */
+	if (scan.datr &&
+	    (*scan.datr != '"' || sscanf(scan.datr + 1, "SF%uBW%u", &tx->sf, &tx->bw_khz) != 2))
+		return -EINVAL;
+	if (scan.codr && (*scan.codr != '"' || sscanf(scan.codr + 1, "4/%u", &tx->cr) != 1))
+		return -EINVAL;
+	return tx->len ? 0 : -EINVAL;
+}
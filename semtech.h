@@ -0,0 +1,105 @@
+#ifndef SEMTECH_H
+#define SEMTECH_H
+
+#include <stdint.h>
+
+/*
+ * Semtech UDP packet forwarder protocol, version 2.
+ *
+ * Every datagram starts with the protocol version, a random token and
+ * the message identifier. PUSH_DATA, PULL_DATA and TX_ACK add the 8 byte
+ * gateway EUI, and PUSH_DATA, PULL_RESP and TX_ACK carry a JSON object.
+ *
+ * JSON is written into and parsed out of caller-provided buffers, so
+ * nothing here allocates. Functions return a length or 0 on success and
+ * a negative errno value on failure: -EMSGSIZE when the output does not
+ * fit, -EINVAL for malformed input, -ENOTSUP for valid but unsupported
+ * requests.
+ */
+
+#define SEMTECH_VERSION		2
+#define SEMTECH_HDR_LEN		12	/* with gateway EUI */
+#define SEMTECH_ACK_LEN		4
+#define SEMTECH_DATA_MAX	256
+
+enum semtech_id {
+	SEMTECH_PUSH_DATA = 0,
+	SEMTECH_PUSH_ACK,
+	SEMTECH_PULL_DATA,
+	SEMTECH_PULL_RESP,
+	SEMTECH_PULL_ACK,
+	SEMTECH_TX_ACK,
+};
+
+/* Writes the 12 byte header of PUSH_DATA, PULL_DATA or TX_ACK. */
+void semtech_hdr(uint8_t *buf, uint16_t token, enum semtech_id id, uint64_t eui);
+
+struct semtech_rxpk {
+	uint64_t time_ns;	/* CLOCK_REALTIME, 0 if unknown */
+	uint32_t tmst;		/* free-running microsecond counter */
+	uint32_t freq_hz;
+	unsigned int chan;
+	unsigned int rfch;
+	unsigned int sf;
+	unsigned int bw_khz;
+	unsigned int cr;	/* 5..8 for 4/5..4/8 */
+	int rssi;
+	int lsnr_cb;		/* centibels */
+	const uint8_t *data;
+	unsigned int len;
+};
+
+/* One PUSH_DATA datagram of rxpk objects being built in place. */
+struct semtech_push {
+	uint8_t *buf;
+	unsigned int cap;
+	unsigned int len;
+	unsigned int nrxpk;
+};
+
+void semtech_push_begin(struct semtech_push *p, uint8_t *buf, unsigned int cap,
+			uint16_t token, uint64_t eui);
+/* Appends one rxpk, or leaves the datagram untouched on -EMSGSIZE. */
+int semtech_push_add(struct semtech_push *p, const struct semtech_rxpk *rx);
+/* Closes the rxpk array; returns the datagram length. */
+unsigned int semtech_push_end(struct semtech_push *p);
+
+struct semtech_stat {
+	uint64_t time_ns;
+	uint32_t rxnb;		/* frames received */
+	uint32_t rxok;		/* with a valid CRC */
+	uint32_t rxfw;		/* forwarded */
+	unsigned int ackr_pm;	/* PUSH_DATA acknowledged, per mille */
+	uint32_t dwnb;		/* downlinks received */
+	uint32_t txnb;		/* downlinks sent */
+};
+
+/* A whole PUSH_DATA datagram with one stat object. */
+int semtech_stat(uint8_t *buf, unsigned int cap, uint16_t token, uint64_t eui,
+		 const struct semtech_stat *st);
+
+struct semtech_txpk {
+	int imme;		/* send now, ignore tmst */
+	int has_tmst;
+	uint32_t tmst;
+	int has_tmms;		/* GPS time, class B */
+	uint32_t freq_hz;
+	unsigned int rfch;
+	int powe;		/* dBm, -1 if absent */
+	unsigned int sf;
+	unsigned int bw_khz;
+	unsigned int cr;
+	int ipol;
+	int ncrc;
+	uint8_t data[SEMTECH_DATA_MAX];
+	unsigned int len;
+};
+
+/* Parses the JSON of a PULL_RESP; json must be NUL-terminated. */
+int semtech_parse_txpk(const char *json, struct semtech_txpk *tx);
+
+/* A whole TX_ACK datagram; error is NULL or "NONE" for success. */
+int semtech_tx_ack(uint8_t *buf, unsigned int cap, uint16_t token, uint64_t eui,
+		   const char *error);
+
+#endif
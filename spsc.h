@@ -0,0 +1,127 @@
+#ifndef SPSC_H
+#define SPSC_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Lock-free single-producer single-consumer ring of fixed-size slots.
+ *
+ * The producer and the consumer each own one index and keep a cached
+ * copy of the other side's, so in the common case neither touches the
+ * other's cache line. Slots are handed out by pointer: a producer can
+ * point recvmmsg() iovecs straight at reserved slots and publish them
+ * with one commit, and a consumer can hand slots to sendmmsg() before
+ * releasing them. No copy is needed in either direction.
+ */
+
+#define SPSC_CACHE_LINE	64
+
+struct spsc_ring {
+	_Alignas(SPSC_CACHE_LINE) _Atomic uint32_t head;	/* written by producer */
+	uint32_t tail_cache;
+	_Alignas(SPSC_CACHE_LINE) _Atomic uint32_t tail;	/* written by consumer */
+	uint32_t head_cache;
+	_Alignas(SPSC_CACHE_LINE) uint32_t mask;
+	uint32_t elem_size;
+	unsigned char *slots;
+};
+
+/* nslots must be a power of two; elem_size is rounded up to a cache line. */
+static inline int spsc_init(struct spsc_ring *r, uint32_t nslots, uint32_t elem_size)
+{
+	if (nslots == 0 || (nslots & (nslots - 1)))
+		return -1;
+
+	elem_size = (elem_size + SPSC_CACHE_LINE - 1) & ~(SPSC_CACHE_LINE - 1);
+	r->slots = aligned_alloc(SPSC_CACHE_LINE, (size_t)nslots * elem_size);
+	if (r->slots == NULL)
+		return -1;
+	memset(r->slots, 0, (size_t)nslots * elem_size);
+
+	atomic_init(&r->head, 0);
+	atomic_init(&r->tail, 0);
+	r->tail_cache = 0;
+	r->head_cache = 0;
+	r->mask = nslots - 1;
+	r->elem_size = elem_size;
+	return 0;
+}
+
+static inline void spsc_free(struct spsc_ring *r)
+{
+	free(r->slots);
+	r->slots = NULL;
+}
+
+static inline void *spsc_slot(struct spsc_ring *r, uint32_t pos)
+{
+	return r->slots + (size_t)(pos & r->mask) * r->elem_size;
+}
+
+/* Producer side. */
+
+static inline uint32_t spsc_prod_avail(struct spsc_ring *r)
+{
+	uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+	uint32_t size = r->mask + 1;
+
+	if (head - r->tail_cache == size)
+		r->tail_cache = atomic_load_explicit(&r->tail, memory_order_acquire);
+	return size - (head - r->tail_cache);
+}
+
+/* Like spsc_prod_avail(), but always sees what the consumer freed so far. */
+static inline uint32_t spsc_prod_space(struct spsc_ring *r)
+{
+	r->tail_cache = atomic_load_explicit(&r->tail, memory_order_acquire);
+	return spsc_prod_avail(r);
+}
+
+/* i-th slot after the current head; valid for i < spsc_prod_avail(). */
+static inline void *spsc_prod_slot(struct spsc_ring *r, uint32_t i)
+{
+	return spsc_slot(r, atomic_load_explicit(&r->head, memory_order_relaxed) + i);
+}
+
+static inline void spsc_prod_commit(struct spsc_ring *r, uint32_t n)
+{
+	uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+
+	atomic_store_explicit(&r->head, head + n, memory_order_release);
+}
+
+/* Consumer side. */
+
+static inline uint32_t spsc_cons_avail(struct spsc_ring *r)
+{
+	uint32_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+	if (r->head_cache == tail)
+		r->head_cache = atomic_load_explicit(&r->head, memory_order_acquire);
+	return r->head_cache - tail;
+}
+
+static inline void *spsc_cons_slot(struct spsc_ring *r, uint32_t i)
+{
+	return spsc_slot(r, atomic_load_explicit(&r->tail, memory_order_relaxed) + i);
+}
+
+static inline void spsc_cons_release(struct spsc_ring *r, uint32_t n)
+{
+	uint32_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+	atomic_store_explicit(&r->tail, tail + n, memory_order_release);
+}
+
+/* Either side, approximate. */
+static inline uint32_t spsc_count(struct spsc_ring *r)
+{
+	return atomic_load_explicit(&r->head, memory_order_acquire) -
+	       atomic_load_explicit(&r->tail, memory_order_acquire);
+}
+
+#endif
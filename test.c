@@ -1,64 +1,567 @@
+#define _GNU_SOURCE
 #include <errno.h>
+#include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
-#include <linux/socket.h>
 #include <net/if.h>
-#include <sys/ioctl.h>
-#include <sys/socket.h>
-#include <sys/types.h>
 
-#include "include/linux/lora.h"
+#include "liblorad.h"
+#include "latency.h"
+#include "loracodec.h"
+#include "lwcrypto.h"
+#include "ifcache.h"
+#include "runtime.h"
+#include "trace.h"
+#include "tstamp.h"
 
-#ifndef AF_LORA
-#define AF_LORA 28
-#endif
+#define LORA_MAX_PAYLOAD	LORA_MAX_FRAME
+#define DRAIN_MS		10000
 
-#ifndef PF_LORA
-#define PF_LORA AF_LORA
-#endif
+struct tx_iface {
+	struct rt_worker *w;	/* NULL when sending through lorad */
+	const char *ifname;
+	int port;
+	long submitted;
+	long backpressure;
+	int pending;		/* submitted since the last kick */
+};
 
-int main(void)
+static struct rt rt;
+static struct lorad_client lc;
+static int use_lorad;
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig)
+{
+	stop = 1;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sleep_until_ns(uint64_t t)
+{
+	struct timespec ts;
+
+	ts.tv_sec = t / 1000000000ULL;
+	ts.tv_nsec = t % 1000000000ULL;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR && !stop)
+		;
+}
+
+static void sign_uplink(uint8_t *frame, unsigned int len, unsigned int payload_len,
+			const struct lw_key *nwkskey, const struct lw_key *appskey,
+			uint32_t devaddr, uint32_t fcnt)
+{
+	struct lw_ctr_job job = {
+		.key = appskey,
+		.payload = frame + lorawan_payload_off(0, 1),
+		.len = payload_len,
+		.dir = LW_DIR_UP,
+		.devaddr = devaddr,
+		.fcnt = fcnt,
+	};
+
+	lw_crypt_batch(&job, 1);
+	lorawan_set_mic(frame, len,
+			lw_mic(nwkskey, frame, len - LORAWAN_MIC_LEN, LW_DIR_UP, devaddr, fcnt));
+}
+
+static int submit_one(struct tx_iface *t, const uint8_t *data, unsigned int len,
+		      long rx1_ms, long rx2_ms)
 {
-	int skt = socket(PF_LORA, SOCK_DGRAM, 1);
-	if (skt == -1) {
-		int err = errno;
-		fprintf(stderr, "socket failed: %s\n", strerror(err));
+	int ret;
+
+	if (rx1_ms) {
+		uint64_t t0 = realtime_ns();
+		ret = lorad_submit_at(&lc, t->port, data, len, t0 + rx1_ms * 1000000ULL,
+				      t->port, rx2_ms ? t0 + rx2_ms * 1000000ULL : 0);
+	} else if (use_lorad) {
+		ret = lorad_submit(&lc, t->port, data, len);
+	} else {
+		ret = rt_submit(t->w, data, len);
+	}
+	if (ret == -EAGAIN)
+		t->backpressure++;
+	else if (ret == 0)
+		t->submitted++;
+	return ret;
+}
+
+static void kick_pending(struct tx_iface *ifaces, int nifaces)
+{
+	int any = 0;
+
+	for (int i = 0; i < nifaces; i++) {
+		if (!ifaces[i].pending)
+			continue;
+		if (!use_lorad)
+			rt_kick(ifaces[i].w);
+		ifaces[i].pending = 0;
+		any = 1;
+	}
+	if (any && use_lorad)
+		lorad_commit(&lc, 0);
+}
+
+/*
+ * Sends every frame of the trace passes times, on ifaces[ifid % nifaces],
+ * at the trace's own spacing divided by speed. Frames already due go out
+ * back to back and their workers are kicked once before the next sleep.
+ * A full queue is waited on, not skipped, so the trace is replayed whole
+ * and backpressure shows up as lateness.
+ */
+static int replay(struct trace *tr, long passes, double speed, struct tx_iface *ifaces,
+		  int nifaces, long rx1_ms, long rx2_ms, long *bytes)
+{
+	static struct lat_hist late;
+	uint64_t start = now_ns(), base = start, span_ns = 0;
+	long frames = 0;
+	int ret = 0;
+
+	lat_hist_init(&late);
+	for (int i = 0; i < tr->nifs; i++)
+		printf("trace %s -> %s\n", tr->ifnames[i], ifaces[i % nifaces].ifname);
+
+	for (long pass = 0; pass < passes && !stop; pass++) {
+		struct trace_frame f;
+		uint64_t first = 0, last = 0;
+		long n = 0;
+
+		trace_rewind(tr);
+		while (!stop && (ret = trace_next(tr, &f)) == 1) {
+			struct tx_iface *t = &ifaces[f.ifid % nifaces];
+			uint64_t due, now;
+
+			if (n++ == 0)
+				first = last = f.time_ns;
+			/* Out of order timestamps go out at once, they never rewind the clock. */
+			if (f.time_ns > last)
+				last = f.time_ns;
+			due = base + (uint64_t)((last - first) / speed);
+
+			now = now_ns();
+			if (due > now) {
+				kick_pending(ifaces, nifaces);
+				sleep_until_ns(due);
+				now = now_ns();
+			}
+			lat_hist_add(&late, now > due ? now - due : 0);
+
+			while ((ret = submit_one(t, f.data, f.len, rx1_ms, rx2_ms)) == -EAGAIN && !stop) {
+				kick_pending(ifaces, nifaces);
+				if (use_lorad)
+					lorad_wait(&lc, 10);
+				else
+					rt_wait(&rt, 10);
+			}
+			if (ret == -EAGAIN)
+				break;
+			if (ret < 0) {
+				fprintf(stderr, "%s: submit: %s\n", t->ifname, strerror(-ret));
+				return 1;
+			}
+			t->pending = 1;
+			frames++;
+			*bytes += f.len;
+		}
+		if (ret < 0 && ret != -EAGAIN) {
+			fprintf(stderr, "trace: %s\n", strerror(-ret));
+			return 1;
+		}
+		kick_pending(ifaces, nifaces);
+		/* The next pass starts where this one's last frame was due. */
+		span_ns += last - first;
+		base = start + (uint64_t)(span_ns / speed);
+	}
+
+	uint64_t elapsed = now_ns() - start;
+	lat_hist_print(stdout, "replay", "late", &late);
+	printf("replay frames %ld span %.6f s at %gx, due %.6f s, took %.6f s, drift %+.6f s\n",
+	       frames, span_ns / 1e9, speed, span_ns / speed / 1e9, elapsed / 1e9,
+	       (elapsed - span_ns / speed) / 1e9);
+	return 0;
+}
+
+static int start_rt(int tstamps, int bypass, long batch, const struct ifc_entry *ifs,
+		    struct tx_iface *ifaces, int nifaces)
+{
+	int ret = rt_init(&rt);
+	if (ret < 0) {
+		fprintf(stderr, "rt_init failed: %s\n", strerror(-ret));
 		return 1;
 	}
-	printf("socket %d\n", skt);
 
-	struct ifreq ifr;
-	strcpy(ifr.ifr_name, "lora0");
-	int ret = ioctl(skt, SIOCGIFINDEX, &ifr);
-	if (ret == -1) {
-		int err = errno;
-		fprintf(stderr, "ioctl failed: %s\n", strerror(err));
+	int flags = 0;
+	if (tstamps)
+		flags |= RT_TSTAMP;
+	if (tstamps == 'H')
+		flags |= RT_HWTSTAMP;
+	if (bypass)
+		flags |= RT_QDISC_BYPASS;
+
+	for (int i = 0; i < nifaces; i++) {
+		ifaces[i].w = rt_add_worker(&rt, RT_TX, ifs[i].name,
+					    bypass ? ETH_P_LORA : 0, flags);
+		if (ifaces[i].w == NULL) {
+			fprintf(stderr, "%s: cannot add worker\n", ifs[i].name);
+			return 1;
+		}
+		ifaces[i].w->ifindex = ifs[i].ifindex;
+		ifaces[i].w->batch = batch;
+		ifaces[i].ifname = ifaces[i].w->ifname;
+		ifaces[i].submitted = 0;
+		ifaces[i].backpressure = 0;
+		ifaces[i].pending = 0;
+	}
+
+	if (rt_start(&rt))
+		return 1;
+	for (int i = 0; i < nifaces; i++)
+		printf("%s socket %d\n", ifaces[i].w->ifname, ifaces[i].w->fd);
+	return 0;
+}
+
+static int start_lorad(const char *path, int flags, const struct ifc_entry *ifs,
+		       struct tx_iface *ifaces, int nifaces)
+{
+	int ret = lorad_connect(&lc, path, flags);
+	if (ret < 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(-ret));
 		return 1;
 	}
-	printf("ifindex %d\n", ifr.ifr_ifindex);
 
-	struct sockaddr_lora addr;
-	addr.lora_family = AF_LORA;
-	addr.lora_ifindex = ifr.ifr_ifindex;
-	ret = bind(skt, (struct sockaddr *)&addr, sizeof(addr));
-	if (ret == -1) {
-		int err = errno;
-		fprintf(stderr, "bind failed: %s\n", strerror(err));
+	for (int i = 0; i < nifaces; i++) {
+		ifaces[i].w = NULL;
+		ifaces[i].ifname = ifs[i].name;
+		ifaces[i].port = lorad_port(&lc, ifs[i].name);
+		if (ifaces[i].port < 0) {
+			fprintf(stderr, "%s: not served by lorad\n", ifs[i].name);
+			return 1;
+		}
+		ifaces[i].submitted = 0;
+		ifaces[i].backpressure = 0;
+		ifaces[i].pending = 0;
+		printf("%s lorad port %d%s\n", ifs[i].name, ifaces[i].port,
+		       lc.shm ? " shm" : "");
+	}
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-i ifname]... [-s size] [-n count] [-r frames/s] [-b batch] [-w devaddr [-k nwkskey:appskey]] [-T | -H] [-q] [-D path | -U path [-A rx1_ms[,rx2_ms]]] [-R trace [-x speed] [-o compact]]\n", prog);
+	fprintf(stderr, "  -i  interface to send on, repeat for one worker per interface (default lora0)\n");
+	fprintf(stderr, "      may also be an ifindex, a glob such as \"lora*\" or \"all\", with an optional :count\n");
+	fprintf(stderr, "  -s  payload size in bytes, 1..%d (default 2)\n", LORA_MAX_PAYLOAD);
+	fprintf(stderr, "  -n  number of frames to send per interface (default 1)\n");
+	fprintf(stderr, "  -r  target rate in frames/s per interface, 0 for unlimited (default 0)\n");
+	fprintf(stderr, "  -b  frames per sendmmsg() batch, 1..%d (default 16)\n", RT_QUEUE_LEN);
+	fprintf(stderr, "  -w  send LoRaWAN unconfirmed uplinks from devaddr, -s sets the FRMPayload size\n");
+	fprintf(stderr, "  -k  encrypt and sign the -w uplinks with these hex ABP session keys\n");
+	fprintf(stderr, "  -T  report SO_TIMESTAMPING software TX latency histograms\n");
+	fprintf(stderr, "  -H  like -T, plus hardware TX timestamps\n");
+	fprintf(stderr, "  -q  send through PF_PACKET ETH_P_LORA with PACKET_QDISC_BYPASS, not PF_LORA\n");
+	fprintf(stderr, "  -D  submit through the lorad at this socket over its shared-memory ring\n");
+	fprintf(stderr, "  -U  like -D, one Unix socket message per frame; with either, -i names lorad ports\n");
+	fprintf(stderr, "  -A  have lorad send each frame rx1_ms after submitting it, else rx2_ms after\n");
+	fprintf(stderr, "  -R  replay a pcapng or compact trace with its own timing, -n times\n");
+	fprintf(stderr, "  -x  replay speed-up, 1..100 (default 1)\n");
+	fprintf(stderr, "  -o  write the -R trace to this file as a compact trace and exit\n");
+}
+
+int main(int argc, char **argv)
+{
+	const char *specs[RT_MAX_WORKERS];
+	struct ifc_entry ifs[RT_MAX_WORKERS];
+	struct ifcache ifc;
+	struct tx_iface ifaces[RT_MAX_WORKERS];
+	int nspecs = 0, nifaces;
+	long size = 2, count = 1, rate = 0, batch = 16;
+	long long devaddr = -1;
+	const char *keys = NULL;
+	const char *lorad_path = NULL;
+	int lorad_flags = 0;
+	long rx1_ms = 0, rx2_ms = 0;
+	const char *trace_path = NULL, *compact_path = NULL;
+	double speed = 1;
+	int tstamps = 0, bypass = 0, opt, ret;
+
+	while ((opt = getopt(argc, argv, "i:s:n:r:b:w:k:THqD:U:A:R:x:o:h")) != -1) {
+		switch (opt) {
+		case 'i':
+			if (nspecs == RT_MAX_WORKERS) {
+				fprintf(stderr, "at most %d interfaces\n", RT_MAX_WORKERS);
+				return 1;
+			}
+			specs[nspecs++] = optarg;
+			break;
+		case 's':
+			size = strtol(optarg, NULL, 0);
+			break;
+		case 'n':
+			count = strtol(optarg, NULL, 0);
+			break;
+		case 'r':
+			rate = strtol(optarg, NULL, 0);
+			break;
+		case 'b':
+			batch = strtol(optarg, NULL, 0);
+			break;
+		case 'w':
+			devaddr = strtoll(optarg, NULL, 16);
+			break;
+		case 'k':
+			keys = optarg;
+			break;
+		case 'T':
+		case 'H':
+			tstamps = opt;
+			break;
+		case 'q':
+			bypass = 1;
+			break;
+		case 'A':
+			if (sscanf(optarg, "%ld,%ld", &rx1_ms, &rx2_ms) < 1) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'D':
+		case 'U':
+			lorad_path = optarg;
+			lorad_flags = opt == 'D' ? LORAD_HELLO_SHM : 0;
+			break;
+		case 'R':
+			trace_path = optarg;
+			break;
+		case 'x':
+			speed = strtod(optarg, NULL);
+			break;
+		case 'o':
+			compact_path = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (!(speed >= 1 && speed <= 100) || (compact_path && !trace_path) ||
+	    (trace_path && (devaddr >= 0 || rate))) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	static struct trace tr;
+	if (trace_path) {
+		ret = trace_open(&tr, trace_path);
+		if (ret < 0) {
+			fprintf(stderr, "%s: %s\n", trace_path, strerror(-ret));
+			return 1;
+		}
+	}
+	if (compact_path) {
+		FILE *out = fopen(compact_path, "w");
+		if (out == NULL) {
+			int err = errno;
+			fprintf(stderr, "%s: %s\n", compact_path, strerror(err));
+			return 1;
+		}
+		ret = trace_write_compact(&tr, out);
+		if (fclose(out) == EOF && ret >= 0)
+			ret = -errno;
+		if (ret < 0) {
+			fprintf(stderr, "%s: %s\n", compact_path, strerror(-ret));
+			return 1;
+		}
+		printf("%s: %d frames, %d interfaces\n", compact_path, ret, tr.nifs);
+		trace_close(&tr);
+		return 0;
+	}
+
+	if (nspecs == 0)
+		specs[nspecs++] = "lora0";
+
+	use_lorad = lorad_path != NULL;
+	if (use_lorad) {
+		/* Only lorad's own ports can be named, so there is nothing to expand. */
+		for (int i = 0; i < nspecs; i++)
+			snprintf(ifs[i].name, sizeof(ifs[i].name), "%s", specs[i]);
+		nifaces = nspecs;
+	} else {
+		ifcache_init(&ifc);
+		nifaces = ifcache_expand_list(&ifc, specs, nspecs, ARPHRD_LORA, ifs, RT_MAX_WORKERS);
+		ifcache_close(&ifc);
+		if (nifaces < 0) {
+			fprintf(stderr, "interfaces: %s\n", strerror(-nifaces));
+			return 1;
+		}
+	}
+	long max_size = devaddr < 0 ? LORA_MAX_PAYLOAD :
+		LORA_MAX_FRAME - (long)lorawan_data_len(0, 1, 0);
+	if (size < 1 || size > max_size || count < 1 || rate < 0 ||
+	    batch < 1 || batch > RT_QUEUE_LEN || devaddr > UINT32_MAX || (keys && devaddr < 0) ||
+	    (use_lorad && (tstamps || bypass)) || rx1_ms < 0 || rx2_ms < 0 || (rx1_ms && !use_lorad)) {
+		usage(argv[0]);
 		return 1;
 	}
 
-	char buf[2];
-	buf[0] = 0x42;
-	buf[1] = 0x43;
-	int bytes_sent = write(skt, buf, 2);
-	if (bytes_sent == -1) {
-		int err = errno;
-		fprintf(stderr, "write failed: %s\n", strerror(err));
+	static struct lw_key nwkskey, appskey;
+	if (keys) {
+		uint8_t k[2][LW_KEY_LEN];
+		int n = 0;
+
+		for (int i = 0; i < 2 * LW_KEY_LEN; i++)
+			n += sscanf(keys + 2 * i + i / LW_KEY_LEN, "%2hhx", &k[i / LW_KEY_LEN][i % LW_KEY_LEN]);
+		if (n != 2 * LW_KEY_LEN || strlen(keys) != 4 * LW_KEY_LEN + 1 ||
+		    keys[2 * LW_KEY_LEN] != ':') {
+			usage(argv[0]);
+			return 1;
+		}
+		lw_key_init(&nwkskey, k[0]);
+		lw_key_init(&appskey, k[1]);
+	}
+	if (batch > count && !trace_path)
+		batch = count;
+
+	if (use_lorad)
+		ret = start_lorad(lorad_path, lorad_flags, ifs, ifaces, nifaces);
+	else
+		ret = start_rt(tstamps, bypass, batch, ifs, ifaces, nifaces);
+	if (ret)
 		return 1;
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	static uint8_t buf[LORA_MAX_PAYLOAD];
+	static uint8_t frame[LORA_MAX_FRAME];
+	for (long i = 0; i < size; i++)
+		buf[i] = 0x42 + i;
+	long frame_len = size;
+
+	uint64_t start = now_ns();
+	long bytes = 0;
+
+	if (trace_path) {
+		ret = replay(&tr, count, speed, ifaces, nifaces, rx1_ms, rx2_ms, &bytes);
+		trace_close(&tr);
+		if (ret)
+			return 1;
+		goto drain;
 	}
-	printf("bytes_sent %d\n", bytes_sent);
+
+	/*
+	 * The dispatcher feeds every worker's queue independently: a full
+	 * queue behind a slow radio is skipped and retried, never waited on.
+	 */
+	uint64_t interval = rate ? 1000000000ULL * batch / rate : 0;
+	uint64_t next = start;
+	int active = nifaces;
+
+	while (active && !stop) {
+		int progress = 0;
+
+		if (interval) {
+			sleep_until_ns(next);
+			next += interval;
+		}
+
+		active = 0;
+		for (int i = 0; i < nifaces; i++) {
+			struct tx_iface *t = &ifaces[i];
+			long quota = interval ? batch : RT_QUEUE_LEN;
+			long n = 0;
+
+			while (n < quota && t->submitted < count) {
+				const uint8_t *data = buf;
+
+				if (devaddr >= 0) {
+					frame_len = lorawan_data_build(frame, sizeof(frame), LORAWAN_UNCONF_UP,
+								       devaddr, 0, t->submitted, NULL, 0, 1,
+								       buf, size);
+					if (keys)
+						sign_uplink(frame, frame_len, size, &nwkskey, &appskey,
+							    devaddr, t->submitted);
+					data = frame;
+				}
+				ret = submit_one(t, data, frame_len, rx1_ms, rx2_ms);
+				if (ret == -EAGAIN)
+					break;
+				if (ret < 0) {
+					fprintf(stderr, "%s: submit: %s\n", t->ifname, strerror(-ret));
+					return 1;
+				}
+				n++;
+			}
+			if (n) {
+				if (!use_lorad)
+					rt_kick(t->w);
+				progress = 1;
+			}
+			if (t->submitted < count)
+				active++;
+		}
+
+		if (use_lorad) {
+			/* One doorbell for every port's frames. */
+			if (progress)
+				lorad_commit(&lc, 0);
+			else if (!interval)
+				lorad_wait(&lc, 10);
+		} else if (!progress && !interval) {
+			rt_wait(&rt, 10);
+		}
+	}
+
+drain:
+	if (use_lorad)
+		ret = lorad_flush(&lc, DRAIN_MS);
+	else
+		ret = rt_drain(&rt, DRAIN_MS);
+	if (ret < 0)
+		fprintf(stderr, "TX queues not drained after %d ms\n", DRAIN_MS);
+	double elapsed = (now_ns() - start) / 1e9;
+
+	if (!use_lorad) {
+		rt_stop(&rt);
+		rt_join(&rt);
+	}
+
+	long total = 0;
+	for (int i = 0; i < nifaces; i++) {
+		if (use_lorad) {
+			printf("%s submitted %ld\n", ifaces[i].ifname, ifaces[i].submitted);
+			total += ifaces[i].submitted;
+		} else {
+			rt_print_stats(stdout, ifaces[i].w, elapsed);
+			total += ifaces[i].w->st.frames;
+		}
+		if (ifaces[i].backpressure)
+			printf("%s queue full %ld times\n", ifaces[i].ifname,
+			       ifaces[i].backpressure);
+	}
+	printf("frames_sent %ld bytes_sent %ld\n", total,
+	       trace_path ? bytes : total * frame_len);
+	printf("elapsed %.6f s, %.1f frames/s\n", elapsed,
+	       elapsed > 0 ? total / elapsed : 0.0);
+
+	if (use_lorad)
+		lorad_close(&lc);
+	else
+		rt_destroy(&rt);
 
 	return 0;
 }
@@ -0,0 +1,327 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pcapng.h"
+#include "trace.h"
+
+#define BT_SHB		0x0a0d0d0a
+#define BT_IDB		0x00000001
+#define BT_EPB		0x00000006
+#define BYTE_ORDER_MAGIC 0x1a2b3c4d
+
+#define OPT_ENDOFOPT	0
+#define OPT_IF_NAME	2
+#define OPT_IF_TSRESOL	9
+
+#define IDB_FIXED	16
+#define EPB_FIXED	28	/* without data, options and trailer */
+
+static inline size_t pad4(size_t n)
+{
+	return (n + 3) & ~(size_t)3;
+}
+
+static uint16_t get16(const unsigned char *p)
+{
+	uint16_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static uint32_t get32(const unsigned char *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static int ifid_of(struct trace *t, const char *name)
+{
+	for (int i = 0; i < t->nifs; i++)
+		if (strcmp(t->ifnames[i], name) == 0)
+			return i;
+	if (t->nifs == TRACE_MAX_IF)
+		return -ENOSPC;
+	snprintf(t->ifnames[t->nifs], IFNAMSIZ, "%s", name);
+	return t->nifs++;
+}
+
+static int read_idb(struct trace *t, const unsigned char *p, uint32_t blen)
+{
+	char name[IFNAMSIZ];
+	uint8_t tsresol = 6;	/* microseconds when the option is missing */
+	size_t o = IDB_FIXED;
+	int id;
+
+	if (t->nidb == TRACE_MAX_IF || blen < IDB_FIXED + 4)
+		return -ENOSPC;
+	snprintf(name, sizeof(name), "if%d", t->nidb);
+	while (o + 4 <= blen - 4) {
+		uint16_t code = get16(p + o), len = get16(p + o + 2);
+
+		if (code == OPT_ENDOFOPT)
+			break;
+		if (o + 4 + len > blen - 4)
+			return -EPROTO;
+		if (code == OPT_IF_NAME)
+			snprintf(name, sizeof(name), "%.*s", (int)len, (const char *)p + o + 4);
+		else if (code == OPT_IF_TSRESOL && len >= 1)
+			tsresol = p[o + 4];
+		o += 4 + pad4(len);
+	}
+
+	id = ifid_of(t, name);
+	if (id < 0)
+		return id;
+	t->idb_ifid[t->nidb] = id;
+	t->idb_linktype[t->nidb] = get16(p + 8);
+	t->idb_tsresol[t->nidb] = tsresol;
+	t->nidb++;
+	return 0;
+}
+
+static uint64_t ts_to_ns(uint64_t ts, uint8_t tsresol)
+{
+	unsigned int exp = tsresol & 0x7f;
+	uint64_t units = 1;
+
+	if (tsresol & 0x80) {
+		if (exp > 63)
+			return 0;
+		units <<= exp;
+	} else {
+		if (exp > 19)
+			return 0;
+		while (exp--)
+			units *= 10;
+	}
+	return (unsigned __int128)ts * 1000000000u / units;
+}
+
+/* The block at t->off; -EPROTO for a truncated or corrupt one. */
+static int block_at(const struct trace *t, uint32_t *type, const unsigned char **p,
+		    uint32_t *blen)
+{
+	if (t->len - t->off < 12)
+		return -EPROTO;
+	*p = t->map + t->off;
+	*type = get32(*p);
+	*blen = get32(*p + 4);
+	if (*blen < 12 || (*blen & 3) || *blen > t->len - t->off ||
+	    get32(*p + *blen - 4) != *blen)
+		return -EPROTO;
+	if (*type == BT_SHB && (*blen < 28 || get32(*p + 8) != BYTE_ORDER_MAGIC))
+		return -EPROTO;	/* the other byte order is not read */
+	return 0;
+}
+
+static int pcapng_next(struct trace *t, struct trace_frame *f)
+{
+	while (t->off < t->len) {
+		const unsigned char *p;
+		uint32_t type, blen;
+		int ret = block_at(t, &type, &p, &blen);
+
+		if (ret < 0)
+			return ret;
+		t->off += blen;
+
+		switch (type) {
+		case BT_SHB:
+			t->nidb = 0;
+			break;
+		case BT_IDB:
+			ret = read_idb(t, p, blen);
+			if (ret < 0)
+				return ret;
+			break;
+		case BT_EPB: {
+			if (blen < EPB_FIXED + 4)
+				return -EPROTO;
+			uint32_t idb = get32(p + 8), caplen = get32(p + 20);
+			uint64_t ts = (uint64_t)get32(p + 12) << 32 | get32(p + 16);
+			const uint8_t *data = p + EPB_FIXED;
+
+			if (idb >= (uint32_t)t->nidb || caplen > blen - EPB_FIXED - 4)
+				return -EPROTO;
+			if (t->idb_linktype[idb] == LINKTYPE_LORATAP && caplen >= 4) {
+				unsigned int hlen = data[2] << 8 | data[3];
+
+				if (hlen > caplen)
+					return -EPROTO;
+				data += hlen;
+				caplen -= hlen;
+			}
+			f->time_ns = ts_to_ns(ts, t->idb_tsresol[idb]);
+			f->ifid = t->idb_ifid[idb];
+			f->data = data;
+			f->len = caplen;
+			return 1;
+		}
+		default:
+			break;
+		}
+	}
+	return 0;
+}
+
+static int compact_next(struct trace *t, struct trace_frame *f)
+{
+	const unsigned char *p = t->map + t->off;
+	size_t left = t->len - t->off;
+
+	if (left == 0)
+		return 0;
+	if (left < TRACE_REC_LEN || left - TRACE_REC_LEN < p[5])
+		return -EPROTO;
+	if (p[4] >= t->nifs)
+		return -EPROTO;
+	t->time_ns += get32(p) * 1000ULL;
+	f->time_ns = t->time_ns;
+	f->ifid = p[4];
+	f->len = p[5];
+	f->data = p + TRACE_REC_LEN;
+	t->off += TRACE_REC_LEN + f->len;
+	return 1;
+}
+
+int trace_next(struct trace *t, struct trace_frame *f)
+{
+	return t->format == TRACE_COMPACT ? compact_next(t, f) : pcapng_next(t, f);
+}
+
+void trace_rewind(struct trace *t)
+{
+	t->nidb = 0;
+	if (t->format == TRACE_COMPACT) {
+		const struct trace_hdr *h = (const struct trace_hdr *)t->map;
+
+		t->off = sizeof(*h);
+		t->time_ns = h->start_ns;
+	} else {
+		t->off = 0;
+	}
+}
+
+/* Walks every block once, so a corrupt file fails here and all names are known. */
+static int pcapng_scan(struct trace *t)
+{
+	struct trace_frame f;
+	int ret;
+
+	while ((ret = pcapng_next(t, &f)) == 1)
+		;
+	return ret;
+}
+
+int trace_open(struct trace *t, const char *path)
+{
+	struct stat st;
+	void *map;
+	int fd, ret;
+
+	memset(t, 0, sizeof(*t));
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return -errno;
+	if (fstat(fd, &st) == -1) {
+		ret = -errno;
+		close(fd);
+		return ret;
+	}
+	if (st.st_size < 12) {
+		close(fd);
+		return -EPROTO;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	ret = -errno;
+	close(fd);
+	if (map == MAP_FAILED)
+		return ret;
+	madvise(map, st.st_size, MADV_SEQUENTIAL | MADV_WILLNEED);
+	t->map = map;
+	t->len = st.st_size;
+
+	if (memcmp(t->map, TRACE_MAGIC, 4) == 0) {
+		const struct trace_hdr *h = map;
+
+		t->format = TRACE_COMPACT;
+		if (t->len < sizeof(*h) || h->version != TRACE_VERSION || h->nifs > TRACE_MAX_IF) {
+			trace_close(t);
+			return -EPROTO;
+		}
+		t->nifs = h->nifs;
+		for (int i = 0; i < t->nifs; i++)
+			snprintf(t->ifnames[i], IFNAMSIZ, "%.*s", IFNAMSIZ - 1, h->ifnames[i]);
+	} else if (get32(t->map) == BT_SHB) {
+		t->format = TRACE_PCAPNG;
+		ret = pcapng_scan(t);
+		if (ret < 0) {
+			trace_close(t);
+			return ret;
+		}
+	} else {
+		trace_close(t);
+		return -EPROTO;
+	}
+
+	trace_rewind(t);
+	return 0;
+}
+
+void trace_close(struct trace *t)
+{
+	munmap((void *)t->map, t->len);
+	t->map = NULL;
+}
+
+int trace_write_compact(struct trace *t, FILE *out)
+{
+	struct trace_hdr h;
+	struct trace_frame f;
+	uint64_t prev;
+	int ret, n = 0;
+
+	trace_rewind(t);
+	ret = trace_next(t, &f);
+	if (ret <= 0)
+		return ret < 0 ? ret : -ENODATA;
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, TRACE_MAGIC, 4);
+	h.version = TRACE_VERSION;
+	h.nifs = t->nifs;
+	h.start_ns = f.time_ns;
+	memcpy(h.ifnames, t->ifnames, sizeof(h.ifnames));
+	if (fwrite(&h, sizeof(h), 1, out) != 1)
+		return -EIO;
+
+	/* Deltas advance prev by what they encode, so rounding never adds up. */
+	prev = f.time_ns;
+	do {
+		unsigned char rec[TRACE_REC_LEN];
+		uint64_t delta = f.time_ns > prev ? (f.time_ns - prev) / 1000 : 0;
+		uint32_t d32 = delta > UINT32_MAX ? UINT32_MAX : delta;
+
+		if (f.len > 255)
+			continue;
+		prev += d32 * 1000ULL;
+		memcpy(rec, &d32, sizeof(d32));
+		rec[4] = f.ifid;
+		rec[5] = f.len;
+		if (fwrite(rec, sizeof(rec), 1, out) != 1 ||
+		    (f.len && fwrite(f.data, f.len, 1, out) != 1))
+			return -EIO;
+		n++;
+	} while ((ret = trace_next(t, &f)) == 1);
+
+	trace_rewind(t);
+	return ret < 0 ? ret : n;
+}
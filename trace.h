@@ -0,0 +1,78 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <net/if.h>
+
+/*
+ * Read-only access to captured traffic for replay, through mmap().
+ *
+ * Two formats are read: pcapng, as rxlora -c writes it, with LoRaTap
+ * headers stripped, and a compact trace of our own. The compact trace
+ * is a header naming the interfaces, followed by one record per frame:
+ *
+ *   le32 delta_us   since the previous frame, or since start_ns
+ *   u8   ifid
+ *   u8   len
+ *   len bytes of payload
+ *
+ * Interfaces are numbered in the order they first appear, across every
+ * pcapng section. Functions return 0 on success and a negative errno
+ * value on failure; trace_next() returns 1 for a frame and 0 at the end.
+ */
+
+#define TRACE_MAGIC		"LTRC"
+#define TRACE_VERSION		1
+#define TRACE_MAX_IF		16
+
+struct trace_hdr {
+	char magic[4];
+	uint16_t version;
+	uint16_t nifs;
+	uint64_t start_ns;	/* CLOCK_REALTIME of delta 0 */
+	char ifnames[TRACE_MAX_IF][IFNAMSIZ];
+};
+
+#define TRACE_REC_LEN		6
+
+struct trace_frame {
+	uint64_t time_ns;
+	int ifid;
+	const uint8_t *data;
+	unsigned int len;
+};
+
+enum trace_format {
+	TRACE_COMPACT,
+	TRACE_PCAPNG,
+};
+
+struct trace {
+	const unsigned char *map;
+	size_t len;
+	enum trace_format format;
+	char ifnames[TRACE_MAX_IF][IFNAMSIZ];
+	int nifs;
+
+	/* Reader state */
+	size_t off;
+	uint64_t time_ns;
+	/* pcapng: this section's interfaces */
+	int nidb;
+	int idb_ifid[TRACE_MAX_IF];
+	uint16_t idb_linktype[TRACE_MAX_IF];
+	uint8_t idb_tsresol[TRACE_MAX_IF];
+};
+
+int trace_open(struct trace *t, const char *path);
+void trace_close(struct trace *t);
+
+int trace_next(struct trace *t, struct trace_frame *f);
+void trace_rewind(struct trace *t);
+
+/* Writes every frame of t from the start as a compact trace. */
+int trace_write_compact(struct trace *t, FILE *out);
+
+#endif
@@ -0,0 +1,119 @@
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <sys/socket.h>
+
+#include "tstamp.h"
+
+static uint64_t ts_ns(const struct timespec *ts)
+{
+	return (uint64_t)ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+}
+
+uint64_t realtime_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts_ns(&ts);
+}
+
+int tstamp_enable_tx(int fd, int hw)
+{
+	int flags = SOF_TIMESTAMPING_TX_SCHED | SOF_TIMESTAMPING_TX_SOFTWARE |
+		    SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_OPT_ID |
+		    SOF_TIMESTAMPING_OPT_TSONLY;
+
+	if (hw)
+		flags |= SOF_TIMESTAMPING_TX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE;
+
+	if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) == -1)
+		return -errno;
+	return 0;
+}
+
+int tstamp_enable_rx(int fd, int hw)
+{
+	int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+
+	if (hw)
+		flags |= SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE;
+
+	if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) == -1)
+		return -errno;
+	return 0;
+}
+
+int tstamp_from_cmsg(struct msghdr *mh, uint64_t *sw_ns, uint64_t *hw_ns)
+{
+	struct cmsghdr *cmsg;
+
+	for (cmsg = CMSG_FIRSTHDR(mh); cmsg != NULL; cmsg = CMSG_NXTHDR(mh, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_TIMESTAMPING) {
+			struct timespec ts[3];
+
+			memcpy(ts, CMSG_DATA(cmsg), sizeof(ts));
+			*sw_ns = ts_ns(&ts[0]);
+			*hw_ns = ts_ns(&ts[2]);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int tstamp_read_tx(int fd, struct tx_tstamp *ts)
+{
+	char control[CMSG_SPACE(3 * sizeof(struct timespec)) +
+		     CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_storage))];
+	struct msghdr mh;
+	struct cmsghdr *cmsg;
+	int have_ts = 0, have_err = 0;
+
+	memset(&mh, 0, sizeof(mh));
+	mh.msg_control = control;
+	mh.msg_controllen = sizeof(control);
+
+	if (recvmsg(fd, &mh, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+			return 0;
+		return -errno;
+	}
+
+	memset(ts, 0, sizeof(*ts));
+	ts->kind = TSTAMP_OTHER;
+
+	for (cmsg = CMSG_FIRSTHDR(&mh); cmsg != NULL; cmsg = CMSG_NXTHDR(&mh, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_TIMESTAMPING) {
+			struct timespec t[3];
+
+			memcpy(t, CMSG_DATA(cmsg), sizeof(t));
+			ts->sw_ns = ts_ns(&t[0]);
+			ts->hw_ns = ts_ns(&t[2]);
+			have_ts = 1;
+		} else if (cmsg->cmsg_len >= CMSG_LEN(sizeof(struct sock_extended_err))) {
+			/* Level and type of the error cmsg are protocol specific. */
+			struct sock_extended_err serr;
+
+			memcpy(&serr, CMSG_DATA(cmsg), sizeof(serr));
+			if (serr.ee_origin != SO_EE_ORIGIN_TIMESTAMPING)
+				continue;
+			ts->id = serr.ee_data;
+			switch (serr.ee_info) {
+			case SCM_TSTAMP_SCHED:
+				ts->kind = TSTAMP_SCHED;
+				break;
+			case SCM_TSTAMP_SND:
+				ts->kind = TSTAMP_SND;
+				break;
+			case SCM_TSTAMP_ACK:
+				ts->kind = TSTAMP_ACK;
+				break;
+			}
+			have_err = 1;
+		}
+	}
+
+	return have_ts && have_err ? 1 : -EPROTO;
+}
@@ -0,0 +1,47 @@
+#ifndef TSTAMP_H
+#define TSTAMP_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+/*
+ * SO_TIMESTAMPING helpers.
+ *
+ * Timestamps are CLOCK_REALTIME nanoseconds. Hardware timestamps are
+ * only meaningful when the driver's clock is disciplined to system time,
+ * e.g. an SX130x concentrator counter that the driver maps to wall time.
+ */
+
+/* Room for SCM_TIMESTAMPING plus one more small cmsg, e.g. SO_RXQ_OVFL. */
+#define TSTAMP_CMSG_SPACE	(CMSG_SPACE(3 * sizeof(struct timespec)) + \
+				 CMSG_SPACE(sizeof(uint32_t)))
+
+enum tstamp_kind {
+	TSTAMP_SCHED,		/* entered the qdisc / packet scheduler */
+	TSTAMP_SND,		/* handed to the driver (or radio, hw) */
+	TSTAMP_ACK,
+	TSTAMP_OTHER,
+};
+
+struct tx_tstamp {
+	uint32_t id;		/* SOF_TIMESTAMPING_OPT_ID counter */
+	enum tstamp_kind kind;
+	uint64_t sw_ns;		/* 0 if absent */
+	uint64_t hw_ns;		/* 0 if absent */
+};
+
+int tstamp_enable_tx(int fd, int hw);
+int tstamp_enable_rx(int fd, int hw);
+
+/* Extracts RX timestamps from a received message; returns 1 if found. */
+int tstamp_from_cmsg(struct msghdr *mh, uint64_t *sw_ns, uint64_t *hw_ns);
+
+/*
+ * Reads one TX timestamp from the socket error queue without blocking.
+ * Returns 1 on success, 0 if the queue is empty, or a negative errno.
+ */
+int tstamp_read_tx(int fd, struct tx_tstamp *ts);
+
+uint64_t realtime_ns(void);
+
+#endif
@@ -1,4 +1,8 @@
+#define _GNU_SOURCE
 #include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -8,34 +12,102 @@
 #include <linux/socket.h>
 #include <net/if.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 
-#ifndef ARPHRD_ENOCEAN
-#define ARPHRD_ENOCEAN 832
-#endif
+#include "crc.h"
+#include "ifcache.h"
+#include "runtime.h"
 
 #ifndef ETH_P_ERP2
 #define ETH_P_ERP2 0x0100
 #endif
 
-int main(void)
+#define TELEGRAM_LEN	15
+#define VLD_DATA_MAX	14
+#define TELEGRAM_TRAILER	5	/* sender ID and status */
+#define TELEGRAM_MAX	(1 + VLD_DATA_MAX + TELEGRAM_TRAILER + 1)
+
+/*
+ * TX ring: TPACKET_V2, since TPACKET_V3 transmit rings need Linux 4.11+.
+ * Frames are tiny telegrams, so pack many per page.
+ */
+#define TX_FRAME_SIZE	TPACKET_ALIGN(TPACKET2_HDRLEN + TELEGRAM_MAX)
+#define TX_BLOCK_SIZE	4096
+#define TX_BLOCK_NR	64
+
+/* RX ring: TPACKET_V3, the kernel hands over whole blocks at a time. */
+#define RX_BLOCK_SIZE	(1 << 16)
+#define RX_BLOCK_NR	16
+#define RX_FRAME_SIZE	2048
+#define RX_BLOCK_TOV_MS	10
+
+static const unsigned char telegram[TELEGRAM_LEN] = {
+	0xD2, 0xDD, 0xDD, 0xDD, 0xDD, 0xDD, 0xDD, 0xDD,
+	0xDD, 0xDD, 0x00, 0x80, 0x35, 0xC4, 0x00,
+};
+
+struct ring {
+	struct tpacket_req3 req;
+	unsigned char *map;
+	size_t len;
+};
+
+/*
+ * Every telegram keeps the RORG, sender ID and status of the canned one.
+ * With -s its data bytes are resized and start with a little-endian
+ * sequence number; with -c a CRC8 over the telegram is appended.
+ */
+static unsigned int data_len = TELEGRAM_LEN - 1 - TELEGRAM_TRAILER;
+static int stamp_seq;
+static int with_crc;
+static long crc_errors;
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig)
+{
+	stop = 1;
+}
+
+static unsigned int build_telegram(unsigned char *buf, uint32_t seq)
+{
+	unsigned int len = 1 + data_len + TELEGRAM_TRAILER;
+
+	buf[0] = telegram[0];
+	for (unsigned int i = 0; i < data_len; i++)
+		buf[1 + i] = stamp_seq && i < 4 ? seq >> (8 * i) : telegram[1];
+	memcpy(buf + 1 + data_len, telegram + TELEGRAM_LEN - TELEGRAM_TRAILER, TELEGRAM_TRAILER);
+	if (with_crc) {
+		buf[len] = crc8_esp3(buf, len);
+		len++;
+	}
+	return len;
+}
+
+static int open_bound_socket(const struct ifc_entry *ife)
 {
 	int skt = socket(PF_PACKET, SOCK_DGRAM, htons(ETH_P_ERP2));
 	if (skt == -1) {
 		int err = errno;
 		fprintf(stderr, "socket failed: %s\n", strerror(err));
-		return 1;
+		return -1;
 	}
 	printf("socket %d\n", skt);
 
 	struct ifreq ifr;
-	strcpy(ifr.ifr_name, "enocean0");
-	int ret = ioctl(skt, SIOCGIFINDEX, &ifr);
-	if (ret == -1) {
-		int err = errno;
-		fprintf(stderr, "ioctl failed: %s\n", strerror(err));
-		return 1;
+	int ret;
+	ifr.ifr_ifindex = ife->ifindex;
+	if (ifr.ifr_ifindex == 0) {
+		strcpy(ifr.ifr_name, ife->name);
+		ret = ioctl(skt, SIOCGIFINDEX, &ifr);
+		if (ret == -1) {
+			int err = errno;
+			fprintf(stderr, "ioctl failed: %s\n", strerror(err));
+			close(skt);
+			return -1;
+		}
 	}
 	printf("ifindex %d\n", ifr.ifr_ifindex);
 
@@ -50,32 +122,355 @@ int main(void)
 	if (ret == -1) {
 		int err = errno;
 		fprintf(stderr, "bind failed: %s\n", strerror(err));
+		close(skt);
+		return -1;
+	}
+
+	return skt;
+}
+
+static int setup_ring(int skt, int version, int optname, struct ring *ring)
+{
+	int ret = setsockopt(skt, SOL_PACKET, PACKET_VERSION, &version, sizeof(version));
+	if (ret == -1) {
+		int err = errno;
+		fprintf(stderr, "PACKET_VERSION failed: %s\n", strerror(err));
+		return -1;
+	}
+
+	/* struct tpacket_req is a prefix of struct tpacket_req3. */
+	ret = setsockopt(skt, SOL_PACKET, optname, &ring->req,
+			 version == TPACKET_V3 ? sizeof(ring->req) : sizeof(struct tpacket_req));
+	if (ret == -1) {
+		int err = errno;
+		fprintf(stderr, "ring setup failed: %s\n", strerror(err));
+		return -1;
+	}
+
+	ring->len = (size_t)ring->req.tp_block_size * ring->req.tp_block_nr;
+	ring->map = mmap(NULL, ring->len, PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_LOCKED | MAP_POPULATE, skt, 0);
+	if (ring->map == MAP_FAILED) {
+		/* MAP_LOCKED may exceed RLIMIT_MEMLOCK, retry without it. */
+		ring->map = mmap(NULL, ring->len, PROT_READ | PROT_WRITE,
+				 MAP_SHARED | MAP_POPULATE, skt, 0);
+	}
+	if (ring->map == MAP_FAILED) {
+		int err = errno;
+		fprintf(stderr, "mmap failed: %s\n", strerror(err));
+		return -1;
+	}
+
+	return 0;
+}
+
+/* One runtime TX worker per interface, fed round-robin from here. */
+static int tx_workers(const struct ifc_entry *ifs, int nifaces, long count, long batch)
+{
+	static struct rt rt;
+	long submitted[RT_MAX_WORKERS] = { 0 };
+	int ret, active;
+
+	ret = rt_init(&rt);
+	if (ret < 0) {
+		fprintf(stderr, "rt_init failed: %s\n", strerror(-ret));
 		return 1;
 	}
 
-	char buf[15];
-	buf[0] = 0xD2;
-	buf[1] = 0xDD;
-	buf[2] = 0xDD;
-	buf[3] = 0xDD;
-	buf[4] = 0xDD;
-	buf[5] = 0xDD;
-	buf[6] = 0xDD;
-	buf[7] = 0xDD;
-	buf[8] = 0xDD;
-	buf[9] = 0xDD;
-	buf[10] = 0x00;
-	buf[11] = 0x80;
-	buf[12] = 0x35;
-	buf[13] = 0xC4;
-	buf[14] = 0x00;
-	int bytes_sent = write(skt, buf, 15);
-	if (bytes_sent == -1) {
+	for (int i = 0; i < nifaces; i++) {
+		struct rt_worker *w = rt_add_worker(&rt, RT_TX, ifs[i].name, ETH_P_ERP2, 0);
+		if (w == NULL) {
+			fprintf(stderr, "%s: cannot add worker\n", ifs[i].name);
+			return 1;
+		}
+		w->ifindex = ifs[i].ifindex;
+		w->batch = batch < RT_QUEUE_LEN ? batch : RT_QUEUE_LEN;
+	}
+
+	if (rt_start(&rt))
+		return 1;
+
+	do {
+		int progress = 0;
+
+		active = 0;
+		for (int i = 0; i < nifaces && !stop; i++) {
+			struct rt_worker *w = &rt.workers[i];
+			long n = 0;
+
+			while (submitted[i] < count) {
+				unsigned char buf[TELEGRAM_MAX];
+				unsigned int len = build_telegram(buf, submitted[i]);
+
+				if (rt_submit(w, buf, len) < 0)
+					break;
+				submitted[i]++;
+				n++;
+			}
+			if (n) {
+				rt_kick(w);
+				progress = 1;
+			}
+			if (submitted[i] < count)
+				active++;
+		}
+		if (active && !progress)
+			rt_wait(&rt, 10);
+	} while (active && !stop);
+
+	rt_drain(&rt, 10000);
+	rt_stop(&rt);
+	rt_join(&rt);
+
+	ret = 0;
+	for (int i = 0; i < nifaces; i++) {
+		struct rt_worker *w = &rt.workers[i];
+
+		printf("%s bytes_sent %llu frames %llu errors %llu\n", w->ifname,
+		       (unsigned long long)w->st.bytes, (unsigned long long)w->st.frames,
+		       (unsigned long long)w->st.errors);
+		if (w->st.frames < (uint64_t)count)
+			ret = 1;
+	}
+
+	rt_destroy(&rt);
+	return ret;
+}
+
+static int tx_flush(int skt)
+{
+	int ret = send(skt, NULL, 0, 0);
+	if (ret == -1) {
 		int err = errno;
-		fprintf(stderr, "write failed: %s\n", strerror(err));
+		fprintf(stderr, "send failed: %s\n", strerror(err));
+		return -1;
+	}
+	return ret;
+}
+
+static int tx_ring(int skt, long count, long batch)
+{
+	struct ring ring;
+
+	memset(&ring, 0, sizeof(ring));
+	ring.req.tp_block_size = TX_BLOCK_SIZE;
+	ring.req.tp_block_nr = TX_BLOCK_NR;
+	ring.req.tp_frame_size = TX_FRAME_SIZE;
+	ring.req.tp_frame_nr = TX_BLOCK_SIZE / TX_FRAME_SIZE * TX_BLOCK_NR;
+	if (setup_ring(skt, TPACKET_V2, PACKET_TX_RING, &ring))
 		return 1;
+
+	unsigned int frames_per_block = TX_BLOCK_SIZE / TX_FRAME_SIZE;
+	unsigned int frame_nr = ring.req.tp_frame_nr;
+	unsigned int slot = 0, pending = 0;
+	long queued = 0, bytes = 0, flushes = 0;
+
+	if (batch > frame_nr)
+		batch = frame_nr;
+
+	while (queued < count && !stop) {
+		unsigned char *frame = ring.map +
+			(size_t)(slot / frames_per_block) * TX_BLOCK_SIZE +
+			(size_t)(slot % frames_per_block) * TX_FRAME_SIZE;
+		struct tpacket2_hdr *hdr = (struct tpacket2_hdr *)frame;
+
+		if (hdr->tp_status != TP_STATUS_AVAILABLE) {
+			if (hdr->tp_status == TP_STATUS_WRONG_FORMAT) {
+				fprintf(stderr, "frame %u rejected by kernel\n", slot);
+				return 1;
+			}
+			/* Ring is full, wait for the kernel to drain it. */
+			if (tx_flush(skt) < 0)
+				return 1;
+			flushes++;
+			pending = 0;
+			continue;
+		}
+
+		unsigned char *data = frame + TPACKET2_HDRLEN - sizeof(struct sockaddr_ll);
+		hdr->tp_len = build_telegram(data, queued);
+		__atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+
+		slot = (slot + 1) % frame_nr;
+		queued++;
+		if (++pending >= batch || queued == count) {
+			int ret = tx_flush(skt);
+			if (ret < 0)
+				return 1;
+			bytes += ret;
+			flushes++;
+			pending = 0;
+		}
 	}
-	printf("bytes_sent %d\n", bytes_sent);
 
+	printf("frames_queued %ld bytes_sent %ld flushes %ld\n", queued, bytes, flushes);
+
+	munmap(ring.map, ring.len);
 	return 0;
 }
+
+static void handle_telegram(const unsigned char *buf, unsigned int len, int verbose)
+{
+	if (with_crc && (len < 2 || crc8_esp3(buf, len - 1) != buf[len - 1]))
+		crc_errors++;
+	if (!verbose)
+		return;
+	for (unsigned int i = 0; i < len; i++)
+		printf("%02x", buf[i]);
+	printf("\n");
+}
+
+static int rx_ring(int skt, long count, int verbose)
+{
+	struct ring ring;
+
+	memset(&ring, 0, sizeof(ring));
+	ring.req.tp_block_size = RX_BLOCK_SIZE;
+	ring.req.tp_block_nr = RX_BLOCK_NR;
+	ring.req.tp_frame_size = RX_FRAME_SIZE;
+	ring.req.tp_frame_nr = RX_BLOCK_SIZE / RX_FRAME_SIZE * RX_BLOCK_NR;
+	ring.req.tp_retire_blk_tov = RX_BLOCK_TOV_MS;
+	ring.req.tp_feature_req_word = TP_FT_REQ_FILL_RXHASH;
+	if (setup_ring(skt, TPACKET_V3, PACKET_RX_RING, &ring))
+		return 1;
+
+	struct pollfd pfd = { .fd = skt, .events = POLLIN | POLLERR };
+	unsigned int block = 0;
+	long frames = 0, bytes = 0, blocks = 0;
+
+	while (!stop && (count == 0 || frames < count)) {
+		struct tpacket_block_desc *pbd = (struct tpacket_block_desc *)
+			(ring.map + (size_t)block * RX_BLOCK_SIZE);
+
+		if (!(__atomic_load_n(&pbd->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER)) {
+			if (poll(&pfd, 1, -1) == -1 && errno != EINTR) {
+				int err = errno;
+				fprintf(stderr, "poll failed: %s\n", strerror(err));
+				return 1;
+			}
+			continue;
+		}
+
+		struct tpacket3_hdr *ppd = (struct tpacket3_hdr *)
+			((unsigned char *)pbd + pbd->hdr.bh1.offset_to_first_pkt);
+		for (unsigned int i = 0; i < pbd->hdr.bh1.num_pkts; i++) {
+			handle_telegram((unsigned char *)ppd + ppd->tp_mac, ppd->tp_snaplen, verbose);
+			frames++;
+			bytes += ppd->tp_snaplen;
+			ppd = (struct tpacket3_hdr *)((unsigned char *)ppd + ppd->tp_next_offset);
+		}
+		blocks++;
+
+		__atomic_store_n(&pbd->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+		block = (block + 1) % RX_BLOCK_NR;
+	}
+
+	struct tpacket_stats_v3 st;
+	socklen_t len = sizeof(st);
+	memset(&st, 0, sizeof(st));
+	getsockopt(skt, SOL_PACKET, PACKET_STATISTICS, &st, &len);
+
+	printf("frames_received %ld bytes_received %ld blocks %ld\n", frames, bytes, blocks);
+	if (with_crc)
+		printf("crc_errors %ld\n", crc_errors);
+	printf("kernel packets %u drops %u freeze_q_cnt %u\n",
+	       st.tp_packets, st.tp_drops, st.tp_freeze_q_cnt);
+
+	munmap(ring.map, ring.len);
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-i ifname]... [-t | -r] [-n count] [-b batch] [-s size] [-c] [-v]\n", prog);
+	fprintf(stderr, "  -i  interface to bind to (default enocean0); without -t/-r it\n");
+	fprintf(stderr, "      may be repeated to send from one worker per interface\n");
+	fprintf(stderr, "      may also be an ifindex, a glob such as \"enocean*\" or \"all\", with an optional :count\n");
+	fprintf(stderr, "  -t  transmit through a PACKET_TX_RING\n");
+	fprintf(stderr, "  -r  receive through a TPACKET_V3 PACKET_RX_RING\n");
+	fprintf(stderr, "  -n  telegrams to send (default 1) or receive (default 0, unlimited)\n");
+	fprintf(stderr, "  -b  frames queued per send() flush or sendmmsg() batch (default 64)\n");
+	fprintf(stderr, "  -s  data bytes per telegram, 1..%d, led by a sequence number\n", VLD_DATA_MAX);
+	fprintf(stderr, "  -c  append a CRC8 to sent telegrams, check it on received ones\n");
+	fprintf(stderr, "  -v  hex dump received telegrams\n");
+}
+
+int main(int argc, char **argv)
+{
+	const char *specs[RT_MAX_WORKERS];
+	struct ifc_entry ifs[RT_MAX_WORKERS];
+	struct ifcache ifc;
+	int nspecs = 0, nifaces;
+	long count = -1, batch = 64;
+	int mode = 0, verbose = 0, opt;
+
+	while ((opt = getopt(argc, argv, "i:trn:b:s:cvh")) != -1) {
+		switch (opt) {
+		case 'i':
+			if (nspecs == RT_MAX_WORKERS) {
+				fprintf(stderr, "at most %d interfaces\n", RT_MAX_WORKERS);
+				return 1;
+			}
+			specs[nspecs++] = optarg;
+			break;
+		case 't':
+		case 'r':
+			mode = opt;
+			break;
+		case 'n':
+			count = strtol(optarg, NULL, 0);
+			break;
+		case 'b':
+			batch = strtol(optarg, NULL, 0);
+			break;
+		case 's':
+			data_len = strtoul(optarg, NULL, 0);
+			stamp_seq = 1;
+			break;
+		case 'c':
+			with_crc = 1;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (nspecs == 0)
+		specs[nspecs++] = "enocean0";
+
+	ifcache_init(&ifc);
+	nifaces = ifcache_expand_list(&ifc, specs, nspecs, ARPHRD_ENOCEAN, ifs, RT_MAX_WORKERS);
+	ifcache_close(&ifc);
+	if (nifaces < 0) {
+		fprintf(stderr, "interfaces: %s\n", strerror(-nifaces));
+		return 1;
+	}
+	if (count == -1)
+		count = mode == 'r' ? 0 : 1;
+	if (count < 0 || batch < 1 || (mode && nifaces > 1) ||
+	    data_len < 1 || data_len > VLD_DATA_MAX) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	if (!mode)
+		return tx_workers(ifs, nifaces, count, batch);
+
+	int skt = open_bound_socket(&ifs[0]);
+	if (skt == -1)
+		return 1;
+
+	int ret = mode == 't' ? tx_ring(skt, count, batch) : rx_ring(skt, count, verbose);
+
+	close(skt);
+	return ret;
+}
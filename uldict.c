@@ -0,0 +1,71 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "trace.h"
+#include "uplink.h"
+
+/*
+ * Makes a pktfwd -Z dictionary from a pcapng or compact trace: the
+ * LoRaWAN headers that recur most often in it, as ul_train_dict() picks
+ * them.
+ */
+
+#define DICT_LEN	8192
+
+static int write_dict(struct trace *tr, FILE *out)
+{
+	static struct ul_trainer t;
+	static uint8_t dict[DICT_LEN];
+	struct trace_frame f;
+	int ret;
+
+	ul_train_init(&t);
+	while ((ret = trace_next(tr, &f)) == 1)
+		ul_train_add(&t, f.data, f.len);
+	if (ret < 0)
+		return ret;
+
+	ret = ul_train_dict(&t, dict, sizeof(dict));
+	if (ret <= 0)
+		return ret < 0 ? ret : -ENODATA;
+	if (fwrite(dict, ret, 1, out) != 1)
+		return -EIO;
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	struct trace tr;
+	FILE *out;
+	int ret;
+
+	if (argc != 3) {
+		fprintf(stderr, "usage: %s trace dictfile\n", argv[0]);
+		return 1;
+	}
+
+	ret = trace_open(&tr, argv[1]);
+	if (ret < 0) {
+		fprintf(stderr, "%s: %s\n", argv[1], strerror(-ret));
+		return 1;
+	}
+	out = fopen(argv[2], "w");
+	if (out == NULL) {
+		int err = errno;
+		fprintf(stderr, "%s: %s\n", argv[2], strerror(err));
+		trace_close(&tr);
+		return 1;
+	}
+	ret = write_dict(&tr, out);
+	if (fclose(out) == EOF && ret >= 0)
+		ret = -errno;
+	trace_close(&tr);
+	if (ret < 0) {
+		fprintf(stderr, "%s: %s\n", argv[2], strerror(-ret));
+		return 1;
+	}
+	printf("%s: %d bytes of LoRaWAN headers\n", argv[2], ret);
+	return 0;
+}
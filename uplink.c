@@ -0,0 +1,441 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "loracodec.h"
+#include "uplink.h"
+
+#define UL_ZSTD_LEVEL	3
+#define UL_REC_HDR_MAX	(1 + 5 + 5 + 1 + 4 + 10 + 5 + 5 + 5)
+
+#define TAG_RADIO	0x1f
+#define TAG_TMST	0x40
+#define TAG_DESC	0x80
+
+static unsigned int put_varint(uint8_t *p, uint64_t v)
+{
+	unsigned int n = 0;
+
+	while (v >= 0x80) {
+		p[n++] = v | 0x80;
+		v >>= 7;
+	}
+	p[n++] = v;
+	return n;
+}
+
+static int get_varint(const uint8_t **p, const uint8_t *end, uint64_t *v)
+{
+	uint64_t acc = 0;
+
+	for (unsigned int shift = 0; shift < 64; shift += 7) {
+		if (*p == end)
+			return -EINVAL;
+		uint8_t b = *(*p)++;
+
+		acc |= (uint64_t)(b & 0x7f) << shift;
+		if (!(b & 0x80)) {
+			*v = acc;
+			return 0;
+		}
+	}
+	return -EINVAL;
+}
+
+static uint64_t zigzag(int64_t v)
+{
+	return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int64_t unzigzag(uint64_t v)
+{
+	return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+void ul_begin(struct ul_batch *b, uint8_t *buf, unsigned int cap, uint16_t token, uint64_t eui)
+{
+	b->buf = buf;
+	b->cap = cap;
+	b->len = UL_RAW_HDR_LEN;
+	b->count = 0;
+	b->prev_us = 0;
+	b->described = 0;
+	semtech_hdr(buf, token, UL_PUSH_BATCH, eui);
+	buf[SEMTECH_HDR_LEN] = UL_RAW;
+}
+
+int ul_add(struct ul_batch *b, const struct semtech_rxpk *rx)
+{
+	uint8_t hdr[UL_REC_HDR_MAX];
+	uint64_t time_us = rx->time_ns / 1000;
+	unsigned int radio = rx->chan, n = 1;
+	uint8_t sfcr = rx->sf << 4 | rx->cr;
+
+	if (radio >= UL_MAX_RADIOS || rx->rfch != radio || rx->sf > 15 || rx->cr > 15 ||
+	    rx->bw_khz > UINT16_MAX)
+		return -EINVAL;
+	if (b->cap < UL_RAW_HDR_LEN || b->count == UL_MAX_COUNT)
+		return -EMSGSIZE;
+
+	/* The first frame's delta is 0, and base_us is its time. */
+	if (b->count == 0)
+		b->prev_us = time_us;
+
+	hdr[0] = radio;
+	if (!(b->described & 1u << radio) || b->radio[radio].freq_hz != rx->freq_hz ||
+	    b->radio[radio].bw_khz != rx->bw_khz || b->radio[radio].sfcr != sfcr) {
+		hdr[0] |= TAG_DESC;
+		n += put_varint(hdr + n, rx->freq_hz);
+		n += put_varint(hdr + n, rx->bw_khz);
+		hdr[n++] = sfcr;
+	}
+	if (rx->tmst != (uint32_t)time_us) {
+		hdr[0] |= TAG_TMST;
+		put_le32(hdr + n, rx->tmst);
+		n += 4;
+	}
+	n += put_varint(hdr + n, zigzag((int64_t)(time_us - b->prev_us)));
+	n += put_varint(hdr + n, zigzag(rx->rssi));
+	n += put_varint(hdr + n, zigzag(rx->lsnr_cb));
+	n += put_varint(hdr + n, rx->len);
+
+	if (n + rx->len > b->cap - b->len)
+		return -EMSGSIZE;
+	if (b->count == 0)
+		put_le64(b->buf + SEMTECH_HDR_LEN + 3, time_us);
+	memcpy(b->buf + b->len, hdr, n);
+	memcpy(b->buf + b->len + n, rx->data, rx->len);
+	b->len += n + rx->len;
+	b->count++;
+	b->prev_us = time_us;
+	b->described |= 1u << radio;
+	b->radio[radio].freq_hz = rx->freq_hz;
+	b->radio[radio].bw_khz = rx->bw_khz;
+	b->radio[radio].sfcr = sfcr;
+	return 0;
+}
+
+unsigned int ul_end(struct ul_batch *b)
+{
+	put_le16(b->buf + SEMTECH_HDR_LEN + 1, b->count);
+	return b->len;
+}
+
+int ul_read_begin(struct ul_reader *r, const uint8_t *buf, unsigned int len)
+{
+	if (len < UL_RAW_HDR_LEN || buf[0] != SEMTECH_VERSION || buf[3] != UL_PUSH_BATCH ||
+	    buf[SEMTECH_HDR_LEN] != UL_RAW)
+		return -EINVAL;
+	memset(r, 0, sizeof(*r));
+	r->p = buf + UL_RAW_HDR_LEN;
+	r->end = buf + len;
+	r->left = get_le16(buf + SEMTECH_HDR_LEN + 1);
+	r->time_us = get_le64(buf + SEMTECH_HDR_LEN + 3);
+	return r->left;
+}
+
+int ul_read_next(struct ul_reader *r, struct semtech_rxpk *rx)
+{
+	uint64_t v[4];
+	unsigned int radio;
+	uint8_t tag;
+
+	if (r->left == 0)
+		return 0;
+	if (r->p == r->end)
+		return -EINVAL;
+	tag = *r->p++;
+	radio = tag & TAG_RADIO;
+
+	memset(rx, 0, sizeof(*rx));
+	if (tag & TAG_DESC) {
+		if (get_varint(&r->p, r->end, &v[0]) || get_varint(&r->p, r->end, &v[1]) ||
+		    r->p == r->end || v[0] > UINT32_MAX)
+			return -EINVAL;
+		r->radio[radio].freq_hz = v[0];
+		r->radio[radio].bw_khz = v[1];
+		r->radio[radio].sf = *r->p >> 4;
+		r->radio[radio].cr = *r->p++ & 0x0f;
+		r->described |= 1u << radio;
+	} else if (!(r->described & 1u << radio)) {
+		return -EINVAL;
+	}
+	if (tag & TAG_TMST) {
+		if (r->end - r->p < 4)
+			return -EINVAL;
+		rx->tmst = get_le32(r->p);
+		r->p += 4;
+	}
+	for (int i = 0; i < 4; i++)
+		if (get_varint(&r->p, r->end, &v[i]))
+			return -EINVAL;
+	if (v[3] > (uint64_t)(r->end - r->p))
+		return -EINVAL;
+
+	r->time_us += unzigzag(v[0]);
+	rx->time_ns = r->time_us * 1000;
+	if (!(tag & TAG_TMST))
+		rx->tmst = r->time_us;
+	rx->chan = radio;
+	rx->rfch = radio;
+	rx->freq_hz = r->radio[radio].freq_hz;
+	rx->sf = r->radio[radio].sf;
+	rx->bw_khz = r->radio[radio].bw_khz;
+	rx->cr = r->radio[radio].cr;
+	rx->rssi = unzigzag(v[1]);
+	rx->lsnr_cb = unzigzag(v[2]);
+	rx->data = r->p;
+	rx->len = v[3];
+	r->p += v[3];
+	r->left--;
+	return 1;
+}
+
+uint32_t ul_dict_id(const uint8_t *dict, unsigned int len)
+{
+	uint32_t h = 2166136261u;
+
+	for (unsigned int i = 0; i < len; i++)
+		h = (h ^ dict[i]) * 16777619u;
+	return h ?: 1;
+}
+
+int ul_codec_init(struct ul_codec *c, enum ul_codec_id id, const uint8_t *dict,
+		  unsigned int dict_len)
+{
+	memset(c, 0, sizeof(*c));
+	c->id = id;
+	c->dict = dict_len ? dict : NULL;
+	c->dict_len = dict_len;
+	c->dict_id = dict_len ? ul_dict_id(dict, dict_len) : 0;
+
+	switch (id) {
+	case UL_RAW:
+		return 0;
+#ifdef HAVE_LZ4
+	case UL_LZ4:
+		c->cctx = LZ4_createStream();
+		return c->cctx ? 0 : -ENOMEM;
+#endif
+#ifdef HAVE_ZSTD
+	case UL_ZSTD:
+		c->cctx = ZSTD_createCCtx();
+		c->dctx = ZSTD_createDCtx();
+		if (c->cctx == NULL || c->dctx == NULL)
+			goto nomem;
+		/* The header carries our own dictionary ID, the frame needs none. */
+		ZSTD_CCtx_setParameter(c->cctx, ZSTD_c_compressionLevel, UL_ZSTD_LEVEL);
+		ZSTD_CCtx_setParameter(c->cctx, ZSTD_c_dictIDFlag, 0);
+		if (dict_len) {
+			c->cdict = ZSTD_createCDict(dict, dict_len, UL_ZSTD_LEVEL);
+			c->ddict = ZSTD_createDDict(dict, dict_len);
+			if (c->cdict == NULL || c->ddict == NULL)
+				goto nomem;
+			ZSTD_CCtx_refCDict(c->cctx, c->cdict);
+		}
+		return 0;
+nomem:
+		ul_codec_free(c);
+		return -ENOMEM;
+#endif
+	default:
+		return -ENOTSUP;
+	}
+}
+
+void ul_codec_free(struct ul_codec *c)
+{
+#ifdef HAVE_LZ4
+	if (c->id == UL_LZ4)
+		LZ4_freeStream(c->cctx);
+#endif
+#ifdef HAVE_ZSTD
+	if (c->id == UL_ZSTD) {
+		ZSTD_freeCCtx(c->cctx);
+		ZSTD_freeDCtx(c->dctx);
+		ZSTD_freeCDict(c->cdict);
+		ZSTD_freeDDict(c->ddict);
+	}
+#endif
+	c->cctx = c->cdict = c->dctx = c->ddict = NULL;
+}
+
+int ul_compress(struct ul_codec *c, uint8_t *out, unsigned int cap, const uint8_t *raw,
+		unsigned int len)
+{
+	unsigned int slen, room;
+	long n = 0;
+
+	if (len < UL_RAW_HDR_LEN || raw[SEMTECH_HDR_LEN] != UL_RAW)
+		return -EINVAL;
+	if (c->id == UL_RAW || cap <= UL_ZIP_HDR_LEN)
+		return 0;
+	slen = len - SEMTECH_HDR_LEN - 1;
+	/* Only worth it when shorter than the raw batch. */
+	room = cap - UL_ZIP_HDR_LEN;
+	if (room > len - UL_ZIP_HDR_LEN - 1)
+		room = len - UL_ZIP_HDR_LEN - 1;
+
+	switch (c->id) {
+#ifdef HAVE_LZ4
+	case UL_LZ4:
+		/* Loading resets the stream, so every batch stands alone. */
+		LZ4_loadDict(c->cctx, (const char *)c->dict, c->dict_len);
+		n = LZ4_compress_fast_continue(c->cctx, (const char *)raw + SEMTECH_HDR_LEN + 1,
+					       (char *)out + UL_ZIP_HDR_LEN, slen, room, 1);
+		break;
+#endif
+#ifdef HAVE_ZSTD
+	case UL_ZSTD: {
+		size_t ret = ZSTD_compress2(c->cctx, out + UL_ZIP_HDR_LEN, room,
+					    raw + SEMTECH_HDR_LEN + 1, slen);
+
+		n = ZSTD_isError(ret) ? 0 : ret;
+		break;
+	}
+#endif
+	default:
+		return -ENOTSUP;
+	}
+	if (n <= 0)
+		return 0;
+
+	memcpy(out, raw, SEMTECH_HDR_LEN);
+	out[SEMTECH_HDR_LEN] = c->id;
+	put_le32(out + SEMTECH_HDR_LEN + 1, c->dict_id);
+	put_le16(out + SEMTECH_HDR_LEN + 5, slen);
+	return UL_ZIP_HDR_LEN + n;
+}
+
+int ul_decompress(struct ul_codec *c, uint8_t *out, unsigned int cap, const uint8_t *in,
+		  unsigned int len)
+{
+	unsigned int slen;
+	long n = -1;
+
+	if (len < UL_ZIP_HDR_LEN || in[SEMTECH_HDR_LEN] != c->id || c->id == UL_RAW ||
+	    get_le32(in + SEMTECH_HDR_LEN + 1) != c->dict_id)
+		return -EINVAL;
+	slen = get_le16(in + SEMTECH_HDR_LEN + 5);
+	if (cap < SEMTECH_HDR_LEN + 1 + slen)
+		return -EMSGSIZE;
+
+	switch (c->id) {
+#ifdef HAVE_LZ4
+	case UL_LZ4:
+		n = LZ4_decompress_safe_usingDict((const char *)in + UL_ZIP_HDR_LEN,
+						  (char *)out + SEMTECH_HDR_LEN + 1,
+						  len - UL_ZIP_HDR_LEN, slen,
+						  (const char *)c->dict, c->dict_len);
+		break;
+#endif
+#ifdef HAVE_ZSTD
+	case UL_ZSTD: {
+		size_t ret;
+
+		if (c->ddict)
+			ret = ZSTD_decompress_usingDDict(c->dctx, out + SEMTECH_HDR_LEN + 1, slen,
+							 in + UL_ZIP_HDR_LEN, len - UL_ZIP_HDR_LEN,
+							 c->ddict);
+		else
+			ret = ZSTD_decompressDCtx(c->dctx, out + SEMTECH_HDR_LEN + 1, slen,
+						  in + UL_ZIP_HDR_LEN, len - UL_ZIP_HDR_LEN);
+		n = ZSTD_isError(ret) ? -1 : (long)ret;
+		break;
+	}
+#endif
+	default:
+		return -ENOTSUP;
+	}
+	if (n != slen)
+		return -EINVAL;
+
+	memcpy(out, in, SEMTECH_HDR_LEN);
+	out[SEMTECH_HDR_LEN] = UL_RAW;
+	return SEMTECH_HDR_LEN + 1 + slen;
+}
+
+void ul_train_init(struct ul_trainer *t)
+{
+	memset(t, 0, sizeof(*t));
+}
+
+void ul_train_add(struct ul_trainer *t, const uint8_t *frame, unsigned int len)
+{
+	uint8_t key[UL_TRAIN_HDR];
+	unsigned int klen, hlen;
+	uint32_t h;
+
+	if (len < LORAWAN_MHDR_LEN)
+		return;
+	if (lorawan_mtype(frame[0]) == LORAWAN_JOIN_REQUEST && len == LORAWAN_JOIN_REQ_LEN)
+		hlen = LORAWAN_MHDR_LEN + 8 + 8;
+	else if (lorawan_mtype_is_uplink(lorawan_mtype(frame[0])) && len >= LORAWAN_DATA_MIN)
+		hlen = LORAWAN_OFF_FCNT;
+	else
+		return;
+	t->frames++;
+
+	klen = put_varint(key, len);
+	memcpy(key + klen, frame, hlen);
+	klen += hlen;
+
+	h = ul_dict_id(key, klen);
+	for (unsigned int i = 0; i < UL_TRAIN_KEYS; i++) {
+		struct ul_train_hdr *e = &t->hdr[(h + i) & (UL_TRAIN_KEYS - 1)];
+
+		if (e->count == 0) {
+			/* Keep a quarter free, so probes stay short. */
+			if (t->nkeys >= UL_TRAIN_KEYS / 4 * 3)
+				return;
+			e->count = 1;
+			e->len = klen;
+			memcpy(e->bytes, key, klen);
+			t->nkeys++;
+			return;
+		}
+		if (e->len == klen && memcmp(e->bytes, key, klen) == 0) {
+			e->count++;
+			return;
+		}
+	}
+}
+
+static int by_count_desc(const void *a, const void *b)
+{
+	const struct ul_train_hdr *x = *(const struct ul_train_hdr *const *)a;
+	const struct ul_train_hdr *y = *(const struct ul_train_hdr *const *)b;
+
+	return x->count != y->count ? (x->count < y->count ? 1 : -1) : 0;
+}
+
+int ul_train_dict(const struct ul_trainer *t, uint8_t *dict, unsigned int cap)
+{
+	const struct ul_train_hdr **order;
+	unsigned int n = 0, k = 0, len = 0;
+
+	order = malloc(UL_TRAIN_KEYS * sizeof(*order));
+	if (order == NULL)
+		return -ENOMEM;
+	for (unsigned int i = 0; i < UL_TRAIN_KEYS; i++)
+		if (t->hdr[i].count > 1)
+			order[n++] = &t->hdr[i];
+	qsort(order, n, sizeof(*order), by_count_desc);
+
+	while (k < n && len + order[k]->len <= cap)
+		len += order[k++]->len;
+	len = 0;
+	while (k--) {
+		memcpy(dict + len, order[k]->bytes, order[k]->len);
+		len += order[k]->len;
+	}
+	free(order);
+	return len;
+}
@@ -0,0 +1,153 @@
+#ifndef UPLINK_H
+#define UPLINK_H
+
+#include <stdint.h>
+
+#include "semtech.h"
+
+/*
+ * Compact binary uplink batches for metered backhauls.
+ *
+ * A batch is one datagram with the 12 byte Semtech header, identifier
+ * UL_PUSH_BATCH, so it travels to the PUSH_DATA port and is answered by
+ * a PUSH_ACK like any other push. Then:
+ *
+ *	u8	codec		UL_RAW, UL_LZ4 or UL_ZSTD
+ *	raw:
+ *	le16	count
+ *	le64	base_us		CLOCK_REALTIME of the first frame
+ *	count records
+ *	compressed:
+ *	le32	dict_id		ul_dict_id() of the dictionary, 0 for none
+ *	le16	raw_len		what count, base_us and the records take raw
+ *	the compressed count, base_us and records
+ *
+ * A record is a tag byte, the radio index in its low five bits, bit 7
+ * set when the radio's descriptor (varint freq_hz, varint bw_khz, u8
+ * sf << 4 | cr) follows because this is its first frame in the batch
+ * or its settings changed since the one before, and bit 6 when a le32
+ * tmst follows because it is not the frame's time in microseconds
+ * modulo 2^32. Then a zigzag varint time delta in microseconds from
+ * the frame before, zigzag varint rssi and lsnr_cb, varint len and the
+ * frame itself. chan and rfch are both the radio index. A typical
+ * uplink costs about 8 bytes besides its payload, against about 190 in
+ * an rxpk object.
+ *
+ * Batches are built in place in a caller-provided buffer and parsed
+ * out of one without copying the frames. The codecs are only there
+ * when built with HAVE_LZ4 or HAVE_ZSTD; both can use a raw content
+ * dictionary, such as the LoRaWAN headers ul_train_dict() picks as
+ * the most frequent in a trace, and zstd also takes one made by
+ * "zstd --train". Both ends must load the same one.
+ *
+ * Functions return a length or 0 on success and a negative errno value
+ * on failure: -EMSGSIZE when the output does not fit, -EINVAL for
+ * malformed input, -ENOTSUP for a codec this build lacks.
+ */
+
+#define UL_PUSH_BATCH	0x80	/* outside the Semtech identifiers */
+#define UL_RAW_HDR_LEN	(SEMTECH_HDR_LEN + 1 + 2 + 8)
+#define UL_ZIP_HDR_LEN	(SEMTECH_HDR_LEN + 1 + 4 + 2)
+#define UL_MAX_RADIOS	32
+#define UL_MAX_COUNT	UINT16_MAX
+
+enum ul_codec_id {
+	UL_RAW = 0,
+	UL_LZ4,
+	UL_ZSTD,
+};
+
+/* One raw batch being built in place. */
+struct ul_batch {
+	uint8_t *buf;
+	unsigned int cap;
+	unsigned int len;
+	unsigned int count;
+	uint64_t prev_us;
+	uint32_t described;	/* radios whose descriptor is in the batch */
+	struct {
+		uint32_t freq_hz;
+		uint16_t bw_khz;
+		uint8_t sfcr;
+	} radio[UL_MAX_RADIOS];
+};
+
+void ul_begin(struct ul_batch *b, uint8_t *buf, unsigned int cap, uint16_t token, uint64_t eui);
+/* Appends one frame, or leaves the batch untouched on -EMSGSIZE. */
+int ul_add(struct ul_batch *b, const struct semtech_rxpk *rx);
+/* Fills in the count; returns the datagram length. */
+unsigned int ul_end(struct ul_batch *b);
+
+/* Walks the frames of a raw batch. */
+struct ul_reader {
+	const uint8_t *p, *end;
+	unsigned int left;
+	uint64_t time_us;
+	uint32_t described;
+	struct {
+		uint32_t freq_hz;
+		unsigned int sf, bw_khz, cr;
+	} radio[UL_MAX_RADIOS];
+};
+
+/* Returns the frame count; a compressed batch must be ul_decompress()ed first. */
+int ul_read_begin(struct ul_reader *r, const uint8_t *buf, unsigned int len);
+/* 1 and the next frame, its data pointing into the batch, or 0 after the last. */
+int ul_read_next(struct ul_reader *r, struct semtech_rxpk *rx);
+
+/* Compression state; the dictionary is referenced, not copied. */
+struct ul_codec {
+	enum ul_codec_id id;
+	const uint8_t *dict;
+	unsigned int dict_len;
+	uint32_t dict_id;
+	void *cctx, *cdict;
+	void *dctx, *ddict;
+};
+
+int ul_codec_init(struct ul_codec *c, enum ul_codec_id id, const uint8_t *dict,
+		  unsigned int dict_len);
+void ul_codec_free(struct ul_codec *c);
+/*
+ * Compresses a raw batch into out; returns its length, or 0 when that
+ * would not be shorter than the raw one, which is then better sent as is.
+ */
+int ul_compress(struct ul_codec *c, uint8_t *out, unsigned int cap, const uint8_t *raw,
+		unsigned int len);
+/* Restores the raw batch; -EINVAL also for one made with another dictionary. */
+int ul_decompress(struct ul_codec *c, uint8_t *out, unsigned int cap, const uint8_t *in,
+		  unsigned int len);
+
+/* FNV-1a of the dictionary, never 0. */
+uint32_t ul_dict_id(const uint8_t *dict, unsigned int len);
+
+/*
+ * Learns the LoRaWAN headers of sample frames: data uplinks up to FCtrl,
+ * join requests up to DevEUI, each with the length byte that comes
+ * before it in a record, so one dictionary match covers all of it.
+ */
+#define UL_TRAIN_KEYS	4096
+#define UL_TRAIN_HDR	18	/* varint len, MHDR, JoinEUI, DevEUI */
+
+struct ul_train_hdr {
+	uint32_t count;
+	uint8_t len;
+	uint8_t bytes[UL_TRAIN_HDR];
+};
+
+struct ul_trainer {
+	unsigned int nkeys;
+	uint64_t frames;
+	struct ul_train_hdr hdr[UL_TRAIN_KEYS];
+};
+
+void ul_train_init(struct ul_trainer *t);
+void ul_train_add(struct ul_trainer *t, const uint8_t *frame, unsigned int len);
+/*
+ * Writes the headers seen more than once, as many of the most frequent
+ * as fit, the most frequent last, where matches are nearest the data.
+ * Returns the dictionary length.
+ */
+int ul_train_dict(const struct ul_trainer *t, uint8_t *dict, unsigned int cap);
+
+#endif
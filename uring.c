@@ -0,0 +1,214 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+static int sys_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_enter(int fd, unsigned int to_submit, unsigned int min_complete,
+		     unsigned int flags, void *arg, size_t argsz)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static int sys_register(int fd, unsigned int opcode, void *arg, unsigned int nr_args)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+int uring_init(struct uring *u, unsigned int entries)
+{
+	struct io_uring_params p;
+	size_t sq_len, cq_len;
+	int err;
+
+	memset(u, 0, sizeof(*u));
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_CLAMP;
+	u->fd = sys_setup(entries, &p);
+	if (u->fd == -1)
+		return -errno;
+	if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_EXT_ARG)) {
+		close(u->fd);
+		return -EOPNOTSUPP;
+	}
+
+	sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	u->ring_len = sq_len > cq_len ? sq_len : cq_len;
+	u->ring = mmap(NULL, u->ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		       u->fd, IORING_OFF_SQ_RING);
+	if (u->ring == MAP_FAILED) {
+		err = errno;
+		close(u->fd);
+		return -err;
+	}
+	u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	u->sqes = mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		       u->fd, IORING_OFF_SQES);
+	if (u->sqes == MAP_FAILED) {
+		err = errno;
+		munmap(u->ring, u->ring_len);
+		close(u->fd);
+		return -err;
+	}
+
+	unsigned char *r = u->ring;
+	u->sq_head = (unsigned int *)(r + p.sq_off.head);
+	u->sq_tail = (unsigned int *)(r + p.sq_off.tail);
+	u->sq_mask = *(unsigned int *)(r + p.sq_off.ring_mask);
+	u->sq_entries = p.sq_entries;
+	u->sq_array = (unsigned int *)(r + p.sq_off.array);
+	u->cq_head = (unsigned int *)(r + p.cq_off.head);
+	u->cq_tail = (unsigned int *)(r + p.cq_off.tail);
+	u->cq_mask = *(unsigned int *)(r + p.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe *)(r + p.cq_off.cqes);
+
+	/* SQEs are used in ring order, so the indirection is fixed. */
+	for (unsigned int i = 0; i < p.sq_entries; i++)
+		u->sq_array[i] = i;
+	return 0;
+}
+
+void uring_exit(struct uring *u)
+{
+	munmap(u->sqes, u->sqes_len);
+	munmap(u->ring, u->ring_len);
+	close(u->fd);
+}
+
+struct io_uring_sqe *uring_get_sqe(struct uring *u)
+{
+	unsigned int tail = *u->sq_tail + u->sq_pending;
+	struct io_uring_sqe *sqe;
+
+	if (tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->sq_entries)
+		return NULL;
+	sqe = &u->sqes[tail & u->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	u->sq_pending++;
+	return sqe;
+}
+
+int uring_enter(struct uring *u, unsigned int wait_nr, int timeout_ms)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	unsigned int flags = IORING_ENTER_EXT_ARG;
+	unsigned int n = u->sq_pending;
+	int ret;
+
+	__atomic_store_n(u->sq_tail, *u->sq_tail + n, __ATOMIC_RELEASE);
+	u->sq_pending = 0;
+
+	memset(&arg, 0, sizeof(arg));
+	if (wait_nr) {
+		flags |= IORING_ENTER_GETEVENTS;
+		if (timeout_ms >= 0) {
+			ts.tv_sec = timeout_ms / 1000;
+			ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+			arg.ts = (uint64_t)(uintptr_t)&ts;
+		}
+	}
+	ret = sys_enter(u->fd, n, wait_nr, flags, &arg, sizeof(arg));
+	if (ret == -1) {
+		if (errno == ETIME || errno == EINTR)
+			return 0;
+		return -errno;
+	}
+	return ret;
+}
+
+void uring_prep_recvmsg_multishot(struct io_uring_sqe *sqe, int fd, struct msghdr *msg,
+				  uint16_t bgid, uint64_t user_data)
+{
+	sqe->opcode = IORING_OP_RECVMSG;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)msg;
+	sqe->len = 1;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = bgid;
+	sqe->user_data = user_data;
+}
+
+void uring_prep_read(struct io_uring_sqe *sqe, int fd, void *buf, unsigned int len,
+		     uint64_t user_data)
+{
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)buf;
+	sqe->len = len;
+	sqe->off = (uint64_t)-1;
+	sqe->user_data = user_data;
+}
+
+void uring_prep_cancel(struct io_uring_sqe *sqe, uint64_t target, uint64_t user_data)
+{
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = target;
+	sqe->user_data = user_data;
+}
+
+int uring_pbuf_init(struct uring *u, struct uring_pbuf *pb, uint16_t bgid,
+		    unsigned int nbufs, unsigned int buf_size)
+{
+	struct io_uring_buf_reg reg;
+	int err;
+
+	memset(pb, 0, sizeof(*pb));
+	if (nbufs == 0 || nbufs > 32768 || (nbufs & (nbufs - 1)))
+		return -EINVAL;
+	pb->nbufs = nbufs;
+	pb->buf_size = buf_size;
+	pb->bgid = bgid;
+
+	/* The ring must be page aligned. */
+	pb->br_len = nbufs * sizeof(struct io_uring_buf);
+	pb->br = mmap(NULL, pb->br_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (pb->br == MAP_FAILED)
+		return -errno;
+	pb->bufs = malloc((size_t)nbufs * buf_size);
+	if (pb->bufs == NULL) {
+		munmap(pb->br, pb->br_len);
+		return -ENOMEM;
+	}
+
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uint64_t)(uintptr_t)pb->br;
+	reg.ring_entries = nbufs;
+	reg.bgid = bgid;
+	if (sys_register(u->fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1) {
+		err = errno;
+		free(pb->bufs);
+		munmap(pb->br, pb->br_len);
+		return -err;
+	}
+
+	for (unsigned int i = 0; i < nbufs; i++)
+		uring_pbuf_recycle(pb, i);
+	uring_pbuf_publish(pb);
+	return 0;
+}
+
+void uring_pbuf_free(struct uring *u, struct uring_pbuf *pb)
+{
+	struct io_uring_buf_reg reg;
+
+	memset(&reg, 0, sizeof(reg));
+	reg.bgid = pb->bgid;
+	sys_register(u->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+	free(pb->bufs);
+	munmap(pb->br, pb->br_len);
+}
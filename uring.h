@@ -0,0 +1,120 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <linux/io_uring.h>
+
+/*
+ * Minimal io_uring over the raw system calls, for the socket receive
+ * paths; liburing is not needed.
+ *
+ * One ring belongs to one thread. SQEs come from uring_get_sqe() and go
+ * to the kernel with the next uring_enter(), which can also wait for
+ * completions. CQEs are read straight from the shared ring, so reaping
+ * costs no system call.
+ *
+ * A provided buffer ring lets multishot receives pick their own buffers:
+ * the kernel takes the next free one for every message, and the consumer
+ * hands it back with uring_pbuf_recycle() once done with it.
+ *
+ * Functions return 0 or a count on success and a negative errno value on
+ * failure.
+ */
+
+struct uring {
+	int fd;
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_array;
+	unsigned int sq_mask;
+	unsigned int sq_entries;
+	unsigned int sq_pending;	/* prepared, not yet submitted */
+	struct io_uring_sqe *sqes;
+
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int cq_mask;
+	struct io_uring_cqe *cqes;
+
+	void *ring;
+	size_t ring_len;
+	size_t sqes_len;
+};
+
+struct uring_pbuf {
+	struct io_uring_buf_ring *br;
+	size_t br_len;
+	unsigned char *bufs;
+	unsigned int nbufs;	/* power of two */
+	unsigned int buf_size;
+	uint16_t bgid;
+	uint16_t tail;
+};
+
+/* Needs IORING_FEAT_SINGLE_MMAP and IORING_FEAT_EXT_ARG (Linux 5.11). */
+int uring_init(struct uring *u, unsigned int entries);
+void uring_exit(struct uring *u);
+
+/* NULL when the SQ is full; submit first. The SQE comes zeroed. */
+struct io_uring_sqe *uring_get_sqe(struct uring *u);
+
+/*
+ * Submits the prepared SQEs and waits up to timeout_ms (-1: forever) for
+ * at least wait_nr completions. Returns the number submitted; a timeout
+ * is not an error.
+ */
+int uring_enter(struct uring *u, unsigned int wait_nr, int timeout_ms);
+
+static inline struct io_uring_cqe *uring_peek_cqe(struct uring *u)
+{
+	unsigned int head = *u->cq_head;
+
+	if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE))
+		return NULL;
+	return &u->cqes[head & u->cq_mask];
+}
+
+static inline void uring_cqe_seen(struct uring *u)
+{
+	__atomic_store_n(u->cq_head, *u->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+/* Multishot recvmsg into buffers of pbuf group bgid (Linux 6.0). */
+void uring_prep_recvmsg_multishot(struct io_uring_sqe *sqe, int fd, struct msghdr *msg,
+				  uint16_t bgid, uint64_t user_data);
+
+/* Reads len bytes from fd once, such as an eventfd counter. */
+void uring_prep_read(struct io_uring_sqe *sqe, int fd, void *buf, unsigned int len,
+		     uint64_t user_data);
+
+/* Cancels the request submitted with target as its user_data. */
+void uring_prep_cancel(struct io_uring_sqe *sqe, uint64_t target, uint64_t user_data);
+
+/* Registers nbufs buffers of buf_size bytes as group bgid, all free. */
+int uring_pbuf_init(struct uring *u, struct uring_pbuf *pb, uint16_t bgid,
+		    unsigned int nbufs, unsigned int buf_size);
+void uring_pbuf_free(struct uring *u, struct uring_pbuf *pb);
+
+static inline unsigned char *uring_pbuf_addr(const struct uring_pbuf *pb, unsigned int bid)
+{
+	return pb->bufs + (size_t)bid * pb->buf_size;
+}
+
+/* Queues buffer bid for reuse; uring_pbuf_publish() hands them over. */
+static inline void uring_pbuf_recycle(struct uring_pbuf *pb, unsigned int bid)
+{
+	struct io_uring_buf *b = &pb->br->bufs[pb->tail & (pb->nbufs - 1)];
+
+	b->addr = (uint64_t)(uintptr_t)uring_pbuf_addr(pb, bid);
+	b->len = pb->buf_size;
+	b->bid = bid;
+	pb->tail++;
+}
+
+static inline void uring_pbuf_publish(struct uring_pbuf *pb)
+{
+	__atomic_store_n(&pb->br->tail, pb->tail, __ATOMIC_RELEASE);
+}
+
+#endif
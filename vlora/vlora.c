@@ -0,0 +1,342 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Virtual LoRa netdev
+ *
+ * Frames sent on a vlora device are received on it again, or with
+ * shared=1 on every vlora device that is up, like radios on one channel.
+ * By default they loop back at once, so PF_LORA and the tools above it
+ * can be benchmarked at full software speed. With airtime=1 each frame
+ * stays on the air for its Semtech AN1200.13 time-on-air at the sf, bw
+ * and cr parameters, one frame at a time per device, with the TX queue
+ * stopped meanwhile as a real radio driver would. loss drops frames per
+ * mille at the receiver and counts them as CRC errors.
+ */
+
+#include <linux/hrtimer.h>
+#include <linux/if_arp.h>
+#include <linux/if_packet.h>
+#include <linux/lora.h>
+#include <linux/lora/dev.h>
+#include <linux/lora/skb.h>
+#include <linux/module.h>
+#include <linux/netdevice.h>
+#include <linux/random.h>
+#include <linux/skbuff.h>
+#include <net/cfglora.h>
+
+#define VLORA_MAX_DEVS	16
+
+static unsigned int numdevs = 2;
+module_param(numdevs, uint, 0444);
+MODULE_PARM_DESC(numdevs, "Number of vlora devices (1..16, default 2)");
+
+static bool shared;
+module_param(shared, bool, 0444);
+MODULE_PARM_DESC(shared, "Every device receives every frame (default off)");
+
+static bool airtime;
+module_param(airtime, bool, 0444);
+MODULE_PARM_DESC(airtime, "Hold each frame for its time-on-air (default off)");
+
+static unsigned int sf = 7;
+module_param(sf, uint, 0444);
+MODULE_PARM_DESC(sf, "Spreading factor for airtime (6..12, default 7)");
+
+static unsigned int bw = 125000;
+module_param(bw, uint, 0444);
+MODULE_PARM_DESC(bw, "Bandwidth in Hz for airtime (default 125000)");
+
+static unsigned int cr = 1;
+module_param(cr, uint, 0444);
+MODULE_PARM_DESC(cr, "Coding rate 4/(4+cr) for airtime (1..4, default 1)");
+
+static unsigned int loss;
+module_param(loss, uint, 0444);
+MODULE_PARM_DESC(loss, "Frames lost per mille (0..1000, default 0)");
+
+static unsigned int freq = 868100000;
+module_param(freq, uint, 0444);
+MODULE_PARM_DESC(freq, "Frequency in Hz reported over nllora (default 868100000)");
+
+struct vlora_priv {
+	struct lora_dev_priv lora;
+	struct net_device *netdev;
+	struct lora_phy *phy;
+
+	struct hrtimer tx_timer;
+	struct sk_buff *tx_skb;		/* on the air with airtime=1 */
+};
+
+static struct net_device *vlora_devs[VLORA_MAX_DEVS];
+
+static u64 vlora_toa_ns(unsigned int len)
+{
+	int de = (1000ULL << sf) > 16ULL * bw;	/* LDRO above 16 ms symbols */
+	int num = 8 * (int)len - 4 * sf + 28 + 16;	/* explicit header, CRC */
+	int den = 4 * (sf - 2 * de);
+	int nsym = 8;
+
+	if (num > 0)
+		nsym += DIV_ROUND_UP(num, den) * (cr + 4);
+
+	/* An 8 symbol preamble lasts 12.25 symbols; count quarter symbols. */
+	return div_u64((4ULL * (8 + nsym) + 17) * ((u64)NSEC_PER_SEC << sf), 4 * bw);
+}
+
+static void vlora_rx(struct net_device *netdev, struct sk_buff *skb)
+{
+	unsigned int len = skb->len;
+
+	if (loss && get_random_u32_below(1000) < loss) {
+		netdev->stats.rx_errors++;
+		netdev->stats.rx_crc_errors++;
+		kfree_skb(skb);
+		return;
+	}
+
+	/* A TX timestamp or shared=1 clone may share the head. */
+	if (skb_cow_head(skb, sizeof(struct lora_skb_priv))) {
+		netdev->stats.rx_dropped++;
+		kfree_skb(skb);
+		return;
+	}
+
+	skb->dev = netdev;
+	skb->protocol = htons(ETH_P_LORA);
+	skb->pkt_type = PACKET_BROADCAST;
+	skb->ip_summed = CHECKSUM_UNNECESSARY;
+	skb->tstamp = 0;
+	skb_reset_mac_header(skb);
+	skb_reset_network_header(skb);
+	skb_reset_transport_header(skb);
+	lora_skb_prv(skb)->ifindex = netdev->ifindex;
+
+	if (netif_rx(skb) == NET_RX_DROP) {
+		netdev->stats.rx_dropped++;
+		return;
+	}
+	netdev->stats.rx_packets++;
+	netdev->stats.rx_bytes += len;
+}
+
+static void vlora_deliver(struct net_device *netdev, struct sk_buff *skb)
+{
+	unsigned int i;
+
+	netdev->stats.tx_packets++;
+	netdev->stats.tx_bytes += skb->len;
+	skb_orphan(skb);
+
+	if (!shared) {
+		vlora_rx(netdev, skb);
+		return;
+	}
+
+	for (i = 0; i < numdevs; i++) {
+		struct net_device *peer = vlora_devs[i];
+		struct sk_buff *nskb;
+
+		if (!peer || peer == netdev || !netif_running(peer))
+			continue;
+		nskb = skb_clone(skb, GFP_ATOMIC);
+		if (!nskb) {
+			peer->stats.rx_dropped++;
+			continue;
+		}
+		vlora_rx(peer, nskb);
+	}
+	vlora_rx(netdev, skb);
+}
+
+static enum hrtimer_restart vlora_tx_done(struct hrtimer *timer)
+{
+	struct vlora_priv *priv = container_of(timer, struct vlora_priv, tx_timer);
+	struct sk_buff *skb = priv->tx_skb;
+
+	priv->tx_skb = NULL;
+	vlora_deliver(priv->netdev, skb);
+	netif_wake_queue(priv->netdev);
+
+	return HRTIMER_NORESTART;
+}
+
+static netdev_tx_t vlora_start_xmit(struct sk_buff *skb, struct net_device *netdev)
+{
+	struct vlora_priv *priv = netdev_priv(netdev);
+
+	if (skb->protocol != htons(ETH_P_LORA)) {
+		kfree_skb(skb);
+		netdev->stats.tx_dropped++;
+		return NETDEV_TX_OK;
+	}
+
+	skb_tx_timestamp(skb);
+
+	if (!airtime) {
+		vlora_deliver(netdev, skb);
+		return NETDEV_TX_OK;
+	}
+
+	netif_stop_queue(netdev);
+	priv->tx_skb = skb;
+	hrtimer_start(&priv->tx_timer, ns_to_ktime(vlora_toa_ns(skb->len)),
+		      HRTIMER_MODE_REL_SOFT);
+
+	return NETDEV_TX_OK;
+}
+
+static int vlora_open(struct net_device *netdev)
+{
+	int ret;
+
+	ret = open_loradev(netdev);
+	if (ret)
+		return ret;
+
+	netif_start_queue(netdev);
+
+	return 0;
+}
+
+static int vlora_stop(struct net_device *netdev)
+{
+	struct vlora_priv *priv = netdev_priv(netdev);
+
+	netif_stop_queue(netdev);
+	hrtimer_cancel(&priv->tx_timer);
+	if (priv->tx_skb) {
+		kfree_skb(priv->tx_skb);
+		priv->tx_skb = NULL;
+		netdev->stats.tx_dropped++;
+	}
+	close_loradev(netdev);
+
+	return 0;
+}
+
+static const struct net_device_ops vlora_netdev_ops = {
+	.ndo_open = vlora_open,
+	.ndo_stop = vlora_stop,
+	.ndo_start_xmit = vlora_start_xmit,
+};
+
+static int vlora_get_freq(struct lora_phy *phy, u32 *val)
+{
+	*val = freq;
+
+	return 0;
+}
+
+static const struct cfglora_ops vlora_cfglora_ops = {
+	.get_freq = vlora_get_freq,
+};
+
+static void vlora_unregister(struct net_device *netdev)
+{
+	struct vlora_priv *priv = netdev_priv(netdev);
+
+	if (priv->phy) {
+		lora_phy_unregister(priv->phy);
+		lora_phy_free(priv->phy);
+		priv->phy = NULL;
+	}
+	unregister_loradev(netdev);
+}
+
+static struct net_device *vlora_create(void)
+{
+	struct net_device *netdev;
+	struct vlora_priv *priv;
+	int ret;
+
+	netdev = alloc_loradev(sizeof(*priv));
+	if (!netdev)
+		return ERR_PTR(-ENOMEM);
+
+	strscpy(netdev->name, "vlora%d", IFNAMSIZ);
+	netdev->netdev_ops = &vlora_netdev_ops;
+	netdev->needed_headroom = sizeof(struct lora_skb_priv);
+
+	priv = netdev_priv(netdev);
+	priv->netdev = netdev;
+	hrtimer_setup(&priv->tx_timer, vlora_tx_done, CLOCK_MONOTONIC,
+		      HRTIMER_MODE_REL_SOFT);
+
+	ret = register_loradev(netdev);
+	if (ret)
+		goto err_free;
+
+	priv->phy = lora_phy_new(&vlora_cfglora_ops, 0);
+	if (!priv->phy) {
+		ret = -ENOMEM;
+		goto err_unregister;
+	}
+	priv->phy->netdev = netdev;
+
+	ret = lora_phy_register(priv->phy);
+	if (ret) {
+		lora_phy_free(priv->phy);
+		priv->phy = NULL;
+		goto err_unregister;
+	}
+
+	return netdev;
+
+err_unregister:
+	unregister_loradev(netdev);
+err_free:
+	free_loradev(netdev);
+	return ERR_PTR(ret);
+}
+
+static void vlora_destroy_all(void)
+{
+	unsigned int i;
+
+	/* With shared=1 a device still up may deliver to any other one. */
+	for (i = 0; i < VLORA_MAX_DEVS; i++)
+		if (vlora_devs[i])
+			vlora_unregister(vlora_devs[i]);
+
+	for (i = 0; i < VLORA_MAX_DEVS; i++) {
+		if (!vlora_devs[i])
+			continue;
+		free_loradev(vlora_devs[i]);
+		vlora_devs[i] = NULL;
+	}
+}
+
+static int __init vlora_init(void)
+{
+	unsigned int i;
+
+	if (numdevs < 1 || numdevs > VLORA_MAX_DEVS || sf < 6 || sf > 12 ||
+	    bw == 0 || cr < 1 || cr > 4 || loss > 1000)
+		return -EINVAL;
+
+	for (i = 0; i < numdevs; i++) {
+		struct net_device *netdev = vlora_create();
+
+		if (IS_ERR(netdev)) {
+			vlora_destroy_all();
+			return PTR_ERR(netdev);
+		}
+		vlora_devs[i] = netdev;
+		netdev_info(netdev, "virtual LoRa device%s%s\n",
+			    shared ? ", shared channel" : "",
+			    airtime ? ", time-on-air emulated" : "");
+	}
+
+	return 0;
+}
+
+static void __exit vlora_exit(void)
+{
+	vlora_destroy_all();
+}
+
+module_init(vlora_init);
+module_exit(vlora_exit);
+
+MODULE_DESCRIPTION("Virtual LoRa loopback netdev");
+MODULE_LICENSE("GPL");